@@ -1,3 +1,51 @@
 #TEMPLATE = lib
 #CONFIG = dll
 #VERSION = 0.0.1
+TEMPLATE = app
+CONFIG += console debug
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++11
+
+INCLUDEPATH += ../tree
+
+SOURCES += main.cpp \
+    gradientboosting.cpp \
+    forest.cpp \
+    ../tree/criterion.cpp \
+    ../tree/splitter.cpp \
+    ../tree/treebuilder.cpp \
+    ../tree/basetree.cpp \
+    ../tree/tree.cpp \
+    ../tree/util.cpp \
+    ../tree/binmapper.cpp \
+    ../tree/quickscorer.cpp \
+    ../tree/codegen.cpp \
+    ../tree/dataset.cpp \
+    ../tree/argsort.cpp \
+    ../tree/simd.cpp \
+    ../tree/threadpool.cpp \
+    ../tree/random.cpp
+
+HEADERS += gradientboosting.h \
+    forest.h \
+    ../tree/criterion.h \
+    ../tree/splitter.h \
+    ../tree/treebuilder.h \
+    ../tree/basetree.h \
+    ../tree/tree.h \
+    ../tree/util.h \
+    ../tree/binmapper.h \
+    ../tree/quickscorer.h \
+    ../tree/codegen.h \
+    ../tree/dataset.h \
+    ../tree/argsort.h \
+    ../tree/simd.h \
+    ../tree/threadpool.h \
+    ../tree/random.h
+
+LIBS += -L/usr/local/lib
+LIBS += -lopencv_core
+LIBS += -lpthread
+
+TARGET = ensemble
@@ -0,0 +1,541 @@
+#include "forest.h"
+#include <cmath>
+#include <algorithm>
+#include "tree.h"
+#include "basetree.h"
+#include "splitter.h"
+#include "threadpool.h"
+#include "random.h"
+
+/**
+ * @brief Leaf of a tree reached by one row of X
+ */
+static inline int apply_row(const Node* nodes,
+                            const double* row)
+{
+    int node_id = 0;
+    while (nodes[node_id].left_child != TREE_LEAF)
+        node_id = (row[nodes[node_id].feature] <= nodes[node_id].threshold) ?
+                  nodes[node_id].left_child : nodes[node_id].right_child;
+    return node_id;
+}
+
+BaseForest::BaseForest(int n_estimators,
+                       bool bootstrap,
+                       bool oob_score,
+                       char* criterion_name,
+                       char* splitter_name,
+                       int max_depth,
+                       int min_samples_split,
+                       int min_samples_leaf,
+                       double min_weight_fraction_leaf,
+                       int max_features,
+                       int max_leaf_nodes,
+                       int random_state)
+    : _n_estimators(n_estimators),
+      _bootstrap(bootstrap),
+      _oob_score_enabled(oob_score),
+      _criterion_name(criterion_name),
+      _splitter_name(splitter_name),
+      _max_depth(max_depth),
+      _min_samples_split(min_samples_split),
+      _min_samples_leaf(min_samples_leaf),
+      _min_weight_fraction_leaf(min_weight_fraction_leaf),
+      _max_features(max_features),
+      _max_leaf_nodes(max_leaf_nodes),
+      _random_state(random_state),
+      _n_threads(1),
+      _n_features(0),
+      _oob_score(0.0)
+{
+
+}
+
+BaseForest::~BaseForest()
+{
+    _clear();
+}
+
+void BaseForest::set_n_threads(int n_threads)
+{
+    _n_threads = n_threads;
+}
+
+void BaseForest::_clear()
+{
+    // The first tree of each thread owns the splitter of the thread, free it last
+    for (int i = static_cast<int>(_estimators.size()) - 1; i >= 0; i--)
+        delete _estimators[i];
+    _estimators.clear();
+    _oob_prediction = Mat();
+    _oob_score = 0.0;
+}
+
+int BaseForest::fit(Mat X,
+                    Mat y,
+                    Mat sample_weight)
+{
+    // Validation
+    if (X.rows == 0 || X.cols == 0)
+        return 1;
+
+    int n_samples = X.rows;
+    _n_features = X.cols;
+
+    // Reshape y to shape[n_samples, 1]
+    y = y.reshape(1, y.total());
+
+    // Validation
+    if (y.rows != n_samples)
+        return 2;
+
+    // Validation
+    if (_n_estimators <= 0)
+        return 3;
+    if (_oob_score_enabled && !_bootstrap)
+        return 3;
+
+    if (sample_weight.total() == 0)
+        sample_weight = Mat::ones(n_samples, 1, CV_64F);
+
+    _clear();
+
+    // One copy of X by column, read in place by all the trees
+    Mat X_col;
+    cv::transpose(X, X_col);
+
+    // Tree t draws from the stream of random_state jumped t times: the
+    // streams of the trees never overlap and don't depend on the thread
+    // fitting the tree
+    RandomGenerator random_generator(_random_state);
+    vector<RandomGenerator> streams(_n_estimators);
+    for (int t = 0; t < _n_estimators; t++)
+    {
+        streams[t] = random_generator;
+        random_generator.jump();
+    }
+
+    ThreadPool pool(_n_threads);
+    int n_workers = pool.size();
+    int n_outputs = _n_outputs();
+
+    // Per thread state, reused from one tree to the next
+    vector<Splitter*> splitters(n_workers, NULL);
+    vector<Mat> tree_weights(n_workers);
+    vector<vector<int> > counts(n_workers);
+    vector<Mat> oob_sums(n_workers);
+    vector<vector<int> > oob_counts(n_workers);
+
+    _estimators.assign(_n_estimators, NULL);
+    vector<int> error_codes(_n_estimators, 0);
+
+    pool.parallel_for(_n_estimators, [&](int t, int worker)
+    {
+        RandomGenerator& stream = streams[t];
+        int seed = static_cast<int>(stream.next() >> 33);
+        BaseDecisionTree* tree = _make_estimator(seed);
+        _estimators[t] = tree;
+
+        // Bootstrap: a sample drawn k times weighs k times its weight
+        vector<int>& count = counts[worker];
+        if (_bootstrap)
+        {
+            count.assign(n_samples, 0);
+            for (int i = 0; i < n_samples; i++)
+                count[stream.rand_int(0, n_samples)] += 1;
+        }
+        else
+        {
+            count.assign(n_samples, 1);
+        }
+
+        Mat& weight = tree_weights[worker];
+        weight.create(n_samples, 1, CV_64F);
+        for (int i = 0; i < n_samples; i++)
+            weight.at<double>(i) = count[i] * sample_weight.at<double>(i);
+
+        // The first tree of a thread allocates the splitter the next ones share
+        if (splitters[worker] != NULL)
+        {
+            splitters[worker]->random_state = seed;
+            tree->set_splitter(splitters[worker]);
+        }
+
+        error_codes[t] = tree->fit_columns(X_col, y, weight);
+        if (error_codes[t] != 0)
+            return;
+        splitters[worker] = tree->_splitter;
+
+        if (!_oob_score_enabled)
+            return;
+
+        // Out-of-bag prediction of the samples left out of the bootstrap
+        Mat& oob_sum = oob_sums[worker];
+        vector<int>& oob_count = oob_counts[worker];
+        if (oob_sum.empty())
+        {
+            oob_sum = Mat::zeros(n_samples, n_outputs, CV_64F);
+            oob_count.assign(n_samples, 0);
+        }
+
+        Tree* fitted = tree->_tree;
+        const Node* nodes = fitted->nodes();
+        for (int i = 0; i < n_samples; i++)
+        {
+            if (count[i] != 0)
+                continue;
+            _add_leaf_value(fitted->value(apply_row(nodes, X.ptr<double>(i))),
+                            oob_sum.ptr<double>(i));
+            oob_count[i] += 1;
+        }
+    });
+
+    for (int t = 0; t < _n_estimators; t++)
+    {
+        if (error_codes[t] != 0)
+        {
+            _clear();
+            return error_codes[t];
+        }
+    }
+
+    if (_oob_score_enabled)
+    {
+        _oob_prediction = Mat::zeros(n_samples, n_outputs, CV_64F);
+        vector<int> n_oob(n_samples, 0);
+        for (int w = 0; w < n_workers; w++)
+        {
+            if (oob_sums[w].empty())
+                continue;
+            for (int i = 0; i < n_samples; i++)
+            {
+                for (int k = 0; k < n_outputs; k++)
+                    _oob_prediction.at<double>(i, k) += oob_sums[w].at<double>(i, k);
+                n_oob[i] += oob_counts[w][i];
+            }
+        }
+
+        vector<bool> has_oob(n_samples);
+        for (int i = 0; i < n_samples; i++)
+        {
+            has_oob[i] = (n_oob[i] != 0);
+            if (has_oob[i])
+                for (int k = 0; k < n_outputs; k++)
+                    _oob_prediction.at<double>(i, k) /= n_oob[i];
+        }
+        _set_oob_score(y, has_oob);
+    }
+    return 0;
+}
+
+RandomForestRegressor::RandomForestRegressor(int n_estimators,
+                                             bool bootstrap,
+                                             bool oob_score,
+                                             char* criterion_name,
+                                             char* splitter_name,
+                                             int max_depth,
+                                             int min_samples_split,
+                                             int min_samples_leaf,
+                                             double min_weight_fraction_leaf,
+                                             int max_features,
+                                             int max_leaf_nodes,
+                                             int random_state)
+    : BaseForest(n_estimators,
+                 bootstrap,
+                 oob_score,
+                 criterion_name,
+                 splitter_name,
+                 max_depth,
+                 min_samples_split,
+                 min_samples_leaf,
+                 min_weight_fraction_leaf,
+                 max_features,
+                 max_leaf_nodes,
+                 random_state)
+{
+
+}
+
+RandomForestRegressor::~RandomForestRegressor()
+{
+
+}
+
+BaseDecisionTree* RandomForestRegressor::_make_estimator(int random_state)
+{
+    return new DecisionTreeRegressor(_criterion_name,
+                                     _splitter_name,
+                                     _max_depth,
+                                     _min_samples_split,
+                                     _min_samples_leaf,
+                                     _min_weight_fraction_leaf,
+                                     _max_features,
+                                     _max_leaf_nodes,
+                                     random_state,
+                                     Mat::ones(0, 0, CV_64F));
+}
+
+int RandomForestRegressor::_n_outputs()
+{
+    return 1;
+}
+
+void RandomForestRegressor::_add_leaf_value(const double* value,
+                                            double* sum)
+{
+    sum[0] += value[0];
+}
+
+void RandomForestRegressor::_set_oob_score(Mat y,
+                                           const vector<bool>& has_oob)
+{
+    // Coefficient of determination R^2 of the samples with a prediction
+    double mean = 0.0;
+    int n = 0;
+    for (int i = 0; i < y.rows; i++)
+    {
+        if (has_oob[i])
+        {
+            mean += y.at<double>(i);
+            n += 1;
+        }
+    }
+    if (n == 0)
+        return;
+    mean /= n;
+
+    double ss_res = 0.0;
+    double ss_tot = 0.0;
+    double diff;
+    for (int i = 0; i < y.rows; i++)
+    {
+        if (!has_oob[i])
+            continue;
+        diff = y.at<double>(i) - _oob_prediction.at<double>(i);
+        ss_res += diff * diff;
+        diff = y.at<double>(i) - mean;
+        ss_tot += diff * diff;
+    }
+    _oob_score = (ss_tot > 0.0) ? 1.0 - ss_res / ss_tot : 0.0;
+}
+
+Mat RandomForestRegressor::predict(Mat X)
+{
+    Mat result = Mat::zeros(X.rows, 1, CV_64F);
+    Mat value;
+    for (size_t t = 0; t < _estimators.size(); t++)
+    {
+        value = _estimators[t]->predict(X);
+        for (int i = 0; i < X.rows; i++)
+            result.at<double>(i) += value.at<double>(i);
+    }
+    for (int i = 0; i < X.rows; i++)
+        result.at<double>(i) /= _estimators.size();
+    return result;
+}
+
+RandomForestClassifier::RandomForestClassifier(int n_estimators,
+                                               bool bootstrap,
+                                               bool oob_score,
+                                               char* criterion_name,
+                                               char* splitter_name,
+                                               int max_depth,
+                                               int min_samples_split,
+                                               int min_samples_leaf,
+                                               double min_weight_fraction_leaf,
+                                               int max_features,
+                                               int max_leaf_nodes,
+                                               int random_state)
+    : BaseForest(n_estimators,
+                 bootstrap,
+                 oob_score,
+                 criterion_name,
+                 splitter_name,
+                 max_depth,
+                 min_samples_split,
+                 min_samples_leaf,
+                 min_weight_fraction_leaf,
+                 max_features,
+                 max_leaf_nodes,
+                 random_state)
+{
+
+}
+
+RandomForestClassifier::~RandomForestClassifier()
+{
+
+}
+
+int RandomForestClassifier::fit(Mat X,
+                                Mat y,
+                                Mat sample_weight)
+{
+    y = y.reshape(1, y.total());
+
+    // The trees encode the labels of the whole y the same way, whatever
+    // their bootstrap, so the leaf values follow this order
+    _classes.clear();
+    for (int i = 0; i < y.rows; i++)
+        _classes.push_back(y.at<double>(i));
+    std::sort(_classes.begin(), _classes.end());
+    _classes.erase(std::unique(_classes.begin(), _classes.end()), _classes.end());
+
+    if (_classes.size() < 2)
+        return 2;
+
+    return BaseForest::fit(X, y, sample_weight);
+}
+
+BaseDecisionTree* RandomForestClassifier::_make_estimator(int random_state)
+{
+    return new DecisionTreeClassifier(_criterion_name,
+                                      _splitter_name,
+                                      _max_depth,
+                                      _min_samples_split,
+                                      _min_samples_leaf,
+                                      _min_weight_fraction_leaf,
+                                      _max_features,
+                                      _max_leaf_nodes,
+                                      random_state,
+                                      Mat::ones(0, 0, CV_64F));
+}
+
+int RandomForestClassifier::_n_outputs()
+{
+    return _classes.size();
+}
+
+void RandomForestClassifier::_add_leaf_value(const double* value,
+                                             double* sum)
+{
+    // The leaf votes with its class probabilities
+    int n_classes = _classes.size();
+    double total = 0.0;
+    for (int k = 0; k < n_classes; k++)
+        total += value[k];
+    if (total <= 0.0)
+        return;
+    for (int k = 0; k < n_classes; k++)
+        sum[k] += value[k] / total;
+}
+
+void RandomForestClassifier::_set_oob_score(Mat y,
+                                            const vector<bool>& has_oob)
+{
+    // Accuracy of the samples with a prediction
+    int n_classes = _classes.size();
+    int n = 0;
+    int n_correct = 0;
+    const double* row;
+    for (int i = 0; i < y.rows; i++)
+    {
+        if (!has_oob[i])
+            continue;
+        row = _oob_prediction.ptr<double>(i);
+        n_correct += (_classes[std::max_element(row, row + n_classes) - row] == y.at<double>(i));
+        n += 1;
+    }
+    _oob_score = (n > 0) ? static_cast<double>(n_correct) / n : 0.0;
+}
+
+Mat RandomForestClassifier::predict_proba(Mat X)
+{
+    int n_classes = _classes.size();
+    Mat proba = Mat::zeros(X.rows, n_classes, CV_64F);
+    Mat leaves;
+    for (size_t t = 0; t < _estimators.size(); t++)
+    {
+        Tree* tree = _estimators[t]->_tree;
+        leaves = tree->apply(X);
+        for (int i = 0; i < X.rows; i++)
+            _add_leaf_value(tree->value(leaves.at<int>(i)), proba.ptr<double>(i));
+    }
+    for (int i = 0; i < X.rows; i++)
+        for (int k = 0; k < n_classes; k++)
+            proba.at<double>(i, k) /= _estimators.size();
+    return proba;
+}
+
+Mat RandomForestClassifier::predict(Mat X)
+{
+    int n_classes = _classes.size();
+    Mat proba = predict_proba(X);
+    Mat decision(X.rows, 1, CV_64F);
+    const double* row;
+    for (int i = 0; i < X.rows; i++)
+    {
+        row = proba.ptr<double>(i);
+        decision.at<double>(i) = _classes[std::max_element(row, row + n_classes) - row];
+    }
+    return decision;
+}
+
+/**
+ * @brief Splitter of the extra-trees, an array since the trees take a char*
+ */
+static char EXTRA_TREES_SPLITTER[] = "Random";
+
+ExtraTreesRegressor::ExtraTreesRegressor(int n_estimators,
+                                         bool bootstrap,
+                                         bool oob_score,
+                                         char* criterion_name,
+                                         int max_depth,
+                                         int min_samples_split,
+                                         int min_samples_leaf,
+                                         double min_weight_fraction_leaf,
+                                         int max_features,
+                                         int max_leaf_nodes,
+                                         int random_state)
+    : RandomForestRegressor(n_estimators,
+                            bootstrap,
+                            oob_score,
+                            criterion_name,
+                            EXTRA_TREES_SPLITTER,
+                            max_depth,
+                            min_samples_split,
+                            min_samples_leaf,
+                            min_weight_fraction_leaf,
+                            max_features,
+                            max_leaf_nodes,
+                            random_state)
+{
+
+}
+
+ExtraTreesRegressor::~ExtraTreesRegressor()
+{
+
+}
+
+ExtraTreesClassifier::ExtraTreesClassifier(int n_estimators,
+                                           bool bootstrap,
+                                           bool oob_score,
+                                           char* criterion_name,
+                                           int max_depth,
+                                           int min_samples_split,
+                                           int min_samples_leaf,
+                                           double min_weight_fraction_leaf,
+                                           int max_features,
+                                           int max_leaf_nodes,
+                                           int random_state)
+    : RandomForestClassifier(n_estimators,
+                             bootstrap,
+                             oob_score,
+                             criterion_name,
+                             EXTRA_TREES_SPLITTER,
+                             max_depth,
+                             min_samples_split,
+                             min_samples_leaf,
+                             min_weight_fraction_leaf,
+                             max_features,
+                             max_leaf_nodes,
+                             random_state)
+{
+
+}
+
+ExtraTreesClassifier::~ExtraTreesClassifier()
+{
+
+}
@@ -0,0 +1,277 @@
+#ifndef FOREST_H
+#define FOREST_H
+
+//========================================
+// Forest
+// Clone of a python ml library(scikit-learn)
+//========================================
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+using std::vector;
+using cv::Mat;
+
+class Splitter;
+class BaseDecisionTree;
+
+class BaseForest
+{
+public:
+    /**
+     * @brief Abstract base class for forests of trees.
+     *
+     * The trees are fitted concurrently, each thread taking the next tree to
+     * fit. All of them read the same copy of X, stored by column once per
+     * fit. The trees fitted by a thread share its Splitter, so the X
+     * dependent state of the splitter is computed once per thread.
+     *
+     * A bootstrap sample is given to its tree as sample weights: the weight
+     * of a sample is multiplied by the number of times it is drawn, and the
+     * samples never drawn have a null weight, so no data is copied per tree.
+     * Every tree draws its bootstrap, and its own random_state, from a
+     * stream of its own: the stream of random_state jumped once per tree, in
+     * tree order. The forest is the same for any number of threads.
+     * @param n_estimators: number of trees
+     * @param bootstrap: whether the trees are fitted on bootstrap samples
+     * @param oob_score: whether to compute the out-of-bag score
+     * @param criterion_name
+     * @param splitter_name
+     * @param max_depth
+     * @param min_samples_split
+     * @param min_samples_leaf
+     * @param min_weight_fraction_leaf
+     * @param max_features
+     * @param max_leaf_nodes
+     * @param random_state
+     */
+    BaseForest(int n_estimators,
+               bool bootstrap,
+               bool oob_score,
+               char* criterion_name,
+               char* splitter_name,
+               int max_depth,
+               int min_samples_split,
+               int min_samples_leaf,
+               double min_weight_fraction_leaf,
+               int max_features,
+               int max_leaf_nodes,
+               int random_state);
+    virtual ~BaseForest();
+
+    /**
+     * @brief Build a forest of trees from the training set (X, y).
+     *
+     * With oob_score, the out-of-bag predictions are accumulated by the
+     * thread fitting each tree, right after the tree is fitted: only the
+     * samples left out of its bootstrap go down the tree, and no pass over
+     * the forest is needed afterwards.
+     * @param X The training input samples, shape = [n_sampels, n_features]
+     * @param y The target values, shape = [n_samples]
+     * @param sample_weight Sample weights. If total size equals to zero, then samples are equally weighted.
+     * @return error_code: 1 X is empty, 2 y doesn't match X, 3 invalid
+     *         parameters, or the error_code of the first tree that failed
+     */
+    virtual int fit(Mat X,
+                    Mat y,
+                    Mat sample_weight);
+
+    /**
+     * @brief Threads used by fit, 1 by default, 0 for one per core.
+     * Every tree is fitted by one thread.
+     * @param n_threads
+     */
+    void set_n_threads(int n_threads);
+
+protected:
+    /**
+     * @brief Allocate an unfitted tree.
+     * @param random_state
+     * @return tree
+     */
+    virtual BaseDecisionTree* _make_estimator(int random_state)=0;
+
+    /**
+     * @brief Number of values accumulated per sample for the out-of-bag
+     * prediction.
+     */
+    virtual int _n_outputs()=0;
+
+    /**
+     * @brief Add the prediction of a leaf to the sums of a sample, e.g. its
+     * out-of-bag sums.
+     * @param value: value of the leaf in the tree
+     * @param sum: n_outputs sums of the sample
+     */
+    virtual void _add_leaf_value(const double* value,
+                                 double* sum)=0;
+
+    /**
+     * @brief Compute _oob_score from the out-of-bag prediction.
+     * @param y
+     * @param has_oob: whether each sample has been left out of a bootstrap
+     */
+    virtual void _set_oob_score(Mat y,
+                                const vector<bool>& has_oob)=0;
+
+    /**
+     * @brief Free the fitted estimators.
+     */
+    void _clear();
+
+public:
+    int _n_estimators;
+    bool _bootstrap;
+    bool _oob_score_enabled;
+    char* _criterion_name;
+    char* _splitter_name;
+    int _max_depth;
+    int _min_samples_split;
+    int _min_samples_leaf;
+    double _min_weight_fraction_leaf;
+    int _max_features;
+    int _max_leaf_nodes;
+    int _random_state;
+    int _n_threads;                             // Threads used by fit
+
+    int _n_features;
+    vector<BaseDecisionTree*> _estimators;
+    Mat _oob_prediction;                        // Mean out-of-bag prediction, shape = [n_samples, n_outputs]
+    double _oob_score;                          // R^2 or accuracy of _oob_prediction
+};
+
+class RandomForestRegressor : public BaseForest
+{
+public:
+    /**
+     * @brief A random forest regressor: the mean of regression trees fitted
+     * on bootstrap samples.
+     * @param criterion_name: "MSE" or "FriedmanMSE"
+     */
+    RandomForestRegressor(int n_estimators,
+                          bool bootstrap,
+                          bool oob_score,
+                          char* criterion_name,
+                          char* splitter_name,
+                          int max_depth,
+                          int min_samples_split,
+                          int min_samples_leaf,
+                          double min_weight_fraction_leaf,
+                          int max_features,
+                          int max_leaf_nodes,
+                          int random_state);
+    virtual ~RandomForestRegressor();
+
+    /**
+     * @brief Predict regression target for X, the mean prediction of the trees.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, 1]
+     */
+    Mat predict(Mat X);
+
+protected:
+    virtual BaseDecisionTree* _make_estimator(int random_state);
+    virtual int _n_outputs();
+    virtual void _add_leaf_value(const double* value, double* sum);
+    virtual void _set_oob_score(Mat y, const vector<bool>& has_oob);
+};
+
+class RandomForestClassifier : public BaseForest
+{
+public:
+    /**
+     * @brief A random forest classifier: the trees vote with the class
+     * probabilities of their leaves.
+     * @param criterion_name: "Gini" or "Entropy"
+     */
+    RandomForestClassifier(int n_estimators,
+                           bool bootstrap,
+                           bool oob_score,
+                           char* criterion_name,
+                           char* splitter_name,
+                           int max_depth,
+                           int min_samples_split,
+                           int min_samples_leaf,
+                           double min_weight_fraction_leaf,
+                           int max_features,
+                           int max_leaf_nodes,
+                           int random_state);
+    virtual ~RandomForestClassifier();
+
+    /**
+     * @brief Fit the forest, y holds the class labels.
+     */
+    virtual int fit(Mat X,
+                    Mat y,
+                    Mat sample_weight);
+
+    /**
+     * @brief Predict class for X.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, 1]
+     */
+    Mat predict(Mat X);
+
+    /**
+     * @brief Predict class probabilities for X, the mean class probabilities
+     * of the leaves reached in the trees.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, n_classes]
+     */
+    Mat predict_proba(Mat X);
+
+protected:
+    virtual BaseDecisionTree* _make_estimator(int random_state);
+    virtual int _n_outputs();
+    virtual void _add_leaf_value(const double* value, double* sum);
+    virtual void _set_oob_score(Mat y, const vector<bool>& has_oob);
+
+public:
+    vector<double> _classes;    // Sorted class labels
+};
+
+class ExtraTreesRegressor : public RandomForestRegressor
+{
+public:
+    /**
+     * @brief Extremely randomized trees for regression. The trees split on
+     * thresholds drawn at random between the min and the max of the drawn
+     * features (RandomSplitter): no sort, so a tree is much cheaper than a
+     * random forest one, and the randomness of the splits replaces the
+     * bootstrap, which is usually disabled.
+     */
+    ExtraTreesRegressor(int n_estimators,
+                        bool bootstrap,
+                        bool oob_score,
+                        char* criterion_name,
+                        int max_depth,
+                        int min_samples_split,
+                        int min_samples_leaf,
+                        double min_weight_fraction_leaf,
+                        int max_features,
+                        int max_leaf_nodes,
+                        int random_state);
+    virtual ~ExtraTreesRegressor();
+};
+
+class ExtraTreesClassifier : public RandomForestClassifier
+{
+public:
+    /**
+     * @brief Extremely randomized trees for classification, see
+     * ExtraTreesRegressor.
+     */
+    ExtraTreesClassifier(int n_estimators,
+                         bool bootstrap,
+                         bool oob_score,
+                         char* criterion_name,
+                         int max_depth,
+                         int min_samples_split,
+                         int min_samples_leaf,
+                         double min_weight_fraction_leaf,
+                         int max_features,
+                         int max_leaf_nodes,
+                         int random_state);
+    virtual ~ExtraTreesClassifier();
+};
+
+#endif // FOREST_H
@@ -0,0 +1,837 @@
+#include "gradientboosting.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "tree.h"
+#include "basetree.h"
+#include "splitter.h"
+#include "quickscorer.h"
+#include "criterion.h"
+#include "random.h"
+
+/**
+ * @brief Logistic sigmoid, 1 / (1 + exp(-x))
+ */
+static inline double expit(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+
+/**
+ * @brief Shuffle values[0:n] in place (Fisher-Yates)
+ */
+static void shuffle(int* values, int n, RandomGenerator& random_generator)
+{
+    for (int i = n - 1; i > 0; i--)
+        std::swap(values[i], values[random_generator.rand_int(0, i + 1)]);
+}
+
+/**
+ * @brief log(sum(exp(row))), computed without overflow
+ */
+static inline double logsumexp(const double* row, int n)
+{
+    double max_value = *std::max_element(row, row + n);
+    double sum = 0.0;
+    for (int k = 0; k < n; k++)
+        sum += exp(row[k] - max_value);
+    return max_value + log(sum);
+}
+
+LossFunction::LossFunction(int _K)
+    : K(_K)
+{
+
+}
+
+LossFunction::~LossFunction()
+{
+
+}
+
+void LossFunction::update_terminal_regions(Tree* tree,
+                                           Mat X,
+                                           Mat y,
+                                           Mat residual,
+                                           Mat pred,
+                                           Mat sample_weight,
+                                           double learning_rate,
+                                           int k,
+                                           bool update_leaves)
+{
+    Mat leaves = tree->apply(X);
+    int n_samples = X.rows;
+    int leaf;
+
+    if (update_leaves && _has_leaf_update())
+    {
+        // One pass over the samples for all the leaves
+        vector<double> numerator(tree->_node_count, 0.0);
+        vector<double> denominator(tree->_node_count, 0.0);
+        double w;
+
+        for (int i = 0; i < n_samples; i++)
+        {
+            w = sample_weight.at<double>(i);
+            if (w == 0.0)
+                continue;
+            leaf = leaves.at<int>(i, 0);
+            _leaf_stats(y, residual, i, k, w, &numerator[leaf], &denominator[leaf]);
+        }
+
+        for (int node_id = 0; node_id < tree->_node_count; node_id++)
+            if (tree->nodes()[node_id].left_child == TREE_LEAF)
+                tree->value(node_id)[0] = _leaf_value(numerator[node_id],
+                                                      denominator[node_id]);
+    }
+
+    // Update the predictions, out-of-bag samples included
+    for (int i = 0; i < n_samples; i++)
+    {
+        leaf = leaves.at<int>(i, 0);
+        pred.at<double>(i, k) += learning_rate * tree->value(leaf)[0];
+    }
+}
+
+bool LossFunction::_has_leaf_update()
+{
+    return false;
+}
+
+void LossFunction::_leaf_stats(Mat,
+                               Mat,
+                               int,
+                               int,
+                               double,
+                               double*,
+                               double*)
+{
+
+}
+
+double LossFunction::_leaf_value(double,
+                                 double)
+{
+    return 0.0;
+}
+
+LeastSquaresError::LeastSquaresError()
+    : LossFunction(1)
+{
+
+}
+
+LeastSquaresError::~LeastSquaresError()
+{
+
+}
+
+Mat LeastSquaresError::init_estimate(Mat y,
+                                     Mat sample_weight)
+{
+    // Weighted mean of y
+    double sum = 0.0;
+    double weight = 0.0;
+    for (int i = 0; i < y.rows; i++)
+    {
+        sum += sample_weight.at<double>(i) * y.at<double>(i);
+        weight += sample_weight.at<double>(i);
+    }
+
+    Mat init = Mat::zeros(1, 1, CV_64F);
+    init.at<double>(0, 0) = sum / weight;
+    return init;
+}
+
+double LeastSquaresError::loss(Mat y,
+                               Mat pred,
+                               Mat sample_weight)
+{
+    double loss = 0.0;
+    double weight = 0.0;
+    double diff;
+    for (int i = 0; i < y.rows; i++)
+    {
+        diff = y.at<double>(i) - pred.at<double>(i, 0);
+        loss += sample_weight.at<double>(i) * diff * diff;
+        weight += sample_weight.at<double>(i);
+    }
+    return loss / weight;
+}
+
+void LeastSquaresError::negative_gradient(Mat y,
+                                          Mat pred,
+                                          int k,
+                                          Mat residual)
+{
+    for (int i = 0; i < y.rows; i++)
+        residual.at<double>(i) = y.at<double>(i) - pred.at<double>(i, k);
+}
+
+void LeastSquaresError::hessian(Mat y,
+                                Mat,
+                                int,
+                                Mat hessian)
+{
+    for (int i = 0; i < y.rows; i++)
+        hessian.at<double>(i) = 1.0;
+}
+
+BinomialDeviance::BinomialDeviance()
+    : LossFunction(1)
+{
+
+}
+
+BinomialDeviance::~BinomialDeviance()
+{
+
+}
+
+Mat BinomialDeviance::init_estimate(Mat y,
+                                    Mat sample_weight)
+{
+    // Log odds of the positive class
+    double pos = 0.0;
+    double weight = 0.0;
+    for (int i = 0; i < y.rows; i++)
+    {
+        pos += sample_weight.at<double>(i) * y.at<double>(i);
+        weight += sample_weight.at<double>(i);
+    }
+
+    Mat init = Mat::zeros(1, 1, CV_64F);
+    init.at<double>(0, 0) = log(pos / (weight - pos));
+    return init;
+}
+
+double BinomialDeviance::loss(Mat y,
+                              Mat pred,
+                              Mat sample_weight)
+{
+    // -2 * sum(y * pred - log(1 + exp(pred)))
+    double loss = 0.0;
+    double weight = 0.0;
+    double p;
+    for (int i = 0; i < y.rows; i++)
+    {
+        p = pred.at<double>(i, 0);
+        loss += sample_weight.at<double>(i) *
+                (y.at<double>(i) * p - (p > 0 ? p + log1p(exp(-p)) : log1p(exp(p))));
+        weight += sample_weight.at<double>(i);
+    }
+    return -2.0 * loss / weight;
+}
+
+void BinomialDeviance::negative_gradient(Mat y,
+                                         Mat pred,
+                                         int k,
+                                         Mat residual)
+{
+    for (int i = 0; i < y.rows; i++)
+        residual.at<double>(i) = y.at<double>(i) - expit(pred.at<double>(i, k));
+}
+
+void BinomialDeviance::hessian(Mat y,
+                               Mat pred,
+                               int k,
+                               Mat hessian)
+{
+    double p;
+    for (int i = 0; i < y.rows; i++)
+    {
+        p = expit(pred.at<double>(i, k));
+        hessian.at<double>(i) = p * (1.0 - p);
+    }
+}
+
+bool BinomialDeviance::_has_leaf_update()
+{
+    return true;
+}
+
+void BinomialDeviance::_leaf_stats(Mat y,
+                                   Mat residual,
+                                   int i,
+                                   int,
+                                   double w,
+                                   double* numerator,
+                                   double* denominator)
+{
+    double r = residual.at<double>(i);
+    double y_i = y.at<double>(i);
+    *numerator += w * r;
+    *denominator += w * (y_i - r) * (1.0 - y_i + r);
+}
+
+double BinomialDeviance::_leaf_value(double numerator,
+                                     double denominator)
+{
+    // Single Newton-Raphson step
+    if (fabs(denominator) < 1e-150)
+        return 0.0;
+    return numerator / denominator;
+}
+
+MultinomialDeviance::MultinomialDeviance(int n_classes)
+    : LossFunction(n_classes)
+{
+
+}
+
+MultinomialDeviance::~MultinomialDeviance()
+{
+
+}
+
+Mat MultinomialDeviance::init_estimate(Mat y,
+                                       Mat sample_weight)
+{
+    // Log of the class priors
+    Mat init = Mat::zeros(1, K, CV_64F);
+    double weight = 0.0;
+    for (int i = 0; i < y.rows; i++)
+    {
+        init.at<double>(0, static_cast<int>(y.at<double>(i))) += sample_weight.at<double>(i);
+        weight += sample_weight.at<double>(i);
+    }
+    for (int k = 0; k < K; k++)
+        init.at<double>(0, k) = log(init.at<double>(0, k) / weight);
+    return init;
+}
+
+double MultinomialDeviance::loss(Mat y,
+                                 Mat pred,
+                                 Mat sample_weight)
+{
+    double loss = 0.0;
+    double weight = 0.0;
+    const double* row;
+    for (int i = 0; i < y.rows; i++)
+    {
+        row = pred.ptr<double>(i);
+        loss += sample_weight.at<double>(i) *
+                (row[static_cast<int>(y.at<double>(i))] - logsumexp(row, K));
+        weight += sample_weight.at<double>(i);
+    }
+    return -loss / weight;
+}
+
+void MultinomialDeviance::negative_gradient(Mat y,
+                                            Mat pred,
+                                            int k,
+                                            Mat residual)
+{
+    const double* row;
+    double y_k;
+    for (int i = 0; i < y.rows; i++)
+    {
+        row = pred.ptr<double>(i);
+        y_k = (static_cast<int>(y.at<double>(i)) == k) ? 1.0 : 0.0;
+        residual.at<double>(i) = y_k - exp(row[k] - logsumexp(row, K));
+    }
+}
+
+void MultinomialDeviance::hessian(Mat y,
+                                  Mat pred,
+                                  int k,
+                                  Mat hessian)
+{
+    // Scaled by K / (K - 1), the factor of the leaf update
+    const double* row;
+    double p;
+    for (int i = 0; i < y.rows; i++)
+    {
+        row = pred.ptr<double>(i);
+        p = exp(row[k] - logsumexp(row, K));
+        hessian.at<double>(i) = K / (K - 1.0) * p * (1.0 - p);
+    }
+}
+
+bool MultinomialDeviance::_has_leaf_update()
+{
+    return true;
+}
+
+void MultinomialDeviance::_leaf_stats(Mat y,
+                                      Mat residual,
+                                      int i,
+                                      int k,
+                                      double w,
+                                      double* numerator,
+                                      double* denominator)
+{
+    double r = residual.at<double>(i);
+    double y_k = (static_cast<int>(y.at<double>(i)) == k) ? 1.0 : 0.0;
+    *numerator += w * r;
+    *denominator += w * (y_k - r) * (1.0 - y_k + r);
+}
+
+double MultinomialDeviance::_leaf_value(double numerator,
+                                        double denominator)
+{
+    if (fabs(denominator) < 1e-150)
+        return 0.0;
+    return (K - 1.0) / K * numerator / denominator;
+}
+
+BaseGradientBoosting::BaseGradientBoosting(char* loss_name,
+                                           double learning_rate,
+                                           int n_estimators,
+                                           double subsample,
+                                           char* criterion_name,
+                                           char* splitter_name,
+                                           int max_depth,
+                                           int min_samples_split,
+                                           int min_samples_leaf,
+                                           double min_weight_fraction_leaf,
+                                           int max_features,
+                                           int max_leaf_nodes,
+                                           int random_state)
+    : _loss_name(loss_name),
+      _learning_rate(learning_rate),
+      _n_estimators(n_estimators),
+      _subsample(subsample),
+      _criterion_name(criterion_name),
+      _splitter_name(splitter_name),
+      _max_depth(max_depth),
+      _min_samples_split(min_samples_split),
+      _min_samples_leaf(min_samples_leaf),
+      _min_weight_fraction_leaf(min_weight_fraction_leaf),
+      _max_features(max_features),
+      _max_leaf_nodes(max_leaf_nodes),
+      _random_state(random_state),
+      _goss_top_rate(0.0),
+      _goss_other_rate(0.0),
+      _l2_regularization(NEWTON_L2_REGULARIZATION),
+      _min_child_hessian(NEWTON_MIN_CHILD_HESSIAN),
+      _n_features(0),
+      _loss(NULL),
+      _scorer(NULL)
+{
+
+}
+
+BaseGradientBoosting::~BaseGradientBoosting()
+{
+    _clear();
+}
+
+void BaseGradientBoosting::set_goss(double top_rate,
+                                    double other_rate)
+{
+    _goss_top_rate = top_rate;
+    _goss_other_rate = other_rate;
+}
+
+void BaseGradientBoosting::set_regularization(double l2_regularization,
+                                              double min_child_hessian)
+{
+    _l2_regularization = l2_regularization;
+    _min_child_hessian = min_child_hessian;
+}
+
+void BaseGradientBoosting::_clear()
+{
+    // The first tree owns the shared splitter, free it last
+    for (int i = static_cast<int>(_estimators.size()) - 1; i >= 0; i--)
+        delete _estimators[i];
+    _estimators.clear();
+    _train_score.clear();
+
+    delete _loss;
+    _loss = NULL;
+    delete _scorer;
+    _scorer = NULL;
+}
+
+int BaseGradientBoosting::fit(Mat X,
+                              Mat y,
+                              Mat sample_weight)
+{
+    // Validation
+    if (X.rows == 0 || X.cols == 0)
+        return 1;
+
+    int n_samples = X.rows;
+    _n_features = X.cols;
+
+    // Reshape y to shape[n_samples, 1]
+    y = y.reshape(1, y.total());
+
+    // Validation
+    if (y.rows != n_samples)
+        return 2;
+
+    // Validation
+    if (_n_estimators <= 0)
+        return 3;
+    if (_learning_rate <= 0.0)
+        return 3;
+    if (_subsample <= 0.0 || _subsample > 1.0)
+        return 3;
+    bool goss = (_goss_other_rate != 0.0);
+    if (goss && (_subsample < 1.0 ||
+                 _goss_top_rate < 0.0 || _goss_other_rate < 0.0 ||
+                 _goss_top_rate + _goss_other_rate > 1.0))
+        return 3;
+
+    if (sample_weight.total() == 0)
+        sample_weight = Mat::ones(n_samples, 1, CV_64F);
+
+    _clear();
+    int error_code = _init_loss(y);
+    if (error_code != 0)
+        return error_code;
+    int K = _loss->K;
+
+    // Raw predictions of the current stage
+    _init = _loss->init_estimate(y, sample_weight);
+    Mat pred(n_samples, K, CV_64F);
+    for (int i = 0; i < n_samples; i++)
+        for (int k = 0; k < K; k++)
+            pred.at<double>(i, k) = _init.at<double>(0, k);
+
+    Mat residual(n_samples, 1, CV_64F);
+    // The Newton criterion fits [residual, hessian]
+    bool is_newton = strcmp(_criterion_name, "Newton") == 0;
+    Mat newton_target(n_samples, 2, CV_64F);
+    Mat hessian(n_samples, 1, CV_64F);
+    Mat tree_weight = sample_weight.clone();
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    vector<int> indices(n_samples);
+    for (int i = 0; i < n_samples; i++)
+        indices[i] = i;
+    int n_inbag = std::max(1, static_cast<int>(_subsample * n_samples));
+
+    // The samples are drawn from the stream of random_state, every tree
+    // gets a seed of its own from the stream jumped once, so that the
+    // stages don't all draw the same features
+    RandomGenerator random_generator(_random_state);
+    RandomGenerator seed_stream = random_generator;
+    seed_stream.jump();
+
+    int n_top = static_cast<int>(_goss_top_rate * n_samples);
+    int n_other = std::min(n_samples - n_top,
+                           std::max(1, static_cast<int>(_goss_other_rate * n_samples)));
+    double other_weight = (1.0 - _goss_top_rate) / _goss_other_rate;
+    vector<double> gradient(n_samples);
+
+    Splitter* splitter = NULL;
+    DecisionTreeRegressor* tree;
+
+    for (int stage = 0; stage < _n_estimators; stage++)
+    {
+        // Subsampling: out-of-bag samples get a null weight
+        if (n_inbag < n_samples)
+        {
+            shuffle(&indices[0], n_samples, random_generator);
+            for (int i = 0; i < n_samples; i++)
+                tree_weight.at<double>(i) = 0.0;
+            for (int i = 0; i < n_inbag; i++)
+                tree_weight.at<double>(indices[i]) = sample_weight.at<double>(indices[i]);
+        }
+        else if (goss)
+        {
+            for (int i = 0; i < n_samples; i++)
+                gradient[i] = 0.0;
+            for (int k = 0; k < K; k++)
+            {
+                _loss->negative_gradient(y, pred, k, residual);
+                for (int i = 0; i < n_samples; i++)
+                    gradient[i] += fabs(residual.at<double>(i));
+            }
+            for (int i = 0; i < n_samples; i++)
+                gradient[i] *= sample_weight.at<double>(i);
+
+            // The n_top largest gradients first, then the others shuffled
+            std::nth_element(indices.begin(), indices.begin() + n_top, indices.end(),
+                             [&gradient](int a, int b) { return gradient[a] > gradient[b]; });
+            shuffle(&indices[n_top], n_samples - n_top, random_generator);
+
+            for (int i = 0; i < n_samples; i++)
+                tree_weight.at<double>(i) = 0.0;
+            for (int i = 0; i < n_top; i++)
+                tree_weight.at<double>(indices[i]) = sample_weight.at<double>(indices[i]);
+            for (int i = n_top; i < n_top + n_other; i++)
+                tree_weight.at<double>(indices[i]) = other_weight * sample_weight.at<double>(indices[i]);
+        }
+
+        for (int k = 0; k < K; k++)
+        {
+            _loss->negative_gradient(y, pred, k, residual);
+            if (is_newton)
+            {
+                _loss->hessian(y, pred, k, hessian);
+                for (int i = 0; i < n_samples; i++)
+                {
+                    newton_target.at<double>(i, 0) = residual.at<double>(i);
+                    newton_target.at<double>(i, 1) = hessian.at<double>(i);
+                }
+            }
+
+            int seed = static_cast<int>(seed_stream.next() >> 33);
+            tree = new DecisionTreeRegressor(_criterion_name,
+                                             _splitter_name,
+                                             _max_depth,
+                                             _min_samples_split,
+                                             _min_samples_leaf,
+                                             _min_weight_fraction_leaf,
+                                             _max_features,
+                                             _max_leaf_nodes,
+                                             seed,
+                                             class_weight);
+
+            // All trees share the splitter of the first one
+            if (splitter != NULL)
+            {
+                splitter->random_state = seed;
+                tree->set_splitter(splitter);
+            }
+
+            if (is_newton)
+            {
+                tree->set_regularization(_l2_regularization, _min_child_hessian);
+                error_code = tree->fit(X, newton_target, tree_weight);
+            }
+            else
+                error_code = tree->fit(X, residual, tree_weight);
+            if (error_code != 0)
+            {
+                delete tree;
+                return error_code;
+            }
+            splitter = tree->_splitter;
+            _estimators.push_back(tree);
+
+            _loss->update_terminal_regions(tree->_tree, X, y, residual, pred,
+                                           tree_weight, _learning_rate, k, !is_newton);
+        }
+
+        _train_score.push_back(_loss->loss(y, pred, tree_weight));
+    }
+
+    // Same sums, in the same order, as staged_decision_function
+    _scorer = new QuickScorer(K);
+    _scorer->set_init(_init);
+    for (size_t i = 0; i < _estimators.size(); i++)
+        _scorer->add_tree(_estimators[i]->_tree, _learning_rate, i % K);
+    return 0;
+}
+
+Mat BaseGradientBoosting::decision_function(Mat X)
+{
+    return _scorer->predict(X);
+}
+
+vector<Mat> BaseGradientBoosting::staged_decision_function(Mat X)
+{
+    int K = _loss->K;
+    int n_samples = X.rows;
+    int n_stages = _estimators.size() / K;
+    vector<Mat> staged;
+
+    Mat score(n_samples, K, CV_64F);
+    for (int i = 0; i < n_samples; i++)
+        for (int k = 0; k < K; k++)
+            score.at<double>(i, k) = _init.at<double>(0, k);
+
+    Mat value;
+    for (int stage = 0; stage < n_stages; stage++)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            value = _estimators[stage * K + k]->predict(X);
+            for (int i = 0; i < n_samples; i++)
+                score.at<double>(i, k) += _learning_rate * value.at<double>(i);
+        }
+        staged.push_back(score.clone());
+    }
+    return staged;
+}
+
+GradientBoostingRegressor::GradientBoostingRegressor(char* loss_name,
+                                                     double learning_rate,
+                                                     int n_estimators,
+                                                     double subsample,
+                                                     char* criterion_name,
+                                                     char* splitter_name,
+                                                     int max_depth,
+                                                     int min_samples_split,
+                                                     int min_samples_leaf,
+                                                     double min_weight_fraction_leaf,
+                                                     int max_features,
+                                                     int max_leaf_nodes,
+                                                     int random_state)
+    : BaseGradientBoosting(loss_name,
+                           learning_rate,
+                           n_estimators,
+                           subsample,
+                           criterion_name,
+                           splitter_name,
+                           max_depth,
+                           min_samples_split,
+                           min_samples_leaf,
+                           min_weight_fraction_leaf,
+                           max_features,
+                           max_leaf_nodes,
+                           random_state)
+{
+
+}
+
+GradientBoostingRegressor::~GradientBoostingRegressor()
+{
+
+}
+
+int GradientBoostingRegressor::_init_loss(Mat)
+{
+    if (strcmp(_loss_name, "ls") == 0)
+        _loss = new LeastSquaresError();
+    else
+        return 3;
+    return 0;
+}
+
+Mat GradientBoostingRegressor::predict(Mat X)
+{
+    return decision_function(X);
+}
+
+vector<Mat> GradientBoostingRegressor::staged_predict(Mat X)
+{
+    return staged_decision_function(X);
+}
+
+GradientBoostingClassifier::GradientBoostingClassifier(char* loss_name,
+                                                       double learning_rate,
+                                                       int n_estimators,
+                                                       double subsample,
+                                                       char* criterion_name,
+                                                       char* splitter_name,
+                                                       int max_depth,
+                                                       int min_samples_split,
+                                                       int min_samples_leaf,
+                                                       double min_weight_fraction_leaf,
+                                                       int max_features,
+                                                       int max_leaf_nodes,
+                                                       int random_state)
+    : BaseGradientBoosting(loss_name,
+                           learning_rate,
+                           n_estimators,
+                           subsample,
+                           criterion_name,
+                           splitter_name,
+                           max_depth,
+                           min_samples_split,
+                           min_samples_leaf,
+                           min_weight_fraction_leaf,
+                           max_features,
+                           max_leaf_nodes,
+                           random_state)
+{
+
+}
+
+GradientBoostingClassifier::~GradientBoostingClassifier()
+{
+
+}
+
+int GradientBoostingClassifier::fit(Mat X,
+                                    Mat y,
+                                    Mat sample_weight)
+{
+    y = y.reshape(1, y.total());
+
+    // Encode the labels as 0, 1, ..., n_classes-1
+    _classes.clear();
+    for (int i = 0; i < y.rows; i++)
+        _classes.push_back(y.at<double>(i));
+    std::sort(_classes.begin(), _classes.end());
+    _classes.erase(std::unique(_classes.begin(), _classes.end()), _classes.end());
+
+    if (_classes.size() < 2)
+        return 2;
+
+    Mat y_encoded(y.rows, 1, CV_64F);
+    for (int i = 0; i < y.rows; i++)
+        y_encoded.at<double>(i) = std::lower_bound(_classes.begin(), _classes.end(),
+                                                   y.at<double>(i)) - _classes.begin();
+
+    return BaseGradientBoosting::fit(X, y_encoded, sample_weight);
+}
+
+int GradientBoostingClassifier::_init_loss(Mat)
+{
+    if (strcmp(_loss_name, "deviance") != 0)
+        return 3;
+
+    if (_classes.size() == 2)
+        _loss = new BinomialDeviance();
+    else
+        _loss = new MultinomialDeviance(_classes.size());
+    return 0;
+}
+
+Mat GradientBoostingClassifier::predict(Mat X)
+{
+    return _score_to_decision(decision_function(X));
+}
+
+Mat GradientBoostingClassifier::predict_proba(Mat X)
+{
+    return _score_to_proba(decision_function(X));
+}
+
+vector<Mat> GradientBoostingClassifier::staged_predict(Mat X)
+{
+    vector<Mat> staged = staged_decision_function(X);
+    for (size_t i = 0; i < staged.size(); i++)
+        staged[i] = _score_to_decision(staged[i]);
+    return staged;
+}
+
+Mat GradientBoostingClassifier::_score_to_proba(Mat score)
+{
+    int n_classes = _classes.size();
+    Mat proba(score.rows, n_classes, CV_64F);
+    const double* row;
+    double norm;
+
+    for (int i = 0; i < score.rows; i++)
+    {
+        row = score.ptr<double>(i);
+        if (n_classes == 2)
+        {
+            proba.at<double>(i, 1) = expit(row[0]);
+            proba.at<double>(i, 0) = 1.0 - proba.at<double>(i, 1);
+        }
+        else
+        {
+            norm = logsumexp(row, n_classes);
+            for (int k = 0; k < n_classes; k++)
+                proba.at<double>(i, k) = exp(row[k] - norm);
+        }
+    }
+    return proba;
+}
+
+Mat GradientBoostingClassifier::_score_to_decision(Mat score)
+{
+    int n_classes = _classes.size();
+    Mat decision(score.rows, 1, CV_64F);
+    const double* row;
+
+    for (int i = 0; i < score.rows; i++)
+    {
+        row = score.ptr<double>(i);
+        if (n_classes == 2)
+            decision.at<double>(i) = _classes[row[0] > 0.0 ? 1 : 0];
+        else
+            decision.at<double>(i) = _classes[std::max_element(row, row + n_classes) - row];
+    }
+    return decision;
+}
@@ -0,0 +1,436 @@
+#ifndef GRADIENTBOOSTING_H
+#define GRADIENTBOOSTING_H
+
+//========================================
+// Gradient Boosting
+// Clone of a python ml library(scikit-learn)
+//========================================
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+using std::vector;
+using cv::Mat;
+
+class Tree;
+class Splitter;
+class DecisionTreeRegressor;
+class QuickScorer;
+
+class LossFunction
+{
+public:
+    /**
+     * @brief Abstract base class for the losses of gradient boosting.
+     * @param K: number of regression trees fitted per boosting stage
+     */
+    LossFunction(int K);
+    virtual ~LossFunction();
+
+    /**
+     * @brief Compute the initial raw prediction, before any tree.
+     * @param y
+     * @param sample_weight
+     * @return Mat, shape = [1, K]
+     */
+    virtual Mat init_estimate(Mat y,
+                              Mat sample_weight)=0;
+
+    /**
+     * @brief Compute the weighted mean loss of the raw predictions.
+     * @param y
+     * @param pred: raw predictions, shape = [n_samples, K]
+     * @param sample_weight
+     * @return loss
+     */
+    virtual double loss(Mat y,
+                        Mat pred,
+                        Mat sample_weight)=0;
+
+    /**
+     * @brief Compute the negative gradient (pseudo-residual) of the k-th output.
+     * @param y
+     * @param pred: raw predictions, shape = [n_samples, K]
+     * @param k
+     * @param residual: output, shape = [n_samples, 1]
+     */
+    virtual void negative_gradient(Mat y,
+                                   Mat pred,
+                                   int k,
+                                   Mat residual)=0;
+
+    /**
+     * @brief Compute the hessian of the loss of the k-th output, the second
+     * order term of the Newton criterion. Its leaf value sum(r) / sum(h)
+     * is the Newton step of update_terminal_regions.
+     * @param y
+     * @param pred: raw predictions, shape = [n_samples, K]
+     * @param k
+     * @param hessian: output, shape = [n_samples, 1]
+     */
+    virtual void hessian(Mat y,
+                         Mat pred,
+                         int k,
+                         Mat hessian)=0;
+
+    /**
+     * @brief Update the leaf values of a tree fitted on the residuals of the
+     * k-th output, then add its shrinked predictions to pred[:, k].
+     * @param tree
+     * @param X
+     * @param y
+     * @param residual
+     * @param pred
+     * @param sample_weight: weight of the samples the tree was fitted on,
+     *        null for the out-of-bag samples
+     * @param learning_rate
+     * @param k
+     * @param update_leaves: false when the leaf values are already Newton
+     *        steps, i.e. the tree was fitted by the Newton criterion
+     */
+    void update_terminal_regions(Tree* tree,
+                                 Mat X,
+                                 Mat y,
+                                 Mat residual,
+                                 Mat pred,
+                                 Mat sample_weight,
+                                 double learning_rate,
+                                 int k,
+                                 bool update_leaves=true);
+
+protected:
+    /**
+     * @brief Whether the leaf values fitted on the residuals must be
+     * re-estimated for this loss (one Newton step per leaf).
+     */
+    virtual bool _has_leaf_update();
+
+    /**
+     * @brief Accumulate the contribution of sample i to the leaf numerator
+     * and denominator.
+     */
+    virtual void _leaf_stats(Mat y,
+                             Mat residual,
+                             int i,
+                             int k,
+                             double w,
+                             double* numerator,
+                             double* denominator);
+
+    /**
+     * @brief Compute the leaf value from its numerator and denominator.
+     */
+    virtual double _leaf_value(double numerator,
+                               double denominator);
+
+public:
+    int K;
+};
+
+class LeastSquaresError : public LossFunction
+{
+public:
+    /**
+     * @brief Loss function for least squares (LS) estimation.
+     * The terminal regions need not to be updated for least squares.
+     */
+    LeastSquaresError();
+    virtual ~LeastSquaresError();
+
+    virtual Mat init_estimate(Mat y, Mat sample_weight);
+    virtual double loss(Mat y, Mat pred, Mat sample_weight);
+    virtual void negative_gradient(Mat y, Mat pred, int k, Mat residual);
+    virtual void hessian(Mat y, Mat pred, int k, Mat hessian);
+};
+
+class BinomialDeviance : public LossFunction
+{
+public:
+    /**
+     * @brief Binomial deviance loss function for binary classification.
+     * Binary classification is a special case; here, we only need to
+     * fit one tree instead of n_classes trees.
+     */
+    BinomialDeviance();
+    virtual ~BinomialDeviance();
+
+    virtual Mat init_estimate(Mat y, Mat sample_weight);
+    virtual double loss(Mat y, Mat pred, Mat sample_weight);
+    virtual void negative_gradient(Mat y, Mat pred, int k, Mat residual);
+    virtual void hessian(Mat y, Mat pred, int k, Mat hessian);
+
+protected:
+    virtual bool _has_leaf_update();
+    virtual void _leaf_stats(Mat y, Mat residual, int i, int k, double w,
+                             double* numerator, double* denominator);
+    virtual double _leaf_value(double numerator, double denominator);
+};
+
+class MultinomialDeviance : public LossFunction
+{
+public:
+    /**
+     * @brief Multinomial deviance loss function for multi-class classification.
+     * For multi-class classification we need to fit n_classes trees at
+     * each stage.
+     * @param n_classes
+     */
+    MultinomialDeviance(int n_classes);
+    virtual ~MultinomialDeviance();
+
+    virtual Mat init_estimate(Mat y, Mat sample_weight);
+    virtual double loss(Mat y, Mat pred, Mat sample_weight);
+    virtual void negative_gradient(Mat y, Mat pred, int k, Mat residual);
+    virtual void hessian(Mat y, Mat pred, int k, Mat hessian);
+
+protected:
+    virtual bool _has_leaf_update();
+    virtual void _leaf_stats(Mat y, Mat residual, int i, int k, double w,
+                             double* numerator, double* denominator);
+    virtual double _leaf_value(double numerator, double denominator);
+};
+
+class BaseGradientBoosting
+{
+public:
+    /**
+     * @brief Abstract base class for Gradient Boosting.
+     *
+     * Every stage fits K DecisionTreeRegressor on the negative gradient of
+     * the loss. All the trees share one Splitter and its Criterion, so the
+     * X dependent state of the splitter (e.g. the binned X of the
+     * HistogramSplitter) is computed once for the whole ensemble.
+     * @param loss_name
+     * @param learning_rate: shrinks the contribution of each tree
+     * @param n_estimators: number of boosting stages
+     * @param subsample: fraction of samples used to fit each stage
+     * @param criterion_name: "MSE", "FriedmanMSE", or "Newton" to fit the
+     *        trees on the gradients and the hessians, see set_regularization
+     * @param splitter_name
+     * @param max_depth
+     * @param min_samples_split
+     * @param min_samples_leaf
+     * @param min_weight_fraction_leaf
+     * @param max_features
+     * @param max_leaf_nodes
+     * @param random_state
+     */
+    BaseGradientBoosting(char* loss_name,
+                         double learning_rate,
+                         int n_estimators,
+                         double subsample,
+                         char* criterion_name,
+                         char* splitter_name,
+                         int max_depth,
+                         int min_samples_split,
+                         int min_samples_leaf,
+                         double min_weight_fraction_leaf,
+                         int max_features,
+                         int max_leaf_nodes,
+                         int random_state);
+    virtual ~BaseGradientBoosting();
+
+    /**
+     * @brief Fit the gradient boosting model.
+     * @param X The training input samples, shape = [n_sampels, n_features]
+     * @param y The target values, shape = [n_samples]
+     * @param sample_weight Sample weights. If total size equals to zero, then samples are equally weighted.
+     * @return error_code: 1 X is empty, 2 y doesn't match X, 3 invalid
+     *         parameters, or the error_code of the first tree that failed
+     */
+    virtual int fit(Mat X,
+                    Mat y,
+                    Mat sample_weight);
+
+    /**
+     * @brief Sample the rows of every stage by gradient (GOSS) instead of
+     * uniformly with subsample.
+     *
+     * The top_rate * n_samples samples with the largest gradients are kept,
+     * other_rate * n_samples of the others are drawn at random and weigh
+     * (1 - top_rate) / other_rate times more, so that the sums of the
+     * gradients stay unbiased. The other samples get a null weight, which
+     * the splitter skips: a stage only sorts and scans the sampled rows.
+     * The gradient of a sample is the sum of the absolute gradients of the
+     * K outputs, times its weight.
+     * @param top_rate: in [0, 1)
+     * @param other_rate: in (0, 1 - top_rate], 0 disables GOSS
+     */
+    void set_goss(double top_rate,
+                  double other_rate);
+
+    /**
+     * @brief Regularization of the trees fitted with the "Newton" criterion.
+     *
+     * The Newton criterion fits every tree on the gradients and the
+     * hessians of the loss: the splits maximize the second order gain and
+     * the leaves are the Newton steps, so the leaf values aren't estimated
+     * again after each tree.
+     * @param l2_regularization: added to the sum of the hessians of a leaf
+     * @param min_child_hessian: min sum of the hessians in a leaf
+     */
+    void set_regularization(double l2_regularization,
+                            double min_child_hessian);
+
+    /**
+     * @brief Compute the raw predictions of X, with the QuickScorer built
+     * from the fitted trees.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, K]
+     */
+    Mat decision_function(Mat X);
+
+    /**
+     * @brief Compute the raw predictions of X after each stage.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return n_estimators Mat, shape = [n_samples, K]
+     */
+    vector<Mat> staged_decision_function(Mat X);
+
+protected:
+    /**
+     * @brief Select the loss, once y is known.
+     * @param y
+     * @return error_code
+     */
+    virtual int _init_loss(Mat y)=0;
+
+    /**
+     * @brief Free the fitted estimators.
+     */
+    void _clear();
+
+public:
+    char* _loss_name;
+    double _learning_rate;
+    int _n_estimators;
+    double _subsample;
+    char* _criterion_name;
+    char* _splitter_name;
+    int _max_depth;
+    int _min_samples_split;
+    int _min_samples_leaf;
+    double _min_weight_fraction_leaf;
+    int _max_features;
+    int _max_leaf_nodes;
+    int _random_state;
+    double _goss_top_rate;                      // Fraction of the samples kept by gradient
+    double _goss_other_rate;                    // Fraction of the samples drawn among the others, 0 without GOSS
+    double _l2_regularization;                  // Of the "Newton" criterion
+    double _min_child_hessian;                  // Of the "Newton" criterion
+
+    int _n_features;
+    LossFunction* _loss;
+    Mat _init;                                  // Initial raw prediction, shape = [1, K]
+    vector<DecisionTreeRegressor*> _estimators; // Stage i, output k is _estimators[i * K + k]
+    vector<double> _train_score;                // Loss on the in-bag samples after each stage
+    QuickScorer* _scorer;                       // All the stages, for decision_function
+};
+
+class GradientBoostingRegressor : public BaseGradientBoosting
+{
+public:
+    /**
+     * @brief Gradient Boosting for regression.
+     * @param loss_name: "ls"
+     */
+    GradientBoostingRegressor(char* loss_name,
+                              double learning_rate,
+                              int n_estimators,
+                              double subsample,
+                              char* criterion_name,
+                              char* splitter_name,
+                              int max_depth,
+                              int min_samples_split,
+                              int min_samples_leaf,
+                              double min_weight_fraction_leaf,
+                              int max_features,
+                              int max_leaf_nodes,
+                              int random_state);
+    virtual ~GradientBoostingRegressor();
+
+    /**
+     * @brief Predict regression target for X.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, 1]
+     */
+    Mat predict(Mat X);
+
+    /**
+     * @brief Predict regression target for X after each stage.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return n_estimators Mat, shape = [n_samples, 1]
+     */
+    vector<Mat> staged_predict(Mat X);
+
+protected:
+    virtual int _init_loss(Mat y);
+};
+
+class GradientBoostingClassifier : public BaseGradientBoosting
+{
+public:
+    /**
+     * @brief Gradient Boosting for classification.
+     * @param loss_name: "deviance"
+     */
+    GradientBoostingClassifier(char* loss_name,
+                               double learning_rate,
+                               int n_estimators,
+                               double subsample,
+                               char* criterion_name,
+                               char* splitter_name,
+                               int max_depth,
+                               int min_samples_split,
+                               int min_samples_leaf,
+                               double min_weight_fraction_leaf,
+                               int max_features,
+                               int max_leaf_nodes,
+                               int random_state);
+    virtual ~GradientBoostingClassifier();
+
+    /**
+     * @brief Fit the gradient boosting model, y holds the class labels.
+     */
+    virtual int fit(Mat X,
+                    Mat y,
+                    Mat sample_weight);
+
+    /**
+     * @brief Predict class for X.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, 1]
+     */
+    Mat predict(Mat X);
+
+    /**
+     * @brief Predict class probabilities for X.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return Mat, shape = [n_samples, n_classes]
+     */
+    Mat predict_proba(Mat X);
+
+    /**
+     * @brief Predict class for X after each stage.
+     * @param X The input samples, shape = [n_samples, n_features]
+     * @return n_estimators Mat, shape = [n_samples, 1]
+     */
+    vector<Mat> staged_predict(Mat X);
+
+protected:
+    virtual int _init_loss(Mat y);
+
+    /**
+     * @brief Turn raw predictions into class probabilities.
+     */
+    Mat _score_to_proba(Mat score);
+
+    /**
+     * @brief Turn raw predictions into class labels.
+     */
+    Mat _score_to_decision(Mat score);
+
+public:
+    vector<double> _classes;    // Sorted class labels
+};
+
+#endif // GRADIENTBOOSTING_H
@@ -0,0 +1,6 @@
+#include "gradientboosting.h"
+
+int main()
+{
+    return 0;
+}
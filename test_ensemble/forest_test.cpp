@@ -0,0 +1,310 @@
+#include "forest_test.h"
+#include <utility>
+#include <chrono>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "forest.h"
+#include "tree.h"
+#include "basetree.h"
+#include "tools.h"
+using std::pair;
+using cv::Mat;
+
+int RandomForestRegression_test(char* splitter_name, QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    // The forest doesn't depend on the number of threads
+    int n_threads[] = {1, 4};
+    RandomForestRegressor* forests[2];
+    Mat predictions[2];
+    for (int f = 0; f < 2; f++)
+    {
+        forests[f] = new RandomForestRegressor(100, true, true, "MSE", splitter_name,
+                                               0, 2, 1, 0.0, 0, 0, 0);
+        forests[f]->set_n_threads(n_threads[f]);
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (forests[f]->fit(X, y, sample_weight) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        predictions[f] = forests[f]->predict(X);
+
+        double mse = 0.0;
+        for (int i = 0; i < y.total(); i++)
+        {
+            double diff = predictions[f].at<double>(i) - y.at<double>(i);
+            mse += diff * diff;
+        }
+        cout << "Threads: " << n_threads[f] << " MSE: " << mse / y.total()
+             << " OOB R^2: " << forests[f]->_oob_score << " " << seconds << "s" << endl;
+    }
+
+    int n_failed = 0;
+    for (int i = 0; i < y.total(); i++)
+        if (predictions[0].at<double>(i) != predictions[1].at<double>(i))
+            n_failed += 1;
+    if (fabs(forests[0]->_oob_score - forests[1]->_oob_score) > 1e-12 ||
+        forests[0]->_oob_score <= 0.0)
+        n_failed += 1;
+    if (n_failed != 0)
+        cout << "Wrong" << endl;
+
+    delete forests[0];
+    delete forests[1];
+    return n_failed;
+}
+
+int RandomForestClassification_test(char* splitter_name, QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    int n_threads[] = {1, 4};
+    RandomForestClassifier* forests[2];
+    Mat probas[2];
+    for (int f = 0; f < 2; f++)
+    {
+        forests[f] = new RandomForestClassifier(100, true, true, "Gini", splitter_name,
+                                                0, 2, 1, 0.0, 0, 0, 0);
+        forests[f]->set_n_threads(n_threads[f]);
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (forests[f]->fit(X, y, sample_weight) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        probas[f] = forests[f]->predict_proba(X);
+
+        Mat result = forests[f]->predict(X);
+        int n_correct = 0;
+        for (int i = 0; i < result.total(); i++)
+        {
+            if (result.at<double>(i) == y.at<double>(i))
+                n_correct += 1;
+        }
+        cout << "Threads: " << n_threads[f] << " Accuracy: " << n_correct << "/" << result.total()
+             << " OOB accuracy: " << forests[f]->_oob_score << " " << seconds << "s" << endl;
+    }
+
+    // Better than the majority class out of bag
+    int n_failed = 0;
+    for (int i = 0; i < probas[0].total(); i++)
+        if (probas[0].at<double>(i) != probas[1].at<double>(i))
+            n_failed += 1;
+    if (fabs(forests[0]->_oob_score - forests[1]->_oob_score) > 1e-12 ||
+        forests[0]->_oob_score <= 0.5)
+        n_failed += 1;
+    if (n_failed != 0)
+        cout << "Wrong" << endl;
+
+    delete forests[0];
+    delete forests[1];
+    return n_failed;
+}
+
+int RandomForestMinWeight_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    // Uneven weights: the weight of a bootstrap, thus the min weight of its
+    // leaves, changes from one tree to the next
+    Mat sample_weight(X.rows, 1, CV_64F);
+    for (int i = 0; i < X.rows; i++)
+        sample_weight.at<double>(i) = 1.0 + (i % 5);
+
+    // The trees of a thread share a splitter, every tree keeps its own limit
+    int n_threads[] = {1, 4};
+    RandomForestRegressor* forests[2];
+    Mat predictions[2];
+    int n_failed = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        forests[f] = new RandomForestRegressor(50, true, false, "MSE", "Best",
+                                               0, 2, 1, 0.05, 0, 0, 0);
+        forests[f]->set_n_threads(n_threads[f]);
+        if (forests[f]->fit(X, y, sample_weight) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        predictions[f] = forests[f]->predict(X);
+
+        int n_light_leaves = 0;
+        for (int t = 0; t < forests[f]->_n_estimators; t++)
+        {
+            BaseDecisionTree* tree = forests[f]->_estimators[t];
+            const Node* nodes = tree->_tree->nodes();
+            const NodeStats* stats = tree->_tree->node_stats();
+            for (int i = 0; i < tree->_tree->_node_count; i++)
+                if (nodes[i].left_child == TREE_LEAF &&
+                    stats[i].weighted_n_node_samples < tree->_min_weight_fraction_leaf)
+                    n_light_leaves += 1;
+        }
+        cout << "Threads: " << n_threads[f] << " leaves below the min weight of their tree: "
+             << n_light_leaves << endl;
+        n_failed += n_light_leaves;
+    }
+
+    for (int i = 0; i < y.total(); i++)
+        if (predictions[0].at<double>(i) != predictions[1].at<double>(i))
+            n_failed += 1;
+    if (n_failed != 0)
+        cout << "Wrong" << endl;
+
+    delete forests[0];
+    delete forests[1];
+    return n_failed;
+}
+
+/**
+ * @brief Split a dataset in 3/4 for training and 1/4 for testing
+ */
+static void split_train_test(Mat X, Mat y,
+                             Mat& X_train, Mat& y_train,
+                             Mat& X_test, Mat& y_test)
+{
+    int n_test = (X.rows + 3) / 4;
+    X_train.create(X.rows - n_test, X.cols, CV_64F);
+    y_train.create(X.rows - n_test, 1, CV_64F);
+    X_test.create(n_test, X.cols, CV_64F);
+    y_test.create(n_test, 1, CV_64F);
+    for (int i = 0; i < X.rows; i++)
+    {
+        Mat& X_out = (i % 4 == 0) ? X_test : X_train;
+        Mat& y_out = (i % 4 == 0) ? y_test : y_train;
+        int row = (i % 4 == 0) ? i / 4 : i - i / 4 - 1;
+        for (int j = 0; j < X.cols; j++)
+            X_out.at<double>(row, j) = X.at<double>(i, j);
+        y_out.at<double>(row) = y.at<double>(i);
+    }
+}
+
+int ExtraTreesRegression_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X_train, y_train, X_test, y_test;
+    split_train_test(pMat.first, pMat.second, X_train, y_train, X_test, y_test);
+
+    // Random forest, then extra trees with 1 and 4 threads
+    RandomForestRegressor* forests[3];
+    forests[0] = new RandomForestRegressor(100, true, false, "MSE", "Best",
+                                           0, 2, 1, 0.0, 0, 0, 0);
+    forests[1] = new ExtraTreesRegressor(100, false, false, "MSE",
+                                         0, 2, 1, 0.0, 0, 0, 0);
+    forests[2] = new ExtraTreesRegressor(100, false, false, "MSE",
+                                         0, 2, 1, 0.0, 0, 0, 0);
+    forests[2]->set_n_threads(4);
+
+    char* names[] = {"RandomForest", "ExtraTrees", "ExtraTrees 4 threads"};
+    Mat predictions[3];
+    for (int f = 0; f < 3; f++)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (forests[f]->fit(X_train, y_train, Mat()) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        predictions[f] = forests[f]->predict(X_test);
+
+        double mse = 0.0;
+        for (int i = 0; i < y_test.total(); i++)
+        {
+            double diff = predictions[f].at<double>(i) - y_test.at<double>(i);
+            mse += diff * diff;
+        }
+        cout << names[f] << ": fit " << seconds << "s, test MSE " << mse / y_test.total() << endl;
+    }
+
+    // Without bootstrap the trees only differ by their random streams
+    int n_failed = 0;
+    for (int i = 0; i < y_test.total(); i++)
+        if (predictions[1].at<double>(i) != predictions[2].at<double>(i))
+            n_failed += 1;
+    Mat first = forests[1]->_estimators[0]->predict(X_test);
+    Mat second = forests[1]->_estimators[1]->predict(X_test);
+    int n_different = 0;
+    for (int i = 0; i < y_test.total(); i++)
+        if (first.at<double>(i) != second.at<double>(i))
+            n_different += 1;
+    if (n_different == 0)
+        n_failed += 1;
+    if (n_failed != 0)
+        cout << "Wrong" << endl;
+
+    for (int f = 0; f < 3; f++)
+        delete forests[f];
+    return n_failed;
+}
+
+int ExtraTreesClassification_test(QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X_train, y_train, X_test, y_test;
+    split_train_test(pMat.first, pMat.second, X_train, y_train, X_test, y_test);
+
+    RandomForestClassifier* forests[3];
+    forests[0] = new RandomForestClassifier(100, true, false, "Gini", "Best",
+                                            0, 2, 1, 0.0, 0, 0, 0);
+    forests[1] = new ExtraTreesClassifier(100, false, false, "Gini",
+                                          0, 2, 1, 0.0, 0, 0, 0);
+    forests[2] = new ExtraTreesClassifier(100, false, false, "Gini",
+                                          0, 2, 1, 0.0, 0, 0, 0);
+    forests[2]->set_n_threads(4);
+
+    char* names[] = {"RandomForest", "ExtraTrees", "ExtraTrees 4 threads"};
+    Mat probas[3];
+    for (int f = 0; f < 3; f++)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (forests[f]->fit(X_train, y_train, Mat()) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        probas[f] = forests[f]->predict_proba(X_test);
+
+        Mat result = forests[f]->predict(X_test);
+        int n_correct = 0;
+        for (int i = 0; i < result.total(); i++)
+        {
+            if (result.at<double>(i) == y_test.at<double>(i))
+                n_correct += 1;
+        }
+        cout << names[f] << ": fit " << seconds << "s, test accuracy "
+             << n_correct << "/" << result.total() << endl;
+    }
+
+    int n_failed = 0;
+    for (int i = 0; i < probas[1].total(); i++)
+        if (probas[1].at<double>(i) != probas[2].at<double>(i))
+            n_failed += 1;
+    if (n_failed != 0)
+        cout << "Wrong" << endl;
+
+    for (int f = 0; f < 3; f++)
+        delete forests[f];
+    return n_failed;
+}
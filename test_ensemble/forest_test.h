@@ -0,0 +1,11 @@
+#ifndef FOREST_TEST_H
+#define FOREST_TEST_H
+#include <QtCore>
+
+int RandomForestRegression_test(char* splitter_name, QString);
+int RandomForestClassification_test(char* splitter_name, QString);
+int RandomForestMinWeight_test(QString);
+int ExtraTreesRegression_test(QString);
+int ExtraTreesClassification_test(QString);
+
+#endif // FOREST_TEST_H
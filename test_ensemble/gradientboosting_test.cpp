@@ -0,0 +1,381 @@
+#include "gradientboosting_test.h"
+#include <utility>
+#include <ctime>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "gradientboosting.h"
+#include "tree.h"
+#include "basetree.h"
+#include "quickscorer.h"
+#include "codegen.h"
+#include "codegen_test.h"
+#include "criterion.h"
+#include "tools.h"
+using std::pair;
+using std::vector;
+using std::string;
+using cv::Mat;
+
+int GradientBoostingRegression_test(char* splitter_name, QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    GradientBoostingRegressor r("ls", 0.1, 100, 0.8, "FriedmanMSE", splitter_name,
+                                3, 2, 1, 0.0, 0, 0, 0);
+    if (r.fit(X, y, sample_weight) != 0)
+    {
+        cout << "Fit failed" << endl;
+        return 1;
+    }
+
+    // The training loss must go down with the stages
+    vector<Mat> staged = r.staged_predict(X);
+    double mse;
+    for (int stage = 0; stage < staged.size(); stage += 10)
+    {
+        mse = 0.0;
+        for (int i = 0; i < y.total(); i++)
+        {
+            double diff = staged[stage].at<double>(i) - y.at<double>(i);
+            mse += diff * diff;
+        }
+        cout << "Stage " << stage << " MSE: " << mse / y.total()
+             << " train_score: " << r._train_score[stage] << endl;
+    }
+
+    if (r._train_score.back() >= r._train_score.front())
+    {
+        cout << "Wrong" << endl;
+        return 1;
+    }
+
+    // Stumps on one drawn feature: every stage draws its own
+    GradientBoostingRegressor stumps("ls", 0.1, 50, 1.0, "FriedmanMSE", splitter_name,
+                                     1, 2, 1, 0.0, 1, 0, 0);
+    if (stumps.fit(X, y, sample_weight) != 0)
+    {
+        cout << "Fit failed" << endl;
+        return 1;
+    }
+    vector<bool> is_root_feature(X.cols, false);
+    int n_root_features = 0;
+    for (size_t t = 0; t < stumps._estimators.size(); t++)
+    {
+        int feature = stumps._estimators[t]->_tree->nodes()[0].feature;
+        if (feature >= 0 && !is_root_feature[feature])
+        {
+            is_root_feature[feature] = true;
+            n_root_features += 1;
+        }
+    }
+    cout << "Features split by " << stumps._estimators.size() << " stumps: " << n_root_features << endl;
+    if (n_root_features < 2)
+    {
+        cout << "Wrong" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int GradientBoostingClassification_test(char* splitter_name, QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    GradientBoostingClassifier c("deviance", 0.1, 100, 1.0, "FriedmanMSE", splitter_name,
+                                 3, 2, 1, 0.0, 0, 0, 0);
+    if (c.fit(X, y, sample_weight) != 0)
+    {
+        cout << "Fit failed" << endl;
+        return 1;
+    }
+
+    Mat result = c.predict(X);
+    int n_correct = 0;
+    for (int i = 0; i < result.total(); i++)
+    {
+        if (result.at<double>(i) == y.at<double>(i))
+            n_correct += 1;
+    }
+    cout << "Accuracy: " << n_correct << "/" << result.total()
+         << " deviance: " << c._train_score.front()
+         << " -> " << c._train_score.back() << endl;
+
+    if (c._train_score.back() >= c._train_score.front())
+    {
+        cout << "Wrong" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int GradientBoostingGOSS_test(char* splitter_name)
+{
+    // A synthetic training set large enough for the stages to cost, and a
+    // validation set drawn from the same function
+    const int n_train = 20000;
+    const int n_valid = 5000;
+    const int n_features = 20;
+    Mat X_train(n_train, n_features, CV_64F);
+    Mat y_train(n_train, 1, CV_64F);
+    Mat X_valid(n_valid, n_features, CV_64F);
+    Mat y_valid(n_valid, 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_train + n_valid; i++)
+    {
+        Mat& X = (i < n_train) ? X_train : X_valid;
+        Mat& y = (i < n_train) ? y_train : y_valid;
+        int row = (i < n_train) ? i : i - n_train;
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(row, j) = rand() / (double)RAND_MAX;
+        y.at<double>(row) = 10.0 * sin(3.0 * X.at<double>(row, 0)) * X.at<double>(row, 1)
+                            + 5.0 * X.at<double>(row, 2) * X.at<double>(row, 2)
+                            + (X.at<double>(row, 3) > 0.5 ? 3.0 : 0.0)
+                            + rand() / (double)RAND_MAX;
+    }
+    Mat sample_weight = Mat::ones(n_train, 1, CV_64F);
+
+    // Full rounds, uniform subsampling, then GOSS
+    const int n_configs = 4;
+    char* names[] = {"full", "subsample 0.2", "GOSS 0.1 + 0.1", "GOSS 0.2 + 0.1"};
+    double subsample[] = {1.0, 0.2, 1.0, 1.0};
+    double top_rate[] = {0.0, 0.0, 0.1, 0.2};
+    double other_rate[] = {0.0, 0.0, 0.1, 0.1};
+    double valid_loss[n_configs];
+    double fit_time[n_configs];
+
+    for (int c = 0; c < n_configs; c++)
+    {
+        GradientBoostingRegressor r("ls", 0.1, 100, subsample[c], "FriedmanMSE", splitter_name,
+                                    3, 2, 1, 0.0, 0, 0, 0);
+        r.set_goss(top_rate[c], other_rate[c]);
+
+        // Wall time of the fit, the speedup is over the full rounds
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (r.fit(X_train, y_train, sample_weight) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        fit_time[c] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        vector<Mat> staged = r.staged_predict(X_valid);
+        cout << splitter_name << " " << names[c] << ": fit " << fit_time[c] << "s, speedup "
+             << fit_time[0] / fit_time[c] << ", validation MSE";
+        for (int stage = 24; stage < staged.size(); stage += 25)
+        {
+            valid_loss[c] = 0.0;
+            for (int i = 0; i < n_valid; i++)
+            {
+                double diff = staged[stage].at<double>(i) - y_valid.at<double>(i);
+                valid_loss[c] += diff * diff;
+            }
+            valid_loss[c] /= n_valid;
+            cout << " " << stage + 1 << ": " << valid_loss[c];
+        }
+        cout << endl;
+    }
+
+    // GOSS must stay close to the full rounds
+    for (int c = 2; c < n_configs; c++)
+    {
+        if (valid_loss[c] > 1.1 * valid_loss[0])
+        {
+            cout << "Wrong" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int GradientBoostingNewton_test(char* splitter_name, QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(X.rows, 1, CV_64F);
+
+    // Trees fitted on the gradients then Newton leaves, against trees
+    // fitted on the gradients and the hessians: stages to reach a deviance
+    const double target_loss = 0.2;
+    char* criteria[] = {"FriedmanMSE", "Newton"};
+    int n_stages[2];
+    for (int c = 0; c < 2; c++)
+    {
+        GradientBoostingClassifier gb("deviance", 0.1, 100, 1.0, criteria[c], splitter_name,
+                                      3, 2, 1, 0.0, 0, 0, 0);
+        gb.set_regularization(0.0, NEWTON_MIN_CHILD_HESSIAN);
+
+        clock_t begin = clock();
+        if (gb.fit(X, y, sample_weight) != 0)
+        {
+            cout << "Fit failed" << endl;
+            return 1;
+        }
+        double fit_time = double(clock() - begin) / CLOCKS_PER_SEC;
+
+        Mat result = gb.predict(X);
+        int n_correct = 0;
+        for (int i = 0; i < result.total(); i++)
+        {
+            if (result.at<double>(i) == y.at<double>(i))
+                n_correct += 1;
+        }
+        cout << splitter_name << " " << criteria[c] << ": fit " << fit_time << "s, accuracy "
+             << n_correct << "/" << result.total() << ", deviance";
+        for (int stage = 0; stage < gb._train_score.size(); stage += 20)
+            cout << " " << stage + 1 << ": " << gb._train_score[stage];
+        cout << " " << gb._train_score.size() << ": " << gb._train_score.back();
+
+        n_stages[c] = gb._train_score.size() + 1;
+        for (int stage = gb._train_score.size() - 1; stage >= 0; stage--)
+            if (gb._train_score[stage] <= target_loss)
+                n_stages[c] = stage + 1;
+        cout << ", " << n_stages[c] << " stages to " << target_loss << endl;
+
+        if (gb._train_score.back() >= gb._train_score.front())
+        {
+            cout << "Wrong" << endl;
+            return 1;
+        }
+    }
+
+    // No gain on these small sets: the second order splits reach the
+    // deviance in as many stages, up to 10%
+    if (fabs(n_stages[1] - n_stages[0]) > 0.1 * n_stages[0])
+    {
+        cout << "Wrong" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int QuickScorer_test(QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    GradientBoostingClassifier c("deviance", 0.1, 100, 1.0, "FriedmanMSE", "Best",
+                                 3, 2, 1, 0.0, 0, 0, 0);
+    if (c.fit(X, y, sample_weight) != 0)
+    {
+        cout << "Fit failed" << endl;
+        return 1;
+    }
+
+    // Same leaves as walking down every tree
+    Mat leaves = c._scorer->apply(X);
+    for (size_t t = 0; t < c._estimators.size(); t++)
+    {
+        Mat tree_leaves = c._estimators[t]->_tree->apply(X);
+        for (int i = 0; i < X.rows; i++)
+        {
+            if (leaves.at<int>(i, t) != tree_leaves.at<int>(i, 0))
+            {
+                cout << "Wrong leaf" << " " << t << " " << i << endl;
+                return 1;
+            }
+        }
+    }
+
+    // A NaN goes right at every node, as in Tree::apply
+    Mat X_nan = X.clone();
+    for (int i = 0; i < X_nan.rows; i += 3)
+        X_nan.at<double>(i, i % X_nan.cols) = NAN;
+    leaves = c._scorer->apply(X_nan);
+    for (size_t t = 0; t < c._estimators.size(); t++)
+    {
+        Mat tree_leaves = c._estimators[t]->_tree->apply(X_nan);
+        for (int i = 0; i < X_nan.rows; i++)
+        {
+            if (leaves.at<int>(i, t) != tree_leaves.at<int>(i, 0))
+            {
+                cout << "Wrong NaN leaf" << " " << t << " " << i << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Same sums as the node by node path
+    clock_t begin = clock();
+    Mat sequential = c.staged_decision_function(X).back();
+    double sequential_seconds = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+    begin = clock();
+    Mat quickscorer = c.decision_function(X);
+    double quickscorer_seconds = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+
+    cout << "Trees: " << c._estimators.size()
+         << " node by node: " << sequential_seconds << "s"
+         << " QuickScorer: " << quickscorer_seconds << "s" << endl;
+
+    for (int i = 0; i < sequential.total(); i++)
+    {
+        if (quickscorer.at<double>(i) != sequential.at<double>(i))
+        {
+            cout << "Wrong" << " " << quickscorer.at<double>(i) << " " << sequential.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int GradientBoostingCodeGen_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    GradientBoostingRegressor r("ls", 0.1, 100, 0.8, "FriedmanMSE", "Best",
+                                3, 2, 1, 0.0, 0, 0, 0);
+    if (r.fit(X, y, sample_weight) != 0)
+    {
+        cout << "Fit failed" << endl;
+        return 1;
+    }
+
+    vector<Tree*> trees;
+    for (size_t t = 0; t < r._estimators.size(); t++)
+        trees.push_back(r._estimators[t]->_tree);
+    vector<double> weights(trees.size(), r._learning_rate);
+    string source = generate_ensemble_source(trees, weights, r._init.at<double>(0, 0), "gbrt");
+
+    GeneratedPredict predict;
+    GeneratedPredictBatch predict_batch;
+    if (load_generated_source(source, "gbrt", &predict, &predict_batch) != 0)
+        return 1;
+
+    Mat expected = r.predict(X);
+    Mat batch(X.rows, 1, CV_64F);
+    predict_batch(X.ptr<double>(0), X.rows, batch.ptr<double>(0));
+    for (int i = 0; i < X.rows; i++)
+    {
+        if (predict(X.ptr<double>(i)) != expected.at<double>(i) ||
+            batch.at<double>(i) != expected.at<double>(i))
+        {
+            cout << "Wrong" << " " << predict(X.ptr<double>(i)) << " " << expected.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    cout << "Generated " << trees.size() << " trees: OK" << endl;
+    return 0;
+}
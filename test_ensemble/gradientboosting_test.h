@@ -0,0 +1,12 @@
+#ifndef GRADIENTBOOSTING_TEST_H
+#define GRADIENTBOOSTING_TEST_H
+#include <QtCore>
+
+int GradientBoostingRegression_test(char* splitter_name, QString);
+int GradientBoostingClassification_test(char* splitter_name, QString);
+int GradientBoostingGOSS_test(char* splitter_name);
+int GradientBoostingNewton_test(char* splitter_name, QString);
+int QuickScorer_test(QString);
+int GradientBoostingCodeGen_test(QString);
+
+#endif // GRADIENTBOOSTING_TEST_H
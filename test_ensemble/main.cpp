@@ -0,0 +1,30 @@
+#include <opencv2/opencv.hpp>
+#include <QtCore>
+#include "gradientboosting_test.h"
+#include "forest_test.h"
+
+int main()
+{
+    // GradientBoosting_test
+    GradientBoostingRegression_test("Best", "test1.txt");
+    GradientBoostingRegression_test("Histogram", "test2.txt");
+    GradientBoostingClassification_test("Best", "test3.txt");
+    GradientBoostingClassification_test("Histogram", "test4.txt");
+    GradientBoostingGOSS_test("Best");
+    GradientBoostingGOSS_test("Histogram");
+    GradientBoostingNewton_test("Best", "test3.txt");
+    GradientBoostingNewton_test("Histogram", "test4.txt");
+
+    // Forest_test
+    RandomForestRegression_test("Best", "test1.txt");
+    RandomForestClassification_test("Best", "test3.txt");
+    RandomForestMinWeight_test("test1.txt");
+    ExtraTreesRegression_test("test1.txt");
+    ExtraTreesClassification_test("test3.txt");
+
+    // QuickScorer_test
+    QuickScorer_test("test3.txt");
+
+    // CodeGen_test
+    GradientBoostingCodeGen_test("test1.txt");
+}
@@ -0,0 +1,59 @@
+TEMPLATE = app
+CONFIG += console debug
+CONFIG -= app_bundle
+#CONFIG -= qt
+CONFIG += c++11
+
+INCLUDEPATH += ../tree
+INCLUDEPATH += ../ensemble
+INCLUDEPATH += ../test_tree
+
+HEADERS += gradientboosting_test.h \
+           forest_test.h \
+           ../test_tree/tools.h \
+           ../test_tree/codegen_test.h \
+           ../tree/criterion.h \
+           ../tree/splitter.h \
+           ../tree/basetree.h \
+           ../tree/tree.h \
+           ../tree/treebuilder.h \
+           ../tree/util.h \
+           ../tree/binmapper.h \
+           ../tree/quickscorer.h \
+           ../tree/codegen.h \
+           ../tree/dataset.h \
+           ../tree/argsort.h \
+           ../tree/simd.h \
+           ../tree/threadpool.h \
+           ../tree/random.h \
+           ../ensemble/gradientboosting.h \
+           ../ensemble/forest.h
+
+SOURCES += main.cpp \
+           gradientboosting_test.cpp \
+           forest_test.cpp \
+           ../test_tree/tools.cpp \
+           ../test_tree/codegen_test.cpp \
+           ../tree/criterion.cpp \
+           ../tree/splitter.cpp \
+           ../tree/basetree.cpp \
+           ../tree/tree.cpp \
+           ../tree/treebuilder.cpp \
+           ../tree/util.cpp \
+           ../tree/binmapper.cpp \
+           ../tree/quickscorer.cpp \
+           ../tree/codegen.cpp \
+           ../tree/dataset.cpp \
+           ../tree/argsort.cpp \
+           ../tree/simd.cpp \
+           ../tree/threadpool.cpp \
+           ../tree/random.cpp \
+           ../ensemble/gradientboosting.cpp \
+           ../ensemble/forest.cpp
+
+LIBS += -L/usr/local/lib
+LIBS += -lopencv_core
+LIBS += -lpthread
+LIBS += -ldl
+
+TARGET = test_ensemble
@@ -0,0 +1,146 @@
+#include "codegen_test.h"
+#include <QtCore>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <dlfcn.h>
+#include <opencv2/opencv.hpp>
+#include "tree.h"
+#include "basetree.h"
+#include "codegen.h"
+#include "tools.h"
+using std::pair;
+using std::string;
+using cv::Mat;
+
+int load_generated_source(const string& source,
+                          const string& name,
+                          GeneratedPredict* predict,
+                          GeneratedPredictBatch* predict_batch)
+{
+    // dlopen returns the already loaded library for a known path, every
+    // call gets its own file
+    static int n_loaded = 0;
+    std::ostringstream stem;
+    stem << "codegen_" << name << "_" << n_loaded++;
+    string source_file = stem.str() + ".cpp";
+    string library_file = "./" + stem.str() + ".so";
+
+    std::ofstream out(source_file.c_str());
+    out << source;
+    out.close();
+
+    string command = "g++ -O2 -shared -fPIC -o " + library_file + " " + source_file;
+    if (system(command.c_str()) != 0)
+    {
+        cout << "Compilation failed: " << command << endl;
+        return 1;
+    }
+
+    void* library = dlopen(library_file.c_str(), RTLD_NOW);
+    if (library == NULL)
+    {
+        cout << dlerror() << endl;
+        return 2;
+    }
+    *predict = reinterpret_cast<GeneratedPredict>(dlsym(library, name.c_str()));
+    *predict_batch = reinterpret_cast<GeneratedPredictBatch>(dlsym(library, (name + "_batch").c_str()));
+    if (*predict == NULL || *predict_batch == NULL)
+        return 3;
+    return 0;
+}
+
+/**
+ * @brief Equal predictions, NaN included
+ */
+static bool same_prediction(double a, double b)
+{
+    return a == b || (a != a && b != b);
+}
+
+/**
+ * @brief Check the generated code of the tree against Tree::predict on X.
+ */
+static int check_generated_tree(Tree* tree, Mat X, const string& name)
+{
+    GeneratedPredict predict;
+    GeneratedPredictBatch predict_batch;
+    if (load_generated_source(generate_tree_source(tree, name), name,
+                              &predict, &predict_batch) != 0)
+        return 1;
+
+    Mat expected = tree->predict(X);
+    Mat batch(X.rows, 1, CV_64F);
+    predict_batch(X.ptr<double>(0), X.rows, batch.ptr<double>(0));
+
+    for (int i = 0; i < X.rows; i++)
+    {
+        if (!same_prediction(predict(X.ptr<double>(i)), expected.at<double>(i)) ||
+            !same_prediction(batch.at<double>(i), expected.at<double>(i)))
+        {
+            cout << "Wrong" << " " << i << " " << predict(X.ptr<double>(i))
+                 << " " << expected.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    cout << name << ": " << tree->_node_count << " nodes, "
+         << X.rows << " samples OK" << endl;
+    return 0;
+}
+
+int TreeCodeGen_classification_test(QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    DecisionTreeClassifier dtc("Gini", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    dtc.fit(X, y, sample_weight);
+    return check_generated_tree(dtc._tree, X, "classification_tree");
+}
+
+int TreeCodeGen_regression_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    DecisionTreeRegressor dtr("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    dtr.fit(X, y, sample_weight);
+    if (check_generated_tree(dtr._tree, X, "regression_tree") != 0)
+        return 1;
+
+    // Infinite and NaN thresholds and values must compile too
+    Tree* tree = dtr._tree;
+    int n_leaves = 0;
+    int n_internal = 0;
+    for (int node_id = 0; node_id < tree->_node_count; node_id++)
+    {
+        Node& node = tree->_node_data[node_id];
+        if (node.left_child == TREE_LEAF)
+        {
+            double special[] = {INFINITY, -INFINITY, NAN};
+            if (n_leaves < 3)
+                tree->value(node_id)[0] = special[n_leaves];
+            n_leaves += 1;
+        }
+        else
+        {
+            double special[] = {INFINITY, -INFINITY};
+            if (n_internal > 0 && n_internal < 3)
+                node.threshold = special[n_internal - 1];
+            n_internal += 1;
+        }
+    }
+    return check_generated_tree(tree, X, "special_tree");
+}
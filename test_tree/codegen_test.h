@@ -0,0 +1,22 @@
+#ifndef CODEGEN_TEST_H
+#define CODEGEN_TEST_H
+#include <QtCore>
+#include <string>
+
+typedef double (*GeneratedPredict)(const double* x);
+typedef void (*GeneratedPredictBatch)(const double* X, int n_samples, double* out);
+
+/**
+ * @brief Compile generated source into a shared library with g++ and load
+ * its `name` and `name_batch` functions.
+ * @return 0 if both functions were loaded
+ */
+int load_generated_source(const std::string& source,
+                          const std::string& name,
+                          GeneratedPredict* predict,
+                          GeneratedPredictBatch* predict_batch);
+
+int TreeCodeGen_classification_test(QString);
+int TreeCodeGen_regression_test(QString);
+
+#endif // CODEGEN_TEST_H
@@ -1,10 +1,15 @@
 #include "criterion_test.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <vector>
 #include <utility>
 #include <iostream>
+#include <cmath>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 #include "criterion.h"
+#include "splitter.h"
+#include "simd.h"
 using namespace cv;
 using namespace std;
 
@@ -144,3 +149,367 @@ int FriedmanMSE_test()
     }
     return 0;
 }
+
+/**
+ * @brief children_impurity of Gini before the kernels, the benchmark reference
+ */
+static pair<double, double> gini_children_reference(ClassificationCriterion& c)
+{
+    double gini_left = 0.0;
+    double gini_right = 0.0;
+    double tmp = 0.0;
+    for (int i = 0; i < c.n_classes; i++)
+    {
+        tmp = c.label_count_left.at(i);
+        gini_left += tmp * tmp;
+        tmp = c.label_count_right.at(i);
+        gini_right += tmp * tmp;
+    }
+    gini_left = 1.0 - gini_left / (c.weighted_n_left * c.weighted_n_left);
+    gini_right = 1.0 - gini_right / (c.weighted_n_right * c.weighted_n_right);
+    return make_pair(gini_left, gini_right);
+}
+
+/**
+ * @brief children_impurity of Entropy before the kernels, the benchmark reference
+ */
+static pair<double, double> entropy_children_reference(ClassificationCriterion& c)
+{
+    double entropy_left = 0.0;
+    double entropy_right = 0.0;
+    double tmp = 0.0;
+    for (int i = 0; i < c.n_classes; i++)
+    {
+        tmp = c.label_count_left.at(i);
+        if (tmp > 0.0)
+        {
+            tmp /= c.weighted_n_left;
+            entropy_left -= tmp * log(tmp);
+        }
+        tmp = c.label_count_right.at(i);
+        if (tmp > 0.0)
+        {
+            tmp /= c.weighted_n_right;
+            entropy_right -= tmp * log(tmp);
+        }
+    }
+    return make_pair(entropy_left, entropy_right);
+}
+
+static bool close_to(double a, double b)
+{
+    return fabs(a - b) <= 1e-12 * std::max(1.0, fabs(b));
+}
+
+int ImpurityKernels_test()
+{
+    int n_failed = 0;
+    int lengths[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 50, 500};
+    vector<double> counts;
+
+    // Every instruction set gives the scalar results, up to the summation order
+    for (int level = SIMD_SCALAR; level <= simd_supported(); level++)
+    {
+        set_simd_level(static_cast<SimdLevel>(level));
+        for (int l = 0; l < 13; l++)
+        {
+            int n = lengths[l];
+            counts.resize(n);
+            double total = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                // Some empty classes, and counts over several binades
+                counts[i] = (i % 3 == 1) ? 0.0 : ldexp(1.0 + (i * 7919 % 1000) / 1000.0, i % 20 - 5);
+                total += counts[i];
+            }
+
+            double squares = 0.0;
+            double entropy = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                squares += counts[i] * counts[i];
+                if (counts[i] > 0.0)
+                    entropy -= counts[i] / total * log(counts[i] / total);
+            }
+            if (!close_to(sum_of_squares(&counts[0], n), squares) ||
+                !close_to(entropy_sum(&counts[0], n, total), entropy))
+            {
+                cout << simd_name(simd_level()) << ": wrong kernel for " << n << " classes: "
+                     << sum_of_squares(&counts[0], n) << " " << squares << " "
+                     << entropy_sum(&counts[0], n, total) << " " << entropy << endl;
+                n_failed += 1;
+            }
+        }
+    }
+
+    // Time children_impurity at a split in the middle of the node
+    int class_counts[] = {2, 50, 500};
+    const int n_calls = 200000;
+    for (int c = 0; c < 3; c++)
+    {
+        int n_classes = class_counts[c];
+        int n_samples = 4 * n_classes;
+        Mat y(n_samples, 1, CV_64F);
+        vector<int> samples(n_samples);
+        for (int i = 0; i < n_samples; i++)
+        {
+            y.at<double>(i) = (i * 7) % n_classes;
+            samples[i] = i;
+        }
+        Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+
+        Gini gini;
+        Entropy entropy;
+        gini.init(y, sample_weight, n_samples, samples, 0, n_samples);
+        entropy.init(y, sample_weight, n_samples, samples, 0, n_samples);
+        gini.update(n_samples / 3);
+        entropy.update(n_samples / 3);
+
+        cout << n_classes << " classes, ns per children_impurity:" << endl;
+        volatile double sink = 0.0;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (int k = 0; k < n_calls; k++)
+        {
+            pair<double, double> impurities = gini_children_reference(gini);
+            sink = impurities.first + impurities.second;
+        }
+        double gini_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        begin = std::chrono::steady_clock::now();
+        for (int k = 0; k < n_calls; k++)
+        {
+            pair<double, double> impurities = entropy_children_reference(entropy);
+            sink = impurities.first + impurities.second;
+        }
+        double entropy_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        cout << "    reference: Gini " << gini_time * 1e9 / n_calls
+             << ", Entropy " << entropy_time * 1e9 / n_calls << endl;
+
+        for (int level = SIMD_SCALAR; level <= simd_supported(); level++)
+        {
+            set_simd_level(static_cast<SimdLevel>(level));
+            begin = std::chrono::steady_clock::now();
+            for (int k = 0; k < n_calls; k++)
+            {
+                pair<double, double> impurities = gini.children_impurity();
+                sink = impurities.first + impurities.second;
+            }
+            gini_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            begin = std::chrono::steady_clock::now();
+            for (int k = 0; k < n_calls; k++)
+            {
+                pair<double, double> impurities = entropy.children_impurity();
+                sink = impurities.first + impurities.second;
+            }
+            entropy_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            cout << "    " << simd_name(simd_level()) << ": Gini " << gini_time * 1e9 / n_calls
+                 << ", Entropy " << entropy_time * 1e9 / n_calls << endl;
+        }
+    }
+
+    set_simd_level(simd_supported());
+    return n_failed;
+}
+
+/**
+ * @brief Scan every position of a node with criterion c and compare the
+ * ranking of proxy_impurity_improvement with the one of impurity_improvement.
+ */
+static int check_proxy_ranking(const char* name, Criterion& c, int n_samples)
+{
+    double impurity = c.node_impurity();
+    vector<double> exact, proxy;
+
+    c.reset();
+    for (int pos = 1; pos < n_samples; pos++)
+    {
+        c.update(pos);
+        exact.push_back(c.impurity_improvement(impurity));
+        proxy.push_back(c.proxy_impurity_improvement());
+    }
+
+    int n_failed = 0;
+    int best_exact = 0;
+    int best_proxy = 0;
+    for (size_t i = 0; i < exact.size(); i++)
+    {
+        if (exact[i] > exact[best_exact])
+            best_exact = i;
+        if (proxy[i] > proxy[best_proxy])
+            best_proxy = i;
+
+        // Same order of the positions, except for near ties
+        for (size_t j = 0; j < i; j++)
+            if (fabs(exact[i] - exact[j]) > 1e-9 * std::max(1.0, fabs(exact[i])) &&
+                (exact[i] > exact[j]) != (proxy[i] > proxy[j]))
+                n_failed += 1;
+    }
+
+    cout << name << ": best position " << best_exact + 1 << " (exact) "
+         << best_proxy + 1 << " (proxy), improvement " << exact[best_exact]
+         << ", " << n_failed << " misordered pairs" << endl;
+    return n_failed;
+}
+
+int ProxyImprovement_test()
+{
+    const int n_samples = 200;
+    Mat y_class(n_samples, 1, CV_64F);
+    Mat y_reg(n_samples, 1, CV_64F);
+    Mat sample_weight(n_samples, 1, CV_64F);
+    vector<int> samples(n_samples);
+
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        // Labels and targets drifting along the samples, so that the best
+        // split is somewhere inside the node
+        y_class.at<double>(i) = (rand() % 4 + i / 50) % 5;
+        y_reg.at<double>(i) = i / 40.0 + rand() / (double)RAND_MAX;
+        sample_weight.at<double>(i) = 0.5 + rand() / (double)RAND_MAX;
+        samples[i] = i;
+    }
+    double weighted_n_samples = sum(sample_weight)[0];
+
+    Gini gini;
+    Entropy entropy;
+    MSE mse;
+    FriedmanMSE friedman_mse;
+    gini.init(y_class, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    entropy.init(y_class, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    mse.init(y_reg, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    friedman_mse.init(y_reg, sample_weight, weighted_n_samples, samples, 0, n_samples);
+
+    int n_failed = 0;
+    n_failed += check_proxy_ranking("Gini", gini, n_samples);
+    n_failed += check_proxy_ranking("Entropy", entropy, n_samples);
+    n_failed += check_proxy_ranking("MSE", mse, n_samples);
+    n_failed += check_proxy_ranking("FriedmanMSE", friedman_mse, n_samples);
+    return n_failed;
+}
+
+int NewtonCriterion_test()
+{
+    const int n_samples = 200;
+    Mat y_reg(n_samples, 1, CV_64F);
+    Mat y_unit(n_samples, 2, CV_64F);
+    Mat y_newton(n_samples, 2, CV_64F);
+    Mat sample_weight(n_samples, 1, CV_64F);
+    vector<int> samples(n_samples);
+
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        y_reg.at<double>(i) = i / 40.0 + rand() / (double)RAND_MAX;
+        y_unit.at<double>(i, 0) = y_reg.at<double>(i);
+        y_unit.at<double>(i, 1) = 1.0;
+        // Gradients and hessians of the binomial deviance
+        double p = 0.05 + 0.9 * rand() / (double)RAND_MAX;
+        y_newton.at<double>(i, 0) = (i < n_samples / 3 ? 1.0 : 0.0) - p;
+        y_newton.at<double>(i, 1) = p * (1.0 - p);
+        sample_weight.at<double>(i) = 0.5 + rand() / (double)RAND_MAX;
+        samples[i] = i;
+    }
+    double weighted_n_samples = sum(sample_weight)[0];
+
+    int n_failed = 0;
+
+    // With unit hessians and no regularization, half of MSE on the gradients
+    MSE mse;
+    NewtonCriterion unit(0.0, 0.0);
+    mse.init(y_reg, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    unit.init(y_unit, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    if (!close_to(unit.node_value()[0], mse.node_value()[0]) ||
+        fabs(2.0 * unit.node_impurity() - mse.node_impurity()) > 1e-9)
+    {
+        cout << "Wrong unit hessian node: " << unit.node_value()[0] << " " << mse.node_value()[0]
+             << ", " << unit.node_impurity() << " " << mse.node_impurity() << endl;
+        n_failed += 1;
+    }
+    for (int pos = 1; pos < n_samples; pos += 37)
+    {
+        mse.update(pos);
+        unit.update(pos);
+        double mse_improvement = mse.impurity_improvement(mse.node_impurity());
+        double unit_improvement = 2.0 * unit.impurity_improvement(unit.node_impurity());
+        if (fabs(mse_improvement - unit_improvement) > 1e-9)
+        {
+            cout << "Wrong unit hessian improvement at " << pos << ": "
+                 << unit_improvement << " " << mse_improvement << endl;
+            n_failed += 1;
+        }
+    }
+
+    NewtonCriterion newton;
+    newton.init(y_newton, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    n_failed += check_proxy_ranking("Newton", newton, n_samples);
+
+    // The leaf value is the regularized Newton step
+    double G = 0.0, H = 0.0;
+    for (int i = 0; i < n_samples; i++)
+    {
+        G += sample_weight.at<double>(i) * y_newton.at<double>(i, 0);
+        H += sample_weight.at<double>(i) * y_newton.at<double>(i, 1);
+    }
+    if (!close_to(newton.node_value()[0], G / (H + NEWTON_L2_REGULARIZATION)))
+    {
+        cout << "Wrong Newton step: " << newton.node_value()[0] << " "
+             << G / (H + NEWTON_L2_REGULARIZATION) << endl;
+        n_failed += 1;
+    }
+
+    // A split is rejected for a small child hessian or a non positive gain
+    NewtonCriterion strict(NEWTON_L2_REGULARIZATION, 1.0);
+    strict.init(y_newton, sample_weight, weighted_n_samples, samples, 0, n_samples);
+    strict.update(1);
+    if (!strict.rejects_split(strict.proxy_impurity_improvement()))
+    {
+        cout << "Wrong: child hessian " << strict.hessian_left << " not rejected" << endl;
+        n_failed += 1;
+    }
+    strict.update(n_samples / 3);
+    if (strict.rejects_split(strict.proxy_impurity_improvement()))
+    {
+        cout << "Wrong: split of gain " << strict.proxy_impurity_improvement() << " rejected" << endl;
+        n_failed += 1;
+    }
+
+    // Constant gradients: lambda makes the gain of any split negative
+    Mat y_flat(n_samples, 2, CV_64F);
+    Mat unit_weight = Mat::ones(n_samples, 1, CV_64F);
+    for (int i = 0; i < n_samples; i++)
+    {
+        y_flat.at<double>(i, 0) = 0.01;
+        y_flat.at<double>(i, 1) = 0.25;
+    }
+    NewtonCriterion regularized(NEWTON_L2_REGULARIZATION, 0.0);
+    regularized.init(y_flat, unit_weight, n_samples, samples, 0, n_samples);
+    regularized.update(n_samples / 2);
+    if (!regularized.rejects_split(regularized.proxy_impurity_improvement()))
+    {
+        cout << "Wrong: split of gain " << regularized.proxy_impurity_improvement() << " not rejected" << endl;
+        n_failed += 1;
+    }
+
+    // A splitter takes a target of as many columns as its criterion
+    Mat X(n_samples, 3, CV_64F);
+    for (int i = 0; i < n_samples; i++)
+        for (int j = 0; j < 3; j++)
+            X.at<double>(i, j) = rand() / (double)RAND_MAX;
+    MSE mse_target;
+    NewtonCriterion newton_target;
+    BestSplitter mse_splitter(&mse_target, 3, 1, 0.0, 0);
+    BestSplitter newton_splitter(&newton_target, 3, 1, 0.0, 0);
+    int error_codes[4] = {mse_splitter.init(X, y_reg, sample_weight),
+                          mse_splitter.init(X, y_newton, sample_weight),
+                          newton_splitter.init(X, y_newton, sample_weight),
+                          newton_splitter.init(X, y_reg, sample_weight)};
+    if (error_codes[0] != 0 || error_codes[1] != 2 || error_codes[2] != 0 || error_codes[3] != 2)
+    {
+        cout << "Wrong target check: " << error_codes[0] << " " << error_codes[1] << " "
+             << error_codes[2] << " " << error_codes[3] << endl;
+        n_failed += 1;
+    }
+
+    cout << "NewtonCriterion: " << n_failed << " failed" << endl;
+    return n_failed;
+}
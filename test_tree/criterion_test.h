@@ -5,5 +5,8 @@ int Gini_test();
 int Entropy_test();
 int MSE_test();
 int FriedmanMSE_test();
+int ImpurityKernels_test();
+int ProxyImprovement_test();
+int NewtonCriterion_test();
 
 #endif // CRITERION_TEST_H
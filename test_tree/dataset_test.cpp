@@ -0,0 +1,215 @@
+#include "dataset_test.h"
+#include <QtCore>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+#include "dataset.h"
+#include "tree.h"
+#include "basetree.h"
+#include "tools.h"
+using std::string;
+using std::vector;
+using cv::Mat;
+
+/**
+ * @brief Compare a loaded dataset value by value with copies of the
+ * reference one
+ */
+static int compare_datasets(Mat X, Mat y, Mat X_ref, Mat y_ref)
+{
+    if (X.rows % X_ref.rows != 0 || X.cols != X_ref.cols || y.rows != X.rows)
+    {
+        cout << "Wrong shape" << " " << X.rows << "x" << X.cols << endl;
+        return 1;
+    }
+    for (int i = 0; i < X.rows; i++)
+    {
+        int r = i % X_ref.rows;
+        if (y.at<double>(i) != y_ref.at<double>(r))
+        {
+            cout << "Wrong target" << " " << i << endl;
+            return 1;
+        }
+        for (int j = 0; j < X.cols; j++)
+        {
+            if (X.at<double>(i, j) != X_ref.at<double>(r, j))
+            {
+                cout << "Wrong" << " " << i << " " << j << " " << X.at<double>(i, j)
+                     << " " << X_ref.at<double>(r, j) << endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int Dataset_test(QString filename)
+{
+    string fn = QString("../test_data/Regression/").append(filename).toStdString();
+
+    // Reference: every value parsed by the standard library
+    std::ifstream in(fn.c_str());
+    string line;
+    vector<vector<double> > rows;
+    while (std::getline(in, line))
+    {
+        std::istringstream values(line);
+        vector<double> row;
+        double value;
+        while (values >> value)
+            row.push_back(value);
+        rows.push_back(row);
+    }
+    in.close();
+
+    Mat X_ref(rows.size(), rows[0].size() - 1, CV_64F);
+    Mat y_ref(rows.size(), 1, CV_64F);
+    for (int i = 0; i < X_ref.rows; i++)
+    {
+        y_ref.at<double>(i) = rows[i][0];
+        for (int j = 0; j < X_ref.cols; j++)
+            X_ref.at<double>(i, j) = rows[i][j + 1];
+    }
+
+    Mat X, y;
+    if (load_txt_dataset(fn.c_str(), X, y, 1) != 0 ||
+        compare_datasets(X, y, X_ref, y_ref) != 0)
+        return 1;
+    if (load_txt_dataset(fn.c_str(), X, y, 4) != 0 ||
+        compare_datasets(X, y, X_ref, y_ref) != 0)
+        return 1;
+
+    // Throughput on a larger file made of copies of the dataset
+    const char* big_file = "dataset_test.txt";
+    std::ifstream source(fn.c_str());
+    std::stringstream content;
+    content << source.rdbuf();
+    std::ofstream out(big_file);
+    const int n_copies = 500;
+    for (int c = 0; c < n_copies; c++)
+        out << content.str();
+    out.close();
+    double megabytes = static_cast<double>(content.str().size()) * n_copies / (1 << 20);
+
+    int thread_counts[] = {1, 4};
+    for (int t = 0; t < 2; t++)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        int error_code = load_txt_dataset(big_file, X, y, thread_counts[t]);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (error_code != 0 || X.rows != X_ref.rows * n_copies)
+        {
+            cout << "Load failed: " << error_code << endl;
+            remove(big_file);
+            return 1;
+        }
+        cout << thread_counts[t] << " threads: " << megabytes / seconds << " MB/s" << endl;
+    }
+    remove(big_file);
+    return compare_datasets(X, y, X_ref, y_ref);
+}
+
+int ColumnDataset_test(QString filename)
+{
+    string fn = QString("../test_data/Regression/").append(filename).toStdString();
+    const char* column_file = "dataset_test.bin";
+
+    Mat X, y;
+    if (load_txt_dataset(fn.c_str(), X, y) != 0)
+        return 1;
+    int error_code = convert_txt_dataset(fn.c_str(), column_file);
+    if (error_code != 0)
+    {
+        cout << "Convert failed: " << error_code << endl;
+        return 1;
+    }
+
+    ColumnDataset dataset;
+    error_code = dataset.load(column_file);
+    if (error_code != 0)
+    {
+        remove(column_file);
+        cout << "Load failed: " << error_code << endl;
+        return 1;
+    }
+
+    // A truncated file and corrupt headers are rejected, whatever the
+    // overflow of the offsets and sizes. The header holds n_features at
+    // byte 24 and y_offset at byte 40.
+    FILE* file = fopen(column_file, "rb");
+    fseek(file, 0, SEEK_END);
+    vector<char> bytes(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t n_read = fread(&bytes[0], 1, bytes.size(), file);
+    fclose(file);
+    remove(column_file);
+    if (n_read != bytes.size())
+        return 1;
+
+    struct Corruption
+    {
+        const char* name;
+        size_t size;                // Bytes kept
+        size_t offset;              // Header field overwritten
+        uint64_t value;
+    };
+    Corruption corruptions[] = {
+        {"truncated file", bytes.size() - 8, 0, 0},
+        {"overflowing y offset", bytes.size(), 40, ~static_cast<uint64_t>(0) - 63},
+        {"too many features", bytes.size(), 24, INT32_MAX}};
+    const char* corrupt_file = "dataset_test_corrupt.bin";
+    for (int c = 0; c < 3; c++)
+    {
+        vector<char> corrupt(bytes.begin(), bytes.begin() + corruptions[c].size);
+        if (corruptions[c].offset != 0)
+            memcpy(&corrupt[corruptions[c].offset], &corruptions[c].value, sizeof(uint64_t));
+        file = fopen(corrupt_file, "wb");
+        fwrite(&corrupt[0], 1, corrupt.size(), file);
+        fclose(file);
+
+        ColumnDataset rejected;
+        error_code = rejected.load(corrupt_file);
+        remove(corrupt_file);
+        if (error_code != 4)
+        {
+            cout << "Wrong" << " " << corruptions[c].name << ": " << error_code << endl;
+            return 1;
+        }
+    }
+    if (compare_datasets(dataset.rows(), dataset.y, X, y) != 0)
+        return 1;
+    for (int i = 0; i < dataset.n_samples; i++)
+    {
+        if (dataset.sample_weight.at<double>(i) != 1.0)
+        {
+            cout << "Wrong weight" << " " << i << endl;
+            return 1;
+        }
+    }
+
+    // The tree fitted on the mapped columns is the one fitted on X
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+    DecisionTreeRegressor rows("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    DecisionTreeRegressor columns("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    rows.fit(X, y, Mat::ones(X.rows, 1, CV_64F));
+    columns.fit_columns(dataset.X_col, dataset.y, dataset.sample_weight);
+
+    Mat expected = rows.predict(X);
+    Mat result = columns.predict(X);
+    int n_wrong = 0;
+    for (int i = 0; i < X.rows; i++)
+        n_wrong += (result.at<double>(i) != expected.at<double>(i));
+    if (n_wrong != 0 || columns._tree->_node_count != rows._tree->_node_count)
+    {
+        cout << "Wrong" << " " << n_wrong << " predictions" << endl;
+        return 1;
+    }
+    cout << "Correct" << endl;
+    return 0;
+}
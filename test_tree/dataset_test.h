@@ -0,0 +1,8 @@
+#ifndef DATASET_TEST_H
+#define DATASET_TEST_H
+#include <QtCore>
+
+int Dataset_test(QString);
+int ColumnDataset_test(QString);
+
+#endif // DATASET_TEST_H
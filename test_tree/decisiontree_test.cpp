@@ -1,8 +1,19 @@
 #include "decisiontree_test.h"
 #include <QtCore>
 #include <utility>
+#include <ctime>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
 #include <opencv2/opencv.hpp>
 #include "tree.h"
+#include "basetree.h"
+#include "treebuilder.h"
+#include "splitter.h"
+#include "dataset.h"
+#include "argsort.h"
 #include "tools.h"
 using std::pair;
 using cv::Mat;
@@ -29,6 +40,38 @@ int DecisionTreeClassification_test(QString filename)
     }
 }
 
+int DecisionTreeLabels_test(QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    // Same classes, with labels that aren't class ids
+    Mat y_labels = y.clone();
+    for (int i = 0; i < y_labels.total(); i++)
+        y_labels.at<double>(i) = y.at<double>(i) == 0 ? -1.5 : 7.0;
+
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+    DecisionTreeClassifier ids("Gini", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    DecisionTreeClassifier labels("Gini", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    ids.fit(X, y, Mat::ones(X.rows, 1, CV_64F));
+    labels.fit(X, y_labels, Mat::ones(X.rows, 1, CV_64F));
+
+    Mat expected = ids.predict(X);
+    Mat result = labels.predict(X);
+    for (int i = 0; i < X.rows; i++)
+    {
+        if (result.at<double>(i) != (expected.at<double>(i) == 0 ? -1.5 : 7.0))
+        {
+            cout << "Wrong" << " " << result.at<double>(i) << " " << expected.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    cout << "Correct" << endl;
+    return 0;
+}
+
 int DecisionTreeRegression_test(QString filename)
 {
     QString fn = QString("../test_data/Regression/").append(filename);
@@ -50,3 +93,796 @@ int DecisionTreeRegression_test(QString filename)
             cout << "Wrong" << " " << result.at<double>(i) << " " << y.at<double>(i) << endl;
     }
 }
+
+int HistogramSubtraction_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    DecisionTreeRegressor best("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    best.fit(X, y, sample_weight);
+    DecisionTreeRegressor hist("MSE", "Histogram", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    hist.fit(X, y, sample_weight);
+
+    // Without subtraction every internal node scans all of its samples
+    long n_node_rows = 0;
+    for (int i = 0; i < hist._tree->_node_count; i++)
+        if (hist._tree->nodes()[i].left_child != TREE_LEAF)
+            n_node_rows += hist._tree->node_stats()[i].n_node_samples;
+
+    DepthFirstBuilder* builder = static_cast<DepthFirstBuilder*>(hist._tree_builder);
+    cout << "Rows scanned: " << builder->n_scanned_rows
+         << " / rows in internal nodes: " << n_node_rows << endl;
+
+    Mat result_best = best.predict(X);
+    Mat result_hist = hist.predict(X);
+    for (int i = 0; i < result_hist.total(); i++)
+    {
+        if (result_hist.at<double>(i) != result_best.at<double>(i))
+        {
+            cout << "Wrong" << " " << result_hist.at<double>(i) << " " << result_best.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Leaves of the rows of X, walking one row at a time, as the reference
+ */
+static void apply_one_row_at_a_time(Tree* tree, Mat X, vector<int>& leaves)
+{
+    const Node* nodes = tree->nodes();
+    leaves.resize(X.rows);
+    for (int i = 0; i < X.rows; i++)
+    {
+        const double* row = X.ptr<double>(i);
+        int node_id = 0;
+        while (nodes[node_id].left_child != TREE_LEAF)
+        {
+            const Node& node = nodes[node_id];
+            node_id = row[node.feature] <= node.threshold ? node.left_child : node.right_child;
+        }
+        leaves[i] = node_id;
+    }
+}
+
+static int count_different_leaves(Mat leaves, const vector<int>& expected)
+{
+    int n_different = 0;
+    for (int i = 0; i < leaves.rows; i++)
+        n_different += (leaves.at<int>(i, 0) != expected[i]);
+    return n_different;
+}
+
+int TreeApply_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(X.rows, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    // Same leaves as the reference, NaN going right
+    DecisionTreeRegressor dtr("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    dtr.fit(X, y, sample_weight);
+    Mat X_nan = X.clone();
+    for (int i = 0; i < X_nan.rows; i += 7)
+        X_nan.at<double>(i, i % X_nan.cols) = NAN;
+    vector<int> expected;
+    int n_failed = 0;
+    for (int t = 0; t < 2; t++)
+    {
+        Mat X_apply = (t == 0) ? X : X_nan;
+        apply_one_row_at_a_time(dtr._tree, X_apply, expected);
+        int n_different = count_different_leaves(dtr._tree->apply(X_apply), expected);
+        if (n_different != 0)
+        {
+            cout << "Wrong" << (t == 0 ? "" : " with NaN") << ": " << n_different << " different leaves" << endl;
+            n_failed += 1;
+        }
+    }
+
+    // A fully grown tree on noisy targets, deep and too large for the
+    // cache, applied to a large batch of other rows
+    const int n_samples = 200000;
+    const int n_features = 8;
+    Mat X_train(n_samples, n_features, CV_64F);
+    Mat X_batch(n_samples, n_features, CV_64F);
+    Mat y_train(n_samples, 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+        {
+            X_train.at<double>(i, j) = rand() / (double)RAND_MAX;
+            X_batch.at<double>(i, j) = rand() / (double)RAND_MAX;
+        }
+        y_train.at<double>(i) = X_train.at<double>(i, 0) + rand() / (double)RAND_MAX;
+    }
+    DecisionTreeRegressor deep("MSE", "Best", 0, 2, 1, 0.0, 0, 0, 0, class_weight);
+    deep.fit(X_train, y_train, Mat::ones(n_samples, 1, CV_64F));
+    Tree* tree = deep._tree;
+
+    // Best of a few runs of each
+    const int n_repeats = 5;
+    double seconds[2] = {INFINITY, INFINITY};
+    Mat leaves;
+    for (int r = 0; r < n_repeats; r++)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        apply_one_row_at_a_time(tree, X_batch, expected);
+        seconds[0] = std::min(seconds[0], std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+        begin = std::chrono::steady_clock::now();
+        leaves = tree->apply(X_batch);
+        seconds[1] = std::min(seconds[1], std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    int n_different = count_different_leaves(leaves, expected);
+    cout << "Deep tree of " << tree->_node_count << " nodes, " << n_samples << " rows, "
+         << "rows per second one row at a time: " << n_samples / seconds[0] << ", apply: " << n_samples / seconds[1]
+         << ", speedup " << seconds[0] / seconds[1] << endl;
+    if (n_different != 0)
+    {
+        cout << "Wrong: " << n_different << " different leaves on the deep tree" << endl;
+        n_failed += 1;
+    }
+    return n_failed;
+}
+
+int TreeSaveLoad_test(QString filename)
+{
+    QString fn = QString("../test_data/Classification/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_classification(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    DecisionTreeClassifier dtc("Gini", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    dtc.fit(X, y, sample_weight);
+
+    const char* model_file = "tree_test.model";
+    int error_code = dtc._tree->save(model_file);
+    if (error_code != 0)
+    {
+        cout << "Save failed: " << error_code << endl;
+        return 1;
+    }
+
+    Tree loaded(0, 0);
+    error_code = loaded.load(model_file);
+    if (error_code != 0)
+    {
+        cout << "Load failed: " << error_code << endl;
+        return 1;
+    }
+    cout << "Loaded " << loaded._node_count << " nodes, "
+         << loaded._n_features << " features, "
+         << loaded._n_classes << " classes" << endl;
+
+    Mat expected = dtc._tree->predict(X);
+    Mat result = loaded.predict(X);
+    Mat expected_importances = dtc._tree->compute_feature_importances(true);
+    Mat importances = loaded.compute_feature_importances(true);
+
+    // Corrupt copies of the file must be rejected
+    FILE* file = fopen(model_file, "rb");
+    vector<char> bytes;
+    char buffer[4096];
+    size_t n_read;
+    while ((n_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + n_read);
+    fclose(file);
+    remove(model_file);
+
+    // Offsets of node_count, nodes_offset and value_offset in the header,
+    // then of the fields of the root node
+    const int node_count_offset = 28;
+    const int nodes_offset_offset = 40;
+    const int value_offset_offset = 56;
+    uint64_t nodes_offset;
+    memcpy(&nodes_offset, &bytes[nodes_offset_offset], sizeof(nodes_offset));
+    struct Corruption
+    {
+        const char* name;
+        size_t offset;
+        int32_t value32;
+        uint64_t value64;
+        bool is_64;
+        int error_code;
+    };
+    Corruption corruptions[] = {
+        {"no node", node_count_offset, 0, 0, false, 3},
+        {"overflowing offset", value_offset_offset, 0, ~static_cast<uint64_t>(0) - 63, true, 4},
+        {"left child out of the tree", nodes_offset, dtc._tree->_node_count, 0, false, 6},
+        {"right child before its node", nodes_offset + 4, 0, 0, false, 6},
+        {"feature out of X", nodes_offset + 8, dtc._tree->_n_features, 0, false, 6}};
+    const char* corrupt_file = "tree_test_corrupt.model";
+    for (int c = 0; c < 5; c++)
+    {
+        vector<char> corrupt = bytes;
+        if (corruptions[c].is_64)
+            memcpy(&corrupt[corruptions[c].offset], &corruptions[c].value64, sizeof(uint64_t));
+        else
+            memcpy(&corrupt[corruptions[c].offset], &corruptions[c].value32, sizeof(int32_t));
+        file = fopen(corrupt_file, "wb");
+        fwrite(&corrupt[0], 1, corrupt.size(), file);
+        fclose(file);
+
+        Tree rejected(0, 0);
+        error_code = rejected.load(corrupt_file);
+        remove(corrupt_file);
+        if (error_code != corruptions[c].error_code)
+        {
+            cout << "Wrong" << " " << corruptions[c].name << ": " << error_code << endl;
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < X.rows; i++)
+    {
+        if (result.at<double>(i) != expected.at<double>(i))
+        {
+            cout << "Wrong" << " " << result.at<double>(i) << " " << expected.at<double>(i) << endl;
+            return 1;
+        }
+    }
+    for (int i = 0; i < importances.total(); i++)
+    {
+        if (importances.at<double>(i) != expected_importances.at<double>(i))
+        {
+            cout << "Wrong importance" << " " << i << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Number of training samples predicted differently by a and b.
+ * Trees can differ by the order of the ties, e.g. a node whose only outlier
+ * is isolated by several features, and still give the same predictions on
+ * the samples they were fitted on.
+ */
+static int count_different_predictions(BaseDecisionTree& a,
+                                       BaseDecisionTree& b,
+                                       Mat X,
+                                       Mat sample_weight)
+{
+    Mat pa = a.predict(X);
+    Mat pb = b.predict(X);
+    int n_different = 0;
+    for (int i = 0; i < X.rows; i++)
+        if (sample_weight.at<double>(i) != 0.0 &&
+            fabs(pa.at<double>(i) - pb.at<double>(i)) > 1e-9 * std::max(1.0, fabs(pa.at<double>(i))))
+            n_different += 1;
+    return n_different;
+}
+
+int PresortBest_test(QString filename)
+{
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> pMat = read_data_from_txt_regression(fn);
+    Mat X = pMat.first;
+    Mat y = pMat.second;
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+    int n_failed = 0;
+
+    // Same predictions as BestSplitter, with unit weights and with some null ones
+    Mat sample_weight = Mat::ones(X.rows, 1, CV_64F);
+    Mat other_weight(X.rows, 1, CV_64F);
+    for (int i = 0; i < X.rows; i++)
+        other_weight.at<double>(i) = (i % 7 == 0) ? 0.0 : 0.5 + (i % 3);
+
+    for (int w = 0; w < 2; w++)
+    {
+        Mat weight = (w == 0) ? sample_weight : other_weight;
+        DecisionTreeRegressor best("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+        DecisionTreeRegressor presort("MSE", "PresortBest", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+        best.fit(X, y, weight);
+        presort.fit(X, y, weight);
+
+        int n_different = count_different_predictions(best, presort, X, weight);
+        cout << "Best " << best._tree->_node_count << " nodes, PresortBest "
+             << presort._tree->_node_count << " nodes, "
+             << n_different << " different predictions" << endl;
+        n_failed += (n_different != 0 || best._tree->_node_count != presort._tree->_node_count);
+    }
+
+    // The columns are sorted by the first tree only
+    clear_argsort_cache();
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    DecisionTreeRegressor first("MSE", "PresortBest", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    first.fit(X, y, sample_weight);
+    double first_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    Mat argsorted = static_cast<PresortBestSplitter*>(first._splitter)->X_argsorted;
+    const int n_trees = 10;
+    begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < n_trees; t++)
+    {
+        DecisionTreeRegressor tree("MSE", "PresortBest", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+        tree.fit(X, y, (t % 2 == 0) ? sample_weight : other_weight);
+        if (static_cast<PresortBestSplitter*>(tree._splitter)->X_argsorted.data != argsorted.data)
+        {
+            cout << "The argsort wasn't shared" << endl;
+            n_failed += 1;
+        }
+    }
+    double other_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    cout << "First tree " << first_time << "s, next ones " << other_time / n_trees << "s" << endl;
+
+    // X changed in place is sorted again
+    Mat X_changed = X.clone();
+    DecisionTreeRegressor before("MSE", "PresortBest", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    before.fit(X_changed, y, sample_weight);
+    for (int i = 0; i < X_changed.rows; i++)
+        for (int j = 0; j < X_changed.cols; j++)
+            X_changed.at<double>(i, j) = X.at<double>(i, (j + 1) % X.cols);
+    DecisionTreeRegressor best("MSE", "Best", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    DecisionTreeRegressor after("MSE", "PresortBest", 100, 2, 1, 0.0, 0, 0, 0, class_weight);
+    best.fit(X_changed, y, sample_weight);
+    after.fit(X_changed, y, sample_weight);
+    int n_different = count_different_predictions(best, after, X_changed, sample_weight);
+    cout << "X changed in place: " << n_different << " different predictions" << endl;
+    n_failed += (n_different != 0);
+
+    clear_argsort_cache();
+    return n_failed;
+}
+
+/**
+ * @brief Number of nodes of a and b which differ
+ */
+static int count_different_nodes(BaseDecisionTree& a,
+                                 BaseDecisionTree& b)
+{
+    if (a._tree->_node_count != b._tree->_node_count)
+        return std::max(a._tree->_node_count, b._tree->_node_count);
+
+    int n_different = 0;
+    for (int i = 0; i < a._tree->_node_count; i++)
+    {
+        Node node = a._tree->nodes()[i];
+        NodeStats stats = a._tree->node_stats()[i];
+        if (!(node == b._tree->nodes()[i]) || !(stats == b._tree->node_stats()[i]))
+            n_different += 1;
+    }
+    return n_different;
+}
+
+int FeatureParallel_test(char* criterion_name)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+
+    // A wide synthetic training set, the target depends on a few features
+    const int n_samples = 2000;
+    const int n_features = 500;
+    Mat X(n_samples, n_features, CV_64F);
+    Mat y(n_samples, 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(i, j) = (j % 5 == 0) ? rand() % 10 : rand() / (double)RAND_MAX;
+        double t = X.at<double>(i, 1) + X.at<double>(i, 7) * X.at<double>(i, 42) + rand() / (double)RAND_MAX;
+        y.at<double>(i) = is_classification ? floor(t) : 10.0 * t;
+    }
+    Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    // Trees with every feature, and with a third of them drawn per node
+    int n_failed = 0;
+    int max_features[] = {n_features, n_features / 3};
+    Criterion* criteria[2];
+    Splitter* splitters[2];
+    for (int m = 0; m < 2; m++)
+    {
+        double times[2];
+        BaseDecisionTree* trees[2];
+        for (int t = 0; t < 2; t++)
+        {
+            if (is_classification)
+                trees[t] = new DecisionTreeClassifier(criterion_name, "Best", 100, 2, 1, 0.0,
+                                                      max_features[m], 0, 0, class_weight);
+            else
+                trees[t] = new DecisionTreeRegressor(criterion_name, "Best", 100, 2, 1, 0.0,
+                                                     max_features[m], 0, 0, class_weight);
+
+            // The tree is built serially, by a splitter evaluating the
+            // features with 4 threads
+            if (t == 1)
+            {
+                criteria[m] = trees[0]->_splitter->criterion->clone();
+                splitters[m] = new BestSplitter(criteria[m], max_features[m], 1, 0.0, 0, 4);
+                trees[t]->set_splitter(splitters[m]);
+            }
+
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            trees[t]->fit(X, y, sample_weight);
+            times[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        int n_different = count_different_nodes(*trees[0], *trees[1]);
+        cout << criterion_name << " max_features " << max_features[m] << ": "
+             << trees[0]->_tree->_node_count << " nodes, " << n_different << " different, "
+             << "1 thread " << times[0] << "s, 4 threads " << times[1] << "s" << endl;
+        n_failed += (n_different != 0);
+        delete trees[0];
+        delete trees[1];
+        delete splitters[m];
+        delete criteria[m];
+    }
+    return n_failed;
+}
+
+int Refit_test(char* criterion_name)
+{
+    bool is_newton = (strcmp(criterion_name, "Newton") == 0);
+
+    // Wide enough for the splitter to evaluate the features of the first
+    // nodes with several threads
+    const int n_samples = 2000;
+    const int n_features = 100;
+    Mat X(n_samples, n_features, CV_64F);
+    Mat y(n_samples, is_newton ? 2 : 1, CV_64F);
+    Mat other_y(n_samples, is_newton ? 2 : 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(i, j) = rand() / (double)RAND_MAX;
+        double t = X.at<double>(i, 1) + X.at<double>(i, 7) * X.at<double>(i, 42) + rand() / (double)RAND_MAX;
+        double other_t = 2.0 * X.at<double>(i, 3) * X.at<double>(i, 60) + rand() / (double)RAND_MAX;
+        if (is_newton)
+        {
+            y.at<double>(i, 0) = t - 1.0;
+            y.at<double>(i, 1) = 0.5 + X.at<double>(i, 5);
+            other_y.at<double>(i, 0) = other_t - 1.0;
+            other_y.at<double>(i, 1) = 0.25 + X.at<double>(i, 9);
+        }
+        else
+        {
+            y.at<double>(i) = floor(t);
+            other_y.at<double>(i) = floor(other_t);
+        }
+    }
+    Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    // A splitter evaluating the features with 4 threads is shared by two
+    // trees, as in boosting: the second one fits the other target, written
+    // over the first one, with the other regularization of the Newton
+    // criterion. The third tree fits it with its own splitter.
+    Criterion* criterion;
+    if (is_newton)
+        criterion = new NewtonCriterion(5.0, 10.0);
+    else
+        criterion = new Gini();
+    Splitter* splitter = new BestSplitter(criterion, n_features, 1, 0.0, 0, 4);
+
+    BaseDecisionTree* trees[3];
+    for (int t = 0; t < 3; t++)
+    {
+        if (is_newton)
+            trees[t] = new DecisionTreeRegressor(criterion_name, "Best", 100, 2, 1, 0.0,
+                                                 0, 0, 0, class_weight);
+        else
+            trees[t] = new DecisionTreeClassifier(criterion_name, "Best", 100, 2, 1, 0.0,
+                                                  0, 0, 0, class_weight);
+        if (t < 2)
+            trees[t]->set_splitter(splitter);
+    }
+    trees[0]->set_regularization(5.0, 10.0);
+    trees[0]->fit(X, y, sample_weight.clone());
+
+    for (int i = 0; i < n_samples; i++)
+        for (int k = 0; k < y.cols; k++)
+            y.at<double>(i, k) = other_y.at<double>(i, k);
+    trees[1]->set_regularization(0.5, 1.0);
+    trees[1]->fit(X, y, sample_weight.clone());
+
+    trees[2]->set_regularization(0.5, 1.0);
+    trees[2]->fit(X, other_y, sample_weight.clone());
+
+    int n_different = count_different_nodes(*trees[1], *trees[2]);
+    cout << criterion_name << " refit: " << trees[1]->_tree->_node_count << " / "
+         << trees[2]->_tree->_node_count << " nodes, " << n_different << " different" << endl;
+    for (int t = 0; t < 3; t++)
+        delete trees[t];
+    delete splitter;
+    delete criterion;
+    return (n_different != 0);
+}
+
+int NodeParallel_test(char* criterion_name)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+
+    // A long synthetic training set, so that the subtrees are built by tasks
+    const int n_samples = 10000;
+    const int n_features = 20;
+    Mat X(n_samples, n_features, CV_64F);
+    Mat y(n_samples, 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(i, j) = (j % 5 == 0) ? rand() % 10 : rand() / (double)RAND_MAX;
+        double t = X.at<double>(i, 1) + X.at<double>(i, 7) * X.at<double>(i, 12) + rand() / (double)RAND_MAX;
+        y.at<double>(i) = is_classification ? floor(t) : 10.0 * t;
+    }
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+
+    // The tree doesn't depend on the number of threads, the serial one
+    // included
+    int n_failed = 0;
+    char* splitter_names[] = {"Best", "PresortBest", "Random"};
+    int n_threads[] = {1, 2, 4};
+    for (int s = 0; s < 3; s++)
+    {
+        double times[3];
+        double training_errors[3];
+        BaseDecisionTree* trees[3];
+        for (int t = 0; t < 3; t++)
+        {
+            if (is_classification)
+                trees[t] = new DecisionTreeClassifier(criterion_name, splitter_names[s], 100, 2, 1, 0.0,
+                                                      0, 0, 0, class_weight);
+            else
+                trees[t] = new DecisionTreeRegressor(criterion_name, splitter_names[s], 100, 2, 1, 0.0,
+                                                     0, 0, 0, class_weight);
+            trees[t]->set_n_threads(n_threads[t]);
+
+            Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            trees[t]->fit(X, y, sample_weight);
+            times[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            Mat prediction = trees[t]->predict(X);
+            training_errors[t] = 0.0;
+            for (int i = 0; i < n_samples; i++)
+                training_errors[t] += fabs(prediction.at<double>(i) - y.at<double>(i));
+        }
+
+        int n_different = count_different_nodes(*trees[0], *trees[1]) +
+                          count_different_nodes(*trees[1], *trees[2]);
+        cout << criterion_name << " " << splitter_names[s] << ": "
+             << trees[0]->_tree->_node_count << " nodes, "
+             << n_different << " different between 1, 2 and 4 threads, "
+             << "training error " << training_errors[0] << ", "
+             << "1 thread " << times[0] << "s, 2 threads " << times[1] << "s, "
+             << "4 threads " << times[2] << "s" << endl;
+        n_failed += (n_different != 0 ||
+                     training_errors[0] != training_errors[1] ||
+                     training_errors[1] != training_errors[2]);
+        for (int t = 0; t < 3; t++)
+            delete trees[t];
+    }
+    return n_failed;
+}
+
+/**
+ * @brief Number of nodes of the subtree of a at node_a that don't have the
+ * split, samples and value of the node of b at the same place
+ */
+static int count_different_nodes(Tree& a,
+                                 int node_a,
+                                 Tree& b,
+                                 int node_b)
+{
+    const Node& na = a.nodes()[node_a];
+    const Node& nb = b.nodes()[node_b];
+    bool a_leaf = (na.left_child == TREE_LEAF);
+    bool b_leaf = (nb.left_child == TREE_LEAF);
+    int n_different = 0;
+
+    if (a_leaf != b_leaf ||
+        a.node_stats()[node_a].n_node_samples != b.node_stats()[node_b].n_node_samples)
+        return 1;
+    if (a_leaf)
+    {
+        for (int c = 0; c < a._n_classes; c++)
+            if (a.value(node_a)[c] != b.value(node_b)[c])
+                return 1;
+        return 0;
+    }
+    if (na.feature != nb.feature || na.threshold != nb.threshold)
+        n_different += 1;
+    n_different += count_different_nodes(a, na.left_child, b, nb.left_child);
+    n_different += count_different_nodes(a, na.right_child, b, nb.right_child);
+    return n_different;
+}
+
+int LevelWise_test(char* criterion_name)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+
+    // Enough samples for the first levels to be built by column scans, and
+    // held-out rows, which tell the trees apart where the training rows
+    // don't. The targets are integers, so that the histogram sums don't
+    // depend on the order of the column scans.
+    const int n_samples = 20000;
+    const int n_test = 5000;
+    const int n_features = 10;
+    Mat X(n_samples, n_features, CV_64F);
+    Mat y(n_samples, 1, CV_64F);
+    Mat X_test(n_test, n_features, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(i, j) = rand() / (double)RAND_MAX;
+        double t = X.at<double>(i, 1) + X.at<double>(i, 7) * X.at<double>(i, 3) + rand() / (double)RAND_MAX;
+        y.at<double>(i) = is_classification ? floor(t) : floor(100.0 * t);
+    }
+    for (int i = 0; i < n_test; i++)
+        for (int j = 0; j < n_features; j++)
+            X_test.at<double>(i, j) = rand() / (double)RAND_MAX;
+    Mat test_weight = Mat::ones(n_test, 1, CV_64F);
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+    Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+    Mat other_weight(n_samples, 1, CV_64F);
+    for (int i = 0; i < n_samples; i++)
+        other_weight.at<double>(i) = (i % 7 == 0) ? 0.0 : 0.5 + (i % 3);
+
+    // Both builders grow the same tree, numbered differently
+    int n_failed = 0;
+    char* splitter_names[] = {"Histogram", "Best"};
+    char* builder_names[] = {"DepthFirst", "LevelWise"};
+    for (int s = 0; s < 2; s++)
+    {
+        for (int w = 0; w < 2; w++)
+        {
+            Mat weight = (w == 0) ? sample_weight : other_weight;
+            double times[2];
+            BaseDecisionTree* trees[2];
+            for (int t = 0; t < 2; t++)
+            {
+                if (is_classification)
+                    trees[t] = new DecisionTreeClassifier(criterion_name, splitter_names[s], 100, 2, 1, 0.0,
+                                                          0, 0, 0, class_weight);
+                else
+                    trees[t] = new DecisionTreeRegressor(criterion_name, splitter_names[s], 100, 2, 1, 0.0,
+                                                         0, 0, 0, class_weight);
+                trees[t]->set_builder(builder_names[t]);
+
+                Mat fit_weight = weight.clone();
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                trees[t]->fit(X, y, fit_weight);
+                times[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            }
+
+            LevelWiseBuilder* builder = static_cast<LevelWiseBuilder*>(trees[1]->_tree_builder);
+            int n_different = count_different_predictions(*trees[0], *trees[1], X_test, test_weight);
+            int n_different_nodes = count_different_nodes(*trees[0]->_tree, 0, *trees[1]->_tree, 0);
+            cout << criterion_name << " " << splitter_names[s] << (w == 0 ? "" : " weighted") << ": "
+                 << trees[0]->_tree->_node_count << " / " << trees[1]->_tree->_node_count << " nodes, "
+                 << n_different_nodes << " different nodes, "
+                 << n_different << " different held-out predictions, "
+                 << builder->n_column_scans << " column scans, "
+                 << "DepthFirst " << times[0] << "s, LevelWise " << times[1] << "s" << endl;
+            n_failed += (n_different != 0 || n_different_nodes != 0 ||
+                         trees[0]->_tree->_node_count != trees[1]->_tree->_node_count);
+            if (s == 0 && builder->n_column_scans == 0)
+                n_failed += 1;
+            delete trees[0];
+            delete trees[1];
+        }
+    }
+    return n_failed;
+}
+
+static int count_leaves(BaseDecisionTree& tree)
+{
+    const Node* nodes = tree._tree->nodes();
+    int n_leaves = 0;
+    for (int i = 0; i < tree._tree->_node_count; i++)
+        if (nodes[i].left_child == TREE_LEAF)
+            n_leaves += 1;
+    return n_leaves;
+}
+
+static double training_error(BaseDecisionTree& tree,
+                             Mat X,
+                             Mat y,
+                             bool is_classification)
+{
+    Mat prediction = tree.predict(X);
+    double error = 0.0;
+    for (int i = 0; i < X.rows; i++)
+    {
+        double diff = prediction.at<double>(i) - y.at<double>(i);
+        error += is_classification ? (diff != 0.0) : diff * diff;
+    }
+    return error / X.rows;
+}
+
+int BestFirst_test(char* criterion_name)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+
+    const int n_samples = 20000;
+    const int n_features = 10;
+    Mat X(n_samples, n_features, CV_64F);
+    Mat y(n_samples, 1, CV_64F);
+    srand(0);
+    for (int i = 0; i < n_samples; i++)
+    {
+        for (int j = 0; j < n_features; j++)
+            X.at<double>(i, j) = rand() / (double)RAND_MAX;
+        // Most of the signal in one corner, where a leaf-wise tree spends its leaves
+        double t = (X.at<double>(i, 1) > 0.7) * 4.0 * X.at<double>(i, 7) * X.at<double>(i, 3)
+                   + 0.5 * X.at<double>(i, 2) + 0.3 * rand() / (double)RAND_MAX;
+        y.at<double>(i) = is_classification ? floor(t) : 10.0 * t;
+    }
+    Mat class_weight = Mat::ones(0, 0, CV_64F);
+    Mat sample_weight = Mat::ones(n_samples, 1, CV_64F);
+
+    int n_failed = 0;
+    char* splitter_names[] = {"Best", "PresortBest", "Histogram"};
+    for (int s = 0; s < 3; s++)
+    {
+        // With more leaves than needed, the best-first tree is the depth-first one
+        // grown in another order, drawing the same features for each node;
+        // with k leaves it has exactly k leaves, and fits the training set
+        // better than the balanced tree of depth log2(k)
+        for (int depth = 0; depth <= 7; depth += (depth == 0 ? 3 : 2))
+        {
+            int max_leaf_nodes = (depth == 0) ? n_samples : (1 << depth);
+            int max_features = (depth == 0) ? 3 : 0;
+            BaseDecisionTree* trees[2];
+            double times[2];
+            for (int t = 0; t < 2; t++)
+            {
+                int max_depth = (t == 0) ? depth : 0;
+                int leaf_nodes = (t == 0) ? 0 : max_leaf_nodes;
+                if (is_classification)
+                    trees[t] = new DecisionTreeClassifier(criterion_name, splitter_names[s], max_depth, 2, 1, 0.0,
+                                                          max_features, leaf_nodes, 0, class_weight);
+                else
+                    trees[t] = new DecisionTreeRegressor(criterion_name, splitter_names[s], max_depth, 2, 1, 0.0,
+                                                         max_features, leaf_nodes, 0, class_weight);
+
+                Mat fit_weight = sample_weight.clone();
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                trees[t]->fit(X, y, fit_weight);
+                times[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            }
+
+            int n_leaves[2] = {count_leaves(*trees[0]), count_leaves(*trees[1])};
+            double errors[2] = {training_error(*trees[0], X, y, is_classification),
+                                training_error(*trees[1], X, y, is_classification)};
+            cout << criterion_name << " " << splitter_names[s] << " max_leaf_nodes " << max_leaf_nodes << ": "
+                 << "DepthFirst " << n_leaves[0] << " leaves, error " << errors[0] << ", " << times[0] << "s / "
+                 << "BestFirst " << n_leaves[1] << " leaves, error " << errors[1] << ", " << times[1] << "s" << endl;
+
+            // The Histogram splitter sums the regression targets of a node in
+            // another order, which may break the ties of the smallest nodes
+            // differently
+            bool exact = (is_classification || s != 2);
+            if (depth == 0)
+                n_failed += ((exact && count_different_nodes(*trees[0]->_tree, 0, *trees[1]->_tree, 0) != 0) ||
+                             count_different_predictions(*trees[0], *trees[1], X, sample_weight) != 0);
+            else
+                n_failed += (n_leaves[1] != max_leaf_nodes || errors[1] > errors[0]);
+            delete trees[0];
+            delete trees[1];
+        }
+    }
+    return n_failed;
+}
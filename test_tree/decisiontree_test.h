@@ -3,6 +3,16 @@
 #include <QtCore>
 
 int DecisionTreeClassification_test(QString);
+int DecisionTreeLabels_test(QString);
 int DecisionTreeRegression_test(QString);
+int HistogramSubtraction_test(QString);
+int TreeApply_test(QString);
+int TreeSaveLoad_test(QString);
+int PresortBest_test(QString);
+int FeatureParallel_test(char* criterion_name);
+int Refit_test(char* criterion_name);
+int NodeParallel_test(char* criterion_name);
+int LevelWise_test(char* criterion_name);
+int BestFirst_test(char* criterion_name);
 
 #endif // DECISIONTREE_TEST_H
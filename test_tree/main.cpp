@@ -17,6 +17,8 @@
 #include "splitter_test.h"
 #include "decisiontree_test.h"
 #include "util_test.h"
+#include "codegen_test.h"
+#include "dataset_test.h"
 #include "tools.h"
 using namespace cv;
 using namespace std;
@@ -28,6 +30,9 @@ int main()
 //    Entropy_test();
 //    MSE_test();
 //    FriedmanMSE_test();
+//    ImpurityKernels_test();
+//    ProxyImprovement_test();
+//    NewtonCriterion_test();
 
     // Splitter_test
 //    BestSplitter_classification_test("Gini", "test4.txt");
@@ -35,14 +40,41 @@ int main()
 //    BestSplitter_regression_test("MSE", "test4.txt");
 //    BestSplitter_regression_test("FriedmanMSE", "test1.txt");
 //    RandomSplitter_test();
+//    HistogramSplitter_test("MSE", "test1.txt", 255);
+//    HistogramSplitter_test("Gini", "test2.txt", 16);
+//    SplitterAllocation_test("MSE", "test1.txt");
+//    SplitterAllocation_test("Gini", "test2.txt");
 
     // Util_test
 //    sort_apply_permutation_test();
+//    sort_samples_test("test1.txt");
 
     // DesicitionTree_test
 //    DecisionTreeClassification_test("test3.txt");
+//    DecisionTreeLabels_test("test3.txt");
     DecisionTreeRegression_test("test3.txt");
     DecisionTreeRegression_test("test2.txt");
+//    HistogramSubtraction_test("test1.txt");
+//    TreeApply_test("test1.txt");
+//    TreeSaveLoad_test("test3.txt");
+//    PresortBest_test("test1.txt");
+//    FeatureParallel_test("MSE");
+//    FeatureParallel_test("Gini");
+//    Refit_test("Gini");
+//    Refit_test("Newton");
+//    NodeParallel_test("MSE");
+//    NodeParallel_test("Gini");
+//    LevelWise_test("MSE");
+//    LevelWise_test("Gini");
+//    BestFirst_test("MSE");
+//    BestFirst_test("Gini");
+
+    // CodeGen_test
+//    TreeCodeGen_classification_test("test3.txt");
+//    TreeCodeGen_regression_test("test1.txt");
+//    TreeCodeGen_regression_test("test4.txt");
 
     // Tools
+//    Dataset_test("test1.txt");
+//    ColumnDataset_test("test1.txt");
 }
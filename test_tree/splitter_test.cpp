@@ -1,5 +1,8 @@
 #include "splitter_test.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <utility>
@@ -10,6 +13,24 @@
 using namespace cv;
 using namespace std;
 
+// Every heap allocation of the test program goes through these, the
+// parallel tests allocate from several threads
+static std::atomic<long> n_allocations(0);
+
+void* operator new(size_t size)
+{
+    n_allocations += 1;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
 int BestSplitter_classification_test(char* criterion_name, QString filename)
 {
     QString fn = QString("../test_data/Classification/").append(filename);
@@ -65,3 +86,182 @@ int BestSplitter_regression_test(char* criterion_name, QString filename)
     double impurity = bs.node_impurity();
     bs.node_split(impurity, &split, &const_feature);
 }
+
+int HistogramSplitter_test(char* criterion_name, QString filename, int max_bins)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+    pair<Mat, Mat> pmat;
+    if (is_classification)
+        pmat = read_data_from_txt_classification(QString("../test_data/Classification/").append(filename));
+    else
+        pmat = read_data_from_txt_regression(QString("../test_data/Regression/").append(filename));
+    Mat X = pmat.first;
+    Mat y = pmat.second;
+
+    Mat sample_weight = Mat::ones(200, 1, CV_64F);
+
+    Criterion* g;
+    Criterion* h;
+    if (strcmp(criterion_name, "Gini") == 0)
+    {
+        g = new Gini();
+        h = new Gini();
+    }
+    else if (strcmp(criterion_name, "Entropy") == 0)
+    {
+        g = new Entropy();
+        h = new Entropy();
+    }
+    else if (strcmp(criterion_name, "MSE") == 0)
+    {
+        g = new MSE();
+        h = new MSE();
+    }
+    else if (strcmp(criterion_name, "FriedmanMSE") == 0)
+    {
+        g = new FriedmanMSE();
+        h = new FriedmanMSE();
+    }
+
+    // With max_bins >= n_samples both splitters see the same candidates
+    SplitRecord best_split, hist_split;
+    int const_feature = 0;
+    BestSplitter bs(g, 20, 2, 1., 0);
+    bs.init(X, y, sample_weight);
+    bs.node_reset(0, 200);
+    bs.node_split(bs.node_impurity(), &best_split, &const_feature);
+
+    const_feature = 0;
+    HistogramSplitter hs(h, 20, 2, 1., 0, max_bins);
+    hs.init(X, y, sample_weight);
+    hs.node_reset(0, 200);
+    hs.node_split(hs.node_impurity(), &hist_split, &const_feature);
+
+    cout << "Best:      feature " << best_split.feature
+         << " threshold " << best_split.threshold
+         << " pos " << best_split.pos
+         << " improvement " << best_split.improvement << endl;
+    cout << "Histogram: feature " << hist_split.feature
+         << " threshold " << hist_split.threshold
+         << " pos " << hist_split.pos
+         << " improvement " << hist_split.improvement << endl;
+
+    // The left child must hold exactly the samples below the threshold
+    for (int i = 0; i < 200; i++)
+    {
+        bool is_left = (i < hist_split.pos);
+        if (is_left != (X.at<double>(hs.samples[i], hist_split.feature) <= hist_split.threshold))
+        {
+            cout << "Wrong partition at " << i << endl;
+            return 1;
+        }
+    }
+
+    delete g;
+    delete h;
+    return 0;
+}
+
+/**
+ * @brief Split every node of a tree down to min_samples_leaf, as the depth
+ * first builder does, and count the heap allocations made by node_reset and
+ * node_split. The first node_split may size the scratch buffers.
+ * @return number of allocations after the root node
+ */
+static long count_node_allocations(Splitter* splitter, int n_samples)
+{
+    const int max_nodes = 1024;
+    int starts[max_nodes], ends[max_nodes], constants[max_nodes];
+    int n_pending = 1;
+    starts[0] = 0;
+    ends[0] = n_samples;
+    constants[0] = 0;
+
+    SplitRecord split;
+    double impurity;
+    long before;
+    long n_node_allocations = 0;
+    int n_nodes = 0;
+    bool root = true;
+    while (n_pending > 0 && n_pending + 2 < max_nodes)
+    {
+        n_pending -= 1;
+        int start = starts[n_pending];
+        int end = ends[n_pending];
+        int n_constant_features = constants[n_pending];
+
+        before = n_allocations;
+        splitter->node_reset(start, end);
+        impurity = splitter->node_impurity();
+        if (impurity > 1e-7)
+            splitter->node_split(impurity, &split, &n_constant_features);
+        if (!root)
+            n_node_allocations += n_allocations - before;
+        root = false;
+        n_nodes += 1;
+
+        if (impurity <= 1e-7 || split.pos >= end - start || split.pos <= 0)
+            continue;
+        starts[n_pending] = start;
+        ends[n_pending] = start + split.pos;
+        constants[n_pending] = n_constant_features;
+        starts[n_pending + 1] = start + split.pos;
+        ends[n_pending + 1] = end;
+        constants[n_pending + 1] = n_constant_features;
+        n_pending += 2;
+    }
+    cout << n_nodes << " nodes, " << n_node_allocations << " allocations" << endl;
+    return n_node_allocations;
+}
+
+int SplitterAllocation_test(char* criterion_name, QString filename)
+{
+    bool is_classification = (strcmp(criterion_name, "Gini") == 0 ||
+                              strcmp(criterion_name, "Entropy") == 0);
+    pair<Mat, Mat> pmat;
+    if (is_classification)
+        pmat = read_data_from_txt_classification(QString("../test_data/Classification/").append(filename));
+    else
+        pmat = read_data_from_txt_regression(QString("../test_data/Regression/").append(filename));
+    Mat X = pmat.first;
+    Mat y = pmat.second;
+    Mat sample_weight = Mat::ones(X.rows, 1, CV_64F);
+
+    Criterion* g;
+    Criterion* h;
+    if (strcmp(criterion_name, "Gini") == 0)
+    {
+        g = new Gini();
+        h = new Gini();
+    }
+    else if (strcmp(criterion_name, "Entropy") == 0)
+    {
+        g = new Entropy();
+        h = new Entropy();
+    }
+    else if (strcmp(criterion_name, "MSE") == 0)
+    {
+        g = new MSE();
+        h = new MSE();
+    }
+    else
+    {
+        g = new FriedmanMSE();
+        h = new FriedmanMSE();
+    }
+
+    BestSplitter bs(g, X.cols, 1, 0., 0);
+    bs.init(X, y, sample_weight);
+    cout << "Best:      ";
+    long n_best = count_node_allocations(&bs, X.rows);
+
+    HistogramSplitter hs(h, X.cols, 1, 0., 0);
+    hs.init(X, y, sample_weight);
+    cout << "Histogram: ";
+    long n_hist = count_node_allocations(&hs, X.rows);
+
+    delete g;
+    delete h;
+    return (n_best != 0 || n_hist != 0) ? 1 : 0;
+}
@@ -5,5 +5,7 @@
 int BestSplitter_classification_test(char* criterion_name, QString);
 int BestSplitter_regression_test(char* criterion_name, QString);
 int RandomSplitter_test();
+int HistogramSplitter_test(char* criterion_name, QString, int max_bins);
+int SplitterAllocation_test(char* criterion_name, QString);
 
 #endif // SPLITTER_TEST_H
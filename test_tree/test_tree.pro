@@ -12,6 +12,8 @@ LIBS += -L../tree
 HEADERS += criterion_test.h \
            splitter_test.h \
            util_test.h \
+           codegen_test.h \
+           dataset_test.h \
            tools.h \
            ../tree/criterion.h \
            ../tree/splitter.h \
@@ -19,12 +21,22 @@ HEADERS += criterion_test.h \
            ../tree/tree.h \
            ../tree/treebuilder.h \
            ../tree/util.h \
+           ../tree/binmapper.h \
+           ../tree/quickscorer.h \
+           ../tree/codegen.h \
+           ../tree/dataset.h \
+           ../tree/argsort.h \
+           ../tree/simd.h \
+           ../tree/threadpool.h \
+           ../tree/random.h \
     decisiontree_test.h
 
 SOURCES += main.cpp \
            criterion_test.cpp \
            splitter_test.cpp \
            util_test.cpp \
+           codegen_test.cpp \
+           dataset_test.cpp \
            tools.cpp \
            ../tree/criterion.cpp \
            ../tree/splitter.cpp \
@@ -32,9 +44,19 @@ SOURCES += main.cpp \
            ../tree/tree.cpp \
            ../tree/treebuilder.cpp \
            ../tree/util.cpp \
+           ../tree/binmapper.cpp \
+           ../tree/quickscorer.cpp \
+           ../tree/codegen.cpp \
+           ../tree/dataset.cpp \
+           ../tree/argsort.cpp \
+           ../tree/simd.cpp \
+           ../tree/threadpool.cpp \
+           ../tree/random.cpp \
     decisiontree_test.cpp
 
 LIBS += -L/usr/local/lib
 LIBS += -lopencv_core
+LIBS += -lpthread
+LIBS += -ldl
 
 TARGET = test_tree
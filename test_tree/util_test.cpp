@@ -1,4 +1,8 @@
 #include "util_test.h"
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include "tools.h"
 
 int sort_apply_permutation_test()
 {
@@ -28,3 +32,136 @@ int sort_apply_permutation_test()
     }
     return 0;
 }
+
+/**
+ * @brief Check that values is sorted and values[i] == column[samples[i]]
+ * for a permutation samples of [0, n).
+ */
+static bool is_sorted_samples(const vector<double>& column,
+                              const vector<double>& values,
+                              const vector<int>& samples)
+{
+    vector<bool> seen(column.size(), false);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (i > 0 && values[i - 1] > values[i])
+            return false;
+        if (seen[samples[i]] || values[i] != column[samples[i]])
+            return false;
+        seen[samples[i]] = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Nanoseconds per value to sort the columns of n values in data with
+ * the sort permutation of std::sort (the former path of BestSplitter),
+ * introsort and the radix sort. Every column is sorted once by each method,
+ * so that the branch predictor can't learn one input.
+ */
+static vector<double> time_sorts(const vector<double>& data,
+                                 int n,
+                                 SortBuffer& buffer,
+                                 int& n_failed)
+{
+    int n_columns = (n == 0) ? 1 : data.size() / n;
+    vector<double> column(n);
+    vector<double> values(n);
+    vector<int> samples(n);
+    vector<double> times;
+
+    for (int method = 0; method < 3; method++)
+    {
+        double elapsed = 0.0;
+        for (int c = 0; c < n_columns; c++)
+        {
+            column.assign(data.begin() + c * n, data.begin() + (c + 1) * n);
+            values = column;
+            for (int i = 0; i < n; i++)
+                samples[i] = i;
+
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            if (method == 0)
+            {
+                vector<int> p = sort_permutation(values,
+                    [](double const& a, double const& b){ return a < b; });
+                values = apply_permutation(values, p);
+                samples = apply_permutation(samples, p);
+            }
+            else if (method == 1)
+                sort_samples(&values[0], &samples[0], n);
+            else
+                radix_sort_samples(&values[0], &samples[0], n, buffer);
+            elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            if (!is_sorted_samples(column, values, samples))
+            {
+                cout << "wrong sort, method " << method << ", " << n << " values" << endl;
+                n_failed += 1;
+            }
+        }
+        times.push_back(n == 0 ? 0.0 : elapsed * 1e9 / n_columns / n);
+    }
+    return times;
+}
+
+int sort_samples_test(QString filename)
+{
+    int n_failed = 0;
+    SortBuffer buffer;
+    vector<double> data;
+    vector<double> times;
+
+    // Special values and ties, at every length around the thresholds
+    for (int n = 0; n <= 2 * RADIX_SORT_MIN; n += (n < 40) ? 1 : 97)
+    {
+        data.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            switch (i % 5)
+            {
+            case 0: data[i] = (i * 7919) % 13 - 6.0; break;        // ties
+            case 1: data[i] = -ldexp(1.0 + (i % 11) / 11.0, i % 40 - 20); break;
+            case 2: data[i] = ldexp(1.0 + (i % 7) / 7.0, i % 60 - 30); break;
+            case 3: data[i] = (i % 2) ? 0.0 : -0.0; break;
+            default: data[i] = (i % 3) ? 1e300 : -1e-300; break;
+            }
+        }
+        time_sorts(data, n, buffer, n_failed);
+    }
+
+    // The features of a test_data file, i.e. root nodes, in random orders
+    srand(0);
+    QString fn = QString("../test_data/Regression/").append(filename);
+    pair<Mat, Mat> data_xy = read_data_from_txt_regression(fn);
+    Mat X = data_xy.first;
+    const int n_shuffles = 100;
+    data.resize(X.rows * X.cols * n_shuffles);
+    for (int c = 0; c < X.cols * n_shuffles; c++)
+    {
+        double* column = &data[c * X.rows];
+        for (int i = 0; i < X.rows; i++)
+            column[i] = X.at<double>(i, c % X.cols);
+        std::random_shuffle(column, column + X.rows);
+    }
+    times = time_sorts(data, X.rows, buffer, n_failed);
+    cout << filename.toStdString() << " " << X.rows << " x " << X.cols << ", ns per value: "
+         << "sort_permutation " << times[0] << ", introsort " << times[1]
+         << ", radix " << times[2] << endl;
+
+    // Synthetic nodes, continuous and integer features, 2M values in total
+    for (int n = 100; n <= 1000000; n *= 10)
+    {
+        data.resize(std::max(2000000, n));
+        for (int kind = 0; kind < 2; kind++)
+        {
+            for (size_t i = 0; i < data.size(); i++)
+                data[i] = (kind == 0) ? rand() / (double)RAND_MAX - 0.5 : rand() % 100;
+            times = time_sorts(data, n, buffer, n_failed);
+            cout << n << (kind == 0 ? " uniform" : " integer") << " values, ns per value: "
+                 << "sort_permutation " << times[0] << ", introsort " << times[1]
+                 << ", radix " << times[2] << endl;
+        }
+    }
+    return n_failed;
+}
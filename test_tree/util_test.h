@@ -4,8 +4,10 @@
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <QtCore>
 using namespace std;
 
 int sort_apply_permutation_test();
+int sort_samples_test(QString filename);
 
 #endif // UTIL_TEST_H
@@ -0,0 +1,141 @@
+#include "argsort.h"
+#include "util.h"
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <list>
+#include <functional>
+using std::vector;
+
+/**
+ * @brief A dataset and the argsort of its features
+ */
+struct ArgsortEntry
+{
+    Mat data;
+    Mat argsorted;
+};
+
+static std::mutex argsort_mutex;
+static std::list<ArgsortEntry> argsort_cache;  // Most recently used first
+
+static bool same_dataset(const Mat& a,
+                         const Mat& b)
+{
+    return (a.data == b.data && a.rows == b.rows &&
+            a.cols == b.cols && a.type() == b.type());
+}
+
+/**
+ * @brief Argsort the features [first, last) of X_col into argsorted
+ */
+static void argsort_features(const Mat& X_col,
+                             Mat& argsorted,
+                             int first,
+                             int last)
+{
+    int n = X_col.cols;
+    vector<double> values(n);
+    SortBuffer buffer;
+    for (int j = first; j < last; j++)
+    {
+        const double* Xf = X_col.ptr<double>(j);
+        int* order = argsorted.ptr<int>(j);
+        std::copy(Xf, Xf + n, values.begin());
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        sort_samples(&values[0], order, n, buffer);
+    }
+}
+
+/**
+ * @brief Whether every row of argsorted still sorts the same row of X_col,
+ * i.e. X wasn't changed in place since it was sorted
+ */
+static bool sorts_columns(const Mat& X_col,
+                          const Mat& argsorted)
+{
+    int n = X_col.cols;
+    for (int j = 0; j < X_col.rows; j++)
+    {
+        const double* Xf = X_col.ptr<double>(j);
+        const int* order = argsorted.ptr<int>(j);
+        for (int i = 1; i < n; i++)
+            if (Xf[order[i]] < Xf[order[i - 1]])
+                return false;
+    }
+    return true;
+}
+
+Mat argsort_columns(Mat data,
+                    Mat X_col,
+                    int n_threads)
+{
+    std::lock_guard<std::mutex> lock(argsort_mutex);
+
+    std::list<ArgsortEntry>::iterator it;
+    for (it = argsort_cache.begin(); it != argsort_cache.end(); ++it)
+    {
+        if (same_dataset(it->data, data))
+        {
+            if (!sorts_columns(X_col, it->argsorted))
+            {
+                // X was changed in place, sort it again
+                argsort_cache.erase(it);
+                break;
+            }
+            argsort_cache.splice(argsort_cache.begin(), argsort_cache, it);
+            return it->argsorted;
+        }
+    }
+
+    // Sort the features by blocks, one per thread
+    Mat argsorted(X_col.rows, X_col.cols, CV_32S);
+    if (n_threads <= 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::max(1, std::min(n_threads, X_col.rows));
+
+    if (n_threads == 1)
+        argsort_features(X_col, argsorted, 0, X_col.rows);
+    else
+    {
+        vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++)
+            threads.push_back(std::thread(argsort_features, std::cref(X_col), std::ref(argsorted),
+                                          X_col.rows * t / n_threads,
+                                          X_col.rows * (t + 1) / n_threads));
+        for (int t = 0; t < n_threads; t++)
+            threads[t].join();
+    }
+
+    ArgsortEntry entry;
+    entry.data = data;
+    entry.argsorted = argsorted;
+    argsort_cache.push_front(entry);
+    if (argsort_cache.size() > static_cast<size_t>(ARGSORT_CACHE_SIZE))
+        argsort_cache.pop_back();
+    return argsorted;
+}
+
+bool release_argsort(Mat data)
+{
+    std::lock_guard<std::mutex> lock(argsort_mutex);
+
+    std::list<ArgsortEntry>::iterator it;
+    for (it = argsort_cache.begin(); it != argsort_cache.end(); ++it)
+    {
+        if (same_dataset(it->data, data))
+        {
+            argsort_cache.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void clear_argsort_cache()
+{
+    std::lock_guard<std::mutex> lock(argsort_mutex);
+    argsort_cache.clear();
+}
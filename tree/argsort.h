@@ -0,0 +1,57 @@
+#ifndef ARGSORT_H
+#define ARGSORT_H
+
+//========================================
+// Argsort
+// Argsort of the features of a dataset, shared by the PresortBestSplitters
+// of all the trees fitted on it
+//========================================
+
+#include <opencv2/opencv.hpp>
+using cv::Mat;
+
+/**
+ * @brief Number of datasets whose argsort is kept by argsort_columns
+ */
+const int ARGSORT_CACHE_SIZE = 4;
+
+/**
+ * @brief Argsort of every feature of a dataset, computed once and shared by
+ * the PresortBestSplitters of all the trees fitted on it, e.g. the stages of
+ * a boosting or the members of a forest. Thread safe, the threads asking for
+ * a dataset being sorted wait for it.
+ *
+ * A dataset is identified by the buffer and the shape of data, the Mat the
+ * trees are fitted on (X, or X_col for fit_columns). The cache keeps a
+ * reference to data so that its buffer can't be given to another dataset
+ * while cached, and ColumnDataset releases its X_col when unmapped. The
+ * ARGSORT_CACHE_SIZE datasets used last are kept.
+ *
+ * A cached argsort is checked against X_col before being returned: if X
+ * was changed in place and a feature isn't sorted by it anymore, the
+ * features are sorted again. The check reads X_col once, much less than
+ * the sort.
+ * @param data: identifies the dataset
+ * @param X_col: the features by column, shape = [n_features, n_samples], CV_64F
+ * @param n_threads: number of sorting threads on a miss, 0 for one per core
+ * @return Mat, shape = [n_features, n_samples], CV_32S, row j holds the
+ *         samples in the order of feature j
+ */
+Mat argsort_columns(Mat data,
+                    Mat X_col,
+                    int n_threads=0);
+
+/**
+ * @brief Drop the argsort of a dataset, e.g. before freeing its buffer.
+ * The Mats returned by argsort_columns stay valid.
+ * @param data
+ * @return whether the dataset was cached
+ */
+bool release_argsort(Mat data);
+
+/**
+ * @brief Drop the argsort of all the datasets
+ */
+void clear_argsort_cache();
+
+#endif // ARGSORT_H
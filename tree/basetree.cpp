@@ -1,6 +1,86 @@
 #include "basetree.h"
 #include "criterion.h"
 #include "splitter.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Header of the binary model file, see Tree::save
+ */
+struct TreeFileHeader
+{
+    char magic[8];                  // "GBRTTREE"
+    int32_t version;                // TREE_FILE_VERSION
+    int32_t header_size;            // sizeof(TreeFileHeader)
+    int32_t n_features;
+    int32_t n_classes;
+    int32_t max_depth;
+    int32_t node_count;
+    int32_t node_size;              // sizeof(Node)
+    int32_t node_stats_size;        // sizeof(NodeStats)
+    uint64_t nodes_offset;          // Offset of the nodes in the file
+    uint64_t node_stats_offset;     // Offset of the node statistics in the file
+    uint64_t value_offset;          // Offset of the values in the file
+};
+
+static const char TREE_FILE_MAGIC[8] = {'G', 'B', 'R', 'T', 'T', 'R', 'E', 'E'};
+static const size_t TREE_FILE_ALIGNMENT = 64;
+
+static_assert(sizeof(TreeFileHeader) == 64, "TreeFileHeader must be 64 bytes");
+static_assert(sizeof(Node) == 24, "Node must be 24 bytes");
+static_assert(sizeof(NodeStats) == 24, "NodeStats must be 24 bytes");
+
+/**
+ * @brief Round offset up to the alignment of the arrays in the model file
+ */
+static inline size_t align_offset(size_t offset)
+{
+    return (offset + TREE_FILE_ALIGNMENT - 1) & ~(TREE_FILE_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Whether count items of item_size bytes starting at offset fit in
+ * file_size bytes, without overflowing
+ */
+static inline bool array_fits(uint64_t offset,
+                              size_t count,
+                              size_t item_size,
+                              size_t file_size)
+{
+    return offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+/**
+ * @brief Whether a node read from a model file is a leaf, or a split node
+ * whose children come after it, which also rules out cycles, and whose
+ * feature is a column of X
+ */
+static inline bool valid_node(const Node& node,
+                              int node_id,
+                              int node_count,
+                              int n_features)
+{
+    if (node.left_child == TREE_LEAF)
+        return node.right_child == TREE_LEAF;
+    return (node.left_child > node_id && node.left_child < node_count &&
+            node.right_child > node_id && node.right_child < node_count &&
+            node.feature >= 0 && node.feature < n_features);
+}
+
+/**
+ * @brief The model file is little-endian, and is mapped as is
+ */
+static inline bool is_little_endian()
+{
+    const uint32_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
 
 Tree::Tree(int n_features,
            int n_classes)
@@ -8,14 +88,39 @@ Tree::Tree(int n_features,
       _n_classes(n_classes),    // Inner structures
       _max_depth(0),
       _node_count(0),
-      _capacity(0)
+      _capacity(0),
+      _node_data(NULL),
+      _node_stats_data(NULL),
+      _value_data(NULL),
+      _mapping(NULL),
+      _mapping_size(0)
 {
 
 }
 
 Tree::~Tree()
 {
+    if (_mapping != NULL)
+        munmap(_mapping, _mapping_size);
+}
+
+void Tree::_bind_vectors()
+{
+    _node_data = _nodes.empty() ? NULL : &_nodes[0];
+    _node_stats_data = _node_stats.empty() ? NULL : &_node_stats[0];
+    _value_data = _value.empty() ? NULL : &_value[0];
+}
+
+void Tree::_unmap()
+{
+    _nodes.assign(_node_data, _node_data + _node_count);
+    _node_stats.assign(_node_stats_data, _node_stats_data + _node_count);
+    _value.assign(_value_data, _value_data + static_cast<size_t>(_node_count) * _n_classes);
 
+    munmap(_mapping, _mapping_size);
+    _mapping = NULL;
+    _mapping_size = 0;
+    _bind_vectors();
 }
 
 int Tree::_add_node(int parent,
@@ -29,14 +134,20 @@ int Tree::_add_node(int parent,
 {
     int node_id = _node_count;
 
-    // Insure _nodes has enough elements
-    Node n = Node();
-    _nodes.push_back(n);
+    // A loaded tree grows in its own arrays
+    if (_mapping != NULL)
+        _unmap();
 
-    Node* node = &(_nodes.at(node_id));
-    node->impurity = impurity;
-    node->n_node_samples = n_node_samples;
-    node->weighted_n_node_samples = weighted_n_node_samples;
+    // Insure _nodes, _node_stats and _value have enough elements
+    _nodes.push_back(Node());
+    _node_stats.push_back(NodeStats());
+    _value.resize(_value.size() + _n_classes, 0.0);
+    _bind_vectors();
+
+    NodeStats* stats = &(_node_stats[node_id]);
+    stats->impurity = impurity;
+    stats->n_node_samples = n_node_samples;
+    stats->weighted_n_node_samples = weighted_n_node_samples;
 
     if (parent != TREE_UNDEFINED)
     {
@@ -50,6 +161,7 @@ int Tree::_add_node(int parent,
         }
     }
 
+    Node* node = &(_nodes[node_id]);
     if (is_leaf)
     {
         node->left_child = TREE_LEAF;
@@ -68,74 +180,176 @@ int Tree::_add_node(int parent,
     return node_id;
 }
 
+void Tree::_set_leaf(int node_id)
+{
+    Node* node = &(_nodes[node_id]);
+    node->left_child = TREE_LEAF;
+    node->right_child = TREE_LEAF;
+    node->feature = TREE_UNDEFINED;
+    node->threshold = TREE_UNDEFINED;
+}
+
+void Tree::_set_value(int node_id,
+                      const vector<double>& value)
+{
+    std::copy(value.begin(), value.begin() + _n_classes, this->value(node_id));
+}
+
 Mat Tree::predict(Mat _X)
+{
+    Mat leaves = apply(_X);
+    int n_samples = _X.rows;
+    Mat_<double> result(n_samples, 1);
+    const int* leaf = leaves.ptr<int>(0);
+    double* out = result.ptr<double>(0);
+
+    const double* value;
+    for (int i = 0; i < n_samples; i++)
+    {
+        value = this->value(leaf[i]);
+
+        // If _n_classes > 1, means this is a classification
+        if (_n_classes > 1)
+            out[i] = static_cast<double>(std::max_element(value, value + _n_classes) - value);
+        else
+            out[i] = value[0];
+    }
+    return result;
+}
+
+Mat Tree::apply(Mat _X)
 {
     // TODO: sparse matrix
     return _apply_dense(_X);
 }
 
+/**
+ * @brief Node of the walk of Tree::_apply_dense. A leaf is its own left and
+ * right child, so that a row stays in its leaf for the remaining steps.
+ */
+struct WalkNode
+{
+    int children[2];                // Left child, then right child
+    int feature;
+    double threshold;
+};
+
+/**
+ * @brief Rows walked down the tree together by Tree::_apply_dense
+ */
+static const int APPLY_BLOCK_SIZE = 32;
+
 Mat Tree::_apply_dense(Mat _X)
 {
-    Node* node;
-    int drop = 0;
+    const Node* nodes = _node_data;
     int n_samples = _X.rows;
-    Mat_<double> result(n_samples, 1);
+    Mat result(n_samples, 1, CV_32S);
+    int* out = result.ptr<int>(0);
 
-    for (int i = 0; i < n_samples; i++)
+    // A lockstep walk costs a pass over the nodes, too much for a few rows
+    if (n_samples < APPLY_BLOCK_SIZE || n_samples < _node_count / APPLY_BLOCK_SIZE)
     {
-        drop = 0;
-        node = &(_nodes.at(drop));
-
-        // Down from the tree root
-        // While node is not a leaf
-        while (node->left_child != TREE_LEAF)
+        const Node* node;
+        const double* row;
+        for (int i = 0; i < n_samples; i++)
         {
-            // and node.right_child != TreeType::TREE_LEAF
-            if (_X.at<double>(i, node->feature) <= node->threshold)
+            row = _X.ptr<double>(i);
+            node = nodes;
+
+            // Down from the tree root
+            // While node is not a leaf
+            while (node->left_child != TREE_LEAF)
             {
-                drop = node->left_child;
-                node = &(_nodes.at(node->left_child));
+                if (row[node->feature] <= node->threshold)
+                    node = nodes + node->left_child;
+                else
+                    node = nodes + node->right_child;
             }
-            else
+
+            out[i] = static_cast<int>(node - nodes);
+        }
+        return result;
+    }
+
+    // The children of a node come after it, which gives the depth of the tree
+    vector<WalkNode> walk(_node_count);
+    vector<int> depth(_node_count, 0);
+    int max_depth = 0;
+    for (int i = 0; i < _node_count; i++)
+    {
+        if (nodes[i].left_child == TREE_LEAF)
+        {
+            walk[i].children[0] = i;
+            walk[i].children[1] = i;
+            walk[i].feature = 0;
+            walk[i].threshold = 0.0;
+            continue;
+        }
+        walk[i].children[0] = nodes[i].left_child;
+        walk[i].children[1] = nodes[i].right_child;
+        walk[i].feature = nodes[i].feature;
+        walk[i].threshold = nodes[i].threshold;
+        depth[nodes[i].left_child] = depth[i] + 1;
+        depth[nodes[i].right_child] = depth[i] + 1;
+        max_depth = std::max(max_depth, depth[i] + 1);
+    }
+
+    // The rows of a block take max_depth steps down the tree in lockstep.
+    // The steps of different rows are independent, so their loads overlap
+    // instead of waiting for each other, and a step has no branch: NaN
+    // fails the comparison and goes right, as in the walk above.
+    const WalkNode* walk_nodes = &walk[0];
+    const WalkNode* node;
+    const double* rows[APPLY_BLOCK_SIZE];
+    int current[APPLY_BLOCK_SIZE];
+    int block_size;
+    for (int block_start = 0; block_start < n_samples; block_start += APPLY_BLOCK_SIZE)
+    {
+        block_size = std::min(APPLY_BLOCK_SIZE, n_samples - block_start);
+        for (int j = 0; j < block_size; j++)
+        {
+            rows[j] = _X.ptr<double>(block_start + j);
+            current[j] = 0;
+        }
+
+        for (int d = 0; d < max_depth; d++)
+        {
+            for (int j = 0; j < block_size; j++)
             {
-                drop = node->right_child;
-                node = &(_nodes.at(node->right_child));
+                node = walk_nodes + current[j];
+                current[j] = node->children[!(rows[j][node->feature] <= node->threshold)];
             }
         }
 
-        // Get the iterator of droped node
-        vector<double>::iterator c = max_element(_value.at(drop).begin(), _value.at(drop).end());
-
-        // If _value.size > 1, means this is a classification
-        if (_value.at(drop).size() > 1)
-            result.at<double>(i, 0) = static_cast<double>(distance(_value.at(drop).begin(), c));
-        else
-            result.at<double>(i, 0) = *c;
+        for (int j = 0; j < block_size; j++)
+            out[block_start + j] = current[j];
     }
     return result;
 }
 
 Mat Tree::compute_feature_importances(bool normalize)
 {
-    // TODO
     Mat result = Mat::zeros(_n_features, 1, CV_64F);
-    Node left, right;
+    const NodeStats* stats;
+    const NodeStats* left;
+    const NodeStats* right;
 
-    for (vector<Node>::iterator it = _nodes.begin(); it != _nodes.end(); it++)
+    for (int i = 0; i < _node_count; i++)
     {
-        if (it->left_child != TREE_LEAF)
+        if (_node_data[i].left_child != TREE_LEAF)
         {
-            left = _nodes.at(it->left_child);
-            right = _nodes.at(it->right_child);
+            stats = &_node_stats_data[i];
+            left = &_node_stats_data[_node_data[i].left_child];
+            right = &_node_stats_data[_node_data[i].right_child];
 
-            result.at<double>(it->feature, 0) += (
-                        it->weighted_n_node_samples * it->impurity -
-                        left.weighted_n_node_samples * left.impurity -
-                        right.weighted_n_node_samples * right.impurity);
+            result.at<double>(_node_data[i].feature, 0) += (
+                        stats->weighted_n_node_samples * stats->impurity -
+                        left->weighted_n_node_samples * left->impurity -
+                        right->weighted_n_node_samples * right->impurity);
         }
     }
 
-    result /= _nodes.at(0).weighted_n_node_samples;
+    result /= _node_stats_data[0].weighted_n_node_samples;
 
     if (normalize)
     {
@@ -147,3 +361,140 @@ Mat Tree::compute_feature_importances(bool normalize)
     }
     return result;
 }
+
+int Tree::save(const char* filename)
+{
+    if (!is_little_endian())
+        return 3;
+
+    size_t nodes_offset = align_offset(sizeof(TreeFileHeader));
+    size_t node_stats_offset = align_offset(nodes_offset + _node_count * sizeof(Node));
+    size_t value_offset = align_offset(node_stats_offset + _node_count * sizeof(NodeStats));
+    size_t file_size = value_offset + static_cast<size_t>(_node_count) * _n_classes * sizeof(double);
+
+    // Zeroed, so that the alignment and the struct padding are deterministic
+    vector<char> buffer(file_size, 0);
+
+    TreeFileHeader* header = reinterpret_cast<TreeFileHeader*>(&buffer[0]);
+    memcpy(header->magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC));
+    header->version = TREE_FILE_VERSION;
+    header->header_size = sizeof(TreeFileHeader);
+    header->n_features = _n_features;
+    header->n_classes = _n_classes;
+    header->max_depth = _max_depth;
+    header->node_count = _node_count;
+    header->node_size = sizeof(Node);
+    header->node_stats_size = sizeof(NodeStats);
+    header->nodes_offset = nodes_offset;
+    header->node_stats_offset = node_stats_offset;
+    header->value_offset = value_offset;
+
+    Node* nodes = reinterpret_cast<Node*>(&buffer[nodes_offset]);
+    NodeStats* node_stats = reinterpret_cast<NodeStats*>(&buffer[node_stats_offset]);
+    for (int i = 0; i < _node_count; i++)
+    {
+        nodes[i].left_child = _node_data[i].left_child;
+        nodes[i].right_child = _node_data[i].right_child;
+        nodes[i].feature = _node_data[i].feature;
+        nodes[i].threshold = _node_data[i].threshold;
+
+        node_stats[i].impurity = _node_stats_data[i].impurity;
+        node_stats[i].n_node_samples = _node_stats_data[i].n_node_samples;
+        node_stats[i].weighted_n_node_samples = _node_stats_data[i].weighted_n_node_samples;
+    }
+    if (_node_count > 0)
+        memcpy(&buffer[value_offset], _value_data,
+               static_cast<size_t>(_node_count) * _n_classes * sizeof(double));
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL)
+        return 1;
+    size_t written = fwrite(&buffer[0], 1, file_size, file);
+    if (fclose(file) != 0 || written != file_size)
+        return 2;
+    return 0;
+}
+
+int Tree::load(const char* filename)
+{
+    if (!is_little_endian())
+        return 5;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        static_cast<size_t>(file_stat.st_size) < sizeof(TreeFileHeader))
+    {
+        close(fd);
+        return 2;
+    }
+    size_t file_size = file_stat.st_size;
+
+    // Private mapping: the pages stay shared with the page cache until written
+    void* mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return 2;
+
+    const char* data = static_cast<const char*>(mapping);
+    const TreeFileHeader* header = reinterpret_cast<const TreeFileHeader*>(data);
+
+    // Validation
+    if (memcmp(header->magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC)) != 0 ||
+        header->version != TREE_FILE_VERSION ||
+        header->header_size != static_cast<int32_t>(sizeof(TreeFileHeader)) ||
+        header->node_size != static_cast<int32_t>(sizeof(Node)) ||
+        header->node_stats_size != static_cast<int32_t>(sizeof(NodeStats)) ||
+        header->node_count < 1 || header->n_features <= 0 || header->n_classes <= 0)
+    {
+        munmap(mapping, file_size);
+        return 3;
+    }
+
+    // Validation
+    size_t node_count = header->node_count;
+    if (header->nodes_offset % TREE_FILE_ALIGNMENT != 0 ||
+        header->node_stats_offset % TREE_FILE_ALIGNMENT != 0 ||
+        header->value_offset % TREE_FILE_ALIGNMENT != 0 ||
+        !array_fits(header->nodes_offset, node_count, sizeof(Node), file_size) ||
+        !array_fits(header->node_stats_offset, node_count, sizeof(NodeStats), file_size) ||
+        !array_fits(header->value_offset, node_count, header->n_classes * sizeof(double), file_size))
+    {
+        munmap(mapping, file_size);
+        return 4;
+    }
+
+    // Validation, apply must stay in the arrays
+    const Node* nodes = reinterpret_cast<const Node*>(data + header->nodes_offset);
+    for (int i = 0; i < header->node_count; i++)
+    {
+        if (!valid_node(nodes[i], i, header->node_count, header->n_features))
+        {
+            munmap(mapping, file_size);
+            return 6;
+        }
+    }
+
+    // Replace the tree
+    if (_mapping != NULL)
+        munmap(_mapping, _mapping_size);
+    vector<Node>().swap(_nodes);
+    vector<NodeStats>().swap(_node_stats);
+    vector<double>().swap(_value);
+
+    _n_features = header->n_features;
+    _n_classes = header->n_classes;
+    _max_depth = header->max_depth;
+    _node_count = header->node_count;
+    _capacity = header->node_count;
+
+    _mapping = mapping;
+    _mapping_size = file_size;
+    _node_data = reinterpret_cast<Node*>(static_cast<char*>(mapping) + header->nodes_offset);
+    _node_stats_data = reinterpret_cast<NodeStats*>(static_cast<char*>(mapping) + header->node_stats_offset);
+    _value_data = reinterpret_cast<double*>(static_cast<char*>(mapping) + header->value_offset);
+    return 0;
+}
@@ -11,6 +11,11 @@ using cv::Mat;
 class Criterion;
 class Splitter;
 
+/**
+ * @brief Version of the binary model file written by Tree::save
+ */
+const int TREE_FILE_VERSION = 1;
+
 /**
  * @brief Define the TreeType
  */
@@ -21,7 +26,9 @@ enum TreeType
 };
 
 /**
- * @brief Base storage structure for the nodes in a Tree object
+ * @brief Base storage structure for the nodes in a Tree object.
+ * Only holds what is needed to walk down the tree, so that a node fits in
+ * 24 bytes and more nodes share a cache line during the predictions.
  */
 struct Node
 {
@@ -29,16 +36,29 @@ struct Node
     int right_child;                // id of the right child of the node
     int feature;                    // Feature used for splitting the node
     double threshold;               // Threshold value at the node
-    double impurity;                // Impurity of the node (i.e., the value of the criterion)
-    int n_node_samples;             // Number of samples at the node
-    double weighted_n_node_samples; // Weighted number of samples at the node
 
     bool operator== (const Node& a){
         if (a.left_child == left_child &&
             a.right_child == right_child &&
             a.feature == feature &&
-            a.threshold == threshold &&
-            a.impurity == impurity &&
+            a.threshold == threshold)
+            return true;
+        return false;
+    }
+};
+
+/**
+ * @brief Training statistics of the nodes in a Tree object, stored apart
+ * from the Node array since they are not used for the predictions.
+ */
+struct NodeStats
+{
+    double impurity;                // Impurity of the node (i.e., the value of the criterion)
+    int n_node_samples;             // Number of samples at the node
+    double weighted_n_node_samples; // Weighted number of samples at the node
+
+    bool operator== (const NodeStats& a){
+        if (a.impurity == impurity &&
             a.n_node_samples == n_node_samples &&
             a.weighted_n_node_samples == weighted_n_node_samples)
             return true;
@@ -91,8 +111,10 @@ public:
      * threshold : array of double, shape [node_count]
      *  threshold[i] holds the threshold for the internal node i.
      *
-     * value : array of double, shape [node_count, n_outputs, max_n_classes]
-     *  Contains the constant prediction value of each node.
+     * value : array of double, shape [node_count, n_classes]
+     *  Contains the constant prediction value of each node, in one
+     *  contiguous buffer: value(i) points to value[i * n_classes].
+     *  n_classes is 1 for a regression tree.
      *
      * impurity : array of double, shape [node_count]
      *  impurity[i] holds the impurity (i.e., the value of the splitting
@@ -105,6 +127,15 @@ public:
      *  weighted_n_node_samples[i] holds the weighted number of training samples
      *  reaching node i.
      *
+     * The hot arrays children_left, children_right, feature and threshold
+     * are stored together in `_nodes`, the statistics impurity,
+     * n_node_samples and weighted_n_node_samples in `_node_stats`.
+     *
+     * A tree built by a TreeBuilder owns these arrays. A tree read by `load`
+     * points into the mapped model file instead and the vectors are empty,
+     * so the arrays are always accessed through `nodes()`, `node_stats()`
+     * and `value()`.
+     *
      * # Wrap for outside world.
      * # WARNING: these reference the current `nodes` and `value` buffers, which
      * # must not be be freed by a subsequent memory allocation.
@@ -134,6 +165,49 @@ public:
                   double impurity,
                   int n_node_samples,
                   double weighted_n_node_samples);
+    /**
+     * @brief Get the array of nodes.
+     * @return pointer to the _node_count nodes
+     */
+    const Node* nodes() const
+    {
+        return _node_data;
+    }
+
+    /**
+     * @brief Get the training statistics of the nodes.
+     * @return pointer to the _node_count statistics
+     */
+    const NodeStats* node_stats() const
+    {
+        return _node_stats_data;
+    }
+
+    /**
+     * @brief Get the value of a node.
+     * @param node_id
+     * @return pointer to the _n_classes values of the node
+     */
+    double* value(int node_id)
+    {
+        return _value_data + static_cast<size_t>(node_id) * _n_classes;
+    }
+
+    /**
+     * @brief Turn a node added as a split node, whose children haven't been
+     * added, into a leaf.
+     * @param node_id
+     */
+    void _set_leaf(int node_id);
+
+    /**
+     * @brief Set the value of a node.
+     * @param node_id
+     * @param value: _n_classes values
+     */
+    void _set_value(int node_id,
+                    const vector<double>& value);
+
     /**
      * @brief Predict target for X.
      * @param X
@@ -144,14 +218,16 @@ public:
     /**
      * @brief Finds the terminal region (=leaf node) for each sample in X.
      * @param X
-     * @return
+     * @return The leaf node id of every sample, shape = [n_samples, 1], CV_32S
      */
     Mat apply(Mat X);
 
     /**
      * @brief Finds the terminal region (=leaf node) for each sample in X.
+     * X must be a CV_64F matrix. Unless there are few rows, blocks of rows
+     * walk down the tree in lockstep, for as many steps as the tree is deep.
      * @param X
-     * @return
+     * @return The leaf node id of every sample, shape = [n_samples, 1], CV_32S
      */
     Mat _apply_dense(Mat X);
 
@@ -162,10 +238,56 @@ public:
      */
     Mat compute_feature_importances(bool normalize);
 
+    /**
+     * @brief Write the tree to a binary model file.
+     *
+     * The file is little-endian: a 64 bytes header (magic "GBRTTREE",
+     * TREE_FILE_VERSION, layout and array offsets) followed by the nodes,
+     * the node statistics and the values, each array starting on a 64 bytes
+     * boundary and laid out exactly like Node, NodeStats and double in
+     * memory.
+     * @param filename
+     * @return error_code
+     */
+    int save(const char* filename);
+
+    /**
+     * @brief Read a model file written by `save`, replacing the tree.
+     *
+     * The file is mapped copy-on-write and the tree predicts directly from
+     * the mapped arrays, nothing is parsed or copied: the pages are shared
+     * with every other tree mapping the same file. Changing a value only
+     * affects this tree, adding a node copies the arrays first.
+     *
+     * The header, the bounds of the arrays and the children and feature of
+     * every node are checked first, so that a corrupt file can't make
+     * apply read outside of the mapping.
+     * @param filename
+     * @return error_code: 1 can't open, 2 shorter than the header or can't
+     *         map, 3 invalid header, 4 arrays out of the file, 5 big-endian
+     *         host, 6 invalid node
+     */
+    int load(const char* filename);
+
+protected:
+    // Not copyable, the array pointers would be shared
+    Tree(const Tree&);
+    Tree& operator=(const Tree&);
+
+    /**
+     * @brief Point the array accessors to the vectors.
+     */
+    void _bind_vectors();
+
+    /**
+     * @brief Copy the mapped arrays into the vectors and unmap the file.
+     */
+    void _unmap();
+
 public:
     // Input/Output layout
     int _n_features;             // Number of features in X
-    int _n_classes;              // max(n_classes)
+    int _n_classes;              // max(n_classes), 1 for regression
 
     // Inner structures: values are stored separately from node structure,
     // since size is determined at runtime.
@@ -173,7 +295,15 @@ public:
     int _node_count;             // Counter for node IDs
     int _capacity;               // Capacity of tree, in terms of nodes
     vector<Node> _nodes;         // Array of nodes
-    vector<vector<double>> _value;       // The value of every node
+    vector<NodeStats> _node_stats;       // Training statistics of every node
+    vector<double> _value;       // The value of every node, shape [node_count, n_classes]
+
+    // Current arrays, either the vectors or the mapped model file
+    Node* _node_data;
+    NodeStats* _node_stats_data;
+    double* _value_data;
+    void* _mapping;              // Mapped model file, NULL if the tree owns its arrays
+    size_t _mapping_size;
 };
 
 #endif // BASETREE_H
@@ -0,0 +1,111 @@
+#include "binmapper.h"
+#include <algorithm>
+
+BinMapper::BinMapper(int _max_bins)
+    : max_bins(_max_bins),
+      n_samples(0),
+      n_features(0)
+{
+    // Bins are stored as unsigned char
+    if (max_bins > MAX_BINS)
+        max_bins = MAX_BINS;
+    if (max_bins < 2)
+        max_bins = 2;
+}
+
+BinMapper::~BinMapper()
+{
+
+}
+
+/**
+ * @brief Mid-point between two consecutive values a < b, guaranteed to be
+ * in [a, b), so that a goes to the left and b to the right.
+ */
+static inline double bin_edge(double a, double b)
+{
+    double edge = (a + b) / 2.0;
+    if (edge == b)
+        edge = a;
+    return edge;
+}
+
+int BinMapper::fit(Mat X_col)
+{
+    if (X_col.rows == 0 || X_col.cols == 0)
+        return 1;
+
+    n_samples = X_col.cols;
+    n_features = X_col.rows;
+
+    thresholds.clear();
+    thresholds.resize(n_features);
+    binned.resize(static_cast<size_t>(n_samples) * n_features);
+
+    vector<double> values(n_samples);
+    vector<double> distinct;
+    vector<int> counts;
+
+    const double* Xf;
+    for (int j = 0; j < n_features; j++)
+    {
+        Xf = X_col.ptr<double>(j);
+        values.assign(Xf, Xf + n_samples);
+        std::sort(values.begin(), values.end());
+
+        // Collect the distinct values and their counts
+        distinct.clear();
+        counts.clear();
+        for (int i = 0; i < n_samples; i++)
+        {
+            if (distinct.empty() || values[i] != distinct.back())
+            {
+                distinct.push_back(values[i]);
+                counts.push_back(0);
+            }
+            counts.back() += 1;
+        }
+
+        vector<double>& edges = thresholds[j];
+        int n_distinct = distinct.size();
+
+        if (n_distinct <= max_bins)
+        {
+            // One bin per distinct value
+            for (int i = 1; i < n_distinct; i++)
+                edges.push_back(bin_edge(distinct[i-1], distinct[i]));
+        }
+        else
+        {
+            // Cut at the quantiles, never inside a run of equal values
+            double per_bin = static_cast<double>(n_samples) / max_bins;
+            double cum = 0.0;
+            int next = 1;
+            for (int i = 0; i < n_distinct - 1; i++)
+            {
+                cum += counts[i];
+                if (cum >= next * per_bin)
+                {
+                    edges.push_back(bin_edge(distinct[i], distinct[i+1]));
+                    while (cum >= next * per_bin)
+                        next += 1;
+                    if (static_cast<int>(edges.size()) == max_bins - 1)
+                        break;
+                }
+            }
+        }
+
+        // Bin the column
+        unsigned char* col = &binned[0] + static_cast<size_t>(j) * n_samples;
+        for (int i = 0; i < n_samples; i++)
+            col[i] = static_cast<unsigned char>(bin_of(j, Xf[i]));
+    }
+    return 0;
+}
+
+int BinMapper::bin_of(int feature, double value) const
+{
+    const vector<double>& edges = thresholds[feature];
+    return static_cast<int>(std::lower_bound(edges.begin(), edges.end(), value) -
+                            edges.begin());
+}
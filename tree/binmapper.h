@@ -0,0 +1,82 @@
+#ifndef BINMAPPER_H
+#define BINMAPPER_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+using std::vector;
+using cv::Mat;
+
+const int MAX_BINS = 255;
+
+/**
+ * @brief The BinMapper quantizes every feature of X into at most `max_bins`
+ * ordinal bins.
+ *
+ * For every feature j, `thresholds[j]` holds the sorted upper edges of the
+ * bins, i.e. a sample goes into bin b iff
+ *
+ *     thresholds[j][b-1] < X[i, j] <= thresholds[j][b]
+ *
+ * so that splitting a node on "bin <= b" is the same as splitting it on
+ * "X[i, j] <= thresholds[j][b]", and the fitted Tree can still be applied on
+ * the raw feature values.
+ *
+ * If a feature has less than `max_bins` distinct values, every distinct
+ * value gets its own bin and the edges are the mid-points between
+ * consecutive values, which gives exactly the candidate thresholds of the
+ * BestSplitter. Otherwise the edges are taken at the quantiles of the values.
+ *
+ * The binned matrix is stored column-major: `binned[j * n_samples + i]`
+ * holds the bin of X[i, j].
+ */
+class BinMapper
+{
+public:
+    BinMapper(int max_bins=MAX_BINS);
+    ~BinMapper();
+
+    /**
+     * @brief Compute the bin thresholds of every feature and bin X.
+     * @param X_col The training input samples by column, X.t(),
+     *              shape = [n_features, n_samples]
+     * @return error_code
+     */
+    int fit(Mat X_col);
+
+    /**
+     * @brief Find the bin of a value for the given feature.
+     * @param feature
+     * @param value
+     * @return bin index
+     */
+    int bin_of(int feature, double value) const;
+
+    /**
+     * @brief Get the number of bins used for the given feature.
+     * @param feature
+     * @return n_bins
+     */
+    int n_bins(int feature) const
+    {
+        return static_cast<int>(thresholds[feature].size()) + 1;
+    }
+
+    /**
+     * @brief Get the binned column of the given feature.
+     * @param feature
+     * @return pointer to binned[feature * n_samples]
+     */
+    const unsigned char* column(int feature) const
+    {
+        return &binned[0] + static_cast<size_t>(feature) * n_samples;
+    }
+
+public:
+    int max_bins;                       // Max number of bins per feature
+    int n_samples;                      // X.shape[0]
+    int n_features;                     // X.shape[1]
+    vector<vector<double> > thresholds; // Upper edges of the bins, per feature
+    vector<unsigned char> binned;       // Binned X, column-major
+};
+
+#endif // BINMAPPER_H
@@ -0,0 +1,141 @@
+#include "codegen.h"
+#include "basetree.h"
+#include <algorithm>
+#include <sstream>
+#include <limits>
+
+/**
+ * @brief Write a double so that it is read back exactly.
+ */
+static string literal(double value)
+{
+    // inf and nan aren't C++ literals
+    if (value != value)
+        return "std::numeric_limits<double>::quiet_NaN()";
+    if (value == std::numeric_limits<double>::infinity())
+        return "std::numeric_limits<double>::infinity()";
+    if (value == -std::numeric_limits<double>::infinity())
+        return "-std::numeric_limits<double>::infinity()";
+
+    std::ostringstream out;
+    out.precision(std::numeric_limits<double>::digits10 + 2);
+    out << value;
+
+    // Keep it a double literal, e.g. "3" -> "3.0"
+    string s = out.str();
+    if (s.find_first_of(".eEn") == string::npos)
+        s += ".0";
+    return s;
+}
+
+/**
+ * @brief What Tree::predict returns for a leaf.
+ */
+static double leaf_prediction(Tree* tree,
+                              int node_id)
+{
+    const double* value = tree->value(node_id);
+    if (tree->_n_classes > 1)
+        return static_cast<double>(std::max_element(value, value + tree->_n_classes) - value);
+    return value[0];
+}
+
+/**
+ * @brief Write the subtree rooted at node_id as nested if/else.
+ */
+static void write_node(std::ostringstream& out,
+                       Tree* tree,
+                       int node_id,
+                       int depth)
+{
+    string indent(4 * (depth + 1), ' ');
+    const Node& node = tree->nodes()[node_id];
+
+    if (node.left_child == TREE_LEAF)
+    {
+        out << indent << "return " << literal(leaf_prediction(tree, node_id)) << ";\n";
+        return;
+    }
+
+    out << indent << "if (x[" << node.feature << "] <= " << literal(node.threshold) << ")\n"
+        << indent << "{\n";
+    write_node(out, tree, node.left_child, depth + 1);
+    out << indent << "}\n"
+        << indent << "else\n"
+        << indent << "{\n";
+    write_node(out, tree, node.right_child, depth + 1);
+    out << indent << "}\n";
+}
+
+/**
+ * @brief Write a function "double name(const double* x)" for the tree.
+ */
+static void write_tree_function(std::ostringstream& out,
+                                Tree* tree,
+                                const string& qualifier,
+                                const string& name)
+{
+    out << "// " << tree->_node_count << " nodes, "
+        << tree->_n_features << " features\n"
+        << qualifier << "double " << name << "(const double* x)\n"
+        << "{\n";
+    write_node(out, tree, 0, 0);
+    out << "}\n\n";
+}
+
+/**
+ * @brief Write the batch variant of the function name.
+ */
+static void write_batch_function(std::ostringstream& out,
+                                 const string& name,
+                                 int n_features)
+{
+    out << "extern \"C\" void " << name << "_batch(const double* X, int n_samples, double* out)\n"
+        << "{\n"
+        << "    for (int i = 0; i < n_samples; i++)\n"
+        << "        out[i] = " << name << "(X + static_cast<size_t>(i) * " << n_features << ");\n"
+        << "}\n";
+}
+
+string generate_tree_source(Tree* tree,
+                            const string& name)
+{
+    std::ostringstream out;
+    out << "// Generated from a fitted Tree, do not edit\n\n"
+        << "#include <cstddef>\n"
+        << "#include <limits>\n\n";
+    write_tree_function(out, tree, "extern \"C\" ", name);
+    write_batch_function(out, name, tree->_n_features);
+    return out.str();
+}
+
+string generate_ensemble_source(const vector<Tree*>& trees,
+                                const vector<double>& weights,
+                                double init,
+                                const string& name)
+{
+    std::ostringstream out;
+    out << "// Generated from " << trees.size() << " fitted Trees, do not edit\n\n"
+        << "#include <cstddef>\n"
+        << "#include <limits>\n\n";
+
+    int n_features = 0;
+    for (size_t t = 0; t < trees.size(); t++)
+    {
+        std::ostringstream tree_name;
+        tree_name << name << "_tree_" << t;
+        write_tree_function(out, trees[t], "static ", tree_name.str());
+        n_features = std::max(n_features, trees[t]->_n_features);
+    }
+
+    out << "extern \"C\" double " << name << "(const double* x)\n"
+        << "{\n"
+        << "    double score = " << literal(init) << ";\n";
+    for (size_t t = 0; t < trees.size(); t++)
+        out << "    score += " << literal(weights[t]) << " * " << name << "_tree_" << t << "(x);\n";
+    out << "    return score;\n"
+        << "}\n\n";
+
+    write_batch_function(out, name, n_features);
+    return out.str();
+}
@@ -0,0 +1,58 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+//========================================
+// Code generation
+// Compile fitted trees into standalone C++ source, the generated code only
+// depends on the C++ language (no OpenCV, no headers).
+//========================================
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+class Tree;
+
+/**
+ * @brief Generate the C++ source of a fitted tree.
+ *
+ * The source defines, with C linkage so that it can also be loaded with
+ * dlsym:
+ *
+ *     double <name>(const double* x);
+ *     void <name>_batch(const double* X, int n_samples, double* out);
+ *
+ * The tree is written as nested if/else on "x[feature] <= threshold" with
+ * the thresholds as immediates, so no node data is loaded at prediction
+ * time. The leaves return what Tree::predict returns: the value of the leaf
+ * for a regression tree, the index of the most probable class for a
+ * classification tree. X of the batch variant is row-major, shape =
+ * [n_samples, n_features].
+ * @param tree
+ * @param name: name of the generated function
+ * @return C++ source
+ */
+string generate_tree_source(Tree* tree,
+                            const string& name);
+
+/**
+ * @brief Generate the C++ source of an ensemble of regression trees,
+ * predicting init + sum(weights[t] * trees[t](x)), summed in the order of
+ * the trees (e.g. a GradientBoostingRegressor with init = _init and
+ * weights = learning_rate).
+ *
+ * Defines `<name>` and `<name>_batch` like `generate_tree_source`, every
+ * tree gets a static function `<name>_tree_<t>`.
+ * @param trees
+ * @param weights
+ * @param init
+ * @param name
+ * @return C++ source
+ */
+string generate_ensemble_source(const vector<Tree*>& trees,
+                                const vector<double>& weights,
+                                double init,
+                                const string& name);
+
+#endif // CODEGEN_H
@@ -1,16 +1,18 @@
 #include "criterion.h"
-#include <set>
-using std::set;
+#include "util.h"
+#include "simd.h"
 
 Criterion::Criterion()
-    : start(0),
+    : samples(NULL),
+      start(0),
       pos(0),
       end(0),
       n_node_samples(0),
       weighted_n_samples(0.0),
       weighted_n_node_samples(0.0),
       weighted_n_left(0.0),
-      weighted_n_right(0.0)
+      weighted_n_right(0.0),
+      has_split_constraints(false)
 {
 
 }
@@ -20,6 +22,18 @@ Criterion::~Criterion()
 
 }
 
+void Criterion::init_labels(Mat,
+                            Mat,
+                            int)
+{
+
+}
+
+int Criterion::n_targets()
+{
+    return 1;
+}
+
 double Criterion::impurity_improvement(double impurity)
 {
     double impurity_left, impurity_right;
@@ -33,9 +47,18 @@ double Criterion::impurity_improvement(double impurity)
                      - weighted_n_left / weighted_n_node_samples * impurity_left);
 }
 
+double Criterion::proxy_impurity_improvement()
+{
+    pair<double, double> p = children_impurity();
+
+    return (- weighted_n_right * p.second
+            - weighted_n_left * p.first);
+}
+
 ClassificationCriterion::ClassificationCriterion()
     : Criterion(),
-      n_classes(0)
+      n_classes(0),
+      labels_y(NULL)
 {
 
 }
@@ -55,41 +78,34 @@ void ClassificationCriterion::init(Mat _y,
     y = _y;
     sample_weight = _sample_weight;
     weighted_n_samples = _weight_n_samples;
-    samples = _samples;
+    samples = _samples.data();
     start = _start;
     end = _end;
 
-    // Find how many classes in y
-    set<double> unique;
-    for (int i = 0; i < y.rows; i++)
+    // Encode y only if it wasn't done for this target
+    if (labels_y != y.data || labels.rows != y.rows)
     {
-        if (unique.find(y.at<double>(i)) == unique.end())
-            unique.insert(y.at<double>(i));
+        Mat _labels;
+        vector<double> classes;
+        int _n_classes = encode_labels(y, _labels, classes);
+        init_labels(y, _labels, _n_classes);
     }
-    n_classes = unique.size();
-
-    // Clear
-    label_count_total.clear();
-    label_count_left.clear();
-    label_count_right.clear();
 
-    // Initialize
-    label_count_total.resize(n_classes);
-    label_count_left.resize(n_classes);
-    label_count_right.resize(n_classes);
+    // Clear, the sizes are fixed by init_labels
+    std::fill(label_count_total.begin(), label_count_total.end(), 0.0);
 
     weighted_n_node_samples = 0.0;
     double w = 1.0;
     int index;
     for (int i = start; i < end; i++)
     {
-        index = samples.at(i);
+        index = samples[i];
 
-        if (sample_weight.total() == 0)
+        if (sample_weight.total() != 0)
             w = sample_weight.at<double>(index);
 
         // Get count of every class
-        int c = (int)y.at<double>(index, 0);
+        int c = labels.at<int>(index);
         label_count_total.at(c) += w;
 
         weighted_n_node_samples += w;
@@ -98,6 +114,19 @@ void ClassificationCriterion::init(Mat _y,
     reset();
 }
 
+void ClassificationCriterion::init_labels(Mat _y,
+                                          Mat _labels,
+                                          int _n_classes)
+{
+    labels = _labels;
+    labels_y = _y.data;
+    n_classes = _n_classes;
+
+    label_count_total.assign(n_classes, 0.0);
+    label_count_left.assign(n_classes, 0.0);
+    label_count_right.assign(n_classes, 0.0);
+}
+
 void ClassificationCriterion::reset()
 {
     pos = 0;
@@ -119,12 +148,12 @@ void ClassificationCriterion::update(int new_pos)
     double diff_w = 0.0;
     for (int i = pos; i < new_pos; i++)
     {
-        index = samples.at(i);
+        index = samples[i];
 
         if (sample_weight.total() != 0)
             w = sample_weight.at<double>(index);
 
-        int label_index = static_cast<int>(y.at<double>(index));
+        int label_index = labels.at<int>(index);
         label_count_left.at(label_index) += w;
         label_count_right.at(label_index) -= w;
 
@@ -141,6 +170,36 @@ vector<double> ClassificationCriterion::node_value()
     return label_count_total;
 }
 
+int ClassificationCriterion::n_stats()
+{
+    // weight, label_count[0:n_classes]
+    return 1 + n_classes;
+}
+
+void ClassificationCriterion::add_sample_stats(int index, double* stats)
+{
+    double w = 1.0;
+    if (sample_weight.total() != 0)
+        w = sample_weight.at<double>(index);
+
+    stats[0] += w;
+    stats[1 + labels.at<int>(index)] += w;
+}
+
+void ClassificationCriterion::update_from_stats(const double* stats_left, int new_pos)
+{
+    weighted_n_left = stats_left[0];
+    weighted_n_right = weighted_n_node_samples - weighted_n_left;
+
+    for (int i = 0; i < n_classes; i++)
+    {
+        label_count_left[i] = stats_left[1 + i];
+        label_count_right[i] = label_count_total[i] - label_count_left[i];
+    }
+
+    pos = new_pos;
+}
+
 Entropy::Entropy()
     :ClassificationCriterion()
 {
@@ -152,6 +211,11 @@ Entropy::~Entropy()
 
 }
 
+Criterion* Entropy::clone() const
+{
+    return new Entropy(*this);
+}
+
 double Entropy::node_impurity()
 {
     double total = 0.0;
@@ -172,32 +236,24 @@ double Entropy::node_impurity()
 
 pair<double, double> Entropy::children_impurity()
 {
-    double entropy_left = 0.0;
-    double entropy_right = 0.0;
-    double total_left = 0.0;
-    double total_right = 0.0;
-    double tmp = 0.0;
+    double entropy_left = entropy_sum(&label_count_left[0], n_classes, weighted_n_left);
+    double entropy_right = entropy_sum(&label_count_right[0], n_classes, weighted_n_right);
 
-    for (int i = 0; i < n_classes; i++)
-    {
-        tmp = label_count_left.at(i);
-        if (tmp > 0.0)
-        {
-            tmp /= weighted_n_left;
-            entropy_left -= tmp * log(tmp);
-        }
+    return make_pair(entropy_left, entropy_right);
+}
 
-        tmp = label_count_right.at(i);
-        if (tmp > 0.0)
-        {
-            tmp /= weighted_n_right;
-            entropy_right -= tmp * log(tmp);
-        }
-    }
-    total_left += entropy_left;
-    total_right += entropy_right;
+double Entropy::proxy_impurity_improvement()
+{
+    // entropy_sum with a total of 1 is - sum_k N_k log N_k
+    double proxy = - entropy_sum(&label_count_left[0], n_classes, 1.0)
+                   - entropy_sum(&label_count_right[0], n_classes, 1.0);
+
+    if (weighted_n_left > 0.0)
+        proxy -= weighted_n_left * log(weighted_n_left);
+    if (weighted_n_right > 0.0)
+        proxy -= weighted_n_right * log(weighted_n_right);
 
-    return make_pair(total_left, total_right);
+    return proxy;
 }
 
 Gini::Gini()
@@ -211,16 +267,14 @@ Gini::~Gini()
 
 }
 
-double Gini::node_impurity()
+Criterion* Gini::clone() const
 {
-    double gini = 0.0;
-    double tmp = 0.0;
+    return new Gini(*this);
+}
 
-    for (int i = 0; i < n_classes; i++)
-    {
-        tmp = label_count_total[i];
-        gini += tmp * tmp;
-    }
+double Gini::node_impurity()
+{
+    double gini = sum_of_squares(&label_count_total[0], n_classes);
     gini = 1.0 - gini / (weighted_n_node_samples *
                          weighted_n_node_samples);
     return gini;
@@ -228,17 +282,9 @@ double Gini::node_impurity()
 
 pair<double, double> Gini::children_impurity()
 {
-    double gini_left = 0.0;
-    double gini_right = 0.0;
-    double tmp = 0.0;
+    double gini_left = sum_of_squares(&label_count_left[0], n_classes);
+    double gini_right = sum_of_squares(&label_count_right[0], n_classes);
 
-    for (int i = 0; i < n_classes; i++)
-    {
-        tmp = label_count_left[i];
-        gini_left += tmp * tmp;
-        tmp = label_count_right[i];
-        gini_right += tmp * tmp;
-    }
     gini_left = 1.0 - gini_left / (weighted_n_left *
                                    weighted_n_left);
     gini_right = 1.0 - gini_right / (weighted_n_right *
@@ -247,6 +293,12 @@ pair<double, double> Gini::children_impurity()
     return make_pair(gini_left, gini_right);
 }
 
+double Gini::proxy_impurity_improvement()
+{
+    return (sum_of_squares(&label_count_left[0], n_classes) / weighted_n_left +
+            sum_of_squares(&label_count_right[0], n_classes) / weighted_n_right);
+}
+
 RegressionCriterion::RegressionCriterion()
     : Criterion(),
       mean_left(0.0),
@@ -280,7 +332,7 @@ void RegressionCriterion::init(Mat _y,
     y = _y;
     sample_weight = _sample_weight;
     weighted_n_samples = _weight_n_samples;
-    samples = _samples;
+    samples = _samples.data();
     start = _start;
     end = _end;
 
@@ -299,7 +351,7 @@ void RegressionCriterion::init(Mat _y,
 
     for (int i = start; i < end; i++)
     {
-        index = samples.at(i);
+        index = samples[i];
 
         if (sample_weight.total() != 0)
             w = sample_weight.at<double>(index);
@@ -345,7 +397,7 @@ void RegressionCriterion::update(int new_pos)
 
     for (int i = pos; i < new_pos; i++)
     {
-        index = samples.at(i);
+        index = samples[i];
 
         if (sample_weight.total() != 0)
             w  = sample_weight.at<double>(index);
@@ -364,13 +416,6 @@ void RegressionCriterion::update(int new_pos)
     weighted_n_left += diff_w;
     weighted_n_right -= diff_w;
 
-    mean_left = sum_left / weighted_n_left;
-    mean_right = sum_right / weighted_n_right;
-    var_left = sq_sum_left / weighted_n_left -
-                mean_left * mean_left;
-    var_right = sq_sum_right / weighted_n_right -
-                 mean_right * mean_right;
-
     pos = new_pos;
 }
 
@@ -381,6 +426,37 @@ vector<double> RegressionCriterion::node_value()
     return vec;
 }
 
+int RegressionCriterion::n_stats()
+{
+    // weight, sum(w * y), sum(w * y * y)
+    return 3;
+}
+
+void RegressionCriterion::add_sample_stats(int index, double* stats)
+{
+    double w = 1.0;
+    if (sample_weight.total() != 0)
+        w = sample_weight.at<double>(index);
+
+    double y_i = y.at<double>(index);
+    stats[0] += w;
+    stats[1] += w * y_i;
+    stats[2] += w * y_i * y_i;
+}
+
+void RegressionCriterion::update_from_stats(const double* stats_left, int new_pos)
+{
+    weighted_n_left = stats_left[0];
+    weighted_n_right = weighted_n_node_samples - weighted_n_left;
+
+    sum_left = stats_left[1];
+    sum_right = sum_total - sum_left;
+    sq_sum_left = stats_left[2];
+    sq_sum_right = sq_sum_total - sq_sum_left;
+
+    pos = new_pos;
+}
+
 MSE::MSE()
     : RegressionCriterion()
 {
@@ -392,6 +468,11 @@ MSE::~MSE()
 
 }
 
+Criterion* MSE::clone() const
+{
+    return new MSE(*this);
+}
+
 double MSE::node_impurity()
 {
     return (sq_sum_total / weighted_n_node_samples -
@@ -400,9 +481,23 @@ double MSE::node_impurity()
 
 pair<double, double> MSE::children_impurity()
 {
+    // update only maintains the sums, the variances are computed on demand
+    mean_left = sum_left / weighted_n_left;
+    mean_right = sum_right / weighted_n_right;
+    var_left = sq_sum_left / weighted_n_left -
+                mean_left * mean_left;
+    var_right = sq_sum_right / weighted_n_right -
+                 mean_right * mean_right;
+
     return make_pair(var_left, var_right);
 }
 
+double MSE::proxy_impurity_improvement()
+{
+    return (sum_left * sum_left / weighted_n_left +
+            sum_right * sum_right / weighted_n_right);
+}
+
 FriedmanMSE::FriedmanMSE()
     : MSE()
 {
@@ -414,6 +509,11 @@ FriedmanMSE::~FriedmanMSE()
 
 }
 
+Criterion* FriedmanMSE::clone() const
+{
+    return new FriedmanMSE(*this);
+}
+
 double FriedmanMSE::impurity_improvement(double impurity)
 {
     double total_sum_left = 0.0;
@@ -429,26 +529,209 @@ double FriedmanMSE::impurity_improvement(double impurity)
             (weighted_n_left + weighted_n_right);
 }
 
+double FriedmanMSE::proxy_impurity_improvement()
+{
+    double diff = weighted_n_right * sum_left -
+                  weighted_n_left * sum_right;
 
+    return diff * diff / (weighted_n_left * weighted_n_right);
+}
 
+NewtonCriterion::NewtonCriterion(double _l2_regularization,
+                                 double _min_child_hessian)
+    : Criterion(),
+      l2_regularization(_l2_regularization),
+      sum_left(0.0),
+      sum_right(0.0),
+      sum_total(0.0),
+      hessian_total(0.0),
+      sq_sum_left(0.0),
+      sq_sum_right(0.0),
+      sq_sum_total(0.0),
+      score_total(0.0),
+      hessian_left(0.0),
+      hessian_right(0.0),
+      min_child_hessian(_min_child_hessian),
+      // Only the splits of a positive gain lower the loss
+      min_proxy_improvement(0.0)
+{
+    has_split_constraints = true;
+}
 
+NewtonCriterion::~NewtonCriterion()
+{
 
+}
 
+Criterion* NewtonCriterion::clone() const
+{
+    return new NewtonCriterion(*this);
+}
 
+/**
+ * @brief w * g^2 / h, the contribution of a sample to sq_sum
+ */
+static inline double newton_sq(double w, double g, double h)
+{
+    return (h > 0.0) ? w * g * g / h : 0.0;
+}
 
+void NewtonCriterion::init(Mat _y,
+                           Mat _sample_weight,
+                           double _weight_n_samples,
+                           vector<int>& _samples,
+                           int _start,
+                           int _end)
+{
+    y = _y;
+    sample_weight = _sample_weight;
+    weighted_n_samples = _weight_n_samples;
+    samples = _samples.data();
+    start = _start;
+    end = _end;
 
+    sum_total = 0.0;
+    hessian_total = 0.0;
+    sq_sum_total = 0.0;
 
+    int index;
+    double w = 1.0;
+    const double* y_i;
+    weighted_n_node_samples = 0.0;
 
+    for (int i = start; i < end; i++)
+    {
+        index = samples[i];
 
+        if (sample_weight.total() != 0)
+            w = sample_weight.at<double>(index);
 
+        y_i = y.ptr<double>(index);
+        sum_total += w * y_i[0];
+        hessian_total += w * y_i[1];
+        sq_sum_total += newton_sq(w, y_i[0], y_i[1]);
 
+        weighted_n_node_samples += w;
+    }
+    score_total = sum_total * sum_total / (hessian_total + l2_regularization);
 
+    reset();
+}
 
+void NewtonCriterion::reset()
+{
+    pos = 0;
 
+    sum_left = 0.0;
+    sum_right = sum_total;
+    hessian_left = 0.0;
+    hessian_right = hessian_total;
+    sq_sum_left = 0.0;
+    sq_sum_right = sq_sum_total;
 
+    weighted_n_right = weighted_n_node_samples;
+    weighted_n_left = 0;
+}
+
+void NewtonCriterion::update(int new_pos)
+{
+    double w = 1.0;
+    double w_g_i, w_h_i, sq_i;
+    double diff_w = 0.0;
+    const double* y_i;
+
+    int index = 0;
+
+    for (int i = pos; i < new_pos; i++)
+    {
+        index = samples[i];
+
+        if (sample_weight.total() != 0)
+            w  = sample_weight.at<double>(index);
+
+        y_i = y.ptr<double>(index);
+        w_g_i = w * y_i[0];
+        w_h_i = w * y_i[1];
+        sq_i = newton_sq(w, y_i[0], y_i[1]);
+
+        sum_left += w_g_i;
+        sum_right -= w_g_i;
+        hessian_left += w_h_i;
+        hessian_right -= w_h_i;
+        sq_sum_left += sq_i;
+        sq_sum_right -= sq_i;
+
+        diff_w += w;
+    }
+    weighted_n_left += diff_w;
+    weighted_n_right -= diff_w;
+
+    pos = new_pos;
+}
+
+double NewtonCriterion::node_impurity()
+{
+    return 0.5 * (sq_sum_total - score_total) / weighted_n_node_samples;
+}
+
+pair<double, double> NewtonCriterion::children_impurity()
+{
+    double score_left = sum_left * sum_left / (hessian_left + l2_regularization);
+    double score_right = sum_right * sum_right / (hessian_right + l2_regularization);
+
+    return make_pair(0.5 * (sq_sum_left - score_left) / weighted_n_left,
+                     0.5 * (sq_sum_right - score_right) / weighted_n_right);
+}
+
+vector<double> NewtonCriterion::node_value()
+{
+    vector<double> vec;
+    vec.push_back(sum_total / (hessian_total + l2_regularization));
+    return vec;
+}
+
+int NewtonCriterion::n_targets()
+{
+    return 2;
+}
 
+int NewtonCriterion::n_stats()
+{
+    // weight, sum(w * g), sum(w * h), sum(w * g * g / h)
+    return 4;
+}
 
+void NewtonCriterion::add_sample_stats(int index, double* stats)
+{
+    double w = 1.0;
+    if (sample_weight.total() != 0)
+        w = sample_weight.at<double>(index);
+
+    const double* y_i = y.ptr<double>(index);
+    stats[0] += w;
+    stats[1] += w * y_i[0];
+    stats[2] += w * y_i[1];
+    stats[3] += newton_sq(w, y_i[0], y_i[1]);
+}
 
+void NewtonCriterion::update_from_stats(const double* stats_left, int new_pos)
+{
+    weighted_n_left = stats_left[0];
+    weighted_n_right = weighted_n_node_samples - weighted_n_left;
 
+    sum_left = stats_left[1];
+    sum_right = sum_total - sum_left;
+    hessian_left = stats_left[2];
+    hessian_right = hessian_total - hessian_left;
+    sq_sum_left = stats_left[3];
+    sq_sum_right = sq_sum_total - sq_sum_left;
 
+    pos = new_pos;
+}
 
+double NewtonCriterion::proxy_impurity_improvement()
+{
+    return (sum_left * sum_left / (hessian_left + l2_regularization) +
+            sum_right * sum_right / (hessian_right + l2_regularization) -
+            score_total);
+}
@@ -22,12 +22,18 @@ public:
     Criterion();
     virtual ~Criterion();
 
+    /**
+     * @brief A copy of the criterion with its current state, e.g. for
+     * another thread evaluating splits of the same node. Owned by the caller.
+     */
+    virtual Criterion* clone() const=0;
+
     /**
      * @brief Initialize the criterion at node samples[start:end] and children samples[start:start] and samples[start:end]
      * @param y: y's value or label
      * @param sample_weight: weight of sample
      * @param weight_n_samples: sum(wi) for i in sample.size
-     * @param samples: sample index
+     * @param samples: sample index, referenced and not copied
      * @param start:
      * @param end:
      */
@@ -38,6 +44,23 @@ public:
                       int start,
                       int end)=0;
 
+    /**
+     * @brief Give the target as dense class ids, computed once per fit, so
+     * that init doesn't have to find the classes of y. Only used by the
+     * classification criteria.
+     * @param y: the target passed to init
+     * @param labels: class id of every sample, shape = [n_samples, 1], CV_32S
+     * @param n_classes
+     */
+    virtual void init_labels(Mat y,
+                             Mat labels,
+                             int n_classes);
+
+    /**
+     * @brief Number of columns of the y given to init
+     */
+    virtual int n_targets();
+
     /**
      * @brief Reset the criterion at pos=start
      */
@@ -66,6 +89,28 @@ public:
      */
     virtual vector<double> node_value()=0;
 
+    /**
+     * @brief Number of statistics needed to summarize a set of samples, i.e.
+     * the size of one bin in a histogram. stats[0] is always the weight.
+     */
+    virtual int n_stats()=0;
+
+    /**
+     * @brief Add the statistics of the sample X[index] to stats[0:n_stats()]
+     * @param index: sample index in X, y
+     * @param stats
+     */
+    virtual void add_sample_stats(int index, double* stats)=0;
+
+    /**
+     * @brief Set the collected statistics so that the left child is summarized
+     * by stats_left and the right child holds the rest of the node.
+     * This is the histogram counterpart of update().
+     * @param stats_left
+     * @param new_pos
+     */
+    virtual void update_from_stats(const double* stats_left, int new_pos)=0;
+
     /**
      * @brief Weighted impurity improvement, i.e.
      *
@@ -77,13 +122,23 @@ public:
      *     child and N_t_R is the number of samples in the right child
      * @return impurity_improvement
      */
-    double impurity_improvement(double impurity);
+    virtual double impurity_improvement(double impurity);
+
+    /**
+     * @brief Proxy of the impurity improvement, cheaper to compute and with
+     * the same ranking of the splits of a node. It is only used to find the
+     * best split, whose impurity_improvement is then computed once, e.g.
+     *
+     *     - N_t_R * right impurity - N_t_L * left impurity
+     * @return proxy_impurity_improvement
+     */
+    virtual double proxy_impurity_improvement();
 
 public:
     Mat y;                 // Values of y
     Mat sample_weight;     // Sample weights
 
-    vector<int> samples;            // Sample indice in X, y
+    const int* samples;             // Sample indices in X, y, a view of the splitter's buffer
     int start;                      // samples[start:pos] are the samples in the left node
     int pos;                        // samples[pos:end] are the samples in the right node
     int end;
@@ -97,6 +152,11 @@ public:
     vector<double> label_count_left;
     vector<double> label_count_right;
     vector<double> label_count_total;
+
+    // Whether the criterion constrains the splits, see
+    // NewtonCriterion::rejects_split. A flag rather than a virtual call, as
+    // node_split checks it for every candidate position.
+    bool has_split_constraints;
 };
 
 class ClassificationCriterion : public Criterion
@@ -113,7 +173,7 @@ public:
      * @param y: y's value or label
      * @param sample_weight: weight of sample
      * @param weight_n_samples: sum(wi) for i in sample.size
-     * @param samples: sample index
+     * @param samples: sample index, referenced and not copied
      * @param start:
      * @param end:
      */
@@ -124,6 +184,17 @@ public:
                       int start,
                       int end);
 
+    /**
+     * @brief Store the class ids of y and size the label counts.
+     * When init is called with another y, the ids are computed there, once.
+     * @param y
+     * @param labels
+     * @param n_classes
+     */
+    virtual void init_labels(Mat y,
+                             Mat labels,
+                             int n_classes);
+
     /**
      * @brief Reset the criterion at pos=start
      */
@@ -152,8 +223,29 @@ public:
      */
     virtual vector<double> node_value();
 
+    /**
+     * @brief Number of statistics summarizing a set of samples
+     */
+    virtual int n_stats();
+
+    /**
+     * @brief Add the statistics of the sample X[index] to stats[0:n_stats()]
+     * @param index
+     * @param stats
+     */
+    virtual void add_sample_stats(int index, double* stats);
+
+    /**
+     * @brief Set the left child to stats_left, the right child to the rest
+     * @param stats_left
+     * @param new_pos
+     */
+    virtual void update_from_stats(const double* stats_left, int new_pos);
+
 public:
     int n_classes;
+    Mat labels;                     // Class id of every sample, CV_32S
+    const uchar* labels_y;          // Data of the y the labels were computed from
 };
 
 class Entropy : public ClassificationCriterion
@@ -176,6 +268,8 @@ public:
     Entropy();
     virtual ~Entropy();
 
+    virtual Criterion* clone() const;
+
     /**
      * @brief Evaluate the impurity of the current node, i.e. the impurity of samples[start:end].
      */
@@ -186,6 +280,14 @@ public:
      * @return pair<impurity_left, impurity_right>
      */
     virtual pair<double, double> children_impurity();
+
+    /**
+     * @brief Proxy of the impurity improvement, without the divisions:
+     *
+     *     sum_k (N_t_L,k log N_t_L,k + N_t_R,k log N_t_R,k)
+     *         - N_t_L log N_t_L - N_t_R log N_t_R
+     */
+    virtual double proxy_impurity_improvement();
 };
 
 class Gini : public ClassificationCriterion
@@ -209,6 +311,8 @@ public:
     Gini();
     virtual ~Gini();
 
+    virtual Criterion* clone() const;
+
     /**
      * @brief Evaluate the impurity of the current node, i.e. the impurity of samples[start:end].
      */
@@ -219,6 +323,13 @@ public:
      * @return pair<impurity_left, impurity_right>
      */
     virtual pair<double, double> children_impurity();
+
+    /**
+     * @brief Proxy of the impurity improvement:
+     *
+     *     sum_k N_t_L,k ** 2 / N_t_L + sum_k N_t_R,k ** 2 / N_t_R
+     */
+    virtual double proxy_impurity_improvement();
 };
 
 class RegressionCriterion : public Criterion
@@ -240,7 +351,7 @@ public:
      * @param y: y's value or label
      * @param sample_weight: weight of sample
      * @param weight_n_samples: sum(wi) for i in sample.size
-     * @param samples: sample index
+     * @param samples: sample index, referenced and not copied
      * @param start:
      * @param end:
      */
@@ -279,6 +390,25 @@ public:
      */
     virtual vector<double> node_value();
 
+    /**
+     * @brief Number of statistics summarizing a set of samples
+     */
+    virtual int n_stats();
+
+    /**
+     * @brief Add the statistics of the sample X[index] to stats[0:n_stats()]
+     * @param index
+     * @param stats
+     */
+    virtual void add_sample_stats(int index, double* stats);
+
+    /**
+     * @brief Set the left child to stats_left, the right child to the rest
+     * @param stats_left
+     * @param new_pos
+     */
+    virtual void update_from_stats(const double* stats_left, int new_pos);
+
 public:
     double mean_left;
     double mean_right;
@@ -302,6 +432,8 @@ public:
     MSE();
     virtual ~MSE();
 
+    virtual Criterion* clone() const;
+
     /**
      * @brief Evaluate the impurity of the current node, i.e. the impurity of samples[start:end].
      */
@@ -312,6 +444,13 @@ public:
      * @return pair<impurity_left, impurity_right>
      */
     virtual pair<double, double> children_impurity();
+
+    /**
+     * @brief Proxy of the impurity improvement, which needs the sums only:
+     *
+     *     sum_left ** 2 / N_t_L + sum_right ** 2 / N_t_R
+     */
+    virtual double proxy_impurity_improvement();
 };
 
 class FriedmanMSE : public MSE
@@ -326,7 +465,167 @@ public:
     FriedmanMSE();
     virtual ~FriedmanMSE();
 
+    virtual Criterion* clone() const;
+
     virtual double impurity_improvement(double impurity);
+
+    /**
+     * @brief Proxy of the impurity improvement, i.e. the improvement times
+     * (n_left + n_right):
+     *
+     *     diff = n_right * sum_left - n_left * sum_right
+     *     proxy = diff^2 / (n_left * n_right)
+     */
+    virtual double proxy_impurity_improvement();
+};
+
+/**
+ * @brief Default L2 regularization of the leaf values of NewtonCriterion
+ */
+const double NEWTON_L2_REGULARIZATION = 1.0;
+
+/**
+ * @brief Default min sum of the hessians in a child of NewtonCriterion
+ */
+const double NEWTON_MIN_CHILD_HESSIAN = 1e-3;
+
+class NewtonCriterion : public Criterion
+{
+public:
+    /**
+     * @brief Second order criterion for Newton boosting.
+     *
+     * y has two columns, the negative gradient g_i of the loss and its
+     * hessian h_i > 0 at every sample. With G and H the weighted sums of g
+     * and h in a node, the leaf value G / (H + lambda) minimizes the second
+     * order expansion of the loss, which it lowers by G^2 / (2 (H + lambda)).
+     * The gain of a split is
+     *
+     *     gain = G_L^2 / (H_L + lambda) + G_R^2 / (H_R + lambda)
+     *            - G^2 / (H + lambda)
+     *
+     * and the impurity of a node is what a leaf per sample would lower the
+     * loss by, on top of the leaf of the node:
+     *
+     *     impurity = (sum_i w_i g_i^2 / h_i - G^2 / (H + lambda)) / (2 N_t)
+     *
+     * so that impurity_improvement is gain / (2 N). With h_i = 1 and
+     * lambda = 0 this is half of MSE on g, and the leaf value its mean.
+     *
+     * node_split rejects the splits of a non positive gain, which lambda
+     * makes possible, and the ones leaving a child a sum of hessians below
+     * min_child_hessian.
+     * @param l2_regularization: lambda
+     * @param min_child_hessian
+     */
+    NewtonCriterion(double l2_regularization=NEWTON_L2_REGULARIZATION,
+                    double min_child_hessian=NEWTON_MIN_CHILD_HESSIAN);
+    virtual ~NewtonCriterion();
+
+    virtual Criterion* clone() const;
+
+    /**
+     * @brief Initialize the criterion at node samples[start:end] and children samples[start:start] and samples[start:end]
+     * @param y: shape = [n_samples, 2], the negative gradient and the hessian
+     * @param sample_weight: weight of sample
+     * @param weight_n_samples: sum(wi) for i in sample.size
+     * @param samples: sample index, referenced and not copied
+     * @param start:
+     * @param end:
+     */
+    virtual void init(Mat y,
+                      Mat sample_weight,
+                      double weight_n_samples,
+                      vector<int>& samples,
+                      int start,
+                      int end);
+
+    /**
+     * @brief Reset the criterion at pos=start
+     */
+    virtual void reset();
+
+    /**
+     * @brief Update the collected statistics by moving samples[pos:new_pos] from the right child to the left child
+     * @param new_pos
+     */
+    virtual void update(int new_pos);
+
+    /**
+     * @brief Evaluate the impurity of the current node, i.e. the impurity of samples[start:end].
+     */
+    virtual double node_impurity();
+
+    /**
+     * @brief Evaluate the impurity in children nodes, i.e. the impurity of samples[start:pos] + the impurity of samples[pos:end].
+     * @return pair<impurity_left, impurity_right>
+     */
+    virtual pair<double, double> children_impurity();
+
+    /**
+     * @brief Compute the node value of samples[start:end], G / (H + lambda)
+     * @return
+     */
+    virtual vector<double> node_value();
+
+    /**
+     * @brief y holds the gradient and the hessian, two columns
+     */
+    virtual int n_targets();
+
+    /**
+     * @brief Number of statistics summarizing a set of samples
+     */
+    virtual int n_stats();
+
+    /**
+     * @brief Add the statistics of the sample X[index] to stats[0:n_stats()]
+     * @param index
+     * @param stats
+     */
+    virtual void add_sample_stats(int index, double* stats);
+
+    /**
+     * @brief Set the left child to stats_left, the right child to the rest
+     * @param stats_left
+     * @param new_pos
+     */
+    virtual void update_from_stats(const double* stats_left, int new_pos);
+
+    /**
+     * @brief The gain of the split:
+     *
+     *     G_L^2 / (H_L + lambda) + G_R^2 / (H_R + lambda) - G^2 / (H + lambda)
+     */
+    virtual double proxy_impurity_improvement();
+
+public:
+    double l2_regularization;
+    double sum_left;            // sum(w * g)
+    double sum_right;
+    double sum_total;
+    double hessian_total;       // sum(w * h)
+    double sq_sum_left;         // sum(w * g^2 / h)
+    double sq_sum_right;
+    double sq_sum_total;
+    double score_total;         // G^2 / (H + lambda) of the node
+    double hessian_left;        // sum(w * h) of the left node
+    double hessian_right;
+    double min_child_hessian;
+    double min_proxy_improvement;   // Max rejected proxy_impurity_improvement
+
+    /**
+     * @brief Whether node_split must reject the current split, on top of
+     * min_samples_leaf and min_weight_leaf: a child with a sum of hessians
+     * below min_child_hessian, or a non positive gain.
+     * @param proxy_improvement: proxy_impurity_improvement of the split
+     */
+    inline bool rejects_split(double proxy_improvement) const
+    {
+        return ((hessian_left < min_child_hessian) ||
+                (hessian_right < min_child_hessian) ||
+                (proxy_improvement <= min_proxy_improvement));
+    }
 };
 
 #endif // CRITERION_H
@@ -0,0 +1,652 @@
+#include "dataset.h"
+#include "argsort.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using std::vector;
+
+/**
+ * @brief Header of the column dataset file, see save_column_dataset
+ */
+struct DatasetFileHeader
+{
+    char magic[8];                  // "GBRTDATA"
+    int32_t version;                // DATASET_FILE_VERSION
+    int32_t header_size;            // sizeof(DatasetFileHeader)
+    int64_t n_samples;
+    int64_t n_features;
+    uint64_t X_offset;              // Offsets from the beginning of the file
+    uint64_t y_offset;
+    uint64_t sample_weight_offset;
+    int64_t reserved;
+};
+
+static const char DATASET_FILE_MAGIC[8] = {'G', 'B', 'R', 'T', 'D', 'A', 'T', 'A'};
+static const size_t DATASET_FILE_ALIGNMENT = 64;
+
+static_assert(sizeof(DatasetFileHeader) == 64, "DatasetFileHeader must be 64 bytes");
+
+/**
+ * @brief Powers of 10 exactly representable as double
+ */
+static const double EXACT_POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const uint64_t MAX_EXACT_MANTISSA = static_cast<uint64_t>(1) << 53;
+
+/**
+ * @brief Round offset up to the next multiple of DATASET_FILE_ALIGNMENT
+ */
+static inline size_t align_offset(size_t offset)
+{
+    return (offset + DATASET_FILE_ALIGNMENT - 1) & ~(DATASET_FILE_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Whether count items of item_size bytes starting at offset fit in
+ * file_size bytes, without overflowing
+ */
+static inline bool array_fits(uint64_t offset,
+                              size_t count,
+                              size_t item_size,
+                              size_t file_size)
+{
+    return offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+/**
+ * @brief The dataset file is little-endian, and is mapped as is
+ */
+static inline bool is_little_endian()
+{
+    const uint32_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * @brief Parse the number starting at p, ending before end.
+ * If the decimal mantissa and the power of 10 are both exact doubles, one
+ * correctly rounded multiplication or division gives the correctly rounded
+ * value (Clinger's fast path). Otherwise fall back to strtod.
+ * @return pointer after the number, NULL if there is no number at p
+ */
+static const char* parse_double(const char* p,
+                                const char* end,
+                                double* value)
+{
+    const char* begin = p;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;           // Significant digits in mantissa
+    int n_parsed = 0;           // All the digits
+    int exponent = 0;
+    bool exact = true;
+
+    for (; p != end && is_digit(*p); p++, n_parsed++)
+    {
+        if (mantissa == 0 && *p == '0')
+            continue;
+        if (n_digits < 19)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+        {
+            exact = false;
+            exponent += 1;
+        }
+        n_digits += 1;
+    }
+    if (p != end && *p == '.')
+    {
+        p++;
+        for (; p != end && is_digit(*p); p++, n_parsed++)
+        {
+            if (mantissa == 0 && *p == '0')
+            {
+                exponent -= 1;
+                continue;
+            }
+            if (n_digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent -= 1;
+            }
+            else
+                exact = false;
+            n_digits += 1;
+        }
+    }
+    if (n_parsed > 0 && p != end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q != end && (*q == '-' || *q == '+'))
+        {
+            negative_exponent = (*q == '-');
+            q++;
+        }
+        if (q != end && is_digit(*q))
+        {
+            int e = 0;
+            for (; q != end && is_digit(*q); q++)
+                if (e < 100000)
+                    e = e * 10 + (*q - '0');
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    if (n_parsed > 0 && exact && mantissa <= MAX_EXACT_MANTISSA &&
+        exponent >= -22 && exponent <= 22)
+    {
+        double result = static_cast<double>(mantissa);
+        if (exponent < 0)
+            result /= EXACT_POW10[-exponent];
+        else
+            result *= EXACT_POW10[exponent];
+        *value = negative ? -result : result;
+        return p;
+    }
+
+    // Slow path: long mantissas, large exponents, inf and nan
+    const char* token_end = begin;
+    while (token_end != end && !is_blank(*token_end) && *token_end != '\n')
+        token_end++;
+    std::string token(begin, token_end);
+    char* parsed_end;
+    *value = strtod(token.c_str(), &parsed_end);
+    if (parsed_end == token.c_str())
+        return NULL;
+    return begin + (parsed_end - token.c_str());
+}
+
+/**
+ * @brief Count the non blank lines ending in [p, end).
+ * @param has_value: in/out, whether the current line already has a value
+ * @return number of lines
+ */
+static int count_lines(const char* p,
+                       const char* end,
+                       bool* has_value)
+{
+    int n_lines = 0;
+    const char* newline;
+    while (p != end)
+    {
+        // Most lines start with a value, this is usually one comparison
+        if (!*has_value)
+        {
+            while (p != end && is_blank(*p))
+                p++;
+            if (p == end)
+                break;
+            *has_value = (*p != '\n');
+        }
+
+        newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (newline == NULL)
+            break;
+        n_lines += *has_value;
+        *has_value = false;
+        p = newline + 1;
+    }
+    return n_lines;
+}
+
+/**
+ * @brief Count the non blank lines in [p, end)
+ */
+static int count_samples(const char* p,
+                         const char* end)
+{
+    bool has_value = false;
+    int n_samples = count_lines(p, end, &has_value);
+    return n_samples + has_value;
+}
+
+/**
+ * @brief Count the values of the first non blank line, from [p, end).
+ * @param n_fields: in/out, values counted so far
+ * @param in_field: in/out, whether p is inside a value
+ * @return whether the line is complete
+ */
+static bool count_fields(const char* p,
+                         const char* end,
+                         int* n_fields,
+                         bool* in_field)
+{
+    for (; p != end; p++)
+    {
+        if (*p == '\n')
+        {
+            *in_field = false;
+            if (*n_fields > 0)
+                return true;
+        }
+        else if (is_blank(*p))
+            *in_field = false;
+        else
+        {
+            *n_fields += !*in_field;
+            *in_field = true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Parse the lines in [p, end) into the rows of X and y starting at
+ * first_row. Every line must hold the target and n_features values.
+ * @return error_code
+ */
+static int parse_lines(const char* p,
+                       const char* end,
+                       Mat* X,
+                       Mat* y,
+                       int first_row)
+{
+    int n_features = X->cols;
+    int row = first_row;
+    double* x;
+    while (p != end)
+    {
+        while (p != end && is_blank(*p))
+            p++;
+        if (p == end)
+            break;
+        if (*p == '\n')
+        {
+            p++;
+            continue;
+        }
+
+        p = parse_double(p, end, y->ptr<double>(row));
+        if (p == NULL)
+            return 4;
+
+        x = X->ptr<double>(row);
+        for (int j = 0; j < n_features; j++)
+        {
+            while (p != end && is_blank(*p))
+                p++;
+            if (p == end || *p == '\n')
+                return 3;
+            p = parse_double(p, end, x + j);
+            if (p == NULL)
+                return 4;
+        }
+
+        // Nothing else on the line
+        while (p != end && is_blank(*p))
+            p++;
+        if (p != end && *p != '\n')
+            return 3;
+        row += 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the next block of the file after the `kept` bytes already at
+ * the beginning of buffer, growing buffer if it is full.
+ * @return number of bytes in buffer
+ */
+static size_t read_block(FILE* file,
+                         vector<char>& buffer,
+                         size_t kept)
+{
+    if (buffer.size() < kept + DATASET_CHUNK_SIZE)
+        buffer.resize(kept + DATASET_CHUNK_SIZE);
+    return kept + fread(&buffer[kept], 1, DATASET_CHUNK_SIZE, file);
+}
+
+int load_txt_dataset(const char* filename,
+                     Mat& X,
+                     Mat& y,
+                     int n_threads)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+        return 1;
+
+    if (n_threads <= 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    vector<char> buffer;
+    size_t size;
+
+    // First pass: number of samples, and number of features from the
+    // first sample
+    int n_samples = 0;
+    int n_fields = 0;
+    bool has_value = false;     // The current line has a value
+    bool in_field = false;
+    bool first_line_done = false;
+    while ((size = read_block(file, buffer, 0)) > 0)
+    {
+        if (!first_line_done)
+            first_line_done = count_fields(&buffer[0], &buffer[0] + size, &n_fields, &in_field);
+        n_samples += count_lines(&buffer[0], &buffer[0] + size, &has_value);
+    }
+    n_samples += has_value;
+
+    if (n_samples == 0 || n_fields < 1)
+    {
+        fclose(file);
+        return 2;
+    }
+
+    X.create(n_samples, n_fields - 1, CV_64F);
+    y.create(n_samples, 1, CV_64F);
+
+    // Second pass: parse the complete lines of every block, the end of the
+    // last line is kept for the next block
+    rewind(file);
+    int row = 0;
+    size_t kept = 0;
+    int error_code = 0;
+    vector<int> piece_errors(n_threads);
+    vector<std::thread> threads;
+
+    while (error_code == 0)
+    {
+        size = read_block(file, buffer, kept);
+        bool last = (size == kept);
+        if (size == 0)
+            break;
+
+        const char* begin = &buffer[0];
+        const char* end = begin + size;
+        if (!last)
+        {
+            // Keep the incomplete line for the next block
+            const char* line_end = end;
+            while (line_end != begin && line_end[-1] != '\n')
+                line_end--;
+            if (line_end == begin)
+            {
+                // The line is longer than the block
+                kept = size;
+                continue;
+            }
+            end = line_end;
+        }
+
+        // Split the lines between the threads
+        vector<const char*> bounds(1, begin);
+        vector<int> first_rows(1, row);
+        for (int t = 1; t < n_threads; t++)
+        {
+            const char* p = begin + (end - begin) * t / n_threads;
+            if (p < bounds.back())
+                p = bounds.back();
+            while (p != end && p != begin && p[-1] != '\n')
+                p++;
+            first_rows.push_back(first_rows.back() + count_samples(bounds.back(), p));
+            bounds.push_back(p);
+        }
+        bounds.push_back(end);
+        int n_block_samples = first_rows.back() + count_samples(bounds[n_threads - 1], end) - row;
+
+        if (row + n_block_samples > n_samples)
+        {
+            error_code = 3;
+            break;
+        }
+
+        if (n_threads == 1)
+            error_code = parse_lines(begin, end, &X, &y, row);
+        else
+        {
+            threads.clear();
+            for (int t = 0; t < n_threads; t++)
+                threads.push_back(std::thread([&, t]() {
+                    piece_errors[t] = parse_lines(bounds[t], bounds[t + 1], &X, &y, first_rows[t]);
+                }));
+            for (int t = 0; t < n_threads; t++)
+                threads[t].join();
+            for (int t = 0; t < n_threads && error_code == 0; t++)
+                error_code = piece_errors[t];
+        }
+        row += n_block_samples;
+
+        if (last)
+            break;
+        kept = (&buffer[0] + size) - end;
+        memmove(&buffer[0], end, kept);
+    }
+
+    fclose(file);
+
+    // Validation
+    if (error_code == 0 && row != n_samples)
+        error_code = 3;
+    return error_code;
+}
+
+/**
+ * @brief Write n bytes at p, then zeros up to the next aligned offset.
+ * @param offset: in/out, offset of p in the file
+ * @return whether everything was written
+ */
+static bool write_aligned(FILE* file,
+                          const void* p,
+                          size_t n,
+                          size_t* offset)
+{
+    static const char zeros[DATASET_FILE_ALIGNMENT] = {0};
+    size_t padding = align_offset(*offset + n) - (*offset + n);
+    *offset += n + padding;
+
+    // p may be NULL when there is only padding to write
+    if (n != 0 && fwrite(p, 1, n, file) != n)
+        return false;
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+int save_column_dataset(const char* filename,
+                        Mat X,
+                        Mat y,
+                        Mat sample_weight)
+{
+    if (!is_little_endian())
+        return 4;
+
+    // Validation
+    int n_samples = X.rows;
+    int n_features = X.cols;
+    if (n_samples == 0 || n_features == 0 ||
+        y.total() != static_cast<size_t>(n_samples) ||
+        sample_weight.total() != static_cast<size_t>(n_samples))
+        return 3;
+
+    size_t column_size = static_cast<size_t>(n_samples) * sizeof(double);
+
+    DatasetFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC));
+    header.version = DATASET_FILE_VERSION;
+    header.header_size = sizeof(DatasetFileHeader);
+    header.n_samples = n_samples;
+    header.n_features = n_features;
+    header.X_offset = align_offset(sizeof(DatasetFileHeader));
+    header.y_offset = align_offset(header.X_offset + n_features * column_size);
+    header.sample_weight_offset = align_offset(header.y_offset + column_size);
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL)
+        return 1;
+
+    size_t offset = 0;
+    bool written = write_aligned(file, &header, sizeof(header), &offset);
+
+    // The columns are contiguous, so that X_col is one [n_features, n_samples] Mat
+    vector<double> column(n_samples);
+    for (int j = 0; j < n_features && written; j++)
+    {
+        for (int i = 0; i < n_samples; i++)
+            column[i] = X.at<double>(i, j);
+        written = fwrite(&column[0], 1, column_size, file) == column_size;
+        offset += column_size;
+    }
+    if (written)
+        written = write_aligned(file, NULL, 0, &offset);
+
+    for (int i = 0; i < n_samples; i++)
+        column[i] = y.at<double>(i);
+    written = written && write_aligned(file, &column[0], column_size, &offset);
+    for (int i = 0; i < n_samples; i++)
+        column[i] = sample_weight.at<double>(i);
+    written = written && write_aligned(file, &column[0], column_size, &offset);
+
+    if (fclose(file) != 0 || !written)
+        return 2;
+    return 0;
+}
+
+int convert_txt_dataset(const char* txt_filename,
+                        const char* filename,
+                        int n_threads)
+{
+    Mat X, y;
+    int error_code = load_txt_dataset(txt_filename, X, y, n_threads);
+    if (error_code != 0)
+        return error_code;
+
+    error_code = save_column_dataset(filename, X, y, Mat::ones(X.rows, 1, CV_64F));
+    if (error_code != 0)
+        return 10 + error_code;
+    return 0;
+}
+
+ColumnDataset::ColumnDataset()
+    : n_samples(0),
+      n_features(0),
+      _mapping(NULL),
+      _mapping_size(0)
+{
+
+}
+
+ColumnDataset::~ColumnDataset()
+{
+    _unmap();
+}
+
+void ColumnDataset::_unmap()
+{
+    // The mapping may be given to another file
+    if (!X_col.empty())
+        release_argsort(X_col);
+
+    X_col = Mat();
+    y = Mat();
+    sample_weight = Mat();
+    n_samples = 0;
+    n_features = 0;
+    if (_mapping != NULL)
+        munmap(_mapping, _mapping_size);
+    _mapping = NULL;
+    _mapping_size = 0;
+}
+
+int ColumnDataset::load(const char* filename)
+{
+    if (!is_little_endian())
+        return 5;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        static_cast<size_t>(file_stat.st_size) < sizeof(DatasetFileHeader))
+    {
+        close(fd);
+        return 2;
+    }
+    size_t file_size = file_stat.st_size;
+
+    // Private mapping: the pages stay shared with the page cache until written
+    void* mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return 2;
+
+    char* data = static_cast<char*>(mapping);
+    const DatasetFileHeader* header = reinterpret_cast<const DatasetFileHeader*>(data);
+
+    // Validation
+    if (memcmp(header->magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC)) != 0 ||
+        header->version != DATASET_FILE_VERSION ||
+        header->header_size != static_cast<int32_t>(sizeof(DatasetFileHeader)) ||
+        header->n_samples <= 0 || header->n_samples > INT32_MAX ||
+        header->n_features <= 0 || header->n_features > INT32_MAX)
+    {
+        munmap(mapping, file_size);
+        return 3;
+    }
+
+    // Validation
+    size_t column_size = header->n_samples * sizeof(double);
+    if (header->X_offset % DATASET_FILE_ALIGNMENT != 0 ||
+        header->y_offset % DATASET_FILE_ALIGNMENT != 0 ||
+        header->sample_weight_offset % DATASET_FILE_ALIGNMENT != 0 ||
+        !array_fits(header->X_offset, header->n_features, column_size, file_size) ||
+        !array_fits(header->y_offset, 1, column_size, file_size) ||
+        !array_fits(header->sample_weight_offset, 1, column_size, file_size))
+    {
+        munmap(mapping, file_size);
+        return 4;
+    }
+
+    // Replace the dataset
+    _unmap();
+    _mapping = mapping;
+    _mapping_size = file_size;
+    n_samples = header->n_samples;
+    n_features = header->n_features;
+    X_col = Mat(n_features, n_samples, CV_64F, data + header->X_offset);
+    y = Mat(n_samples, 1, CV_64F, data + header->y_offset);
+    sample_weight = Mat(n_samples, 1, CV_64F, data + header->sample_weight_offset);
+    return 0;
+}
+
+Mat ColumnDataset::rows()
+{
+    Mat X(n_samples, n_features, CV_64F);
+    const double* column;
+    for (int j = 0; j < n_features; j++)
+    {
+        column = X_col.ptr<double>(j);
+        for (int i = 0; i < n_samples; i++)
+            X.at<double>(i, j) = column[i];
+    }
+    return X;
+}
@@ -0,0 +1,128 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+//========================================
+// Dataset
+// Load the "target f1 f2 ..." text files, one sample per line, and cache
+// them as mappable column files
+//========================================
+
+#include <opencv2/opencv.hpp>
+using cv::Mat;
+
+/**
+ * @brief Size of the blocks read from the text file
+ */
+const size_t DATASET_CHUNK_SIZE = 1 << 24;
+
+/**
+ * @brief Load a text dataset, one sample per line: the target followed by
+ * the features, separated by spaces or tabs. Blank lines are skipped.
+ *
+ * The file is read twice by blocks of DATASET_CHUNK_SIZE bytes: the first
+ * pass counts the samples so that X and y are allocated once, the second
+ * one parses the values straight into their rows. The lines of a block are
+ * split between n_threads threads, each one parsing its own rows.
+ *
+ * Decimal numbers with up to 15 significant digits (e.g. "0.296486163078")
+ * are parsed exactly with one multiplication or division by a power of 10,
+ * the other ones with strtod.
+ * @param filename
+ * @param X: output, shape = [n_samples, n_features], CV_64F
+ * @param y: output, shape = [n_samples, 1], CV_64F
+ * @param n_threads: number of parsing threads, 0 for one per core
+ * @return error_code: 1 the file can't be opened, 2 no sample, 3 a line
+ *         hasn't the number of values of the first one, 4 a value isn't
+ *         a number
+ */
+int load_txt_dataset(const char* filename,
+                     Mat& X,
+                     Mat& y,
+                     int n_threads=1);
+
+/**
+ * @brief Version of the column dataset file format
+ */
+const int DATASET_FILE_VERSION = 1;
+
+/**
+ * @brief Write a training set as a column dataset file, which is mapped by
+ * ColumnDataset::load instead of being parsed again.
+ *
+ * The file is a 64 bytes header followed by X by column (feature 0 of all
+ * the samples, then feature 1, ...), y and sample_weight, all as
+ * little-endian doubles. Every array starts on a 64 bytes boundary.
+ * @param filename
+ * @param X: shape = [n_samples, n_features], CV_64F
+ * @param y: shape = [n_samples, 1], CV_64F
+ * @param sample_weight: shape = [n_samples, 1], CV_64F
+ * @return error_code: 1 the file can't be opened, 2 write error,
+ *         3 the shapes don't match, 4 big-endian host
+ */
+int save_column_dataset(const char* filename,
+                        Mat X,
+                        Mat y,
+                        Mat sample_weight);
+
+/**
+ * @brief Convert a text dataset (see load_txt_dataset) to a column dataset
+ * file, with sample weights of 1.
+ * @param txt_filename
+ * @param filename
+ * @param n_threads
+ * @return error_code: the one of load_txt_dataset, or 10 + the one of
+ *         save_column_dataset
+ */
+int convert_txt_dataset(const char* txt_filename,
+                        const char* filename,
+                        int n_threads=1);
+
+/**
+ * @brief A training set mapped from a column dataset file.
+ *
+ * X_col, y and sample_weight point into a private mapping of the file: the
+ * pages are read from the page cache on first use and are shared with the
+ * other processes training on the same file, nothing is parsed or copied.
+ * Writing to the Mats changes the mapping only, never the file.
+ *
+ * The Mats are only valid until the dataset is destroyed or reloaded.
+ */
+class ColumnDataset
+{
+public:
+    ColumnDataset();
+    ~ColumnDataset();
+
+    /**
+     * @brief Map a file written by save_column_dataset.
+     * @param filename
+     * @return error_code: 1 the file can't be opened, 2 the file can't be
+     *         mapped, 3 not a column dataset file or another version,
+     *         4 truncated file, 5 big-endian host
+     */
+    int load(const char* filename);
+
+    /**
+     * @brief Copy X back to one sample per row, e.g. for predict.
+     * @return Mat, shape = [n_samples, n_features]
+     */
+    Mat rows();
+
+public:
+    int n_samples;
+    int n_features;
+    Mat X_col;                  // X by column, shape = [n_features, n_samples]
+    Mat y;                      // shape = [n_samples, 1]
+    Mat sample_weight;          // shape = [n_samples, 1]
+
+private:
+    void _unmap();
+
+    void* _mapping;
+    size_t _mapping_size;
+
+    ColumnDataset(const ColumnDataset&);
+    ColumnDataset& operator=(const ColumnDataset&);
+};
+
+#endif // DATASET_H
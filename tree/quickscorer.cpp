@@ -0,0 +1,224 @@
+#include "quickscorer.h"
+#include "basetree.h"
+#include <algorithm>
+
+/**
+ * @brief Sort the conditions of a feature by threshold
+ */
+static bool condition_less(const QSCondition& a, const QSCondition& b)
+{
+    return a.threshold < b.threshold;
+}
+
+/**
+ * @brief Number the leaves of the subtree rooted at node_id from left to
+ * right, and record for every internal node the range [left_begin, left_end)
+ * of the leaves of its left subtree.
+ */
+static void number_leaves(const Node* nodes,
+                          int node_id,
+                          vector<int>& left_begin,
+                          vector<int>& left_end,
+                          vector<int>& leaf_nodes)
+{
+    const Node& node = nodes[node_id];
+    if (node.left_child == TREE_LEAF)
+    {
+        leaf_nodes.push_back(node_id);
+        return;
+    }
+    left_begin[node_id] = leaf_nodes.size();
+    number_leaves(nodes, node.left_child, left_begin, left_end, leaf_nodes);
+    left_end[node_id] = leaf_nodes.size();
+    number_leaves(nodes, node.right_child, left_begin, left_end, leaf_nodes);
+}
+
+QuickScorer::QuickScorer(int n_outputs)
+    : _n_outputs(n_outputs),
+      _n_features(0),
+      _n_trees(0),
+      _n_words(0),
+      _sorted(true),
+      _init(n_outputs, 0.0),
+      _tree_words(1, 0),
+      _tree_leaves(1, 0)
+{
+
+}
+
+QuickScorer::~QuickScorer()
+{
+
+}
+
+int QuickScorer::add_tree(Tree* tree,
+                          double weight,
+                          int output)
+{
+    // Only one value per leaf
+    if (tree->_n_classes != 1)
+        return 1;
+    if (output < 0 || output >= _n_outputs)
+        return 2;
+    if (tree->_node_count == 0)
+        return 3;
+
+    const Node* nodes = tree->nodes();
+    vector<int> left_begin(tree->_node_count, 0);
+    vector<int> left_end(tree->_node_count, 0);
+    vector<int> leaf_nodes;
+    number_leaves(nodes, 0, left_begin, left_end, leaf_nodes);
+
+    int n_leaves = leaf_nodes.size();
+    int word_base = _n_words;
+    int n_tree_words = (n_leaves + 63) / 64;
+
+    if (tree->_n_features > _n_features)
+    {
+        _n_features = tree->_n_features;
+        _conditions.resize(_n_features);
+    }
+
+    // One condition per internal node, its mask clears the leaves of the
+    // left subtree
+    QSCondition condition;
+    int first_word, last_word, begin_bit, end_bit;
+    uint64_t clear;
+    for (int node_id = 0; node_id < tree->_node_count; node_id++)
+    {
+        const Node& node = nodes[node_id];
+        if (node.left_child == TREE_LEAF)
+            continue;
+
+        first_word = left_begin[node_id] / 64;
+        last_word = (left_end[node_id] - 1) / 64;
+
+        condition.threshold = node.threshold;
+        condition.word_begin = word_base + first_word;
+        condition.n_words = last_word - first_word + 1;
+        condition.mask_offset = _masks.size();
+
+        for (int w = first_word; w <= last_word; w++)
+        {
+            begin_bit = std::max(left_begin[node_id] - w * 64, 0);
+            end_bit = std::min(left_end[node_id] - w * 64, 64);
+            if (end_bit - begin_bit == 64)
+                clear = ~static_cast<uint64_t>(0);
+            else
+                clear = ((static_cast<uint64_t>(1) << (end_bit - begin_bit)) - 1) << begin_bit;
+            _masks.push_back(~clear);
+        }
+        _conditions[node.feature].push_back(condition);
+    }
+
+    for (int i = 0; i < n_leaves; i++)
+    {
+        _leaf_nodes.push_back(leaf_nodes[i]);
+        _leaf_values.push_back(tree->value(leaf_nodes[i])[0]);
+    }
+
+    _weights.push_back(weight);
+    _outputs.push_back(output);
+    _n_words += n_tree_words;
+    _tree_words.push_back(_n_words);
+    _tree_leaves.push_back(_tree_leaves.back() + n_leaves);
+    _n_trees += 1;
+    _sorted = false;
+    return 0;
+}
+
+void QuickScorer::set_init(Mat init)
+{
+    for (int k = 0; k < _n_outputs; k++)
+        _init[k] = init.at<double>(0, k);
+}
+
+void QuickScorer::_sort_conditions()
+{
+    for (int f = 0; f < _n_features; f++)
+        std::stable_sort(_conditions[f].begin(), _conditions[f].end(), condition_less);
+    _sorted = true;
+}
+
+void QuickScorer::_score_row(const double* row,
+                             uint64_t* bitvectors)
+{
+    std::fill(bitvectors, bitvectors + _n_words, ~static_cast<uint64_t>(0));
+
+    const QSCondition* condition;
+    const QSCondition* end;
+    const uint64_t* mask;
+    double x;
+    bool is_nan;
+    for (int f = 0; f < _n_features; f++)
+    {
+        if (_conditions[f].empty())
+            continue;
+
+        x = row[f];
+        condition = &_conditions[f][0];
+        end = condition + _conditions[f].size();
+
+        // The nodes with threshold < x send the sample to the right, and a
+        // NaN fails every test as in Tree::apply, so all of them do
+        is_nan = (x != x);
+        for (; condition != end && (is_nan || condition->threshold < x); condition++)
+        {
+            mask = &_masks[condition->mask_offset];
+            for (int w = 0; w < condition->n_words; w++)
+                bitvectors[condition->word_begin + w] &= mask[w];
+        }
+    }
+}
+
+int QuickScorer::_exit_leaf(int t,
+                            const uint64_t* bitvectors)
+{
+    // The exit leaf is never cleared, the loop always returns
+    int w = _tree_words[t];
+    while (bitvectors[w] == 0)
+        w++;
+    return _tree_leaves[t] + (w - _tree_words[t]) * 64 + __builtin_ctzll(bitvectors[w]);
+}
+
+Mat QuickScorer::apply(Mat X)
+{
+    if (!_sorted)
+        _sort_conditions();
+
+    int n_samples = X.rows;
+    Mat result(n_samples, _n_trees, CV_32S);
+    vector<uint64_t> bitvectors(std::max(_n_words, 1));
+    int* out;
+
+    for (int i = 0; i < n_samples; i++)
+    {
+        _score_row(X.ptr<double>(i), &bitvectors[0]);
+        out = result.ptr<int>(i);
+        for (int t = 0; t < _n_trees; t++)
+            out[t] = _leaf_nodes[_exit_leaf(t, &bitvectors[0])];
+    }
+    return result;
+}
+
+Mat QuickScorer::predict(Mat X)
+{
+    if (!_sorted)
+        _sort_conditions();
+
+    int n_samples = X.rows;
+    Mat result(n_samples, _n_outputs, CV_64F);
+    vector<uint64_t> bitvectors(std::max(_n_words, 1));
+    double* out;
+
+    for (int i = 0; i < n_samples; i++)
+    {
+        _score_row(X.ptr<double>(i), &bitvectors[0]);
+        out = result.ptr<double>(i);
+        for (int k = 0; k < _n_outputs; k++)
+            out[k] = _init[k];
+        for (int t = 0; t < _n_trees; t++)
+            out[_outputs[t]] += _weights[t] * _leaf_values[_exit_leaf(t, &bitvectors[0])];
+    }
+    return result;
+}
@@ -0,0 +1,126 @@
+#ifndef QUICKSCORER_H
+#define QUICKSCORER_H
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+using std::vector;
+using cv::Mat;
+
+class Tree;
+
+/**
+ * @brief A test "X[:, feature] <= threshold" of an internal node, as stored
+ * by the QuickScorer.
+ */
+struct QSCondition
+{
+    double threshold;               // Threshold value at the node
+    int word_begin;                 // First word of the tree bitvector touched by the mask
+    int n_words;                    // Number of words touched by the mask
+    int mask_offset;                // Offset of the mask words in QuickScorer::_masks
+};
+
+/**
+ * @brief The QuickScorer evaluates an ensemble of trees without walking
+ * down the trees node by node.
+ *
+ * The leaves of every tree are numbered from left to right, and every tree
+ * gets a bitvector with one bit per leaf. The test of an internal node is
+ * "false" when X[i, feature] > threshold: the sample then goes right and
+ * none of the leaves of the left subtree can be its exit leaf, so the mask
+ * of the node clears their bits. A NaN value makes every test false. The
+ * exit leaf of a tree is the leftmost leaf whose bit is still set once the
+ * masks of all the false nodes have been applied.
+ *
+ * The internal nodes of all the trees are grouped by feature and sorted by
+ * threshold, so that for every feature the false nodes of a sample are a
+ * prefix of the sorted list: they are found with one comparison each, and
+ * the scan stops at the first true node.
+ *
+ * The trees are read from the node and value arrays of fitted Tree
+ * objects, which are not referenced after `add_tree` returns.
+ */
+class QuickScorer
+{
+public:
+    /**
+     * @param n_outputs: number of columns of the predictions
+     */
+    QuickScorer(int n_outputs);
+    ~QuickScorer();
+
+    /**
+     * @brief Add a regression tree, its values are added to the predictions
+     * of the given output after being multiplied by weight.
+     * @param tree
+     * @param weight
+     * @param output
+     * @return error_code
+     */
+    int add_tree(Tree* tree,
+                 double weight,
+                 int output);
+
+    /**
+     * @brief Set the initial predictions, before any tree.
+     * @param init: shape = [1, n_outputs]
+     */
+    void set_init(Mat init);
+
+    /**
+     * @brief Finds the leaf node of every tree for each sample in X.
+     * @param X The input samples, shape = [n_samples, n_features], CV_64F
+     * @return The leaf node id in every tree, shape = [n_samples, n_trees], CV_32S
+     */
+    Mat apply(Mat X);
+
+    /**
+     * @brief Compute init + sum(weight * value) over the trees, summed in the
+     * order the trees were added.
+     * @param X The input samples, shape = [n_samples, n_features], CV_64F
+     * @return Mat, shape = [n_samples, n_outputs]
+     */
+    Mat predict(Mat X);
+
+protected:
+    /**
+     * @brief Sort the conditions of every feature by threshold, done once
+     * before the first prediction following `add_tree`.
+     */
+    void _sort_conditions();
+
+    /**
+     * @brief Set the tree bitvectors of one sample.
+     * @param row
+     * @param bitvectors: output, _n_words words
+     */
+    void _score_row(const double* row,
+                    uint64_t* bitvectors);
+
+    /**
+     * @brief Index of the exit leaf of tree t in the leaves of all the trees.
+     */
+    int _exit_leaf(int t,
+                   const uint64_t* bitvectors);
+
+public:
+    int _n_outputs;
+    int _n_features;
+    int _n_trees;
+    int _n_words;                          // Total length of the tree bitvectors, in words
+    bool _sorted;
+
+    vector<double> _init;                  // Initial predictions, shape [n_outputs]
+    vector<double> _weights;               // Weight of every tree
+    vector<int> _outputs;                  // Output of every tree
+    vector<int> _tree_words;               // First bitvector word of every tree, shape [n_trees + 1]
+    vector<int> _tree_leaves;              // First leaf of every tree, shape [n_trees + 1]
+    vector<int> _leaf_nodes;               // Node id of every leaf in its Tree
+    vector<double> _leaf_values;           // Value of every leaf
+
+    vector<vector<QSCondition> > _conditions;   // Conditions of every feature
+    vector<uint64_t> _masks;               // Words of the condition masks
+};
+
+#endif // QUICKSCORER_H
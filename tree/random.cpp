@@ -0,0 +1,48 @@
+#include "random.h"
+
+RandomGenerator::RandomGenerator(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void RandomGenerator::seed(uint64_t seed)
+{
+    // splitmix64, so that close seeds give unrelated states, never all zeros
+    uint64_t x = seed;
+    for (int i = 0; i < 4; i++)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        _state[i] = z ^ (z >> 31);
+    }
+}
+
+void RandomGenerator::jump()
+{
+    static const uint64_t JUMP[] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+                                    0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (JUMP[i] & (1ULL << b))
+            {
+                for (int k = 0; k < 4; k++)
+                    s[k] ^= _state[k];
+            }
+            next();
+        }
+    }
+
+    for (int k = 0; k < 4; k++)
+        _state[k] = s[k];
+}
+
+RandomGenerator RandomGenerator::split()
+{
+    return RandomGenerator(next());
+}
@@ -0,0 +1,96 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+//========================================
+// RandomGenerator
+// xoshiro256** generator owned by each splitter, so that the threads never
+// share a random state
+//========================================
+
+#include <stdint.h>
+
+/**
+ * @brief Seed replacing a null seed
+ */
+const uint64_t DEFAULT_SEED = 1;
+
+class RandomGenerator
+{
+public:
+    /**
+     * @brief A xoshiro256** generator: 256 bits of state, a period of
+     * 2^256 - 1, a few shifts and rotations per draw.
+     *
+     * Every object is a stream of its own. Independent parallel streams are
+     * made by jump(), which moves a copy 2^128 draws ahead: the streams taken
+     * from one seed by successive jumps never overlap. When the number of
+     * streams isn't known beforehand, e.g. the subtrees of a tree, split()
+     * seeds a new stream from the next draw.
+     * @param seed: any value, expanded to the state by splitmix64
+     */
+    RandomGenerator(uint64_t seed=DEFAULT_SEED);
+
+    /**
+     * @brief Restart the stream from a seed
+     * @param seed
+     */
+    void seed(uint64_t seed);
+
+    /**
+     * @brief Next 64 random bits
+     */
+    inline uint64_t next()
+    {
+        uint64_t result = _rotl(_state[1] * 5, 7) * 9;
+        uint64_t t = _state[1] << 17;
+
+        _state[2] ^= _state[0];
+        _state[3] ^= _state[1];
+        _state[1] ^= _state[2];
+        _state[0] ^= _state[3];
+        _state[2] ^= t;
+        _state[3] = _rotl(_state[3], 45);
+
+        return result;
+    }
+
+    /**
+     * @brief Random integer in [low, high), without the modulo of a division
+     * (Lemire's multiply and shift)
+     */
+    inline int rand_int(int low, int high)
+    {
+        uint64_t range = static_cast<uint64_t>(high - low);
+        return low + static_cast<int>(((next() >> 32) * range) >> 32);
+    }
+
+    /**
+     * @brief Random double in [low, high), from the 53 high bits of a draw
+     */
+    inline double rand_double(double low, double high)
+    {
+        double u = static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+        return low + (high - low) * u;
+    }
+
+    /**
+     * @brief Move the stream 2^128 draws ahead, as if next() had been called
+     * 2^128 times
+     */
+    void jump();
+
+    /**
+     * @brief A new stream seeded from the next draw of this one
+     */
+    RandomGenerator split();
+
+private:
+    static inline uint64_t _rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t _state[4];
+};
+
+#endif // RANDOM_H
@@ -0,0 +1,363 @@
+#include "simd.h"
+#include <cmath>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+//========================================
+// Scalar kernels, the reference results
+//========================================
+
+static double sum_of_squares_scalar(const double* x,
+                                    int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; i++)
+        sum += x[i] * x[i];
+    return sum;
+}
+
+static double entropy_sum_scalar(const double* counts,
+                                 int n,
+                                 double total)
+{
+    double entropy = 0.0;
+    double p;
+    for (int i = 0; i < n; i++)
+    {
+        if (counts[i] > 0.0)
+        {
+            p = counts[i] / total;
+            entropy -= p * log(p);
+        }
+    }
+    return entropy;
+}
+
+#ifdef SIMD_X86
+
+/**
+ * Coefficients of log(1 + f) = f - s * (f - R(s)), s = f / (2 + f), from
+ * fdlibm's e_log.c: the error is below 1 ulp for the reduced argument.
+ */
+static const double LOG_LG1 = 6.666666666666735130e-01;
+static const double LOG_LG2 = 3.999999999940941908e-01;
+static const double LOG_LG3 = 2.857142874366239149e-01;
+static const double LOG_LG4 = 2.222219843214978396e-01;
+static const double LOG_LG5 = 1.818357216161805012e-01;
+static const double LOG_LG6 = 1.531383769920937332e-01;
+static const double LOG_LG7 = 1.479819860511658591e-01;
+static const double LOG_LN2_HI = 6.93147180369123816490e-01;
+static const double LOG_LN2_LO = 1.90821492927058770002e-10;
+static const double LOG_SQRT2 = 1.41421356237309504880;
+static const double LOG_TWO52 = 4503599627370496.0;         // 2^52
+static const int64_t LOG_MANTISSA_MASK = 0x000FFFFFFFFFFFFFLL;
+static const int64_t LOG_ONE_BITS = 0x3FF0000000000000LL;   // 1.0
+static const int64_t LOG_TWO52_BITS = 0x4330000000000000LL; // 2^52
+
+//========================================
+// AVX2 kernels
+//========================================
+
+/**
+ * @brief log(x) of 4 positive normal doubles: x = 2^k * m with m in
+ * [sqrt(2)/2, sqrt(2)), and log(m) = log(1 + f) by the fdlibm polynomial.
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256d log_avx2(__m256d x)
+{
+    __m256i bits = _mm256_castpd_si256(x);
+
+    // m in [1, 2), and the biased exponent as a double with the 2^52 trick
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi64x(LOG_MANTISSA_MASK)),
+        _mm256_set1_epi64x(LOG_ONE_BITS)));
+    __m256d k = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                            _mm256_set1_epi64x(LOG_TWO52_BITS))),
+        _mm256_set1_pd(LOG_TWO52 + 1023.0));
+
+    // m in [sqrt(2)/2, sqrt(2))
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(LOG_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    k = _mm256_add_pd(k, _mm256_and_pd(big, _mm256_set1_pd(1.0)));
+
+    __m256d f = _mm256_sub_pd(m, _mm256_set1_pd(1.0));
+    __m256d s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2.0), f));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d w = _mm256_mul_pd(z, z);
+    __m256d t1 = _mm256_fmadd_pd(w, _mm256_set1_pd(LOG_LG6), _mm256_set1_pd(LOG_LG4));
+    t1 = _mm256_fmadd_pd(w, t1, _mm256_set1_pd(LOG_LG2));
+    t1 = _mm256_mul_pd(w, t1);
+    __m256d t2 = _mm256_fmadd_pd(w, _mm256_set1_pd(LOG_LG7), _mm256_set1_pd(LOG_LG5));
+    t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(LOG_LG3));
+    t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(LOG_LG1));
+    t2 = _mm256_mul_pd(z, t2);
+    __m256d R = _mm256_add_pd(t2, t1);
+    __m256d hfsq = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_mul_pd(f, f));
+
+    // k * ln2_hi - ((hfsq - (s * (hfsq + R) + k * ln2_lo)) - f)
+    __m256d r = _mm256_fmadd_pd(s, _mm256_add_pd(hfsq, R),
+                                _mm256_mul_pd(k, _mm256_set1_pd(LOG_LN2_LO)));
+    r = _mm256_sub_pd(_mm256_sub_pd(hfsq, r), f);
+    return _mm256_fmsub_pd(k, _mm256_set1_pd(LOG_LN2_HI), r);
+}
+
+__attribute__((target("avx2,fma")))
+static inline double horizontal_sum_avx2(__m256d v)
+{
+    __m128d low = _mm256_castpd256_pd128(v);
+    __m128d high = _mm256_extractf128_pd(v, 1);
+    low = _mm_add_pd(low, high);
+    return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+__attribute__((target("avx2,fma")))
+static double sum_of_squares_avx2(const double* x,
+                                  int n)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    __m256d a, b;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        a = _mm256_loadu_pd(x + i);
+        b = _mm256_loadu_pd(x + i + 4);
+        sum0 = _mm256_fmadd_pd(a, a, sum0);
+        sum1 = _mm256_fmadd_pd(b, b, sum1);
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        a = _mm256_loadu_pd(x + i);
+        sum0 = _mm256_fmadd_pd(a, a, sum0);
+    }
+    double sum = horizontal_sum_avx2(_mm256_add_pd(sum0, sum1));
+    for (; i < n; i++)
+        sum += x[i] * x[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double entropy_sum_avx2(const double* counts,
+                               int n,
+                               double total)
+{
+    __m256d sum = _mm256_setzero_pd();
+    __m256d inv_total = _mm256_set1_pd(1.0 / total);
+    __m256d c, p, nonzero;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        c = _mm256_loadu_pd(counts + i);
+        nonzero = _mm256_cmp_pd(c, _mm256_setzero_pd(), _CMP_GT_OQ);
+        p = _mm256_mul_pd(c, inv_total);
+
+        // Empty classes add 0, whatever log(0) gives
+        p = _mm256_blendv_pd(_mm256_set1_pd(1.0), p, nonzero);
+        sum = _mm256_fnmadd_pd(p, log_avx2(p), sum);
+    }
+    double entropy = horizontal_sum_avx2(sum);
+    double q;
+    for (; i < n; i++)
+    {
+        if (counts[i] > 0.0)
+        {
+            q = counts[i] / total;
+            entropy -= q * log(q);
+        }
+    }
+    return entropy;
+}
+
+//========================================
+// AVX-512 kernels
+//========================================
+
+/**
+ * @brief log(x) of 8 positive normal doubles, see log_avx2
+ */
+__attribute__((target("avx512f")))
+static inline __m512d log_avx512(__m512d x)
+{
+    __m512i bits = _mm512_castpd_si512(x);
+
+    __m512d m = _mm512_castsi512_pd(_mm512_or_si512(
+        _mm512_and_si512(bits, _mm512_set1_epi64(LOG_MANTISSA_MASK)),
+        _mm512_set1_epi64(LOG_ONE_BITS)));
+    __m512d k = _mm512_sub_pd(
+        _mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(bits, 52),
+                                            _mm512_set1_epi64(LOG_TWO52_BITS))),
+        _mm512_set1_pd(LOG_TWO52 + 1023.0));
+
+    __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(LOG_SQRT2), _CMP_GT_OQ);
+    m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+    k = _mm512_mask_add_pd(k, big, k, _mm512_set1_pd(1.0));
+
+    __m512d f = _mm512_sub_pd(m, _mm512_set1_pd(1.0));
+    __m512d s = _mm512_div_pd(f, _mm512_add_pd(_mm512_set1_pd(2.0), f));
+    __m512d z = _mm512_mul_pd(s, s);
+    __m512d w = _mm512_mul_pd(z, z);
+    __m512d t1 = _mm512_fmadd_pd(w, _mm512_set1_pd(LOG_LG6), _mm512_set1_pd(LOG_LG4));
+    t1 = _mm512_fmadd_pd(w, t1, _mm512_set1_pd(LOG_LG2));
+    t1 = _mm512_mul_pd(w, t1);
+    __m512d t2 = _mm512_fmadd_pd(w, _mm512_set1_pd(LOG_LG7), _mm512_set1_pd(LOG_LG5));
+    t2 = _mm512_fmadd_pd(w, t2, _mm512_set1_pd(LOG_LG3));
+    t2 = _mm512_fmadd_pd(w, t2, _mm512_set1_pd(LOG_LG1));
+    t2 = _mm512_mul_pd(z, t2);
+    __m512d R = _mm512_add_pd(t2, t1);
+    __m512d hfsq = _mm512_mul_pd(_mm512_set1_pd(0.5), _mm512_mul_pd(f, f));
+
+    __m512d r = _mm512_fmadd_pd(s, _mm512_add_pd(hfsq, R),
+                                _mm512_mul_pd(k, _mm512_set1_pd(LOG_LN2_LO)));
+    r = _mm512_sub_pd(_mm512_sub_pd(hfsq, r), f);
+    return _mm512_fmsub_pd(k, _mm512_set1_pd(LOG_LN2_HI), r);
+}
+
+__attribute__((target("avx512f")))
+static double sum_of_squares_avx512(const double* x,
+                                    int n)
+{
+    __m512d sum0 = _mm512_setzero_pd();
+    __m512d sum1 = _mm512_setzero_pd();
+    __m512d a, b;
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        a = _mm512_loadu_pd(x + i);
+        b = _mm512_loadu_pd(x + i + 8);
+        sum0 = _mm512_fmadd_pd(a, a, sum0);
+        sum1 = _mm512_fmadd_pd(b, b, sum1);
+    }
+    if (i + 8 <= n)
+    {
+        a = _mm512_loadu_pd(x + i);
+        sum0 = _mm512_fmadd_pd(a, a, sum0);
+        i += 8;
+    }
+    // The last 0 to 7 classes with a masked load
+    if (i < n)
+    {
+        __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+        a = _mm512_maskz_loadu_pd(tail, x + i);
+        sum1 = _mm512_fmadd_pd(a, a, sum1);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+static double entropy_sum_avx512(const double* counts,
+                                 int n,
+                                 double total)
+{
+    __m512d sum = _mm512_setzero_pd();
+    __m512d inv_total = _mm512_set1_pd(1.0 / total);
+    __m512d c, p;
+    __mmask8 nonzero;
+    __mmask8 valid = 0xFF;
+    for (int i = 0; i < n; i += 8)
+    {
+        if (i + 8 > n)
+            valid = static_cast<__mmask8>((1u << (n - i)) - 1);
+        c = _mm512_maskz_loadu_pd(valid, counts + i);
+        nonzero = _mm512_cmp_pd_mask(c, _mm512_setzero_pd(), _CMP_GT_OQ);
+
+        // Empty classes add 0, whatever log(0) gives
+        p = _mm512_mask_mul_pd(_mm512_set1_pd(1.0), nonzero, c, inv_total);
+        sum = _mm512_fnmadd_pd(p, log_avx512(p), sum);
+    }
+    return _mm512_reduce_add_pd(sum);
+}
+
+#endif // SIMD_X86
+
+//========================================
+// Dispatch
+//========================================
+
+typedef double (*SumOfSquaresKernel)(const double*, int);
+typedef double (*EntropyKernel)(const double*, int, double);
+
+static SimdLevel detect_simd_level()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+#endif
+    return SIMD_SCALAR;
+}
+
+static SimdLevel supported_level = detect_simd_level();
+static SimdLevel current_level = SIMD_SCALAR;
+static SumOfSquaresKernel sum_of_squares_kernel = sum_of_squares_scalar;
+static EntropyKernel entropy_kernel = entropy_sum_scalar;
+static SimdLevel initial_level = set_simd_level(supported_level);
+
+SimdLevel simd_supported()
+{
+    return supported_level;
+}
+
+SimdLevel simd_level()
+{
+    return current_level;
+}
+
+SimdLevel set_simd_level(SimdLevel level)
+{
+    if (level > supported_level)
+        level = supported_level;
+
+    current_level = level;
+    sum_of_squares_kernel = sum_of_squares_scalar;
+    entropy_kernel = entropy_sum_scalar;
+#ifdef SIMD_X86
+    if (level == SIMD_AVX2)
+    {
+        sum_of_squares_kernel = sum_of_squares_avx2;
+        entropy_kernel = entropy_sum_avx2;
+    }
+    else if (level == SIMD_AVX512)
+    {
+        sum_of_squares_kernel = sum_of_squares_avx512;
+        entropy_kernel = entropy_sum_avx512;
+    }
+#endif
+    return level;
+}
+
+const char* simd_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SIMD_AVX2:
+        return "AVX2";
+    case SIMD_AVX512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+double sum_of_squares(const double* x,
+                      int n)
+{
+    if (n < SIMD_MIN_LENGTH)
+        return sum_of_squares_scalar(x, n);
+    return sum_of_squares_kernel(x, n);
+}
+
+double entropy_sum(const double* counts,
+                   int n,
+                   double total)
+{
+    if (n < SIMD_MIN_LENGTH)
+        return entropy_sum_scalar(counts, n, total);
+    return entropy_kernel(counts, n, total);
+}
@@ -0,0 +1,71 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+//========================================
+// SIMD
+// Vectorized kernels of the classification criteria, the instruction set
+// is chosen at runtime
+//========================================
+
+/**
+ * @brief Instruction sets of the kernels, from the slowest
+ */
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,                  // AVX2 + FMA, 4 doubles
+    SIMD_AVX512 = 2                 // AVX-512F, 8 doubles
+};
+
+/**
+ * @brief Below this length the kernels always use the scalar code, whose
+ * results don't depend on the instruction set.
+ */
+const int SIMD_MIN_LENGTH = 4;
+
+/**
+ * @brief Best instruction set supported by the CPU, and by the compiler.
+ */
+SimdLevel simd_supported();
+
+/**
+ * @brief Instruction set used by the kernels, simd_supported() unless
+ * changed with set_simd_level.
+ */
+SimdLevel simd_level();
+
+/**
+ * @brief Choose the instruction set of the kernels, e.g. to compare them.
+ * Not thread safe, call it before fitting.
+ * @param level: lowered to simd_supported() if not supported
+ * @return the level in use
+ */
+SimdLevel set_simd_level(SimdLevel level);
+
+/**
+ * @brief Name of an instruction set, e.g. "AVX2"
+ */
+const char* simd_name(SimdLevel level);
+
+/**
+ * @brief Sum of x[i] * x[i] for i in [0, n)
+ * @param x
+ * @param n
+ * @return sum of squares
+ */
+double sum_of_squares(const double* x,
+                      int n);
+
+/**
+ * @brief Entropy of the class counts, i.e. sum of -p * log(p) with
+ * p = counts[i] / total over the non zero counts.
+ * @param counts: weighted count of every class, >= 0
+ * @param n: number of classes
+ * @param total: sum of the counts
+ * @return entropy
+ */
+double entropy_sum(const double* counts,
+                   int n,
+                   double total);
+
+#endif // SIMD_H
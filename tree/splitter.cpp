@@ -1,6 +1,20 @@
 #include "splitter.h"
+#include "argsort.h"
 #include <algorithm>
 
+/**
+ * @brief Whether the constraints of the criterion itself reject the current
+ * split, only NewtonCriterion has some
+ * @param criterion
+ * @param proxy_improvement: proxy_impurity_improvement of the split
+ */
+static inline bool rejects_split(const Criterion* criterion,
+                                 double proxy_improvement)
+{
+    return (criterion->has_split_constraints &&
+            static_cast<const NewtonCriterion*>(criterion)->rejects_split(proxy_improvement));
+}
+
 void SplitRecord::init_split(int start_pos)
 {
     impurity_left = INFINITY;
@@ -21,6 +35,7 @@ Splitter::Splitter(Criterion* _criterion,
       min_samples_leaf(_min_samples_leaf),
       min_weight_leaf(_min_weight_leaf),
       random_state(_random_state),
+      random_generator(_random_state),
       n_samples(0),
       n_features(0),
       weighted_n_samples(0.0),
@@ -38,56 +53,114 @@ Splitter::~Splitter()
 int Splitter::init(Mat _X,
                    Mat _y,
                    Mat _sample_weight)
+{
+    // The X dependent state is kept between fits on the same data, so that
+    // ensembles only pay for it once
+    if (X.data != _X.data || X.rows != _X.rows || X.cols != _X.cols)
+    {
+        // Validation
+        if (_X.rows == 0 || _X.cols == 0)
+            return 5;
+
+        // X is set first, init_features may identify the dataset by it
+        Mat _X_col;
+        cv::transpose(_X, _X_col);
+        X = _X;
+        int error_code = init_features(_X_col);
+        if (error_code != 0)
+        {
+            X = Mat();
+            return error_code;
+        }
+    }
+
+    return reset_target(_y, _sample_weight);
+}
+
+int Splitter::init_columns(Mat _X_col,
+                           Mat _y,
+                           Mat _sample_weight)
+{
+    if (!X.empty() || X_col.data != _X_col.data ||
+        X_col.rows != _X_col.rows || X_col.cols != _X_col.cols)
+    {
+        X = Mat();
+        int error_code = init_features(_X_col);
+        if (error_code != 0)
+            return error_code;
+    }
+
+    return reset_target(_y, _sample_weight);
+}
+
+int Splitter::init_features(Mat _X_col)
+{
+    // Validation
+    if (_X_col.rows == 0 || _X_col.cols == 0)
+        return 5;
+
+    n_features = _X_col.rows;
+
+    // Store the constant feature index
+    constant_features.resize(n_features);
+
+    // Store the data
+    X_col = _X_col;
+    return 0;
+}
+
+int Splitter::reset_target(Mat _y,
+                           Mat _sample_weight)
 {
     // Init some value
-    n_samples = _X.rows;
-    n_features = _X.cols;
+    n_samples = X_col.cols;
 
     weighted_n_samples = 0.0;
 
     // Validation
-    // _X.rows == _y.rows == _y.total
+    // X.rows == _y.rows, _y.cols == criterion->n_targets()
     // _y.rows == _samples_weight.rows == _samples_weight.total
-    if (_X.rows != _y.rows)
+    if (X_col.cols != _y.rows)
         return 1;
-    if (_y.rows != _y.total())
+    if (_y.cols != criterion->n_targets())
         return 2;
-    if (_y.rows != _sample_weight.rows)
+    if (_sample_weight.total() != 0 && _y.rows != _sample_weight.rows)
         return 3;
     if (_sample_weight.rows != _sample_weight.total())
         return 4;
 
-    // Calculate the weight sum
-    int j = 0;
+    // Calculate the weight sum, samples with a null weight are left out
+    samples.clear();
     for (int i = 0; i < n_samples; i++)
     {
-        if (_sample_weight.total() != 0 || _sample_weight.at<double>(i) != 0.0)
-        {
+        if (_sample_weight.total() == 0 || _sample_weight.at<double>(i) != 0.0)
             samples.push_back(i);
-            j += 1;
-        }
 
         if (_sample_weight.total() != 0)
             weighted_n_samples += _sample_weight.at<double>(i);
         else
             weighted_n_samples += 1.0;
     }
-    n_samples = j;
+    n_samples = samples.size();
+
+    // Every fit draws the same stream from random_state
+    random_generator.seed(random_state);
 
     // Store all feature index
+    features.resize(n_features);
     for (int i = 0; i < n_features; i++)
-        features.push_back(i);
+        features[i] = i;
 
-    // Store the constant feature index
-    constant_features.resize(n_features);
-
-    // Init the size of feature_values
+    // Size the scratch buffers once, node_split doesn't allocate
     feature_values.resize(n_samples);
+    active_samples.resize(n_samples);
+    if (n_samples >= RADIX_SORT_MIN)
+        sort_buffer.reserve(n_samples);
 
-    // Store the data
-    X = _X;
+    // Store the target
     y = _y;
     sample_weight = _sample_weight;
+    return 0;
 }
 
 double Splitter::node_reset(int _start, int _end)
@@ -106,6 +179,49 @@ double Splitter::node_reset(int _start, int _end)
     return weighted_n_node_samples;
 }
 
+void Splitter::reset_features(int n_constant_features)
+{
+    for (int f = 0; f < n_features; f++)
+        features[f] = f;
+    for (int f = 0; f < n_constant_features; f++)
+        features[constant_features[f]] = -1;
+
+    // Move the other features to the end, keeping their order
+    int f_j = n_features - 1;
+    for (int f = n_features - 1; f >= 0; f--)
+        if (features[f] >= 0)
+            features[f_j--] = features[f];
+    for (int f = 0; f < n_constant_features; f++)
+        features[f] = constant_features[f];
+}
+
+Splitter* Splitter::clone() const
+{
+    return NULL;
+}
+
+void Splitter::copy_state(const Splitter& other)
+{
+    n_samples = other.n_samples;
+    n_features = other.n_features;
+    samples = other.samples;
+    features = other.features;
+    constant_features = other.constant_features;
+    weighted_n_samples = other.weighted_n_samples;
+    random_generator = other.random_generator;
+
+    // The scratch buffers are sized, not copied
+    feature_values.resize(other.feature_values.size());
+    active_samples.resize(other.active_samples.size());
+    if (n_samples >= RADIX_SORT_MIN)
+        sort_buffer.reserve(n_samples);
+
+    X = other.X;
+    X_col = other.X_col;
+    y = other.y;
+    sample_weight = other.sample_weight;
+}
+
 BaseDenseSplitter::BaseDenseSplitter(Criterion* criterion,
                                      int max_feature,
                                      int min_samples_leaf,
@@ -129,26 +245,197 @@ int BaseDenseSplitter::init(Mat _X,
                             Mat _y,
                             Mat _sample_weight)
 {
-    Splitter::init(_X, _y, _sample_weight);
+    return Splitter::init(_X, _y, _sample_weight);
 }
 
 BestSplitter::BestSplitter(Criterion* criterion,
                            int max_features,
                            int min_samples_leaf,
                            double min_weight_leaf,
-                           int random_state)
+                           int random_state,
+                           int _n_threads)
     : BaseDenseSplitter(criterion,
                         max_features,
                         min_samples_leaf,
                         min_weight_leaf,
-                        random_state)
+                        random_state),
+      n_threads(_n_threads),
+      pool(NULL)
 {
 
 }
 
 BestSplitter::~BestSplitter()
 {
+    delete pool;
+    for (size_t w = 0; w < workers.size(); w++)
+        delete workers[w].criterion;
+}
+
+int BestSplitter::reset_target(Mat _y,
+                               Mat _sample_weight)
+{
+    // The next parallel node clones the criterion of this fit
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        delete workers[w].criterion;
+        workers[w].criterion = NULL;
+    }
+    return Splitter::reset_target(_y, _sample_weight);
+}
 
+Splitter* BestSplitter::clone() const
+{
+    BestSplitter* splitter = new BestSplitter(criterion->clone(),
+                                              max_features,
+                                              min_samples_leaf,
+                                              min_weight_leaf,
+                                              random_state,
+                                              1);
+    splitter->copy_state(*this);
+    return splitter;
+}
+
+void BestSplitter::evaluate_feature(int feature,
+                                    Criterion* feature_criterion,
+                                    int* active,
+                                    double* Xv,
+                                    SortBuffer& buffer,
+                                    double& best_proxy_improvement,
+                                    SplitRecord& best)
+{
+    int range = end - start;
+    SplitRecord current;
+    double current_proxy_improvement;
+    int p;
+
+    /**
+      * Sort samples along that feature; first copy the feature values for
+      * the node samples into Xv, s.t. Xv[i] == X[active[i], j], so the sort
+      * uses the cache more effectively. Every feature is sorted from the
+      * node order, the result doesn't depend on the features evaluated
+      * before it, nor on the thread.
+      */
+    const double* Xf = X_col.ptr<double>(feature);
+    std::copy(samples.begin() + start, samples.begin() + end, active);
+    for (int i = 0; i < range; i++)
+        Xv[i] = Xf[active[i]];
+    sort_samples(Xv, active, range, buffer);
+
+    // Evaluate all splits
+    feature_criterion->samples = active;
+    feature_criterion->reset();
+    current.feature = feature;
+    p = 0;
+
+    while (p < range)
+    {
+        while (p + 1 < range &&
+               Xv[p+1] <= Xv[p] + FEATURE_THRESHOLD)
+            p += 1;
+        p += 1;
+
+        if (p < range)
+        {
+            current.pos = p;
+
+            // Reject if min_samples_leaf is not guaranteed
+            if (((current.pos) < min_samples_leaf) ||
+                ((range - current.pos) < min_samples_leaf))
+                continue;
+
+            feature_criterion->update(current.pos);
+
+            // Reject if min_weight_leaf is not satisfied
+            if ((feature_criterion->weighted_n_left < min_weight_leaf) ||
+                 feature_criterion->weighted_n_right < min_weight_leaf)
+                continue;
+
+            current_proxy_improvement = feature_criterion->proxy_impurity_improvement();
+
+            // Reject if the constraints of the criterion are not satisfied,
+            // only checked for a split better than the best one
+            if (current_proxy_improvement > best_proxy_improvement &&
+                !rejects_split(feature_criterion, current_proxy_improvement))
+            {
+                best_proxy_improvement = current_proxy_improvement;
+                current.threshold = (Xv[p-1] + Xv[p]) / 2.0;
+
+                if (current.threshold == Xv[p])
+                    current.threshold = Xv[p-1];
+
+                best = current;
+            }
+        }
+    }
+}
+
+void BestSplitter::parallel_evaluate_features(const int* candidates,
+                                              int n_candidates,
+                                              double& best_proxy_improvement,
+                                              SplitRecord& best)
+{
+    if (pool == NULL)
+        pool = new ThreadPool(n_threads);
+
+    // Scratch space of every thread, sized at the root so that the other
+    // nodes don't allocate
+    int n_workers = pool->size();
+    if (static_cast<int>(workers.size()) < n_workers)
+        workers.resize(n_workers);
+    for (int w = 0; w < n_workers; w++)
+    {
+        FeatureWorker& worker = workers[w];
+        if (worker.criterion == NULL)
+            worker.criterion = criterion->clone();
+        if (static_cast<int>(worker.active_samples.size()) < end - start)
+        {
+            worker.active_samples.resize(end - start);
+            worker.feature_values.resize(end - start);
+        }
+        worker.node_ready = false;
+        worker.best_proxy_improvement = -INFINITY;
+        worker.best_candidate = -1;
+    }
+
+    // Task c evaluates the c-th drawn feature. Every thread keeps its best
+    // split, the first one of the tasks it took, which come in increasing
+    // order.
+    pool->parallel_for(n_candidates, [&](int c, int w) {
+        FeatureWorker& worker = workers[w];
+        if (!worker.node_ready)
+        {
+            worker.criterion->init(y, sample_weight, weighted_n_samples,
+                                   samples, start, end);
+            worker.node_ready = true;
+        }
+
+        double previous = worker.best_proxy_improvement;
+        evaluate_feature(candidates[n_candidates - 1 - c], worker.criterion,
+                         &worker.active_samples[0], &worker.feature_values[0],
+                         worker.sort_buffer, worker.best_proxy_improvement,
+                         worker.best);
+        if (worker.best_proxy_improvement > previous)
+            worker.best_candidate = c;
+    });
+
+    // Same split as the serial loop: the best proxy, the first candidate
+    // on ties
+    int best_candidate = n_candidates;
+    for (int w = 0; w < n_workers; w++)
+    {
+        FeatureWorker& worker = workers[w];
+        if (worker.best_candidate < 0)
+            continue;
+        if (worker.best_proxy_improvement > best_proxy_improvement ||
+            (worker.best_proxy_improvement == best_proxy_improvement &&
+             worker.best_candidate < best_candidate))
+        {
+            best_proxy_improvement = worker.best_proxy_improvement;
+            best_candidate = worker.best_candidate;
+            best = worker.best;
+        }
+    }
 }
 
 void BestSplitter::node_split(double impurity,
@@ -160,11 +447,17 @@ void BestSplitter::node_split(double impurity,
 
     std::pair<double, double> pdd;
 
-    SplitRecord best, current;
+    SplitRecord best;
+    best.init_split(end);
+    double best_proxy_improvement = -INFINITY;
 
     int p;
     int tmp;
     int partition_end;
+    int feature;
+    double value;
+    double min_feature_value;
+    double max_feature_value;
     int n_visited_features = 0;
     // Num of features discovered to be constant during the split search
     int n_found_constants = 0;
@@ -173,11 +466,7 @@ void BestSplitter::node_split(double impurity,
     int n_known_constants = *n_constant_features;
     // n_total_constants = n_known_constants + n_found_constants
     int n_total_constants = n_known_constants;
-
-    feature_values.resize(range);
-    active_samples = vector<int>(samples.begin()+start, samples.begin()+end);
-    vector<int> sorted_samples = active_samples;
-    std::sort(sorted_samples.begin(), sorted_samples.end());
+    const double* Xf;                   // Column of the current feature
 
     /**
       * Sample up to max_features without replacement using a
@@ -189,6 +478,10 @@ void BestSplitter::node_split(double impurity,
       * for good splitting) by ancestor nodes and save the information on
       * newly discovered constant features to spare computation on descendant
       * node.
+      *
+      * The features are only drawn here, a new constant feature is found by
+      * its range over the node without sorting it. The drawn features are
+      * evaluated after the loop, serially or in parallel.
       */
     int f_i = n_features;
     int f_j = 0;
@@ -214,8 +507,8 @@ void BestSplitter::node_split(double impurity,
           */
 
         // Draw a feature at random
-        f_j = rand_int(n_drawn_constants, f_i - n_found_constants,
-                       random_state);
+        f_j = random_generator.rand_int(n_drawn_constants,
+                                       f_i - n_found_constants);
 
         if (f_j < n_known_constants) // in the interval [n_drawn_constasn, n_known_constants]
         {
@@ -233,33 +526,26 @@ void BestSplitter::node_split(double impurity,
             f_j += n_found_constants;
             // f_j in the interval [n_total_constants, f_i]
 
-            current.feature = features[f_j];
+            feature = features[f_j];
 
-            /**
-              * Sort sampels along that feature; first copy the feature
-              * values for the active samples into feature_values, s.t.
-              * feature_values[i] == X[sampels[i], j], so the sort uses the cache more
-              * effectively.
-              */
-            for (int i = 0; i < range; i++)
+            Xf = X_col.ptr<double>(feature);
+            min_feature_value = Xf[samples[start]];
+            max_feature_value = min_feature_value;
+            for (p = start + 1; p < end; p++)
             {
-                feature_values.at(i) = X.at<double>(active_samples.at(i), current.feature);
+                value = Xf[samples[p]];
+                if (value < min_feature_value)
+                    min_feature_value = value;
+                else if (value > max_feature_value)
+                    max_feature_value = value;
             }
 
-            // sort feature_values and apply the squence to samples
-            // std::sort(feature_values.begin(), feature_values.end());
-            auto sequence = sort_permutation(feature_values,
-                                [](double const& a, double const &b){return a<b;});
-            feature_values = apply_permutation(feature_values, sequence);
-            active_samples = apply_permutation(active_samples, sequence);
-            criterion->samples = active_samples;
-
-            if (feature_values.back() <= feature_values.front() + FEATURE_THRESHOLD)
+            if (max_feature_value <= min_feature_value + FEATURE_THRESHOLD)
             {
                 // The feature is constant
                 // Move it to the features[n_total_constants]
                 features[f_j] = features[n_total_constants];
-                features[n_total_constants] = current.feature;
+                features[n_total_constants] = feature;
 
                 n_found_constants += 1;
                 n_total_constants += 1;
@@ -271,64 +557,35 @@ void BestSplitter::node_split(double impurity,
                 tmp = features[f_i];
                 features[f_i] = features[f_j];
                 features[f_j] = tmp;
-
-                // Evaluate all splits
-                criterion->reset();
-                p = 0;
-
-                while (p < range)
-                {
-                    while (p + 1 < range &&
-                           feature_values.at(p+1) <= feature_values.at(p) + FEATURE_THRESHOLD)
-                        p += 1;
-                    p += 1;
-
-                    if (p < range)
-                    {
-                        current.pos = p;
-
-                        // Reject if min_samples_leaf is not guaranteed
-                        if (((current.pos) < min_samples_leaf) ||
-                            ((end - current.pos) < min_samples_leaf))
-                            continue;
-
-                        criterion->update(current.pos);
-
-                        // Reject if min_weight_leaf is not satisfied
-                        if ((criterion->weighted_n_left < min_weight_leaf) ||
-                             criterion->weighted_n_right < min_weight_leaf)
-                            continue;
-
-                        double a = impurity;
-                        current.improvement = criterion->impurity_improvement(impurity);
-
-                        if (current.improvement > best.improvement)
-                        {
-                            pdd = criterion->children_impurity();
-                            current.impurity_left = pdd.first;
-                            current.impurity_right = pdd.second;
-                            current.threshold = (feature_values.at(p-1) + feature_values.at(p)) / 2.0;
-
-                            if (current.threshold == feature_values.at(p))
-                                current.threshold = feature_values.at(p-1);
-
-                            best = current;
-                        }
-                    }
-                }
             }
         }
     }
 
+    // The drawn features are features[f_i:n_features], from the last drawn
+    // to the first one. They are evaluated in the drawing order.
+    int n_candidates = n_features - f_i;
+    const int* candidates = &features[f_i];
+
+    if (n_threads != 1 && n_candidates > 1 &&
+        static_cast<long>(n_candidates) * range >= FEATURE_PARALLEL_MIN_WORK)
+        parallel_evaluate_features(candidates, n_candidates,
+                                   best_proxy_improvement, best);
+    else
+        for (int c = n_candidates - 1; c >= 0; c--)
+            evaluate_feature(candidates[c], criterion,
+                             &active_samples[0], &feature_values[0],
+                             sort_buffer, best_proxy_improvement, best);
+
     // Recoganize into samples[start:best.pos] + samples[best.pos:end]
     if (best.pos < end)
     {
         partition_end = end;
         p = start;
+        Xf = X_col.ptr<double>(best.feature);
 
         while (p < partition_end)
         {
-            if (X.at<double>(samples.at(p), best.feature) <= best.threshold)
+            if (Xf[samples.at(p)] <= best.threshold)
                 p += 1;
             else
             {
@@ -341,6 +598,19 @@ void BestSplitter::node_split(double impurity,
         }
     }
 
+    // Only the best split needs its exact improvement, the criterion is
+    // moved back to it on the partitioned samples
+    if (best.pos < end)
+    {
+        criterion->samples = &samples[start];
+        criterion->reset();
+        criterion->update(best.pos);
+        best.improvement = criterion->impurity_improvement(impurity);
+        pdd = criterion->children_impurity();
+        best.impurity_left = pdd.first;
+        best.impurity_right = pdd.second;
+    }
+
     // Respect invariant for constant features: the original order of
     // element in features[:n_known_constants] must be preserved for sibling
     // and child nodes
@@ -375,20 +645,34 @@ RandomSplitter::~RandomSplitter()
 
 }
 
+Splitter* RandomSplitter::clone() const
+{
+    RandomSplitter* splitter = new RandomSplitter(criterion->clone(),
+                                                  max_features,
+                                                  min_samples_leaf,
+                                                  min_weight_leaf,
+                                                  random_state);
+    splitter->copy_state(*this);
+    return splitter;
+}
+
 void RandomSplitter::node_split(double impurity,
                                 SplitRecord *split,
                                 int *n_constant_features)
 {
     split->init_split(end);
 
-    feature_values.clear();
     std::pair<double, double> pdd;
 
     SplitRecord best, current;
+    best.init_split(end);
+    double current_proxy_improvement;
+    double best_proxy_improvement = -INFINITY;
 
     double min_feature_value;
     double max_feature_value;
     double current_feature_value;
+    const double* Xf;                   // Column of the current feature
     int p;
     int tmp;
     int partition_end;
@@ -401,6 +685,9 @@ void RandomSplitter::node_split(double impurity,
     // n_total_constants = n_known_constants + n_found_constants
     int n_total_constants = n_known_constants;
 
+    // The criterion sees the node samples, split positions are relative to start
+    criterion->samples = &samples[start];
+
     /**
       * Sample up to max_features without replacement using a
       * Fisher-Yates-based algorithm (using the local variables 'f_i' and
@@ -436,8 +723,8 @@ void RandomSplitter::node_split(double impurity,
           */
 
         // Draw a feature at random
-        f_j = rand_int(n_drawn_constants, f_i - n_found_constants,
-                       random_state);
+        f_j = random_generator.rand_int(n_drawn_constants,
+                                       f_i - n_found_constants);
 
         if (f_j < n_known_constants) // in the interval [n_drawn_constasn, n_known_constants]
         {
@@ -459,13 +746,14 @@ void RandomSplitter::node_split(double impurity,
 
             // Find min, max
             // This is faster than sort
-            min_feature_value = X.at<double>(samples[start], current.feature);
+            Xf = X_col.ptr<double>(current.feature);
+            min_feature_value = Xf[samples[start]];
             max_feature_value = min_feature_value;
             feature_values.at(start) = min_feature_value;
 
             for (int i = start+1; i < end; i++)
             {
-                current_feature_value = X.at<double>(samples[i], current.feature);
+                current_feature_value = Xf[samples[i]];
                 feature_values.at(i) = current_feature_value;
 
                 if (current_feature_value < min_feature_value)
@@ -490,9 +778,8 @@ void RandomSplitter::node_split(double impurity,
                 features.at(f_i) = tmp;
 
                 // Draw a random threshold
-                current.threshold = rand_double(min_feature_value,
-                                                max_feature_value,
-                                                random_state);
+                current.threshold = random_generator.rand_double(min_feature_value,
+                                                                 max_feature_value);
 
                 if (current.threshold == max_feature_value)
                     current.threshold = min_feature_value;
@@ -517,11 +804,11 @@ void RandomSplitter::node_split(double impurity,
                         samples.at(p) = tmp;
                     }
                 }
-                current.pos = partition_end;
+                current.pos = partition_end - start;
 
                 // Reject if min_samples_leaf is not guaranteed
-                if (((current.pos - start) < min_samples_leaf) ||
-                        ((end - current.pos) < min_samples_leaf))
+                if ((current.pos < min_samples_leaf) ||
+                        ((end - start - current.pos) < min_samples_leaf))
                     continue;
 
                 // Evaluate split
@@ -533,13 +820,14 @@ void RandomSplitter::node_split(double impurity,
                         criterion->weighted_n_right < min_weight_leaf)
                     continue;
 
-                current.improvement = criterion->impurity_improvement(impurity);
+                current_proxy_improvement = criterion->proxy_impurity_improvement();
 
-                if (current.improvement > best.improvement)
+                // Reject if the constraints of the criterion are not satisfied,
+                // only checked for a split better than the best one
+                if (current_proxy_improvement > best_proxy_improvement &&
+                    !rejects_split(criterion, current_proxy_improvement))
                 {
-                    pdd = criterion->children_impurity();
-                    current.impurity_left = pdd.first;
-                    current.impurity_right = pdd.second;
+                    best_proxy_improvement = current_proxy_improvement;
                     best = current;
                 }
             }
@@ -551,10 +839,11 @@ void RandomSplitter::node_split(double impurity,
     {
         partition_end = end;
         p = start;
+        Xf = X_col.ptr<double>(best.feature);
 
         while (p < partition_end)
         {
-            if (X.at<double>(samples[p], best.feature) <= best.threshold)
+            if (Xf[samples[p]] <= best.threshold)
                 p += 1;
             else
             {
@@ -567,6 +856,17 @@ void RandomSplitter::node_split(double impurity,
         }
     }
 
+    // Only the best split needs its exact improvement
+    if (best.pos < end)
+    {
+        criterion->reset();
+        criterion->update(best.pos);
+        best.improvement = criterion->impurity_improvement(impurity);
+        pdd = criterion->children_impurity();
+        best.impurity_left = pdd.first;
+        best.impurity_right = pdd.second;
+    }
+
     // Respect invariant for constant features: the original order of
     // element in features[:n_known_constants] must be preserved for sibling
     // and child nodes
@@ -601,40 +901,54 @@ PresortBestSplitter::~PresortBestSplitter()
 
 }
 
-int PresortBestSplitter::init(Mat _X,
-                              Mat _y,
-                              Mat _sample_weight)
+Splitter* PresortBestSplitter::clone() const
 {
-    // Call parent initializer
-    BaseDenseSplitter::init(_X, _y, _sample_weight);
-
-    X = _X;
+    PresortBestSplitter* splitter = new PresortBestSplitter(criterion->clone(),
+                                                            max_features,
+                                                            min_samples_leaf,
+                                                            min_weight_leaf,
+                                                            random_state);
+    splitter->copy_state(*this);
+    splitter->X_argsorted = X_argsorted;
+    splitter->n_total_samples = n_total_samples;
+    splitter->sample_mask = sample_mask;
+    return splitter;
+}
 
-    // Pre-sort X
-//    if (X_old == X)
-    if (true)
-    {
-        X_old = X.clone();
-        n_total_samples = X.rows;
-        cv::sortIdx(_X, X_argsorted, CV_SORT_EVERY_COLUMN + CV_SORT_ASCENDING);
-        sample_mask.resize(n_total_samples);
-    }
+int PresortBestSplitter::init_features(Mat _X_col)
+{
+    // Call parent initializer
+    int error_code = BaseDenseSplitter::init_features(_X_col);
+    if (error_code != 0)
+        return error_code;
+
+    // Sort every feature once per dataset, X_argsorted.at<int>(j, i) is the
+    // i-th sample along feature j. The trees fitted on X share it.
+    X_argsorted = argsort_columns(X.empty() ? X_col : X, X_col);
+    n_total_samples = X_col.cols;
+    sample_mask.assign(n_total_samples, 0);
+    return 0;
 }
 
 void PresortBestSplitter::node_split(double impurity,
                                      SplitRecord *split,
                                      int *n_constant_features)
 {
+    int range = end - start;
     split->init_split(end);
 
-    feature_values.clear();
     std::pair<double, double> pdd;
 
     SplitRecord best, current;
+    best.init_split(end);
+    double current_proxy_improvement;
+    double best_proxy_improvement = -INFINITY;
 
     int partition_end = 0;
     int p = 0;
     int tmp;
+    const double* Xf;                   // Column of the current feature
+    const int* order;                   // Samples in the order of the current feature
     int n_visited_features = 0;
     // Num of features discovered to be constant during the split search
     int n_found_constants = 0;
@@ -644,10 +958,17 @@ void PresortBestSplitter::node_split(double impurity,
     // n_total_constants = n_known_constants + n_found_constants
     int n_total_constants = n_known_constants;
 
-    for (p = start; p < end; p++)
-    {
-        sample_mask.at(samples[p]) = 1;
-    }
+    // The node is samples[start:end], as in BestSplitter the positions are
+    // relative to start
+    int* node_samples = &samples[start];
+    double* Xv = &feature_values[start];
+
+    // Taking the node samples from the argsort scans all the samples, the
+    // small nodes are sorted as in BestSplitter instead
+    bool use_argsort = (static_cast<long>(range) * PRESORT_MAX_SCAN_RATIO >= n_total_samples);
+    if (use_argsort)
+        for (p = 0; p < range; p++)
+            sample_mask[node_samples[p]] = 1;
 
     /**
       * Sample up to max_features without replacement using a
@@ -662,10 +983,10 @@ void PresortBestSplitter::node_split(double impurity,
       */
     int f_i = n_features;
     int f_j = 0;
-    while (f_i > n_total_samples && // Stop early if remaining features
-                                     // are constant
+    while (f_i > n_total_constants && // Stop early if remaining features
+                                      // are constant
            (n_visited_features < max_features ||
-            // At least one drawn features must be non constant)
+            // At least one drawn features must be non constant
             n_visited_features <= n_found_constants + n_drawn_constants))
     {
         n_visited_features += 1;
@@ -684,8 +1005,8 @@ void PresortBestSplitter::node_split(double impurity,
           */
 
         // Draw a feature at random
-        f_j = rand_int(n_drawn_constants, f_i - n_found_constants,
-                       random_state);
+        f_j = random_generator.rand_int(n_drawn_constants,
+                                       f_i - n_found_constants);
 
         if (f_j < n_known_constants) // in the interval [n_drawn_constasn, n_known_constants]
         {
@@ -705,23 +1026,34 @@ void PresortBestSplitter::node_split(double impurity,
 
             current.feature = features[f_j];
 
-            // Extract ordering from X_argsorted
-            p = start;
-
-            for (int i = start, j = 0; i < n_total_samples; i++)
+            Xf = X_col.ptr<double>(current.feature);
+            if (use_argsort)
             {
-                j = X_argsorted.at<int>(current.feature, i);
-                if (sample_mask[j] == 1)
+                // Extract the node samples in the order of X_argsorted, no sort
+                order = X_argsorted.ptr<int>(current.feature);
+                p = 0;
+                for (int i = 0, j = 0; i < n_total_samples; i++)
                 {
-                    samples[p] = j;
-                    feature_values.at(p) = X.at<double>(j, current.feature);
-                    p += 1;
+                    j = order[i];
+                    if (sample_mask[j] == 1)
+                    {
+                        node_samples[p] = j;
+                        Xv[p] = Xf[j];
+                        p += 1;
+                    }
                 }
             }
+            else
+            {
+                for (p = 0; p < range; p++)
+                    Xv[p] = Xf[node_samples[p]];
+                sort_samples(Xv, node_samples, range, sort_buffer);
+            }
+            criterion->samples = node_samples;
 
-            // Evaluate all splits
-            if (feature_values.at(end-1) <= feature_values.at(start) + FEATURE_THRESHOLD)
+            if (Xv[range - 1] <= Xv[0] + FEATURE_THRESHOLD)
             {
+                // The feature is constant
                 features[f_j] = features[n_total_constants];
                 features[n_total_constants] = current.feature;
 
@@ -730,48 +1062,51 @@ void PresortBestSplitter::node_split(double impurity,
             }
             else
             {
+                // The feature is good
                 f_i -= 1;
                 tmp = features[f_i];
                 features[f_i] = features[f_j];
                 features[f_j] = tmp;
 
+                // Evaluate all splits
                 criterion->reset();
+                p = 0;
 
-                while (p < end)
+                while (p < range)
                 {
-                    while (p + 1 < end &&
-                           feature_values.at(p+1) <= feature_values.at(p) + FEATURE_THRESHOLD)
+                    while (p + 1 < range &&
+                           Xv[p+1] <= Xv[p] + FEATURE_THRESHOLD)
                         p += 1;
-
                     p += 1;
 
-                    if (p < end)
+                    if (p < range)
                     {
                         current.pos = p;
 
                         // Reject if min_samples_leaf is not guaranteed
-                        if (((current.pos - start) < min_samples_leaf) ||
-                             ((end - current.pos) < min_samples_leaf))
+                        if ((current.pos < min_samples_leaf) ||
+                            ((range - current.pos) < min_samples_leaf))
                             continue;
 
                         criterion->update(current.pos);
 
                         // Reject if min_weight_leaf is not satisfied
                         if ((criterion->weighted_n_left < min_weight_leaf) ||
-                                (criterion->weighted_n_right < min_weight_leaf))
+                             criterion->weighted_n_right < min_weight_leaf)
                             continue;
 
-                        current.improvement = criterion->impurity_improvement(impurity);
+                        current_proxy_improvement = criterion->proxy_impurity_improvement();
 
-                        if (current.improvement > best.improvement)
+                        // Reject if the constraints of the criterion are not satisfied,
+                        // only checked for a split better than the best one
+                        if (current_proxy_improvement > best_proxy_improvement &&
+                            !rejects_split(criterion, current_proxy_improvement))
                         {
-                            pdd = criterion->children_impurity();
-                            current.impurity_left = pdd.first;
-                            current.impurity_right = pdd.second;
-                            current.threshold = (feature_values.at(p-1) + feature_values.at(p)) / 2.0;
+                            best_proxy_improvement = current_proxy_improvement;
+                            current.threshold = (Xv[p-1] + Xv[p]) / 2.0;
 
-                            if (current.threshold == feature_values.at(p))
-                                current.threshold = feature_values.at(p-1);
+                            if (current.threshold == Xv[p])
+                                current.threshold = Xv[p-1];
 
                             best = current;
                         }
@@ -786,10 +1121,11 @@ void PresortBestSplitter::node_split(double impurity,
     {
         partition_end = end;
         p = start;
+        Xf = X_col.ptr<double>(best.feature);
 
         while (p < partition_end)
         {
-            if (X.at<double>(samples[p], best.feature) <= best.threshold)
+            if (Xf[samples[p]] <= best.threshold)
                 p += 1;
             else
             {
@@ -802,6 +1138,24 @@ void PresortBestSplitter::node_split(double impurity,
         }
     }
 
+    // Only the best split needs its exact improvement, the criterion is
+    // moved back to it on the partitioned samples
+    if (best.pos < end)
+    {
+        criterion->samples = &samples[start];
+        criterion->reset();
+        criterion->update(best.pos);
+        best.improvement = criterion->impurity_improvement(impurity);
+        pdd = criterion->children_impurity();
+        best.impurity_left = pdd.first;
+        best.impurity_right = pdd.second;
+    }
+
+    // Clear the mask for the next node
+    if (use_argsort)
+        for (p = start; p < end; p++)
+            sample_mask[samples[p]] = 0;
+
     // Respect invariant for constant features: the original order of
     // element in features[:n_known_constants] must be preserved for sibling
     // and child nodes
@@ -853,3 +1207,424 @@ void PresortBestSplitter::node_split(double impurity,
 
 
 
+
+HistogramPool::HistogramPool()
+    : n_stats_total(0),
+      n_bins_total(0)
+{
+
+}
+
+HistogramPool::~HistogramPool()
+{
+    for (size_t i = 0; i < all.size(); i++)
+        delete all[i];
+}
+
+void HistogramPool::init(int _n_stats_total, int _n_bins_total)
+{
+    n_stats_total = _n_stats_total;
+    n_bins_total = _n_bins_total;
+
+    // Histograms of a previous size can not be reused
+    for (size_t i = 0; i < all.size(); i++)
+        delete all[i];
+    all.clear();
+    free_list.clear();
+}
+
+NodeHistogram* HistogramPool::acquire()
+{
+    if (free_list.empty())
+    {
+        NodeHistogram* hist = new NodeHistogram();
+        hist->stats.resize(n_stats_total);
+        hist->counts.resize(n_bins_total);
+        all.push_back(hist);
+        return hist;
+    }
+    NodeHistogram* hist = free_list.back();
+    free_list.pop_back();
+    return hist;
+}
+
+void HistogramPool::release(NodeHistogram* hist)
+{
+    if (hist != NULL)
+        free_list.push_back(hist);
+}
+
+HistogramSplitter::HistogramSplitter(Criterion* _criterion,
+                                     int _max_features,
+                                     int _min_samples_leaf,
+                                     double _min_weight_leaf,
+                                     int _random_state,
+                                     int _max_bins)
+    : BaseDenseSplitter(_criterion,
+                        _max_features,
+                        _min_samples_leaf,
+                        _min_weight_leaf,
+                        _random_state),
+      bin_mapper(_max_bins),
+      n_stats(0),
+      node_histogram(NULL),
+      n_scanned_rows(0)
+{
+
+}
+
+HistogramSplitter::~HistogramSplitter()
+{
+
+}
+
+int HistogramSplitter::init_features(Mat _X_col)
+{
+    // Call parent initializer
+    int error_code = BaseDenseSplitter::init_features(_X_col);
+    if (error_code != 0)
+        return error_code;
+
+    // Quantize X once, every node only reads the bins
+    error_code = bin_mapper.fit(_X_col);
+    if (error_code != 0)
+        return error_code;
+
+    // Layout of the node histograms
+    offsets.resize(n_features + 1);
+    offsets[0] = 0;
+    for (int j = 0; j < n_features; j++)
+        offsets[j+1] = offsets[j] + bin_mapper.n_bins(j);
+
+    node_histogram = NULL;
+    n_scanned_rows = 0;
+    return 0;
+}
+
+void HistogramSplitter::init_histogram_pool(HistogramPool* pool)
+{
+    n_stats = criterion->n_stats();
+    pool->init(offsets[n_features] * n_stats, offsets[n_features]);
+}
+
+void HistogramSplitter::build_node_histogram(NodeHistogram* hist,
+                                             int _start,
+                                             int _end)
+{
+    double* stats = &hist->stats[0];
+    int* counts = &hist->counts[0];
+
+    std::fill(hist->stats.begin(), hist->stats.end(), 0.0);
+    std::fill(hist->counts.begin(), hist->counts.end(), 0);
+
+    int index, b;
+    for (int i = _start; i < _end; i++)
+    {
+        index = samples[i];
+        for (int j = 0; j < n_features; j++)
+        {
+            b = offsets[j] + bin_mapper.column(j)[index];
+            counts[b] += 1;
+            criterion->add_sample_stats(index, stats + b * n_stats);
+        }
+    }
+    n_scanned_rows += _end - _start;
+}
+
+void HistogramSplitter::subtract_histogram(NodeHistogram* parent,
+                                           const NodeHistogram* child)
+{
+    for (size_t i = 0; i < parent->stats.size(); i++)
+        parent->stats[i] -= child->stats[i];
+    for (size_t i = 0; i < parent->counts.size(); i++)
+        parent->counts[i] -= child->counts[i];
+}
+
+void HistogramSplitter::build_level_histograms(NodeHistogram** histograms,
+                                               int n_histograms,
+                                               const int* sample_slots)
+{
+    int n_rows = X_col.cols;
+
+    for (int h = 0; h < n_histograms; h++)
+    {
+        std::fill(histograms[h]->stats.begin(), histograms[h]->stats.end(), 0.0);
+        std::fill(histograms[h]->counts.begin(), histograms[h]->counts.end(), 0);
+    }
+
+    // The rows to scan in increasing order with their slot and statistics,
+    // computed once for all the features
+    level_rows.clear();
+    level_slots.clear();
+    for (int i = 0; i < n_rows; i++)
+    {
+        if (sample_slots[i] >= 0)
+        {
+            level_rows.push_back(i);
+            level_slots.push_back(sample_slots[i]);
+        }
+    }
+    int n_level_rows = level_rows.size();
+    n_scanned_rows += n_level_rows;
+
+    row_stats.assign(static_cast<size_t>(n_level_rows) * n_stats, 0.0);
+    for (int r = 0; r < n_level_rows; r++)
+        criterion->add_sample_stats(level_rows[r], &row_stats[static_cast<size_t>(r) * n_stats]);
+
+    const int* rows = &level_rows[0];
+    const int* slots = &level_slots[0];
+    int b;
+    for (int j = 0; j < n_features; j++)
+    {
+        const unsigned char* bins = bin_mapper.column(j);
+        int offset = offsets[j];
+
+        for (int r = 0; r < n_level_rows; r++)
+        {
+            NodeHistogram* hist = histograms[slots[r]];
+            b = offset + bins[rows[r]];
+            hist->counts[b] += 1;
+
+            double* bin_stats = &hist->stats[b * n_stats];
+            const double* stats = &row_stats[static_cast<size_t>(r) * n_stats];
+            for (int k = 0; k < n_stats; k++)
+                bin_stats[k] += stats[k];
+        }
+    }
+}
+
+void HistogramSplitter::build_histogram(int feature,
+                                        double* hist,
+                                        int* counts)
+{
+    int n_bins = bin_mapper.n_bins(feature);
+    const unsigned char* bins = bin_mapper.column(feature);
+
+    std::fill(hist, hist + n_bins * n_stats, 0.0);
+    std::fill(counts, counts + n_bins, 0);
+
+    int index, b;
+    for (int i = start; i < end; i++)
+    {
+        index = samples[i];
+        b = bins[index];
+        counts[b] += 1;
+        criterion->add_sample_stats(index, hist + b * n_stats);
+    }
+    n_scanned_rows += end - start;
+}
+
+void HistogramSplitter::node_split(double impurity,
+                                   SplitRecord *split,
+                                   int *n_constant_features)
+{
+    int range = end - start;
+
+    std::pair<double, double> pdd;
+
+    SplitRecord best, current;
+    best.init_split(end);
+    double current_proxy_improvement;
+    double best_proxy_improvement = -INFINITY;
+    int best_bin = 0;
+
+    int n_bins;
+    int n_left;
+    int n_nonempty;
+    int p;
+    int tmp;
+    int partition_end;
+    int n_visited_features = 0;
+    // Num of features discovered to be constant during the split search
+    int n_found_constants = 0;
+    // Num of features known to be constant and drawn without replacement
+    int n_drawn_constants = 0;
+    int n_known_constants = *n_constant_features;
+    // n_total_constants = n_known_constants + n_found_constants
+    int n_total_constants = n_known_constants;
+
+    double* hist;
+    int* counts;
+
+    n_stats = criterion->n_stats();
+    histogram.resize(bin_mapper.max_bins * n_stats);
+    bin_counts.resize(bin_mapper.max_bins);
+    stats_left.resize(n_stats);
+    best_stats_left.resize(n_stats);
+
+    /**
+      * Sample up to max_features without replacement using a
+      * Fisher-Yates-based algorithm (using the local variables 'f_i' and
+      * 'f_j' to compute a permutation of the 'features' array.
+      *
+      * Skip the CPU intensive evaluation of the impurity criterion for
+      * features that were already detected as constant (hence not suitable
+      * for good splitting) by ancestor nodes and save the information on
+      * newly discovered constant features to spare computation on descendant
+      * node.
+      */
+    int f_i = n_features;
+    int f_j = 0;
+    while (f_i > n_total_constants && // Stop early if remaining features
+                                      // are constant
+           (n_visited_features < max_features ||
+            // At least one drawn features must be non constant
+            n_visited_features <= n_found_constants + n_drawn_constants))
+    {
+        n_visited_features += 1;
+
+        // Draw a feature at random
+        f_j = random_generator.rand_int(n_drawn_constants,
+                                       f_i - n_found_constants);
+
+        if (f_j < n_known_constants) // in the interval [n_drawn_constasn, n_known_constants]
+        {
+            // swap features[f_j] and features[n_drawn_constants]
+            // move the constant feature to the end
+            tmp = features[f_j];
+            features[f_j] = features[n_drawn_constants];
+            features[n_drawn_constants] = tmp;
+
+            n_drawn_constants += 1;
+        }
+        else
+        {
+            // f_j in the interval [n_known_constants, f_i-n_found_constatns]
+            f_j += n_found_constants;
+            // f_j in the interval [n_total_constants, f_i]
+
+            current.feature = features[f_j];
+            n_bins = bin_mapper.n_bins(current.feature);
+
+            if (node_histogram != NULL)
+            {
+                // Histogram given by the builder
+                hist = &node_histogram->stats[0] + offsets[current.feature] * n_stats;
+                counts = &node_histogram->counts[0] + offsets[current.feature];
+            }
+            else
+            {
+                // One pass over the node samples, no sort
+                hist = &histogram[0];
+                counts = &bin_counts[0];
+                build_histogram(current.feature, hist, counts);
+            }
+
+            n_nonempty = 0;
+            for (int b = 0; b < n_bins; b++)
+                if (counts[b] != 0)
+                    n_nonempty += 1;
+
+            if (n_nonempty <= 1)
+            {
+                // The feature is constant
+                features[f_j] = features[n_total_constants];
+                features[n_total_constants] = current.feature;
+
+                n_found_constants += 1;
+                n_total_constants += 1;
+            }
+            else
+            {
+                // The feature is good
+                f_i -= 1;
+                tmp = features[f_i];
+                features[f_i] = features[f_j];
+                features[f_j] = tmp;
+
+                // Evaluate the split after every non empty bin
+                criterion->reset();
+                std::fill(stats_left.begin(), stats_left.end(), 0.0);
+                n_left = 0;
+
+                for (int b = 0; b < n_bins - 1; b++)
+                {
+                    if (counts[b] == 0)
+                        continue;
+
+                    n_left += counts[b];
+                    for (int k = 0; k < n_stats; k++)
+                        stats_left[k] += hist[b * n_stats + k];
+
+                    if (n_left >= range)
+                        break;
+
+                    current.pos = n_left;
+
+                    // Reject if min_samples_leaf is not guaranteed
+                    if ((current.pos < min_samples_leaf) ||
+                        ((range - current.pos) < min_samples_leaf))
+                        continue;
+
+                    criterion->update_from_stats(&stats_left[0], start + current.pos);
+
+                    // Reject if min_weight_leaf is not satisfied
+                    if ((criterion->weighted_n_left < min_weight_leaf) ||
+                         criterion->weighted_n_right < min_weight_leaf)
+                        continue;
+
+                    current_proxy_improvement = criterion->proxy_impurity_improvement();
+
+                    // Reject if the constraints of the criterion are not satisfied,
+                    // only checked for a split better than the best one
+                    if (current_proxy_improvement > best_proxy_improvement &&
+                        !rejects_split(criterion, current_proxy_improvement))
+                    {
+                        best_proxy_improvement = current_proxy_improvement;
+                        current.threshold = bin_mapper.thresholds[current.feature][b];
+
+                        best = current;
+                        best_bin = b;
+                        best_stats_left = stats_left;
+                    }
+                }
+            }
+        }
+    }
+
+    // Recoganize into samples[start:best.pos] + samples[best.pos:end]
+    if (best.pos < end)
+    {
+        const unsigned char* bins = bin_mapper.column(best.feature);
+        partition_end = end;
+        p = start;
+
+        while (p < partition_end)
+        {
+            if (bins[samples[p]] <= best_bin)
+                p += 1;
+            else
+            {
+                partition_end -= 1;
+
+                tmp = samples[partition_end];
+                samples[partition_end] = samples[p];
+                samples[p] = tmp;
+            }
+        }
+    }
+
+    // Only the best split needs its exact improvement
+    if (best.pos < end)
+    {
+        criterion->update_from_stats(&best_stats_left[0], start + best.pos);
+        best.improvement = criterion->impurity_improvement(impurity);
+        pdd = criterion->children_impurity();
+        best.impurity_left = pdd.first;
+        best.impurity_right = pdd.second;
+    }
+
+    // Respect invariant for constant features: the original order of
+    // element in features[:n_known_constants] must be preserved for sibling
+    // and child nodes
+    for (int i = 0; i < n_known_constants; i++)
+        features.at(i) = constant_features.at(i);
+
+    // Copy newly found constant features
+    for (int i = n_known_constants; i < n_known_constants+n_found_constants; i++)
+        constant_features.at(i) = features.at(i);
+
+    // Return values
+    split[0] = best;
+    n_constant_features[0] = n_total_constants;
+}
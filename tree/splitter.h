@@ -6,7 +6,10 @@
 #include <cstdlib>
 #include <opencv2/opencv.hpp>
 #include "criterion.h"
+#include "binmapper.h"
 #include "util.h"
+#include "threadpool.h"
+#include "random.h"
 
 using std::vector;
 using cv::Mat;
@@ -69,6 +72,13 @@ public:
 
     /**
      * @brief Initialize the splitter.
+     * The X dependent state is only computed when X is not the data the
+     * splitter was last initialized with (same buffer and shape), so that
+     * ensembles can fit many trees on the same X with one splitter. X must
+     * not be modified in place between such fits.
+     *
+     * The split search reads one feature at a time, so X is stored by
+     * column in X_col. An empty X keeps the columns given to init_columns.
      * @param X
      * @param y
      * @param sample_weight
@@ -77,6 +87,35 @@ public:
                      Mat y,
                      Mat sample_weight);
 
+    /**
+     * @brief Initialize the splitter with X given by column, e.g. the
+     * mapped columns of a ColumnDataset, so that no copy of X is made.
+     * @param X_col: X.t(), shape = [n_features, n_samples], CV_64F
+     * @param y
+     * @param sample_weight
+     * @return error_code
+     */
+    int init_columns(Mat X_col,
+                     Mat y,
+                     Mat sample_weight);
+
+    /**
+     * @brief Initialize the state depending on X only.
+     * @param X_col: X.t(), shape = [n_features, n_samples]
+     * @return error_code
+     */
+    virtual int init_features(Mat X_col);
+
+    /**
+     * @brief Set the target and the sample weights of the next fit.
+     * Samples with a null weight are left out of samples.
+     * @param y
+     * @param sample_weight
+     * @return error_code
+     */
+    virtual int reset_target(Mat y,
+                             Mat sample_weight);
+
     /**
      * @brief Reset splitter on node samples[start:end].
      * @param start
@@ -86,6 +125,14 @@ public:
     double node_reset(int start,
                       int end);
 
+    /**
+     * @brief Order features as init does, after the known constant features
+     * constant_features[:n_constant_features]. The features a node draws
+     * then don't depend on the nodes split before it.
+     * @param n_constant_features
+     */
+    void reset_features(int n_constant_features);
+
     /**
      * @brief Find a split on onde samples[start:end].
      * @param impurity
@@ -112,27 +159,45 @@ public:
         return criterion->node_impurity();
     }
 
+    /**
+     * @brief A splitter of the same kind and parameters, initialized on the
+     * same data, for another thread building a part of the tree. Its
+     * criterion is a clone too, the caller frees both.
+     * @return the copy, NULL if the splitter can't be copied
+     */
+    virtual Splitter* clone() const;
+
+protected:
+    /**
+     * @brief Copy the state set by init, the data being shared
+     * @param other
+     */
+    void copy_state(const Splitter& other);
+
 public:
     Criterion* criterion;               // impurity Criterion
     int max_features;                   // Number of features to test
     int min_samples_leaf;               // Min samples in a leaf
     double min_weight_leaf;             // Minimum weight in a leaf
 
-    int random_state;                   // Random state
+    int random_state;                   // Seed of every fit
+    RandomGenerator random_generator;   // Stream of the draws, restarted from random_state by init
 
-    int n_samples;                      // X.shape[0]
+    int n_samples;                      // Samples with a non null weight
     int n_features;                     // X.shape[1]
     vector<int> samples;                // Sample indices in X, y
     vector<int> active_samples;         // Sample indices in X, y
     vector<int> features;               // Feature indices in x
     vector<int> constant_features;      // Constant features indices
     vector<double> feature_values;      // temp. array holding feature values
+    SortBuffer sort_buffer;             // Scratch space of the radix sort
     double weighted_n_samples;          // Weighted number of samples
 
     int start;                          // Start position for the current nodes
     int end;                            // End position for the current nodes
 
-    Mat X;
+    Mat X;                              // X as given to init, empty after init_columns
+    Mat X_col;                          // X by column, X_col.ptr<double>(j)[i] == X[i, j]
     Mat y;
     Mat sample_weight;
 
@@ -186,17 +251,35 @@ public:
 //                       int* n_constant_features);
 };
 
+/**
+ * @brief Below this work (node samples times drawn features) BestSplitter
+ * evaluates the features serially
+ */
+const long FEATURE_PARALLEL_MIN_WORK = 1 << 16;
+
 /**
  * @brief Splitter for finding the best split
  */
 class BestSplitter : public BaseDenseSplitter
 {
 public:
+    /**
+     * @brief Splitter for finding the best split.
+     * @param criterion
+     * @param max_features
+     * @param min_samples_leaf
+     * @param min_weight_leaf
+     * @param random_state
+     * @param n_threads: threads evaluating the features of the nodes larger
+     *        than FEATURE_PARALLEL_MIN_WORK, 1 for serial, 0 for one per core.
+     *        The splits don't depend on it.
+     */
     BestSplitter(Criterion* criterion,
                  int max_features,
                  int min_samples_leaf,
                  double min_weight_leaf,
-                 int random_state);
+                 int random_state,
+                 int n_threads=1);
     virtual ~BestSplitter();
 
     /**
@@ -208,6 +291,81 @@ public:
     virtual void node_split(double impurity,
                             SplitRecord *split,
                             int* n_constant_features);
+
+    /**
+     * @brief Set the target and the sample weights of the next fit. The
+     * criteria of the feature threads are cloned again from criterion, whose
+     * labels and parameters may have changed since the last fit.
+     * @param y
+     * @param sample_weight
+     * @return error_code
+     */
+    virtual int reset_target(Mat y,
+                             Mat sample_weight);
+
+    /**
+     * @brief Copy of the splitter evaluating the features serially
+     */
+    virtual Splitter* clone() const;
+
+private:
+    /**
+     * @brief Sort the node samples along feature and keep the best split
+     * with a proxy improvement above best_proxy_improvement.
+     * @param feature
+     * @param feature_criterion: initialized at the node
+     * @param active: scratch space for the node samples
+     * @param Xv: scratch space for the feature values
+     * @param buffer
+     * @param best_proxy_improvement: input and output
+     * @param best: output, set if a better split is found
+     */
+    void evaluate_feature(int feature,
+                          Criterion* feature_criterion,
+                          int* active,
+                          double* Xv,
+                          SortBuffer& buffer,
+                          double& best_proxy_improvement,
+                          SplitRecord& best);
+
+    /**
+     * @brief Evaluate the candidates on the thread pool, with the same
+     * result as evaluating them serially from candidates[n_candidates-1]
+     * down to candidates[0].
+     * @param candidates
+     * @param n_candidates
+     * @param best_proxy_improvement: input and output
+     * @param best: output
+     */
+    void parallel_evaluate_features(const int* candidates,
+                                    int n_candidates,
+                                    double& best_proxy_improvement,
+                                    SplitRecord& best);
+
+    /**
+     * @brief State of a thread evaluating features
+     */
+    struct FeatureWorker
+    {
+        Criterion* criterion;           // Clone of the splitter's criterion
+        vector<int> active_samples;
+        vector<double> feature_values;
+        SortBuffer sort_buffer;
+        bool node_ready;                // criterion is initialized at the node
+        double best_proxy_improvement;
+        int best_candidate;             // Task of best, -1 if none
+        SplitRecord best;
+
+        FeatureWorker() : criterion(NULL), node_ready(false),
+            best_proxy_improvement(0.0), best_candidate(-1) {}
+    };
+
+public:
+    int n_threads;                      // Threads evaluating the features of a node
+
+private:
+    ThreadPool* pool;                   // Created on the first parallel node
+    vector<FeatureWorker> workers;
 };
 
 class RandomSplitter : public BaseDenseSplitter
@@ -228,6 +386,11 @@ public:
                    int random_state);
     virtual ~RandomSplitter();
 
+    /**
+     * @brief Copy of the splitter, drawing from the same stream
+     */
+    virtual Splitter* clone() const;
+
     /**
      * @brief Find a split on onde samples[start:end].
      * @param impurity
@@ -239,6 +402,13 @@ public:
                             int* n_constant_features);
 };
 
+/**
+ * @brief PresortBestSplitter takes the samples of a node from the argsort,
+ * a scan of all the samples, when the node holds at least
+ * 1 / PRESORT_MAX_SCAN_RATIO of them. The smaller nodes are sorted.
+ */
+const int PRESORT_MAX_SCAN_RATIO = 8;
+
 class PresortBestSplitter : public BaseDenseSplitter
 {
 public:
@@ -257,22 +427,193 @@ public:
                         int _random_state);
     virtual ~PresortBestSplitter();
 
-    virtual int init(Mat X,
-                     Mat y,
-                     Mat sample_weight);
+    /**
+     * @brief Get the argsort of every feature from the dataset cache, see
+     * argsort_columns. It is only computed by the first splitter fitted on
+     * the data.
+     * @param X_col: X.t(), shape = [n_features, n_samples]
+     * @return error_code
+     */
+    virtual int init_features(Mat X_col);
 
+    /**
+     * @brief Same as BestSplitter::node_split, the node samples are taken in
+     * the order of every feature from X_argsorted instead of being sorted,
+     * but in the nodes smaller than n_total_samples / PRESORT_MAX_SCAN_RATIO.
+     * @param impurity
+     * @param split
+     * @param n_constant_features
+     */
     virtual void node_split(double impurity,
                             SplitRecord *split,
                             int *n_constant_features);
 
+    /**
+     * @brief Copy of the splitter sharing X_argsorted
+     */
+    virtual Splitter* clone() const;
+
 public:
-    vector<int> X_argsorted_ptr;
+    Mat X_argsorted;                    // Samples sorted by every feature, shape = [n_features, n_total_samples]
+
+    int n_total_samples;                // X.rows, including the samples with a null weight
+    vector<uchar> sample_mask;          // 1 for the samples of the current node
+};
+
+/**
+ * @brief Histograms of all the features for one node.
+ * The bins of feature j start at offsets[j] of the HistogramSplitter.
+ */
+struct NodeHistogram
+{
+    vector<double> stats;               // n_stats statistics per bin
+    vector<int> counts;                 // sample count per bin
+};
+
+/**
+ * @brief Recycles NodeHistogram buffers, so that building a tree allocates
+ * at most as many histograms as there are pending nodes at a time.
+ */
+class HistogramPool
+{
+public:
+    HistogramPool();
+    ~HistogramPool();
+
+    /**
+     * @brief Set the size of the histograms handed out by acquire().
+     * @param n_stats_total
+     * @param n_bins_total
+     */
+    void init(int n_stats_total, int n_bins_total);
 
-    Mat X_old;
-    Mat X_argsorted;
+    /**
+     * @brief Get an histogram from the pool, allocating one if empty.
+     * The content of the histogram is undefined.
+     * @return
+     */
+    NodeHistogram* acquire();
 
-    int n_total_samples;
-    vector<uchar> sample_mask;
+    /**
+     * @brief Give an histogram back to the pool.
+     * @param hist
+     */
+    void release(NodeHistogram* hist);
+
+public:
+    int n_stats_total;
+    int n_bins_total;
+    vector<NodeHistogram*> all;         // Every histogram owned by the pool
+    vector<NodeHistogram*> free_list;   // Histograms ready to be reused
+};
+
+class HistogramSplitter : public BaseDenseSplitter
+{
+public:
+    /**
+     * @brief Splitter for finding the best split on binned features.
+     *
+     * Every feature is quantized once into at most `max_bins` bins by a
+     * BinMapper in init(). A node is split by accumulating the criterion
+     * statistics of its samples per bin and scanning the bin boundaries, so
+     * that no sort is needed: the cost is O(n_node_samples + n_bins) per
+     * feature instead of O(n_node_samples log(n_node_samples)).
+     * @param criterion
+     * @param max_features
+     * @param min_samples_leaf
+     * @param min_weight_leaf
+     * @param random_state
+     * @param max_bins
+     */
+    HistogramSplitter(Criterion* criterion,
+                      int max_features,
+                      int min_samples_leaf,
+                      double min_weight_leaf,
+                      int random_state,
+                      int max_bins=MAX_BINS);
+    virtual ~HistogramSplitter();
+
+    /**
+     * @brief Bin X, only done once per dataset.
+     * @param X_col
+     * @return error_code
+     */
+    virtual int init_features(Mat X_col);
+
+    /**
+     * @brief Find a split on onde samples[start:end].
+     * @param impurity
+     * @param split
+     * @param n_constant_features
+     */
+    virtual void node_split(double impurity,
+                            SplitRecord *split,
+                            int *n_constant_features);
+
+    /**
+     * @brief Accumulate the histogram of samples[start:end] for one feature.
+     * @param feature
+     * @param hist: n_bins(feature) * n_stats statistics
+     * @param counts: n_bins(feature) sample counts
+     */
+    void build_histogram(int feature,
+                         double* hist,
+                         int* counts);
+
+    /**
+     * @brief Initialize the pool and the per feature offsets of the node
+     * histograms. Must be called after the first node_reset().
+     * @param pool
+     */
+    void init_histogram_pool(HistogramPool* pool);
+
+    /**
+     * @brief Accumulate the histograms of all the features for
+     * samples[_start:_end] in one pass over the samples.
+     * @param hist
+     * @param _start
+     * @param _end
+     */
+    void build_node_histogram(NodeHistogram* hist,
+                              int _start,
+                              int _end);
+
+    /**
+     * @brief Histogram subtraction: turn the histogram of a parent into the
+     * histogram of one child, given the histogram of the other child.
+     * @param parent: histogram of the parent, overwritten by the result
+     * @param child
+     */
+    void subtract_histogram(NodeHistogram* parent,
+                            const NodeHistogram* child);
+
+    /**
+     * @brief Accumulate the histograms of several nodes in one sequential
+     * pass over every binned feature column: row i of X is added to
+     * histograms[sample_slots[i]], or skipped if sample_slots[i] < 0. The
+     * rows to scan are listed once in increasing order with their statistics,
+     * so that every column is read forward without branching.
+     * @param histograms: overwritten
+     * @param n_histograms
+     * @param sample_slots: shape = [X.rows], in [-1, n_histograms)
+     */
+    void build_level_histograms(NodeHistogram** histograms,
+                                int n_histograms,
+                                const int* sample_slots);
+
+public:
+    BinMapper bin_mapper;               // Quantization of X
+    int n_stats;                        // criterion->n_stats()
+    vector<int> offsets;                // First bin of every feature in a NodeHistogram
+    NodeHistogram* node_histogram;      // Histogram of samples[start:end] if known, given by the builder
+    long n_scanned_rows;                // Rows accumulated into histograms since init
+    vector<double> histogram;           // Per bin statistics of the node
+    vector<int> bin_counts;             // Per bin sample counts of the node
+    vector<double> stats_left;          // Cumulated statistics of the left child
+    vector<double> best_stats_left;     // stats_left of the best split
+    vector<int> level_rows;             // Rows scanned by build_level_histograms
+    vector<int> level_slots;            // Histogram of every row of level_rows
+    vector<double> row_stats;           // Statistics of every row of level_rows
 };
 
 class BaseSparseSplitter : public Splitter
@@ -296,18 +637,4 @@ public:
     virtual ~RandomSparseSplitter();
 };
 
-inline int rand_int(int low, int high, int random_state)
-{
-    std::srand(random_state);
-    int random_variable = std::rand();
-    return low + random_variable % (high - low);
-}
-
-inline int rand_double(int low, int high, int random_state)
-{
-    std::srand(random_state);
-    int random_variable = std::rand();
-    return ((high - low) * (double)random_variable) / RAND_MAX + low;
-}
-
 #endif // SPLITTER_H
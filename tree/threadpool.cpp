@@ -0,0 +1,91 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int n_threads)
+    : _task(NULL),
+      _n_tasks(0),
+      _next_task(0),
+      _generation(0),
+      _n_running(0),
+      _stop(false)
+{
+    if (n_threads <= 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int t = 1; t < n_threads; t++)
+        _threads.push_back(std::thread(&ThreadPool::_work, this, t));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (size_t t = 0; t < _threads.size(); t++)
+        _threads[t].join();
+}
+
+int ThreadPool::size() const
+{
+    return _threads.size() + 1;
+}
+
+void ThreadPool::parallel_for(int n_tasks,
+                              const std::function<void(int, int)>& task)
+{
+    if (_threads.empty() || n_tasks <= 1)
+    {
+        for (int i = 0; i < n_tasks; i++)
+            task(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _n_tasks = n_tasks;
+        _next_task = 0;
+        _n_running = _threads.size();
+        _generation += 1;
+    }
+    _start.notify_all();
+
+    _run_tasks(0);
+
+    // The task may only be released once no thread reads it
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _n_running == 0; });
+    _task = NULL;
+}
+
+void ThreadPool::_run_tasks(int worker)
+{
+    int i;
+    while ((i = _next_task.fetch_add(1)) < _n_tasks)
+        (*_task)(i, worker);
+}
+
+void ThreadPool::_work(int worker)
+{
+    int generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [&]() { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+        }
+
+        _run_tasks(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _n_running -= 1;
+        }
+        _done.notify_one();
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+//========================================
+// ThreadPool
+// Persistent threads running parallel loops, so that a loop inside
+// node_split doesn't pay for creating threads
+//========================================
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using std::vector;
+
+class ThreadPool
+{
+public:
+    /**
+     * @brief Start n_threads - 1 threads, the thread calling parallel_for
+     * is the last worker.
+     * @param n_threads: number of workers, 0 for one per core
+     */
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    /**
+     * @brief Number of workers, including the calling thread
+     */
+    int size() const;
+
+    /**
+     * @brief Run task(i, worker) for every i in [0, n_tasks) and return when
+     * they are all done. The tasks are taken in increasing order by the
+     * free workers; worker in [0, size()) tells which one runs the task, so
+     * that a task can use per-worker buffers. The calling thread is worker 0.
+     * Not reentrant: a task must not call parallel_for on the same pool.
+     * @param n_tasks
+     * @param task
+     */
+    void parallel_for(int n_tasks,
+                      const std::function<void(int, int)>& task);
+
+private:
+    void _work(int worker);
+    void _run_tasks(int worker);
+
+    vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _start;     // A loop is started, or the pool stops
+    std::condition_variable _done;      // A worker has finished the loop
+
+    const std::function<void(int, int)>* _task;
+    int _n_tasks;
+    std::atomic<int> _next_task;
+    int _generation;                    // Number of loops started
+    int _n_running;                     // Threads still in the current loop
+    bool _stop;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif // THREADPOOL_H
@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <algorithm>
 using std::max;
-#include <set>
 #include "criterion.h"
 #include "splitter.h"
 #include "basetree.h"
@@ -23,6 +22,7 @@ BaseDecisionTree::BaseDecisionTree(char* criterion_name,
 // Need constructor paras for Tree
     : _criterion_name(criterion_name),
       _splitter_name(splitter_name),
+      _builder_name("DepthFirst"),
       _max_depth(max_depth),
       _min_samples_split(min_samples_split),
       _min_samples_leaf(min_samples_leaf),
@@ -33,14 +33,57 @@ BaseDecisionTree::BaseDecisionTree(char* criterion_name,
       _class_weight(class_weight),
       _n_samples(0),
       _n_features(0),
-      _is_classification(is_classification)
+      _is_classification(is_classification),
+      _criterion(NULL),
+      _splitter(NULL),
+      _tree(NULL),
+      _tree_builder(NULL),
+      _owns_splitter(true),
+      _n_threads(1),
+      _l2_regularization(NEWTON_L2_REGULARIZATION),
+      _min_child_hessian(NEWTON_MIN_CHILD_HESSIAN)
 {
 
 }
 
 BaseDecisionTree::~BaseDecisionTree()
 {
+    delete _tree_builder;
+    delete _tree;
+    if (_owns_splitter)
+    {
+        delete _splitter;
+        delete _criterion;
+    }
+}
 
+void BaseDecisionTree::set_n_threads(int n_threads)
+{
+    _n_threads = n_threads;
+}
+
+void BaseDecisionTree::set_builder(const char* builder_name)
+{
+    _builder_name = builder_name;
+}
+
+void BaseDecisionTree::set_regularization(double l2_regularization,
+                                          double min_child_hessian)
+{
+    _l2_regularization = l2_regularization;
+    _min_child_hessian = min_child_hessian;
+}
+
+void BaseDecisionTree::set_splitter(Splitter* splitter)
+{
+    if (_owns_splitter)
+    {
+        delete _splitter;
+        delete _criterion;
+    }
+    _splitter = splitter;
+    _criterion = splitter->criterion;
+    _owns_splitter = false;
 }
 
 int BaseDecisionTree::fit(Mat X,
@@ -51,16 +94,48 @@ int BaseDecisionTree::fit(Mat X,
     if (X.rows == 0 || X.cols == 0)
         return 1;
 
+    return _fit(X, Mat(), y, sample_weight);
+}
+
+int BaseDecisionTree::fit_columns(Mat X_col,
+                                  Mat y,
+                                  Mat sample_weight)
+{
+    // Validation
+    if (X_col.rows == 0 || X_col.cols == 0)
+        return 1;
+
+    return _fit(Mat(), X_col, y, sample_weight);
+}
+
+int BaseDecisionTree::_fit(Mat X,
+                           Mat X_col,
+                           Mat y,
+                           Mat sample_weight)
+{
     // Determine output setting
-    _n_samples = X.rows;
-    _n_features = X.cols;
+    if (X_col.empty())
+    {
+        _n_samples = X.rows;
+        _n_features = X.cols;
+    }
+    else
+    {
+        _n_samples = X_col.cols;
+        _n_features = X_col.rows;
+    }
 
-    // Reshape y to shape[n_samples, 1]
-    y = y.reshape(1, y.total());
+    // Reshape y to shape[n_samples, 1], the Newton criterion takes
+    // shape[n_samples, 2]
+    bool is_newton = (strcmp(_criterion_name, "Newton") == 0);
+    if (!is_newton)
+        y = y.reshape(1, y.total());
 
     // Validation
     if (y.rows != _n_samples)
         return 2;
+    if (is_newton && y.cols != 2)
+        return 2;
 
     // Validation
     if (_max_depth < 0)
@@ -75,6 +150,8 @@ int BaseDecisionTree::fit(Mat X,
         return 3;
     if (_min_weight_fraction_leaf < 0. || _min_weight_fraction_leaf > 1.0)
         return 3;
+    if (_l2_regularization < 0.0 || _min_child_hessian < 0.0)
+        return 3;
 
     // Validation
     if (_max_depth == 0)
@@ -90,13 +167,11 @@ int BaseDecisionTree::fit(Mat X,
     if (_max_leaf_nodes == 0)
         _max_leaf_nodes = -1;                               // available when use best_build
 
-    // Get _n_classes
-    std::set<double> s;
-    for (int i = 0; i < y.total(); i++)
-    {
-        s.insert(y.at<double>(i));
-    }
-    int _n_classes = s.size();
+    // Encode the classes as dense ids once, the criterion counts the ids
+    Mat labels;
+    int _n_classes = 1;
+    if (_is_classification == 0)
+        _n_classes = encode_labels(y, labels, _classes);
 
     // Calculate class_weight
     Mat expended_class_weight = Mat::ones(_n_samples, 1, CV_64F);
@@ -119,39 +194,91 @@ int BaseDecisionTree::fit(Mat X,
     // Set min_samples_split
     _min_samples_split = max(_min_samples_split, 2 * _min_samples_leaf);
 
-    // Select a Criterion
-    if (strcmp(_criterion_name, "Gini") == 0)
-        _criterion = new Gini();
-    else if (strcmp(_criterion_name, "Entropy") == 0)
-        _criterion = new Entropy();
-    else if (strcmp(_criterion_name, "MSE") == 0)
-        _criterion = new MSE();
-    else if (strcmp(_criterion_name, "FriedmanMSE") == 0)
-        _criterion = new FriedmanMSE();
-    else
-        exit(1);
-
-    // Select a Splitter
-    if (strcmp(_splitter_name, "Best") == 0)
-        _splitter = new BestSplitter(_criterion,
-                                     _max_features,
-                                     _min_samples_leaf,
-                                     _min_weight_fraction_leaf,
-                                     _random_state);
-    else if (strcmp(_splitter_name, "Random") == 0)
-        _splitter = new RandomSplitter(_criterion,
-                                       _max_features,
-                                       _min_samples_leaf,
-                                       _min_weight_fraction_leaf,
-                                       _random_state);
+    // Select a Criterion and a Splitter, unless a splitter is shared
+    if (_splitter == NULL)
+    {
+        // Select a Criterion
+        if (strcmp(_criterion_name, "Gini") == 0)
+            _criterion = new Gini();
+        else if (strcmp(_criterion_name, "Entropy") == 0)
+            _criterion = new Entropy();
+        else if (strcmp(_criterion_name, "MSE") == 0)
+            _criterion = new MSE();
+        else if (strcmp(_criterion_name, "FriedmanMSE") == 0)
+            _criterion = new FriedmanMSE();
+        else if (strcmp(_criterion_name, "Newton") == 0)
+            _criterion = new NewtonCriterion(_l2_regularization,
+                                             _min_child_hessian);
+        else
+            exit(1);
+
+        // Select a Splitter
+        if (strcmp(_splitter_name, "Best") == 0)
+            _splitter = new BestSplitter(_criterion,
+                                         _max_features,
+                                         _min_samples_leaf,
+                                         _min_weight_fraction_leaf,
+                                         _random_state,
+                                         _n_threads);
+        else if (strcmp(_splitter_name, "Random") == 0)
+            _splitter = new RandomSplitter(_criterion,
+                                           _max_features,
+                                           _min_samples_leaf,
+                                           _min_weight_fraction_leaf,
+                                           _random_state);
+        else if (strcmp(_splitter_name, "PresortBest") == 0)
+            _splitter = new PresortBestSplitter(_criterion,
+                                                _max_features,
+                                                _min_samples_leaf,
+                                                _min_weight_fraction_leaf,
+                                                _random_state);
+        else if (strcmp(_splitter_name, "Histogram") == 0)
+            _splitter = new HistogramSplitter(_criterion,
+                                              _max_features,
+                                              _min_samples_leaf,
+                                              _min_weight_fraction_leaf,
+                                              _random_state);
+        else
+            exit(1);
+    }
     else
-        exit(1);
+    {
+        // A shared or refitted splitter was made for another fit
+        _splitter->min_weight_leaf = _min_weight_fraction_leaf;
+        NewtonCriterion* newton = dynamic_cast<NewtonCriterion*>(_criterion);
+        if (newton != NULL)
+        {
+            newton->l2_regularization = _l2_regularization;
+            newton->min_child_hessian = _min_child_hessian;
+        }
+    }
 
     // Select a Tree
+    delete _tree;
+    delete _tree_builder;
+    // Regression trees store one value per node
     _tree = new Tree(_n_features, _n_classes);
 
     // Select a Tree Builder
-    if (_max_leaf_nodes < 0)
+    if (_max_leaf_nodes < 0 && strcmp(_builder_name, "LevelWise") == 0)
+        _tree_builder = new LevelWiseBuilder(_splitter,
+                                             _min_samples_split,
+                                             _min_samples_leaf,
+                                             _min_weight_fraction_leaf,
+                                             _max_depth,
+                                             _max_leaf_nodes);
+    else if (_max_leaf_nodes < 0 && strcmp(_builder_name, "DepthFirst") != 0)
+        exit(1);
+    else if (_max_leaf_nodes < 0 && _n_threads != 1 &&
+             dynamic_cast<HistogramSplitter*>(_splitter) == NULL)
+        _tree_builder = new ParallelDepthFirstBuilder(_splitter,
+                                                      _min_samples_split,
+                                                      _min_samples_leaf,
+                                                      _min_weight_fraction_leaf,
+                                                      _max_depth,
+                                                      _max_leaf_nodes,
+                                                      _n_threads);
+    else if (_max_leaf_nodes < 0)
         _tree_builder = new DepthFirstBuilder(_splitter,
                                               _min_samples_split,
                                               _min_samples_leaf,
@@ -166,13 +293,32 @@ int BaseDecisionTree::fit(Mat X,
                                                  _max_depth,
                                                  _max_leaf_nodes);
 
-    // Build a tree
+    if (_is_classification == 0)
+        _splitter->criterion->init_labels(y, labels, _n_classes);
+
+    // Build a tree, the builder keeps the columns when X is empty
+    if (!X_col.empty())
+    {
+        int error_code = _splitter->init_columns(X_col, y, sample_weight);
+        if (error_code != 0)
+            return error_code;
+    }
     _tree_builder->build(_tree, X, y, sample_weight);
+    return 0;
 }
 
 Mat BaseDecisionTree::predict(Mat X)
 {
-    return _tree->predict(X);
+    Mat result = _tree->predict(X);
+
+    // The tree predicts class ids, map them back to the labels of y
+    if (_is_classification == 0)
+    {
+        double* out = result.ptr<double>(0);
+        for (int i = 0; i < X.rows; i++)
+            out[i] = _classes[_classes.size() > 1 ? static_cast<int>(out[i]) : 0];
+    }
+    return result;
 }
 
 Mat BaseDecisionTree::feature_importances()
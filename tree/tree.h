@@ -1,8 +1,10 @@
 #ifndef TREE_H
 #define TREE_H
 
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+using std::vector;
 using cv::Mat;
 
 class Criterion;
@@ -38,12 +40,14 @@ public:
                      int random_state,
                      Mat class_weight,
                      int is_classification);
-    ~BaseDecisionTree();
+    virtual ~BaseDecisionTree();
 
     /**
      * @brief Build a decision tree for the training set (X, y).
      * @param X The training input samples, shape = [n_sampels, n_features]
-     * @param y The target values, shape = [n_samples]
+     * @param y The target values, shape = [n_samples], or for the "Newton"
+     *        criterion the negative gradient and the hessian of the loss,
+     *        shape = [n_samples, 2]
      * @param sample_weight Sample weights. If total size equals to zero, then samples are equally weighted.
      * @return error_code
      */
@@ -51,6 +55,18 @@ public:
             Mat y,
             Mat sample_weight);
 
+    /**
+     * @brief Build a decision tree for a training set stored by column,
+     * e.g. a ColumnDataset, the columns are read in place.
+     * @param X_col The training input samples by column, X.t(), shape = [n_features, n_samples]
+     * @param y The target values, shape = [n_samples]
+     * @param sample_weight Sample weights. If total size equals to zero, then samples are equally weighted.
+     * @return error_code
+     */
+    int fit_columns(Mat X_col,
+                    Mat y,
+                    Mat sample_weight);
+
     /**
      * @brief Predict class or regression value of X.
      * For a classification modle, the predicted class for each sample in X is returned.
@@ -60,6 +76,50 @@ public:
      */
     Mat predict(Mat X);
 
+    /**
+     * @brief Use an existing splitter, and its criterion, instead of
+     * allocating them in fit. The splitter is not owned by the tree.
+     * Ensembles use it to share one splitter, and the binned or sorted copy
+     * of X it holds, between all their trees. fit sets its min_weight_leaf
+     * from the weights of the fit, and the regularization of a Newton
+     * criterion from set_regularization.
+     * @param splitter
+     */
+    void set_splitter(Splitter* splitter);
+
+    /**
+     * @brief Threads used by fit, 1 by default, 0 for one per core.
+     * The BestSplitter evaluates the features of the large nodes in
+     * parallel and, except with the Histogram splitter or max_leaf_nodes, the
+     * large subtrees are built in parallel by ParallelDepthFirstBuilder.
+     * The tree is the same for any number of threads, the serial one
+     * included.
+     * Call it before fit, a splitter given by set_splitter keeps its own
+     * feature threads.
+     * @param n_threads
+     */
+    void set_n_threads(int n_threads);
+
+    /**
+     * @brief Choose how fit builds the tree: "DepthFirst" (default), or
+     * "LevelWise" to expand all the nodes of a depth level together, with
+     * one pass over each feature column per level for the Histogram
+     * splitter. Both give the same tree, numbered differently, up to the
+     * rounding of the Histogram splitter's sums. Trees with
+     * max_leaf_nodes are built best first.
+     * @param builder_name
+     */
+    void set_builder(const char* builder_name);
+
+    /**
+     * @brief Regularization of the "Newton" criterion, NEWTON_L2_REGULARIZATION
+     * and NEWTON_MIN_CHILD_HESSIAN by default. Call it before fit.
+     * @param l2_regularization: added to the sum of the hessians of a leaf
+     * @param min_child_hessian: min sum of the hessians in a leaf
+     */
+    void set_regularization(double l2_regularization,
+                            double min_child_hessian);
+
    /**
     * @brief Return the feature importances.
     * The importance of a feature is computed as the normalized total
@@ -68,27 +128,43 @@ public:
     */
     Mat feature_importances();
 
+protected:
+    /**
+     * @brief Shared by fit and fit_columns, exactly one of X and X_col is
+     * not empty.
+     */
+    int _fit(Mat X,
+             Mat X_col,
+             Mat y,
+             Mat sample_weight);
+
 public:
-    Criterion* _criterion;
-    Splitter* _splitter;
+    char* _criterion_name;
+    char* _splitter_name;
+    const char* _builder_name;
+
     int _max_depth;
     int _min_samples_split;
     int _min_samples_leaf;
     double _min_weight_fraction_leaf;
     int _max_features;
-    int _random_state;
     int _max_leaf_nodes;
+    int _random_state;
     Mat _class_weight;
 
-    char* _criterion_name;
-    char* _splitter_name;
-
     int _n_samples;
     int _n_features;
     int _is_classification;
+    vector<double> _classes;        // Sorted class labels, the tree predicts their index
 
+    Criterion* _criterion;
+    Splitter* _splitter;
     Tree* _tree;
     TreeBuilder* _tree_builder;
+    bool _owns_splitter;            // Whether _splitter and _criterion are freed with the tree
+    int _n_threads;                 // Threads used by fit
+    double _l2_regularization;      // Of the "Newton" criterion
+    double _min_child_hessian;      // Of the "Newton" criterion
 };
 
 class DecisionTreeClassifier : public BaseDecisionTree
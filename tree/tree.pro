@@ -12,16 +12,33 @@ SOURCES += criterion.cpp \
     main.cpp \
     basetree.cpp \
     tree.cpp \
-    util.cpp
+    util.cpp \
+    binmapper.cpp \
+    quickscorer.cpp \
+    codegen.cpp \
+    dataset.cpp \
+    argsort.cpp \
+    simd.cpp \
+    threadpool.cpp \
+    random.cpp
 
 HEADERS += criterion.h \
     splitter.h \
     treebuilder.h \
     basetree.h \
     tree.h \
-    util.h
+    util.h \
+    binmapper.h \
+    quickscorer.h \
+    codegen.h \
+    dataset.h \
+    argsort.h \
+    simd.h \
+    threadpool.h \
+    random.h
 
 LIBS += -L/usr/local/lib
 LIBS += -lopencv_core
+LIBS += -lpthread
 
 TARGET = tree
@@ -3,8 +3,10 @@
 #include "splitter.h"
 #include "basetree.h"
 #include "tree.h"
+#include "threadpool.h"
 #include <stack>
 #include <queue>
+#include <algorithm>
 using std::stack;
 using std::priority_queue;
 
@@ -40,7 +42,9 @@ DepthFirstBuilder::DepthFirstBuilder(Splitter* _splitter,
                   _min_samples_leaf,
                   _min_weight_leaf,
                   _max_depth,
-                  _max_leaf_nodes)
+                  _max_leaf_nodes),
+      histogram_pool(new HistogramPool()),
+      n_scanned_rows(0)
 {
 
 }
@@ -48,7 +52,33 @@ DepthFirstBuilder::DepthFirstBuilder(Splitter* _splitter,
 
 DepthFirstBuilder::~DepthFirstBuilder()
 {
+    delete histogram_pool;
+}
+
+/**
+ * @brief Set the splitter up for the node n: the features in the order of
+ * Splitter::reset_features, and the stream of the node. What a node draws
+ * only depends on its path from the root, not on the nodes split before it,
+ * so that DepthFirstBuilder, ParallelDepthFirstBuilder with any number of
+ * threads and LevelWiseBuilder build the same tree.
+ */
+static void start_node(Splitter* splitter,
+                       const N& n)
+{
+    splitter->reset_features(n.n_constant_features);
+    splitter->random_generator = n.random_generator;
+}
 
+/**
+ * @brief Seed the streams of the children of the node just split from the
+ * stream of the node, the left child first
+ */
+static void fork_streams(Splitter* splitter,
+                         N& left,
+                         N& right)
+{
+    left.random_generator = splitter->random_generator.split();
+    right.random_generator = splitter->random_generator.split();
 }
 
 void DepthFirstBuilder::build(Tree* _tree,
@@ -78,9 +108,20 @@ void DepthFirstBuilder::build(Tree* _tree,
 
     bool first = true;
 
+    // Histogram subtraction is only available with binned features
+    HistogramSplitter* hist_splitter = dynamic_cast<HistogramSplitter*>(splitter);
+    NodeHistogram* small_histogram;
+    long n_scanned_rows_before = 0;
+    int n_left, n_right;
+    bool split_left, split_right;
+    if (hist_splitter != NULL)
+        n_scanned_rows_before = hist_splitter->n_scanned_rows;
+
     stack<N> stk;
     // Push root node onto stack
-    stk.push(N(0, n_node_samples, 0, TREE_UNDEFINED, 0, INFINITY, 0));
+    N root(0, n_node_samples, 0, TREE_UNDEFINED, 0, INFINITY, 0);
+    root.random_generator = splitter->random_generator;
+    stk.push(root);
 
     while (!stk.empty())
     {
@@ -106,12 +147,25 @@ void DepthFirstBuilder::build(Tree* _tree,
         {
             impurity = splitter->node_impurity();
             first = false;
+
+            if (hist_splitter != NULL)
+                hist_splitter->init_histogram_pool(histogram_pool);
         }
 
         is_leaf = is_leaf || (impurity <= MIN_IMPURITY_SPLIT);
 
+        if (hist_splitter != NULL && !is_leaf && n.histogram == NULL)
+        {
+            // Only the root (or a child whose sibling wasn't split) is built from scratch
+            n.histogram = histogram_pool->acquire();
+            hist_splitter->build_node_histogram(n.histogram, start, end);
+        }
+
         if (!is_leaf)
         {
+            if (hist_splitter != NULL)
+                hist_splitter->node_histogram = n.histogram;
+            start_node(splitter, n);
             splitter->node_split(impurity, &split, &n_constant_features);
             is_leaf = is_leaf || (split.pos >= end);
         }
@@ -123,21 +177,709 @@ void DepthFirstBuilder::build(Tree* _tree,
         if (is_leaf)
         {
             // Don't store value for internal nodes
-            if (_tree->_value.size() < node_id+1)
-                _tree->_value.resize(node_id+1);
-            _tree->_value.at(node_id) = splitter->node_value();
+            _tree->_set_value(node_id, splitter->node_value());
+
+            histogram_pool->release(n.histogram);
         }
         else
         {
+            NodeHistogram* left_histogram = NULL;
+            NodeHistogram* right_histogram = NULL;
+
+            if (hist_splitter != NULL)
+            {
+                // Children that will be leaves anyway don't need a histogram
+                n_left = split.pos;
+                n_right = end - start - split.pos;
+                split_left = (depth + 1 < max_depth &&
+                              n_left >= min_samples_split &&
+                              n_left >= 2 * min_samples_leaf);
+                split_right = (depth + 1 < max_depth &&
+                               n_right >= min_samples_split &&
+                               n_right >= 2 * min_samples_leaf);
+
+                if (split_left || split_right)
+                {
+                    // Scan the smaller child, subtract it from the parent for the larger one
+                    small_histogram = histogram_pool->acquire();
+                    if (n_left <= n_right)
+                    {
+                        hist_splitter->build_node_histogram(small_histogram, start, start + n_left);
+                        hist_splitter->subtract_histogram(n.histogram, small_histogram);
+                        left_histogram = small_histogram;
+                        right_histogram = n.histogram;
+                    }
+                    else
+                    {
+                        hist_splitter->build_node_histogram(small_histogram, start + n_left, end);
+                        hist_splitter->subtract_histogram(n.histogram, small_histogram);
+                        left_histogram = n.histogram;
+                        right_histogram = small_histogram;
+                    }
+
+                    if (!split_left)
+                    {
+                        histogram_pool->release(left_histogram);
+                        left_histogram = NULL;
+                    }
+                    if (!split_right)
+                    {
+                        histogram_pool->release(right_histogram);
+                        right_histogram = NULL;
+                    }
+                }
+                else
+                {
+                    histogram_pool->release(n.histogram);
+                }
+            }
+
+            N left(start, split.pos+start, depth+1, node_id, 1,
+                   split.impurity_left, n_constant_features,
+                   left_histogram);
+            N right(split.pos+start, end, depth+1, node_id, 0,
+                    split.impurity_right, n_constant_features,
+                    right_histogram);
+            fork_streams(splitter, left, right);
+
             // Push right child on stack
-            stk.push(N(split.pos+start, end, depth+1, node_id, 0,
-                       split.impurity_right, n_constant_features));
-            stk.push(N(start, split.pos+start, depth+1, node_id, 1,
-                       split.impurity_left, n_constant_features));
+            stk.push(right);
+            stk.push(left);
         }
         if (depth > max_depth)
             max_depth_seen = depth;
     }
+
+    if (hist_splitter != NULL)
+    {
+        hist_splitter->node_histogram = NULL;
+        n_scanned_rows = hist_splitter->n_scanned_rows - n_scanned_rows_before;
+    }
+}
+
+LevelWiseBuilder::LevelWiseBuilder(Splitter* _splitter,
+                                   int _min_samples_split,
+                                   int _min_samples_leaf,
+                                   double _min_weight_leaf,
+                                   int _max_depth,
+                                   int _max_leaf_nodes)
+    : TreeBuilder(_splitter,
+                  _min_samples_split,
+                  _min_samples_leaf,
+                  _min_weight_leaf,
+                  _max_depth,
+                  _max_leaf_nodes),
+      histogram_pool(new HistogramPool()),
+      n_scanned_rows(0),
+      n_column_scans(0)
+{
+
+}
+
+LevelWiseBuilder::~LevelWiseBuilder()
+{
+    delete histogram_pool;
+}
+
+void LevelWiseBuilder::build(Tree* _tree,
+                             Mat _X,
+                             Mat _y,
+                             Mat _sample_weight)
+{
+    if (_sample_weight.total() != 0)
+        sample_weight = _sample_weight;
+
+    splitter->init(_X, _y, _sample_weight);
+
+    int n_node_samples = splitter->n_samples;
+    double weighted_n_node_samples;
+    bool is_leaf;
+    SplitRecord split;
+    int node_id;
+
+    int start;
+    int end;
+    int depth;
+    double impurity;
+    int n_constant_features;
+
+    bool first = true;
+
+    /**
+     * A histogram to accumulate from samples[start:end], and a parent
+     * histogram to turn into the one of its larger child by subtracting
+     * the smaller child, once the level is scanned.
+     */
+    struct HistogramScan
+    {
+        NodeHistogram* histogram;
+        int start;
+        int end;
+    };
+    struct HistogramSubtraction
+    {
+        NodeHistogram* parent;
+        NodeHistogram* child;
+        bool release_child;     // The smaller child is a leaf, it was only scanned for its sibling
+    };
+
+    HistogramSplitter* hist_splitter = dynamic_cast<HistogramSplitter*>(splitter);
+    vector<HistogramScan> scans, next_scans;
+    vector<HistogramSubtraction> subtractions, next_subtractions;
+    vector<NodeHistogram*> scan_histograms;
+    vector<int> sample_slots;
+    long n_scanned_rows_before = 0;
+    int n_left, n_right;
+    bool split_left, split_right;
+    int min_histogram_samples = 0;
+    n_column_scans = 0;
+
+    // Nodes of the current and of the next level, n.parent is the node id
+    // of the parent in the tree
+    vector<N> level, next_level;
+    level.push_back(N(0, n_node_samples, 0, TREE_UNDEFINED, 0, INFINITY, 0));
+    level[0].random_generator = splitter->random_generator;
+
+    // The splitter keeps the constant features of the path to the node in
+    // constant_features, which only holds depth first. The constant
+    // features known by the nodes of a level are kept in constants, from
+    // constants_start[i] for level[i], and given back to the splitter.
+    vector<int> constants, next_constants;
+    vector<int> constants_start(1, 0), next_constants_start;
+
+    if (hist_splitter != NULL)
+    {
+        // The criterion computes the row statistics once initialized at the root
+        splitter->node_reset(0, n_node_samples);
+        hist_splitter->init_histogram_pool(histogram_pool);
+        n_scanned_rows_before = hist_splitter->n_scanned_rows;
+        sample_slots.assign(splitter->X_col.cols, -1);
+
+        // A level holds the histograms of all its nodes, the nodes with
+        // fewer samples than bins are binned by the splitter itself
+        min_histogram_samples = hist_splitter->bin_mapper.max_bins;
+
+        if (n_node_samples >= min_samples_split && n_node_samples >= 2 * min_samples_leaf &&
+            n_node_samples >= min_histogram_samples)
+        {
+            level[0].histogram = histogram_pool->acquire();
+            HistogramScan scan = {level[0].histogram, 0, n_node_samples};
+            scans.push_back(scan);
+        }
+    }
+
+    while (!level.empty())
+    {
+        if (hist_splitter != NULL && !scans.empty())
+        {
+            long n_scan_samples = 0;
+            for (size_t s = 0; s < scans.size(); s++)
+                n_scan_samples += scans[s].end - scans[s].start;
+
+            if (n_scan_samples * LEVEL_SCAN_MIN_RATIO >= splitter->X_col.cols)
+            {
+                // One pass over every column for all the histograms of the level
+                scan_histograms.resize(scans.size());
+                for (size_t s = 0; s < scans.size(); s++)
+                {
+                    scan_histograms[s] = scans[s].histogram;
+                    for (int p = scans[s].start; p < scans[s].end; p++)
+                        sample_slots[splitter->samples[p]] = s;
+                }
+
+                hist_splitter->build_level_histograms(&scan_histograms[0],
+                                                      scan_histograms.size(),
+                                                      &sample_slots[0]);
+
+                for (size_t s = 0; s < scans.size(); s++)
+                    for (int p = scans[s].start; p < scans[s].end; p++)
+                        sample_slots[splitter->samples[p]] = -1;
+                n_column_scans += 1;
+            }
+            else
+            {
+                for (size_t s = 0; s < scans.size(); s++)
+                    hist_splitter->build_node_histogram(scans[s].histogram,
+                                                        scans[s].start,
+                                                        scans[s].end);
+            }
+
+            for (size_t s = 0; s < subtractions.size(); s++)
+            {
+                hist_splitter->subtract_histogram(subtractions[s].parent,
+                                                  subtractions[s].child);
+                if (subtractions[s].release_child)
+                    histogram_pool->release(subtractions[s].child);
+            }
+        }
+
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            N& n = level[i];
+            start = n.start;
+            end = n.end;
+            depth = n.depth;
+            impurity = n.impurity;
+            n_constant_features = n.n_constant_features;
+
+            n_node_samples = end - start;
+            weighted_n_node_samples = splitter->node_reset(start, end);
+
+            is_leaf = ((depth >= max_depth) ||
+                       (n_node_samples < min_samples_split) ||
+                       (n_node_samples < 2 * min_samples_leaf) ||
+                       (weighted_n_node_samples < min_weight_leaf));
+
+            if (first)
+            {
+                impurity = splitter->node_impurity();
+                first = false;
+            }
+
+            is_leaf = is_leaf || (impurity <= MIN_IMPURITY_SPLIT);
+
+            if (!is_leaf)
+            {
+                std::copy(constants.begin() + constants_start[i],
+                          constants.begin() + constants_start[i] + n_constant_features,
+                          splitter->constant_features.begin());
+
+                if (hist_splitter != NULL)
+                    hist_splitter->node_histogram = n.histogram;
+                start_node(splitter, n);
+                splitter->node_split(impurity, &split, &n_constant_features);
+                is_leaf = is_leaf || (split.pos >= end);
+            }
+
+            node_id = _tree->_add_node(n.parent, n.is_left, is_leaf, split.feature,
+                                       split.threshold, impurity, n_node_samples,
+                                       weighted_n_node_samples);
+
+            if (is_leaf)
+            {
+                // Don't store value for internal nodes
+                _tree->_set_value(node_id, splitter->node_value());
+
+                histogram_pool->release(n.histogram);
+                continue;
+            }
+
+            N left(start, split.pos+start, depth+1, node_id, 1,
+                   split.impurity_left, n_constant_features);
+            N right(split.pos+start, end, depth+1, node_id, 0,
+                    split.impurity_right, n_constant_features);
+            fork_streams(splitter, left, right);
+
+            if (hist_splitter != NULL)
+            {
+                // Children that will be leaves anyway don't need a histogram
+                n_left = split.pos;
+                n_right = end - start - split.pos;
+                split_left = (depth + 1 < max_depth &&
+                              n_left >= min_samples_split &&
+                              n_left >= 2 * min_samples_leaf &&
+                              n_left >= min_histogram_samples);
+                split_right = (depth + 1 < max_depth &&
+                               n_right >= min_samples_split &&
+                               n_right >= 2 * min_samples_leaf &&
+                               n_right >= min_histogram_samples);
+
+                N& small = (n_left <= n_right) ? left : right;
+                N& large = (n_left <= n_right) ? right : left;
+                bool split_small = (n_left <= n_right) ? split_left : split_right;
+                bool split_large = (n_left <= n_right) ? split_right : split_left;
+
+                if (split_large)
+                {
+                    // Scan the smaller child, subtract it from the parent for the larger one
+                    NodeHistogram* small_histogram = histogram_pool->acquire();
+                    HistogramScan scan = {small_histogram, small.start, small.end};
+                    HistogramSubtraction subtraction = {n.histogram, small_histogram, !split_small};
+                    next_scans.push_back(scan);
+                    next_subtractions.push_back(subtraction);
+                    large.histogram = n.histogram;
+                    if (split_small)
+                        small.histogram = small_histogram;
+                }
+                else if (split_small)
+                {
+                    histogram_pool->release(n.histogram);
+                    small.histogram = histogram_pool->acquire();
+                    HistogramScan scan = {small.histogram, small.start, small.end};
+                    next_scans.push_back(scan);
+                }
+                else
+                {
+                    histogram_pool->release(n.histogram);
+                }
+            }
+
+            next_level.push_back(left);
+            next_level.push_back(right);
+
+            // Both children know the constant features found up to the node
+            next_constants_start.push_back(next_constants.size());
+            next_constants_start.push_back(next_constants.size());
+            next_constants.insert(next_constants.end(),
+                                  splitter->constant_features.begin(),
+                                  splitter->constant_features.begin() + n_constant_features);
+        }
+
+        level.swap(next_level);
+        next_level.clear();
+        constants.swap(next_constants);
+        next_constants.clear();
+        constants_start.swap(next_constants_start);
+        next_constants_start.clear();
+        scans.swap(next_scans);
+        next_scans.clear();
+        subtractions.swap(next_subtractions);
+        next_subtractions.clear();
+    }
+
+    if (hist_splitter != NULL)
+    {
+        hist_splitter->node_histogram = NULL;
+        n_scanned_rows = hist_splitter->n_scanned_rows - n_scanned_rows_before;
+    }
+}
+
+/**
+ * @brief A node built by ParallelDepthFirstBuilder, before it is added to
+ * the Tree
+ */
+struct SubtreeNode
+{
+    bool is_leaf;
+    int feature;
+    double threshold;
+    double impurity;
+    int n_node_samples;
+    double weighted_n_node_samples;
+    int children[2];            // Left and right child: index in the task's nodes,
+                                // or -1 - index in the task's subtasks
+    vector<double> value;       // Value of a leaf
+};
+
+/**
+ * @brief A subtree built by one worker of ParallelDepthFirstBuilder
+ */
+struct SubtreeTask
+{
+    N root;                     // root.parent is unused
+    vector<int> constant_features;  // constant_features[:root.n_constant_features] of the splitter
+    vector<SubtreeNode> nodes;  // nodes[0] is the root
+    vector<SubtreeTask*> subtasks;
+
+    SubtreeTask(const N& _root)
+        : root(_root) {
+    }
+};
+
+ParallelDepthFirstBuilder::ParallelDepthFirstBuilder(Splitter* _splitter,
+                                                     int _min_samples_split,
+                                                     int _min_samples_leaf,
+                                                     double _min_weight_leaf,
+                                                     int _max_depth,
+                                                     int _max_leaf_nodes,
+                                                     int _n_threads)
+    : TreeBuilder(_splitter,
+                  _min_samples_split,
+                  _min_samples_leaf,
+                  _min_weight_leaf,
+                  _max_depth,
+                  _max_leaf_nodes),
+      n_threads(_n_threads),
+      _pool(NULL),
+      _n_queued(0),
+      _n_pending(0)
+{
+
+}
+
+ParallelDepthFirstBuilder::~ParallelDepthFirstBuilder()
+{
+    delete _pool;
+}
+
+void ParallelDepthFirstBuilder::build(Tree* _tree,
+                                      Mat _X,
+                                      Mat _y,
+                                      Mat _sample_weight)
+{
+    if (_sample_weight.total() != 0)
+        sample_weight = _sample_weight;
+
+    splitter->init(_X, _y, _sample_weight);
+
+    SubtreeTask* root = new SubtreeTask(N(0, splitter->n_samples, 0,
+                                          TREE_UNDEFINED, 0, INFINITY, 0));
+    root->root.random_generator = splitter->random_generator;
+
+    // Only a root larger than PARALLEL_SUBTREE_MIN_SAMPLES can have several
+    // tasks, a smaller tree is built by the calling thread
+    _splitters.assign(1, splitter);
+    if (n_threads != 1 && splitter->n_samples > PARALLEL_SUBTREE_MIN_SAMPLES)
+    {
+        if (_pool == NULL)
+            _pool = new ThreadPool(n_threads);
+
+        for (int w = 1; w < _pool->size(); w++)
+        {
+            Splitter* worker_splitter = splitter->clone();
+            if (worker_splitter == NULL)
+                break;
+            _splitters.push_back(worker_splitter);
+        }
+    }
+
+    int n_workers = _splitters.size();
+    _queues.assign(n_workers, deque<SubtreeTask*>());
+    _n_queued = 0;
+    _n_pending = 0;
+    _push_task(root, 0);
+
+    if (n_workers == 1)
+        _run_worker(0);
+    else
+        _pool->parallel_for(n_workers, [this](int worker, int) {
+            _run_worker(worker);
+        });
+
+    for (int w = 1; w < n_workers; w++)
+    {
+        delete _splitters[w]->criterion;
+        delete _splitters[w];
+    }
+    _splitters.resize(1);
+
+    // Add the nodes in the order of DepthFirstBuilder: a node, then its
+    // left subtree, then its right subtree
+    struct NodeRef
+    {
+        SubtreeTask* task;
+        int index;
+        int parent;
+        bool is_left;
+    };
+    stack<NodeRef> stk;
+    NodeRef ref = {root, 0, TREE_UNDEFINED, false};
+    stk.push(ref);
+
+    while (!stk.empty())
+    {
+        ref = stk.top();
+        stk.pop();
+        const SubtreeNode& node = ref.task->nodes[ref.index];
+
+        int node_id = _tree->_add_node(ref.parent, ref.is_left, node.is_leaf,
+                                       node.feature, node.threshold,
+                                       node.impurity, node.n_node_samples,
+                                       node.weighted_n_node_samples);
+        if (node.is_leaf)
+        {
+            _tree->_set_value(node_id, node.value);
+            continue;
+        }
+
+        // Push the right child first, the left one is added next
+        for (int side = 1; side >= 0; side--)
+        {
+            int child = node.children[side];
+            NodeRef child_ref = {ref.task, child, node_id, side == 0};
+            if (child < 0)
+            {
+                child_ref.task = ref.task->subtasks[-1 - child];
+                child_ref.index = 0;
+            }
+            stk.push(child_ref);
+        }
+    }
+
+    for (size_t t = 0; t < _tasks.size(); t++)
+        delete _tasks[t];
+    _tasks.clear();
+}
+
+void ParallelDepthFirstBuilder::_push_task(SubtreeTask* task,
+                                           int worker)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(task);
+        _queues[worker].push_back(task);
+        _n_queued += 1;
+        _n_pending += 1;
+    }
+    _work.notify_one();
+}
+
+void ParallelDepthFirstBuilder::_run_worker(int worker)
+{
+    int n_workers = _queues.size();
+
+    while (true)
+    {
+        SubtreeTask* task = NULL;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work.wait(lock, [this]() { return _n_queued > 0 || _n_pending == 0; });
+            if (_n_pending == 0)
+                return;
+
+            if (!_queues[worker].empty())
+            {
+                task = _queues[worker].back();
+                _queues[worker].pop_back();
+            }
+            else
+            {
+                for (int i = 1; i < n_workers; i++)
+                {
+                    deque<SubtreeTask*>& victim = _queues[(worker + i) % n_workers];
+                    if (!victim.empty())
+                    {
+                        task = victim.front();
+                        victim.pop_front();
+                        break;
+                    }
+                }
+            }
+            _n_queued -= 1;
+        }
+
+        _build_subtree(task, worker);
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _n_pending -= 1;
+            done = (_n_pending == 0);
+        }
+        if (done)
+            _work.notify_all();
+    }
+}
+
+void ParallelDepthFirstBuilder::_build_subtree(SubtreeTask* task,
+                                               int worker)
+{
+    Splitter* worker_splitter = _splitters[worker];
+
+    // The samples are partitioned in splitter->samples; the other workers
+    // copy the range of the task in and the ranges of the leaves back
+    bool is_copy = (worker_splitter != splitter);
+    vector<int>& samples = splitter->samples;
+    vector<int>& worker_samples = worker_splitter->samples;
+    if (is_copy)
+        std::copy(samples.begin() + task->root.start,
+                  samples.begin() + task->root.end,
+                  worker_samples.begin() + task->root.start);
+
+    std::copy(task->constant_features.begin(),
+              task->constant_features.end(),
+              worker_splitter->constant_features.begin());
+
+    int n_node_samples;
+    double weighted_n_node_samples;
+    bool is_leaf;
+    SplitRecord split;
+    int node_id;
+
+    int start;
+    int end;
+    int depth;
+    double impurity;
+    int n_constant_features;
+
+    stack<N> stk;
+    // n.parent is the index of the parent in task->nodes, -1 for the root
+    N root = task->root;
+    root.parent = -1;
+    stk.push(root);
+
+    while (!stk.empty())
+    {
+        N n = stk.top();
+        stk.pop();
+        start = n.start;
+        end = n.end;
+        depth = n.depth;
+        impurity = n.impurity;
+        n_constant_features = n.n_constant_features;
+
+        n_node_samples = end - start;
+        weighted_n_node_samples = worker_splitter->node_reset(start, end);
+
+        is_leaf = ((depth >= max_depth) ||
+                   (n_node_samples < min_samples_split) ||
+                   (n_node_samples < 2 * min_samples_leaf) ||
+                   (weighted_n_node_samples < min_weight_leaf));
+
+        if (depth == 0)
+            impurity = worker_splitter->node_impurity();
+
+        is_leaf = is_leaf || (impurity <= MIN_IMPURITY_SPLIT);
+
+        if (!is_leaf)
+        {
+            start_node(worker_splitter, n);
+            worker_splitter->node_split(impurity, &split, &n_constant_features);
+            is_leaf = is_leaf || (split.pos >= end);
+        }
+
+        node_id = task->nodes.size();
+        task->nodes.push_back(SubtreeNode());
+        SubtreeNode& node = task->nodes.back();
+        node.is_leaf = is_leaf;
+        node.feature = split.feature;
+        node.threshold = split.threshold;
+        node.impurity = impurity;
+        node.n_node_samples = n_node_samples;
+        node.weighted_n_node_samples = weighted_n_node_samples;
+        if (n.parent >= 0)
+            task->nodes[n.parent].children[n.is_left ? 0 : 1] = node_id;
+
+        if (is_leaf)
+        {
+            node.value = worker_splitter->node_value();
+
+            if (is_copy)
+                std::copy(worker_samples.begin() + start,
+                          worker_samples.begin() + end,
+                          samples.begin() + start);
+            continue;
+        }
+
+        // Push right child on stack, then the left one
+        N children[2] = {N(split.pos+start, end, depth+1, node_id, 0,
+                           split.impurity_right, n_constant_features),
+                         N(start, split.pos+start, depth+1, node_id, 1,
+                           split.impurity_left, n_constant_features)};
+        fork_streams(worker_splitter, children[1], children[0]);
+        for (int c = 0; c < 2; c++)
+        {
+            if (children[c].end - children[c].start < PARALLEL_SUBTREE_MIN_SAMPLES)
+            {
+                stk.push(children[c]);
+                continue;
+            }
+
+            // A large child is a new task, given the constant features
+            // known to it
+            SubtreeTask* subtask = new SubtreeTask(children[c]);
+            subtask->constant_features.assign(worker_splitter->constant_features.begin(),
+                                              worker_splitter->constant_features.begin() + n_constant_features);
+            task->nodes[node_id].children[children[c].is_left ? 0 : 1] = -1 - (int)task->subtasks.size();
+            task->subtasks.push_back(subtask);
+
+            if (is_copy)
+                std::copy(worker_samples.begin() + children[c].start,
+                          worker_samples.begin() + children[c].end,
+                          samples.begin() + children[c].start);
+            _push_task(subtask, worker);
+        }
+    }
 }
 
 BestFirstTreeBuilder::BestFirstTreeBuilder(Splitter* _splitter,
@@ -172,81 +914,99 @@ void BestFirstTreeBuilder::build(Tree* _tree,
     splitter->init(_X, _y, _sample_weight);
 
     int n_node_samples = splitter->n_samples;
-    double weighted_n_node_samples = splitter->weighted_n_samples;
+    int max_split_nodes = max_leaf_nodes - 1;
     bool is_leaf;
-    SplitRecord split;
-    int node_id;
-    int max_depth_seen = -1;
+    int index;
 
-    int start;
-    int end;
-    int depth;
-    int parent;
-    bool is_left;
-    double impurity;
-    int n_constant_features;
+    _frontier = priority_queue<FrontierEntry>();
+    _records.clear();
+    _free_records.clear();
 
-    bool first = true;
+    P record(0, 0, 0, 0, 0, true, 0.0, 0.0, 0.0, 0.0);
+    P split_node(record);
 
-    priority_queue<P> pq;
-    P record, split_node_left, split_node_right;
     // Push root to frontier
-    _add_split_node(splitter,
-                    _tree,
-                    0,
-                    n_node_samples,
-                    INFINITY,
-                    1,
-                    1,
-                    -1,
-                    0,
-                    &split_node_left);
-
-    _add_to_frontier(&split_node_left, pq);
-
-    while (!pq.empty())
+    N root(0, n_node_samples, 0, TREE_UNDEFINED, 1, INFINITY, 0);
+    root.random_generator = splitter->random_generator;
+    _add_split_node(splitter, _tree, root, true, &split_node);
+    if (!split_node._is_leaf)
+        _add_to_frontier(split_node);
+
+    while (!_frontier.empty())
     {
-        record = pq.pop();
+        index = _frontier.top().record;
+        _frontier.pop();
+        record = _records[index];
+        _free_records.push_back(index);
+
+        is_leaf = (max_split_nodes <= 0);
+        if (is_leaf)
+        {
+            // The leaf budget is spent, the rest of the frontier stays leaves
+            _tree->_set_leaf(record._node_id);
+            continue;
+        }
+        max_split_nodes -= 1;
+
+        // The children fork the stream the node had after its split
+        N left(record._start, record._pos, record._depth + 1, record._node_id, 1,
+               record._impurity_left, record._n_constant_features);
+        N right(record._pos, record._end, record._depth + 1, record._node_id, 0,
+                record._impurity_right, record._n_constant_features);
+        splitter->random_generator = record._random_generator;
+        fork_streams(splitter, left, right);
 
-        node =
+        // Compute left split node
+        std::copy(record._constant_features.begin(), record._constant_features.end(),
+                  splitter->constant_features.begin());
+        _add_split_node(splitter, _tree, left, false, &split_node);
+        if (!split_node._is_leaf)
+            _add_to_frontier(split_node);
+
+        // Compute right split node
+        std::copy(record._constant_features.begin(), record._constant_features.end(),
+                  splitter->constant_features.begin());
+        _add_split_node(splitter, _tree, right, false, &split_node);
+        if (!split_node._is_leaf)
+            _add_to_frontier(split_node);
     }
 }
 
 int BestFirstTreeBuilder::_add_split_node(Splitter* _splitter,
                                           Tree* _tree,
-                                          int _start,
-                                          int _end,
-                                          double _impurity,
+                                          const N& n,
                                           bool _is_first,
-                                          bool _is_left,
-                                          int _parent,
-                                          int _depth,
-                                          P *res)
+                                          P* res)
 {
     SplitRecord split;
-    int n_constant_features = 0;
+    int _start = n.start;
+    int _end = n.end;
+    int _depth = n.depth;
+    double _impurity = n.impurity;
+    int n_constant_features = n.n_constant_features;
     int node_id = 0;
     bool is_leaf = false;
+    int n_node_samples = _end - _start;
     double weighted_n_node_samples = _splitter->node_reset(_start, _end);
 
     if (_is_first)
         _impurity = _splitter->node_impurity();
 
-    is_leaf = ((_depth > max_depth) ||
+    is_leaf = ((_depth >= max_depth) ||
                (n_node_samples < min_samples_split) ||
                (n_node_samples < 2 * min_samples_leaf) ||
-               (impurity <= MIN_IMPURITY_SPLIT));
+               (weighted_n_node_samples < min_weight_leaf) ||
+               (_impurity <= MIN_IMPURITY_SPLIT));
 
     if (!is_leaf)
     {
-        _splitter->node_split(_impurity, split, &n_constant_features);
-        is_leaf = is_leaf || (split.pos >= end);
+        start_node(_splitter, n);
+        _splitter->node_split(_impurity, &split, &n_constant_features);
+        is_leaf = is_leaf || (split.pos >= _end);
     }
 
-    if (_parent == -1)
-        _parent = TREE_UNDEFINED;
-    node_id = _tree->_add_node(_parent,
-                               _is_left,
+    node_id = _tree->_add_node(n.parent,
+                               n.is_left,
                                is_leaf,
                                split.feature,
                                split.threshold,
@@ -254,29 +1014,51 @@ int BestFirstTreeBuilder::_add_split_node(Splitter* _splitter,
                                n_node_samples,
                                weighted_n_node_samples);
 
-    _tree->_value.at(node_id) = splitter->node_value();
+    // Every node may end up a leaf, depending on the rest of the frontier
+    _tree->_set_value(node_id, _splitter->node_value());
 
     res->_node_id = node_id;
     res->_start = _start;
-    res->_end;
-    res->_depth;
-    res->_impurity;
+    res->_end = _end;
+    res->_depth = _depth;
+    res->_impurity = _impurity;
 
     if (!is_leaf)
     {
         res->_pos = split.pos + _start;
-        res->_is_leaf = 0;
+        res->_is_leaf = false;
         res->_improvement = split.improvement;
         res->_impurity_left = split.impurity_left;
         res->_impurity_right = split.impurity_right;
+        res->_n_constant_features = n_constant_features;
+        res->_constant_features.assign(_splitter->constant_features.begin(),
+                                       _splitter->constant_features.begin() + n_constant_features);
+        res->_random_generator = _splitter->random_generator;
     }
     else
     {
         res->_pos = _end;
-        res->_is_leaf = 1;
+        res->_is_leaf = true;
         res->_improvement = 0.0;
         res->_impurity_left = _impurity;
         res->_impurity_right = _impurity;
     }
     return 0;
 }
+
+void BestFirstTreeBuilder::_add_to_frontier(const P& p)
+{
+    int index;
+    if (_free_records.empty())
+    {
+        index = _records.size();
+        _records.push_back(p);
+    }
+    else
+    {
+        index = _free_records.back();
+        _free_records.pop_back();
+        _records[index] = p;
+    }
+    _frontier.push(FrontierEntry(p._improvement, p._node_id, index));
+}
@@ -3,13 +3,24 @@
 
 #include <opencv2/opencv.hpp>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "random.h"
 using cv::Mat;
 using std::priority_queue;
+using std::deque;
+using std::vector;
 
 class Criterion;
 class Splitter;
 class Node;
 class Tree;
+class HistogramPool;
+struct NodeHistogram;
+class ThreadPool;
+struct SubtreeTask;
 
 const double MIN_IMPURITY_SPLIT = 1e-7;
 
@@ -22,6 +33,8 @@ struct N
     bool is_left;
     double impurity;
     int n_constant_features;
+    NodeHistogram* histogram;   // Histogram of samples[start:end], if known
+    RandomGenerator random_generator;   // Stream of the draws of the node
 
     N(int _start,
       int _end,
@@ -29,14 +42,16 @@ struct N
       int _parent,
       bool _is_left,
       double _impurity,
-      int _n_constant_feautes)
+      int _n_constant_feautes,
+      NodeHistogram* _histogram=NULL)
         : start(_start),
           end(_end),
           depth(_depth),
           parent(_parent),
           is_left(_is_left),
           impurity(_impurity),
-          n_constant_features(_n_constant_feautes){
+          n_constant_features(_n_constant_feautes),
+          histogram(_histogram){
     }
 };
 
@@ -52,6 +67,9 @@ struct P
     double _impurity_left;
     double _impurity_right;
     double _improvement;
+    int _n_constant_features;
+    vector<int> _constant_features;     // Constant features found up to the split
+    RandomGenerator _random_generator;  // Stream of the node after its split
 
     P(int node_id,
       int start,
@@ -72,7 +90,8 @@ struct P
           _impurity(impurity),
           _impurity_left(impurity_left),
           _impurity_right(impurity_right),
-          _improvement(improvement){
+          _improvement(improvement),
+          _n_constant_features(0){
     }
 };
 
@@ -118,7 +137,10 @@ class DepthFirstBuilder : public TreeBuilder
 {
 public:
     /**
-     * @brief Build a decision tree in depth-first fashion
+     * @brief Build a decision tree in depth-first fashion. Every node draws
+     * from a stream split from its parent's, its features ordered by
+     * Splitter::reset_features, so that ParallelDepthFirstBuilder and
+     * LevelWiseBuilder give the same tree.
      * @param splitter
      * @param min_samples_split
      * @param min_samples_leaf
@@ -148,16 +170,217 @@ public:
 
 public:
     Mat sample_weight;
+
+    /**
+     * With a HistogramSplitter, every pending node carries the histogram of
+     * its samples. When a node is split, only the smaller child is scanned;
+     * the histogram of the larger child is the parent's minus the smaller
+     * one's, computed in place in the parent's buffer. Buffers of finished
+     * nodes go back to the pool.
+     */
+    HistogramPool* histogram_pool;
+    long n_scanned_rows;        // Rows scanned to build histograms for the last tree
+};
+
+/**
+ * @brief Children of at least this many samples are built as separate tasks
+ * by ParallelDepthFirstBuilder
+ */
+const int PARALLEL_SUBTREE_MIN_SAMPLES = 1024;
+
+class ParallelDepthFirstBuilder : public TreeBuilder
+{
+public:
+    /**
+     * @brief Build a decision tree in depth-first fashion, several subtrees
+     * at a time.
+     * @param splitter: copied for every thread with Splitter::clone, built
+     *        serially if it can't be
+     * @param min_samples_split
+     * @param min_samples_leaf
+     * @param min_weight_leaf
+     * @param max_depth
+     * @param max_leaf_nodes
+     * @param n_threads: number of threads, 0 for one per core
+     */
+    ParallelDepthFirstBuilder(Splitter* splitter,
+                              int min_samples_split,
+                              int min_samples_leaf,
+                              double min_weight_leaf,
+                              int max_depth,
+                              int max_leaf_nodes,
+                              int n_threads);
+    virtual ~ParallelDepthFirstBuilder();
+
+    /**
+     * @brief Build a decision tree from the training set (X, y)
+     * @param tree
+     * @param X
+     * @param y
+     * @param sample_weight
+     */
+    virtual void build(Tree* tree,
+                       Mat X,
+                       Mat y,
+                       Mat sample_weight);
+
+private:
+    /**
+     * @brief Take tasks from the own queue, or steal them from the others,
+     * until the tree is built
+     * @param worker
+     */
+    void _run_worker(int worker);
+
+    /**
+     * @brief Build the nodes of a task, the children of at least
+     * PARALLEL_SUBTREE_MIN_SAMPLES samples are queued as new tasks
+     * @param task
+     * @param worker
+     */
+    void _build_subtree(SubtreeTask* task,
+                        int worker);
+
+    /**
+     * @brief Queue a task on the worker's queue
+     * @param task
+     * @param worker
+     */
+    void _push_task(SubtreeTask* task,
+                    int worker);
+
+public:
+    Mat sample_weight;
+
+    /**
+     * The root and every child of at least PARALLEL_SUBTREE_MIN_SAMPLES
+     * samples is a task; a task builds the smaller nodes below it. Subtrees
+     * hold disjoint samples[start:end] ranges and are built concurrently,
+     * each worker with its own splitter and criterion. A worker takes the
+     * last task of its own queue and, when it is empty, steals the oldest
+     * task, i.e. the largest subtree, of another worker.
+     *
+     * A task only takes the constant features known to its root from its
+     * parent, the draws of a node depending on its path alone, so the tree
+     * doesn't depend on the number of threads or on the scheduling, and is
+     * the one of DepthFirstBuilder. The nodes of every task are kept apart
+     * and are numbered at the end in the order of DepthFirstBuilder.
+     */
+    int n_threads;
+
+private:
+    ThreadPool* _pool;                  // Created on the first tree with several tasks
+    vector<Splitter*> _splitters;       // Splitter of every worker, splitter for worker 0
+    vector<SubtreeTask*> _tasks;        // All the tasks of the tree being built
+    vector<deque<SubtreeTask*> > _queues;
+    std::mutex _mutex;                  // Guards the queues and the counts
+    std::condition_variable _work;      // A task is queued, or the tree is done
+    int _n_queued;                      // Tasks in the queues
+    int _n_pending;                     // Tasks queued or being built
 };
 
+/**
+ * @brief LevelWiseBuilder scans every feature column for the histograms of
+ * a level only if the nodes to scan hold at least 1 / LEVEL_SCAN_MIN_RATIO
+ * of the rows of X, smaller nodes are scanned one by one
+ */
+const int LEVEL_SCAN_MIN_RATIO = 8;
+
+class LevelWiseBuilder : public TreeBuilder
+{
+public:
+    /**
+     * @brief Build a decision tree in breadth-first fashion, all the nodes
+     * of a depth level together. The tree is the one of DepthFirstBuilder,
+     * with its nodes numbered level by level. The column scans of a
+     * HistogramSplitter add the samples in another order though, so the
+     * rounding of non integer sums can choose another one of two splits of
+     * nearly equal improvement.
+     * @param splitter
+     * @param min_samples_split
+     * @param min_samples_leaf
+     * @param min_weight_leaf
+     * @param max_depth
+     * @param max_leaf_nodes
+     */
+    LevelWiseBuilder(Splitter* splitter,
+                     int min_samples_split,
+                     int min_samples_leaf,
+                     double min_weight_leaf,
+                     int max_depth,
+                     int max_leaf_nodes);
+    virtual ~LevelWiseBuilder();
+
+    /**
+     * @brief Build a decision tree from the training set (X, y)
+     * @param tree
+     * @param X
+     * @param y
+     * @param sample_weight
+     */
+    virtual void build(Tree* tree,
+                       Mat X,
+                       Mat y,
+                       Mat sample_weight);
+
+public:
+    Mat sample_weight;
+
+    /**
+     * With a HistogramSplitter, the histograms of a level are built before
+     * its nodes are split. Every row of X is tagged with the histogram of
+     * its node, and one sequential pass over each binned feature column
+     * accumulates all of them, instead of a random access pass over the
+     * columns per node. As in DepthFirstBuilder, only the smaller child of
+     * a split is scanned, the larger one is the parent minus the smaller.
+     * Other splitters just split the nodes level by level.
+     */
+    HistogramPool* histogram_pool;
+    long n_scanned_rows;        // Rows scanned to build histograms for the last tree
+    int n_column_scans;         // Levels of the last tree built by column scans
+};
+
+/**
+ * @brief Entry of the frontier of BestFirstTreeBuilder. The heap only moves
+ * these entries, the split of the node is kept in the frontier records.
+ */
+struct FrontierEntry
+{
+    double improvement;
+    int node_id;
+    int record;                 // Index of the node in the frontier records
+
+    FrontierEntry(double _improvement,
+                  int _node_id,
+                  int _record)
+        : improvement(_improvement),
+          node_id(_node_id),
+          record(_record){
+    }
+};
+
+/**
+ * @brief The node with the highest improvement is expanded first, the oldest
+ * one on ties so that the tree doesn't depend on the heap implementation
+ */
+inline bool operator < (const FrontierEntry& e1, const FrontierEntry& e2)
+{
+    if (e1.improvement != e2.improvement)
+        return e1.improvement < e2.improvement;
+    return e1.node_id > e2.node_id;
+}
+
 class BestFirstTreeBuilder : public TreeBuilder
 {
 public:
     /**
      * @brief Build a decision tree in best-first fashion.
      * The best node to expand is given by the node at the frontier that has the
-     * highest impurity improvement.
-     * Note: this TreeBuilder will ignore tree.max_depth
+     * highest impurity improvement, until the tree has max_leaf_nodes leaves.
+     * The split of a node is computed once, when the node enters the frontier.
+     * The frontier records keep the stream and the constant features of the
+     * nodes, so that a node draws the same features as with
+     * DepthFirstBuilder whatever was split in between.
      * @param splitter
      * @param min_samples_split
      * @param min_samples_leaf
@@ -185,47 +408,33 @@ public:
                        Mat y,
                        Mat sample_weight);
 
+private:
     /**
-     * @brief Adds node w/ partition [start, end) to the frontier
+     * @brief Find the split of the node n and add the node to the tree, as a
+     * leaf if it can't be split. The constant features known by the node are
+     * in splitter->constant_features.
      * @param splitter
      * @param tree
-     * @param start
-     * @param end
-     * @param impurity
+     * @param n: the node, with its stream
      * @param is_first
-     * @param is_left
-     * @param parent
-     * @param depth
-     * @param res
+     * @param res: output, the node and its split
      * @return
      */
     int _add_split_node(Splitter* splitter,
                         Tree* tree,
-                        int start,
-                        int end,
-                        double impurity,
+                        const N& n,
                         bool is_first,
-                        bool is_left,
-                        int parent,
-                        int depth,
                         P* res);
 
-    inline void _add_to_frontier(const P& p, priority_queue<P> pq)
-    {
-        pq.push(P(p._node_id,
-                  p._start,
-                  p._end,
-                  p._pos,
-                  p._depth,
-                  p._is_leaf,
-                  p._impurity,
-                  p._impurity_left,
-                  p._impurity_right,
-                  p._improvement));
-    }
+    /**
+     * @brief Adds a node that can be split to the frontier
+     * @param p
+     */
+    void _add_to_frontier(const P& p);
 
-public:
-    int max_leaf_nodes;
+    priority_queue<FrontierEntry> _frontier;
+    vector<P> _records;         // Split of the frontier nodes
+    vector<int> _free_records;  // Records of the nodes already expanded
 };
 
 #endif // TREEBUILDER_H
@@ -1,4 +1,6 @@
 #include "util.h"
+#include <cmath>
+#include <cstring>
 
 Mat_<double> compute_sample_weight(Mat_<double> class_weight,
                                    Mat_<double> y)
@@ -18,6 +20,25 @@ Mat_<double> compute_sample_weight(Mat_<double> class_weight,
     return weight;
 }
 
+int encode_labels(const Mat& y,
+                  Mat& labels,
+                  vector<double>& classes)
+{
+    int n_samples = y.total();
+    const double* values = y.ptr<double>(0);
+
+    classes.assign(values, values + n_samples);
+    std::sort(classes.begin(), classes.end());
+    classes.erase(std::unique(classes.begin(), classes.end()), classes.end());
+
+    labels.create(n_samples, 1, CV_32S);
+    int* ids = labels.ptr<int>(0);
+    for (int i = 0; i < n_samples; i++)
+        ids[i] = std::lower_bound(classes.begin(), classes.end(), values[i]) - classes.begin();
+
+    return classes.size();
+}
+
 vector<double> unique(const Mat &input, bool sort)
 {
     vector<double> out;
@@ -37,3 +58,258 @@ vector<double> unique(const Mat &input, bool sort)
 
     return out;
 }
+
+static inline void swap_samples(double* values,
+                                int* samples,
+                                int i,
+                                int j)
+{
+    std::swap(values[i], values[j]);
+    std::swap(samples[i], samples[j]);
+}
+
+/**
+ * @brief Move the median of the first, middle and last values to values[0],
+ * with values[n-1] >= values[0]
+ */
+static inline void median3_to_front(double* values,
+                                    int* samples,
+                                    int n)
+{
+    int mid = n / 2;
+    if (values[mid] < values[0])
+        swap_samples(values, samples, mid, 0);
+    if (values[n - 1] < values[mid])
+    {
+        swap_samples(values, samples, n - 1, mid);
+        if (values[mid] < values[0])
+            swap_samples(values, samples, mid, 0);
+    }
+    swap_samples(values, samples, 0, mid);
+}
+
+/**
+ * @brief Restore the max-heap property of values[start:end] below start
+ */
+static void sift_down(double* values,
+                      int* samples,
+                      int start,
+                      int end)
+{
+    int child, maxind, root = start;
+    while (true)
+    {
+        child = root * 2 + 1;
+
+        // Find max of root, left child, right child
+        maxind = root;
+        if (child < end && values[maxind] < values[child])
+            maxind = child;
+        if (child + 1 < end && values[maxind] < values[child + 1])
+            maxind = child + 1;
+
+        if (maxind == root)
+            break;
+        swap_samples(values, samples, root, maxind);
+        root = maxind;
+    }
+}
+
+static void heapsort(double* values,
+                     int* samples,
+                     int n)
+{
+    // Heapify
+    for (int start = (n - 2) / 2; start >= 0; start--)
+        sift_down(values, samples, start, n);
+
+    // Sort by shrinking the heap, putting the max element immediately after it
+    for (int end = n - 1; end > 0; end--)
+    {
+        swap_samples(values, samples, 0, end);
+        sift_down(values, samples, 0, end);
+    }
+}
+
+static void insertion_sort(double* values,
+                           int* samples,
+                           int n)
+{
+    double v;
+    int s, j;
+    for (int i = 1; i < n; i++)
+    {
+        v = values[i];
+        s = samples[i];
+        for (j = i; j > 0 && values[j - 1] > v; j--)
+        {
+            values[j] = values[j - 1];
+            samples[j] = samples[j - 1];
+        }
+        values[j] = v;
+        samples[j] = s;
+    }
+}
+
+static void introsort(double* values,
+                      int* samples,
+                      int n,
+                      int max_depth)
+{
+    double pivot;
+    int i, j;
+    while (n > INSERTION_SORT_MAX)
+    {
+        if (max_depth <= 0)
+        {
+            heapsort(values, samples, n);
+            return;
+        }
+        max_depth -= 1;
+
+        median3_to_front(values, samples, n);
+        pivot = values[0];
+
+        // Hoare partition: values[0:j+1] <= pivot <= values[j+1:n], the
+        // values equal to the pivot are spread on both sides
+        i = -1;
+        j = n;
+        while (true)
+        {
+            do
+                i += 1;
+            while (values[i] < pivot);
+            do
+                j -= 1;
+            while (values[j] > pivot);
+            if (i >= j)
+                break;
+            swap_samples(values, samples, i, j);
+        }
+        j += 1;
+
+        // Recurse into the smaller part, loop over the larger one
+        if (j < n - j)
+        {
+            introsort(values, samples, j, max_depth);
+            values += j;
+            samples += j;
+            n -= j;
+        }
+        else
+        {
+            introsort(values + j, samples + j, n - j, max_depth);
+            n = j;
+        }
+    }
+    insertion_sort(values, samples, n);
+}
+
+void sort_samples(double* values,
+                  int* samples,
+                  int n)
+{
+    if (n <= 1)
+        return;
+    int max_depth = 2 * static_cast<int>(std::log(static_cast<double>(n)));
+    introsort(values, samples, n, max_depth);
+}
+
+void sort_samples(double* values,
+                  int* samples,
+                  int n,
+                  SortBuffer& buffer)
+{
+    if (n >= RADIX_SORT_MIN)
+        radix_sort_samples(values, samples, n, buffer);
+    else
+        sort_samples(values, samples, n);
+}
+
+void SortBuffer::reserve(int n)
+{
+    if (keys.size() < 2 * static_cast<size_t>(n))
+        keys.resize(2 * static_cast<size_t>(n));
+    if (samples.size() < static_cast<size_t>(n))
+        samples.resize(n);
+    counts.resize(RADIX_PASSES * RADIX_BUCKETS);
+}
+
+static const uint64_t SIGN_BIT = static_cast<uint64_t>(1) << 63;
+
+static inline uint64_t double_to_key(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & SIGN_BIT) ? ~bits : (bits | SIGN_BIT);
+}
+
+static inline double key_to_double(uint64_t key)
+{
+    uint64_t bits = (key & SIGN_BIT) ? (key & ~SIGN_BIT) : ~key;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void radix_sort_samples(double* values,
+                        int* samples,
+                        int n,
+                        SortBuffer& buffer)
+{
+    if (n <= 1)
+        return;
+    buffer.reserve(n);
+
+    uint64_t* keys = &buffer.keys[0];
+    uint64_t* keys_out = keys + n;
+    int* samples_in = samples;
+    int* samples_out = &buffer.samples[0];
+    int* counts = &buffer.counts[0];
+    std::fill(counts, counts + RADIX_PASSES * RADIX_BUCKETS, 0);
+
+    // One pass for the keys and the histograms of all the digits
+    uint64_t key;
+    for (int i = 0; i < n; i++)
+    {
+        key = double_to_key(values[i]);
+        keys[i] = key;
+        for (int pass = 0; pass < RADIX_PASSES; pass++)
+            counts[pass * RADIX_BUCKETS + ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1))] += 1;
+    }
+
+    int shift, digit, offset, count;
+    for (int pass = 0; pass < RADIX_PASSES; pass++)
+    {
+        shift = pass * RADIX_BITS;
+        int* pass_counts = counts + pass * RADIX_BUCKETS;
+
+        // All the keys have the same digit, nothing moves
+        if (pass_counts[(keys[0] >> shift) & (RADIX_BUCKETS - 1)] == n)
+            continue;
+
+        // Start of every bucket
+        offset = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++)
+        {
+            count = pass_counts[b];
+            pass_counts[b] = offset;
+            offset += count;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            digit = (keys[i] >> shift) & (RADIX_BUCKETS - 1);
+            offset = pass_counts[digit]++;
+            keys_out[offset] = keys[i];
+            samples_out[offset] = samples_in[i];
+        }
+        std::swap(keys, keys_out);
+        std::swap(samples_in, samples_out);
+    }
+
+    for (int i = 0; i < n; i++)
+        values[i] = key_to_double(keys[i]);
+    if (samples_in != samples)
+        memcpy(samples, samples_in, n * sizeof(int));
+}
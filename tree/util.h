@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <vector>
+#include <stdint.h>
 #include <opencv2/opencv.hpp>
 
 using std::vector;
@@ -17,6 +18,17 @@ using cv::Mat_;
  */
 Mat_<double> compute_sample_weight(Mat_<double> class_weight,
                                    Mat_<double> y);
+/**
+ * @brief Encode class labels as dense ids, the i-th smallest label gets id i.
+ * @param y The class labels, shape = [n_samples, 1], CV_64F
+ * @param labels output, the class id of every sample, shape = [n_samples, 1], CV_32S
+ * @param classes output, the sorted distinct labels, classes[labels[i]] == y[i]
+ * @return number of classes
+ */
+int encode_labels(const Mat& y,
+                  Mat& labels,
+                  vector<double>& classes);
+
 /**
  * @brief Get the unique value of Mat
  * @param input Mat, every value is double
@@ -25,6 +37,85 @@ Mat_<double> compute_sample_weight(Mat_<double> class_weight,
  */
 vector<double> unique(const Mat& input, bool sort=false);
 
+/**
+ * @brief Below this length the sorts use an insertion sort
+ */
+const int INSERTION_SORT_MAX = 16;
+
+/**
+ * @brief From this length sort_samples uses the radix sort
+ */
+const int RADIX_SORT_MIN = 128;
+
+/**
+ * @brief Digits of the radix sort: 8 passes of 8 bits over the 64 bits keys
+ */
+const int RADIX_BITS = 8;
+const int RADIX_BUCKETS = 1 << RADIX_BITS;
+const int RADIX_PASSES = 64 / RADIX_BITS;
+
+/**
+ * @brief Scratch space of radix_sort_samples, sized once for the largest
+ * node so that the sorts don't allocate.
+ */
+struct SortBuffer
+{
+    vector<uint64_t> keys;          // Sortable keys of the values, and their copy, 2 * n
+    vector<int> samples;            // Copy of the samples, n
+    vector<int> counts;             // Histogram of every digit
+
+    /**
+     * @brief Make room for n values, never shrinks
+     * @param n
+     */
+    void reserve(int n);
+};
+
+/**
+ * @brief Sort values[0:n] in place and apply the same permutation to
+ * samples[0:n], without allocating.
+ * Introsort: quicksort with a Hoare partition around the median of three,
+ * switching to heapsort when the recursion gets too deep and to insertion
+ * sort below INSERTION_SORT_MAX values.
+ * @param values
+ * @param samples
+ * @param n
+ */
+void sort_samples(double* values,
+                  int* samples,
+                  int n);
+
+/**
+ * @brief Same as sort_samples(values, samples, n), with a radix sort from
+ * RADIX_SORT_MIN values.
+ * @param values
+ * @param samples
+ * @param n
+ * @param buffer: scratch space, reserved for n values or grown
+ */
+void sort_samples(double* values,
+                  int* samples,
+                  int n,
+                  SortBuffer& buffer);
+
+/**
+ * @brief Stable LSD radix sort of values[0:n], applying the same permutation
+ * to samples[0:n].
+ * The doubles are mapped to unsigned keys with the same order (sign bit
+ * flipped for the positive values, all the bits for the negative ones),
+ * which are sorted by bytes from the lowest one. The passes over a byte
+ * shared by all the keys, e.g. the low bits of integer features or the
+ * exponent of values in one binade, are skipped. NaN are not supported.
+ * @param values
+ * @param samples
+ * @param n
+ * @param buffer: scratch space, reserved for n values or grown
+ */
+void radix_sort_samples(double* values,
+                        int* samples,
+                        int n,
+                        SortBuffer& buffer);
+
 template <typename T, typename Compare>
 std::vector<int> sort_permutation(
     std::vector<T> const& vec,